@@ -555,6 +555,14 @@ void bind_session()
         .def_readonly("cache_size", &cache_status::cache_size)
         .def_readonly("read_cache_size", &cache_status::read_cache_size)
         .def_readonly("total_used_buffers", &cache_status::total_used_buffers)
+        .def_readonly("ghost_hits", &cache_status::ghost_hits)
+        .def_readonly("protected_read_cache_size", &cache_status::protected_read_cache_size)
+        .def_readonly("disk_pool_slabs", &cache_status::disk_pool_slabs)
+        .def_readonly("disk_pool_free_blocks", &cache_status::disk_pool_free_blocks)
+        .def_readonly("file_pool_hits", &cache_status::file_pool_hits)
+        .def_readonly("file_pool_misses", &cache_status::file_pool_misses)
+        .def_readonly("file_pool_evictions", &cache_status::file_pool_evictions)
+        .def_readonly("open_files", &cache_status::open_files)
     ;
 
     class_<session, boost::noncopyable>("session", no_init)
@@ -157,6 +157,8 @@ void bind_session_settings()
         .def_readwrite("utp_connect_timeout", &session_settings::utp_connect_timeout)
         .def_readwrite("utp_delayed_ack", &session_settings::utp_delayed_ack)
         .def_readwrite("utp_dynamic_sock_buf", &session_settings::utp_dynamic_sock_buf)
+        .def_readwrite("utp_pacing", &session_settings::utp_pacing)
+        .def_readwrite("utp_time_critical_target_delay", &session_settings::utp_time_critical_target_delay)
         .def_readwrite("mixed_mode_algorithm", &session_settings::mixed_mode_algorithm)
         .def_readwrite("listen_queue_size", &session_settings::listen_queue_size)
         .def_readwrite("announce_double_nat", &session_settings::announce_double_nat)
@@ -184,6 +186,13 @@ void bind_session_settings()
 		  .def_readwrite("support_merkle_torrents", &session_settings::support_merkle_torrents)
 		  .def_readwrite("handshake_client_version", &session_settings::handshake_client_version)
 		  .def_readwrite("report_redundant_bytes", &session_settings::report_redundant_bytes)
+		  .def_readwrite("read_cache_algorithm", &session_settings::read_cache_algorithm)
+		  .def_readwrite("use_disk_cache_pool", &session_settings::use_disk_cache_pool)
+		  .def_readwrite("hashing_threads", &session_settings::hashing_threads)
+		  .def_readwrite("recheck_dirty_files_only", &session_settings::recheck_dirty_files_only)
+		  .def_readwrite("checkpoint_directory", &session_settings::checkpoint_directory)
+		  .def_readwrite("read_cursor_readahead", &session_settings::read_cursor_readahead)
+		  .def_readwrite("network_threads", &session_settings::network_threads)
     ;
 
     enum_<proxy_settings::proxy_type>("proxy_type")
@@ -201,6 +210,11 @@ void bind_session_settings()
         .value("largest_contiguous", session_settings::largest_contiguous)
     ;
 
+    enum_<session_settings::read_cache_algo_t>("read_cache_algo_t")
+        .value("read_cache_lru", session_settings::read_cache_lru)
+        .value("read_cache_2q", session_settings::read_cache_2q)
+    ;
+
     enum_<session_settings::choking_algorithm_t>("choking_algorithm_t")
         .value("fixed_slots_choker", session_settings::fixed_slots_choker)
         .value("auto_expand_choker", session_settings::auto_expand_choker)
@@ -367,6 +367,8 @@ void bind_torrent_handle()
 #endif
         .def("add_piece", add_piece)
         .def("read_piece", _(&torrent_handle::read_piece))
+        .def("set_read_cursor", _(&torrent_handle::set_read_cursor))
+        .def("clear_read_cursor", _(&torrent_handle::clear_read_cursor))
         .def("have_piece", _(&torrent_handle::have_piece))
         .def("set_piece_deadline", _(&torrent_handle::set_piece_deadline)
             , (arg("index"), arg("deadline"), arg("flags") = 0))
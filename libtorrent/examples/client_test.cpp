@@ -1850,10 +1850,10 @@ int main(int argc, char* argv[])
 		int max_lines = terminal_height - 15;
 
 		// loop through the alert queue to see if anything has happened.
-		std::deque<alert*> alerts;
+		std::vector<alert*> alerts;
 		ses.pop_alerts(&alerts);
 		std::string now = time_now_string();
-		for (std::deque<alert*>::iterator i = alerts.begin()
+		for (std::vector<alert*>::iterator i = alerts.begin()
 			, end(alerts.end()); i != end; ++i)
 		{
 			bool need_resort = false;
@@ -1875,10 +1875,7 @@ int main(int argc, char* argv[])
 				std::sort(filtered_handles.begin(), filtered_handles.end()
 					, &compare_torrent);
 			}
-
-			delete *i;
 		}
-		alerts.clear();
 
 		session_status sess_stat = ses.status();
 
@@ -2359,15 +2356,12 @@ int main(int argc, char* argv[])
 		alert const* a = ses.wait_for_alert(seconds(10));
 		if (a == 0) continue;
 
-		std::deque<alert*> alerts;
+		std::vector<alert*> alerts;
 		ses.pop_alerts(&alerts);
 		std::string now = time_now_string();
-		for (std::deque<alert*>::iterator i = alerts.begin()
+		for (std::vector<alert*>::iterator i = alerts.begin()
 			, end(alerts.end()); i != end; ++i)
 		{
-			// make sure to delete each alert
-			std::auto_ptr<alert> a(*i);
-
 			torrent_paused_alert const* tp = alert_cast<torrent_paused_alert>(*i);
 			if (tp)
 			{
@@ -64,6 +64,7 @@ int main(int argc, char* argv[])
 	session s;
 	s.set_alert_mask(alert::port_mapping_notification);
 
+	std::vector<alert*> alerts;
 	for (;;)
 	{
 		alert const* a = s.wait_for_alert(seconds(5));
@@ -73,8 +74,10 @@ int main(int argc, char* argv[])
 			s.stop_natpmp();
 			break;
 		}
-		std::auto_ptr<alert> holder = s.pop_alert();
-		print_alert(holder.get());
+		s.pop_alerts(&alerts);
+		for (std::vector<alert*>::iterator i = alerts.begin()
+			, end(alerts.end()); i != end; ++i)
+			print_alert(*i);
 	}
 
 	printf("\x1b[1m\n\n===================== done mapping. Now deleting mappings ========================\n\n\n\x1b[0m");
@@ -83,8 +86,10 @@ int main(int argc, char* argv[])
 	{
 		alert const* a = s.wait_for_alert(seconds(5));
 		if (a == 0) break;
-		std::auto_ptr<alert> holder = s.pop_alert();
-		print_alert(holder.get());
+		s.pop_alerts(&alerts);
+		for (std::vector<alert*>::iterator i = alerts.begin()
+			, end(alerts.end()); i != end; ++i)
+			print_alert(*i);
 	}
 
 
@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <memory>
 #include <deque>
+#include <vector>
 #include <string>
 
 #ifdef _MSC_VER
@@ -125,6 +126,14 @@ namespace libtorrent {
 
 		virtual std::auto_ptr<alert> clone() const = 0;
 
+		// copy constructs this alert into 'storage', which must be at
+		// least allocation_size() bytes. Used by the alert_manager to
+		// queue alerts without a heap allocation per alert. Alerts
+		// not defined with TORRENT_DEFINE_ALERT have an allocation_size()
+		// of 0, and are cloned onto the heap instead
+		virtual alert* clone_into(char* storage) const;
+		virtual int allocation_size() const { return 0; }
+
 	private:
 		ptime m_timestamp;
 	};
@@ -139,14 +148,23 @@ namespace libtorrent {
 		void post_alert(const alert& alert_);
 		void post_alert_ptr(alert* alert_);
 		bool pending() const;
+
+		// these copy each alert onto the heap, to hand over ownership
+		// to the caller. They're slower than the vector overload
+		// of get_all() and only kept for compatibility
 		std::auto_ptr<alert> get();
 		void get_all(std::deque<alert*>* alerts);
 
+		// returns all queued alerts without copying them. The alerts
+		// are owned by the alert_manager and stay valid until the
+		// next call to this function
+		void get_all(std::vector<alert*>* alerts);
+
 		template <class T>
 		bool should_post() const
 		{
 			mutex::scoped_lock lock(m_mutex);
-			if (m_alerts.size() >= m_queue_size_limit) return false;
+			if (m_alerts.size() - m_alerts_first >= m_queue_size_limit) return false;
 			return (m_alert_mask & T::static_category) != 0;
 		}
 
@@ -175,9 +193,40 @@ namespace libtorrent {
 #endif
 
 	private:
-		void post_impl(std::auto_ptr<alert>& alert_, mutex::scoped_lock& l);
+		void post_impl(alert const& alert_, mutex::scoped_lock& l);
+
+		struct alert_chunk
+		{
+			char* buf;
+			int size;
+		};
+
+		char* allocate_alert(int size);
+		void free_alerts(std::vector<alert*>& alerts, std::vector<alert_chunk>& chunks);
+		static void destruct_alert(alert* a);
+
+		// alerts are copy constructed into chunks of memory owned by
+		// the alert_manager. m_alerts are the queued alerts, living in
+		// m_chunks (or on the heap, if their allocation_size() is 0). Once they're handed out by get_all(), they move to
+		// m_handed_out (along with their chunks) and are destructed the
+		// next time alerts are handed out. Chunks are recycled through
+		// m_free_chunks, so in steady state posting an alert doesn't
+		// allocate any memory
+		std::vector<alert*> m_alerts;
+		// the alerts before this index in m_alerts were already taken
+		// by get(), and are set to 0. This keeps get() from having to
+		// erase from the front of m_alerts
+		std::size_t m_alerts_first;
+		std::vector<alert_chunk> m_chunks;
+
+		// the number of bytes used in the last chunk of m_chunks
+		int m_chunk_used;
+
+		std::vector<alert*> m_handed_out;
+		std::vector<alert_chunk> m_handed_out_chunks;
+
+		std::vector<alert_chunk> m_free_chunks;
 
-		std::deque<alert*> m_alerts;
 		mutable mutex m_mutex;
 		condition_variable m_condition;
 		boost::uint32_t m_alert_mask;
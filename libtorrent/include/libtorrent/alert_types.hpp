@@ -42,15 +42,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/address.hpp"
 #include "libtorrent/stat.hpp"
 #include "libtorrent/rss.hpp" // for feed_handle
+#include <new> // for placement new
 
 // lines reserved for future includes
 // the type-ids of the alert types
 // are derived from the line on which
 // they are declared
-
-
-
-
 namespace libtorrent
 {
 
@@ -108,6 +105,9 @@ namespace libtorrent
 	virtual int type() const { return alert_type; } \
 	virtual std::auto_ptr<alert> clone() const \
 	{ return std::auto_ptr<alert>(new name(*this)); } \
+	virtual alert* clone_into(char* storage) const \
+	{ return new (storage) name(*this); } \
+	virtual int allocation_size() const { return sizeof(name); } \
 	virtual int category() const { return static_category; } \
 	virtual char const* what() const { return #name; }
 
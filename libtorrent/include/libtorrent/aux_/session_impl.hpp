@@ -37,6 +37,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <set>
 #include <list>
+#include <deque>
 #include <stdarg.h> // for va_start, va_end
 
 #ifndef TORRENT_DISABLE_GEO_IP
@@ -52,6 +53,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include <boost/pool/object_pool.hpp>
+#include <boost/pool/pool.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -76,6 +78,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket_type.hpp"
 #include "libtorrent/connection_queue.hpp"
 #include "libtorrent/disk_io_thread.hpp"
+#include "libtorrent/network_thread_pool.hpp"
 #include "libtorrent/udp_socket.hpp"
 #include "libtorrent/assert.hpp"
 #include "libtorrent/thread.hpp"
@@ -115,6 +118,7 @@ namespace libtorrent
 	struct fingerprint;
 	class torrent;
 	class alert;
+	struct status_diff_cursor;
 
 	namespace dht
 	{
@@ -360,6 +364,8 @@ namespace libtorrent
 				, boost::uint32_t flags) const;
 			void refresh_torrent_status(std::vector<torrent_status>* ret
 				, boost::uint32_t flags) const;
+			void get_status_diff(std::vector<char>* diff
+				, status_diff_cursor* cursor, boost::uint32_t flags) const;
 			void post_torrent_updates();
 
 			std::vector<torrent_handle> get_torrents() const;
@@ -371,6 +377,7 @@ namespace libtorrent
 			size_t set_alert_queue_size_limit(size_t queue_size_limit_);
 			std::auto_ptr<alert> pop_alert();
 			void pop_alerts(std::deque<alert*>* alerts);
+			void pop_alerts(std::vector<alert*>* alerts);
 			void set_alert_dispatch(boost::function<void(std::auto_ptr<alert>)> const&);
 			void post_alert(const alert& alert_);
 
@@ -587,7 +594,10 @@ namespace libtorrent
 			// this is a shared pool where policy_peer objects
 			// are allocated. It's a pool since we're likely
 			// to have tens of thousands of peers, and a pool
-			// saves significant overhead
+			// saves significant overhead. The ipv4 and ipv6
+			// pools are plain pools, since their peers don't
+			// need destructing and they free in constant time.
+			// The i2p peers own their destination string
 #ifdef TORRENT_STATS
 			struct logging_allocator
 			{
@@ -610,20 +620,18 @@ namespace libtorrent
 				static int allocations;
 				static int allocated_bytes;
 			};
-			boost::object_pool<
-				policy::ipv4_peer, logging_allocator> m_ipv4_peer_pool;
+			boost::pool<logging_allocator> m_ipv4_peer_pool;
 #if TORRENT_USE_IPV6
-			boost::object_pool<
-				policy::ipv6_peer, logging_allocator> m_ipv6_peer_pool;
+			boost::pool<logging_allocator> m_ipv6_peer_pool;
 #endif
 #if TORRENT_USE_I2P
 			boost::object_pool<
 				policy::i2p_peer, logging_allocator> m_i2p_peer_pool;
 #endif
 #else
-			boost::object_pool<policy::ipv4_peer> m_ipv4_peer_pool;
+			boost::pool<> m_ipv4_peer_pool;
 #if TORRENT_USE_IPV6
-			boost::object_pool<policy::ipv6_peer> m_ipv6_peer_pool;
+			boost::pool<> m_ipv6_peer_pool;
 #endif
 #if TORRENT_USE_I2P
 			boost::object_pool<policy::i2p_peer> m_i2p_peer_pool;
@@ -673,6 +681,11 @@ namespace libtorrent
 			// constructed after it.
 			disk_io_thread m_disk_thread;
 
+			// the threads that write peers' send buffers to
+			// their sockets, when network_threads is set. They
+			// post completion events to the io service
+			network_thread_pool m_net_thread_pool;
+
 			// this is a list of half-open tcp connections
 			// (only outgoing connections)
 			// this has to be one of the last
@@ -735,6 +748,18 @@ namespace libtorrent
 			// object. It is the complete list of all connected
 			// peers.
 			connection_map m_connections;
+
+			// incoming connections, in the order they were accepted. Until
+			// they're attached to a torrent, they're not ticked by any
+			// torrent. Only the front of this queue can have timed out
+			// waiting for the handshake, so that's all the second tick
+			// needs to look at
+			std::deque<boost::intrusive_ptr<peer_connection> > m_pending_handshakes;
+
+			// the torrents that have peers or other work to do on the second
+			// tick. Idle torrents are not in this list and don't cost anything
+			// per tick. See torrent::update_want_tick()
+			std::vector<torrent*> m_ticking_torrents;
 			
 			// filters incoming connections
 			ip_filter m_ip_filter;
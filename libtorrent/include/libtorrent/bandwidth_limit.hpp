@@ -45,6 +45,16 @@ struct TORRENT_EXTRA_EXPORT bandwidth_channel
 {
 	static const int inf = boost::integer_traits<int>::const_max;
 
+	// the classes of requests queued for bandwidth. Latency
+	// critical requests are assigned quota before any of the
+	// background requests
+	enum request_class_t
+	{
+		background,
+		latency_critical,
+		num_classes
+	};
+
 	bandwidth_channel();
 
 	// 0 means infinite
@@ -64,9 +74,18 @@ struct TORRENT_EXTRA_EXPORT bandwidth_channel
 	void return_quota(int amount);
 	void use_quota(int amount);
 
-	// used as temporary storage while distributing
-	// bandwidth
-	int tmp;
+	// the sum of the priorities of the requests of each
+	// class that are queued for bandwidth from this channel.
+	// Each request is assigned its share of distribute_quota
+	// in proportion to its priority within its class. This is
+	// maintained by the bandwidth_manager as requests are
+	// queued and completed
+	int queued_priority[num_classes];
+
+	// the index of this channel in the bandwidth_manager's
+	// list of channels with queued requests, or -1 if there
+	// are none
+	int queue_index;
 
 	// this is the number of bytes to distribute this round
 	int distribute_quota;
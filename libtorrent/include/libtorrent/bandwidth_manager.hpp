@@ -61,6 +61,7 @@ struct TORRENT_EXTRA_EXPORT bandwidth_manager
 		, bool log = false
 #endif		
 		);
+	~bandwidth_manager();
 
 	void close();
 
@@ -90,9 +91,33 @@ struct TORRENT_EXTRA_EXPORT bandwidth_manager
 
 	void update_quotas(time_duration const& dt);
 
-	// these are the consumers that want bandwidth
+	// assigns bandwidth to the requests in the queue, removes
+	// the disconnected ones and moves the satisfied ones to
+	// m_completed
 	typedef std::vector<bw_request> queue_t;
-	queue_t m_queue;
+	void assign_bandwidth(queue_t& queue);
+
+	// adds and removes the request's priority to and from
+	// its channels' queued_priority. Channels are added to
+	// m_channels when their first request is queued and
+	// removed when their last request leaves the queue
+	void add_to_channels(bw_request const& r);
+	void remove_from_channels(bw_request const& r);
+
+	// these are the consumers that want bandwidth, one
+	// queue per bandwidth_channel::request_class_t
+	queue_t m_queue[bandwidth_channel::num_classes];
+
+	// the channels that have requests in the queue. These
+	// are the only channels whose quota is refilled when
+	// quotas are updated
+	std::vector<bandwidth_channel*> m_channels;
+
+	// the requests that were satisfied in the last quota
+	// update. Their peers are notified once all requests have
+	// been assigned bandwidth. This is a member to reuse its
+	// storage across updates
+	queue_t m_completed;
 	// the number of bytes all the requests in queue are for
 	int m_queued_bytes;
 
@@ -47,6 +47,9 @@ struct TORRENT_EXTRA_EXPORT bw_request
 	boost::intrusive_ptr<bandwidth_socket> peer;
 	// 1 is normal prio
 	int priority;
+	// the bandwidth_channel::request_class_t this request
+	// is queued as
+	int bandwidth_class;
 	// the number of bytes assigned to this request so far
 	int assigned;
 	// once assigned reaches this, we dispatch the request function
@@ -43,6 +43,9 @@ namespace libtorrent
 	{
 		virtual void assign_bandwidth(int channel, int amount) = 0;
 		virtual bool is_disconnecting() const = 0;
+		// returns true if this socket's requests for bandwidth
+		// on the channel should be served before all others
+		virtual bool latency_critical(int channel) const { return false; }
 		virtual ~bandwidth_socket() {}
 	};
 }
@@ -294,14 +294,14 @@ public:
 		virtual void append_const_send_buffer(char const* buffer, int size);
 		virtual void send_buffer(char const* begin, int size, int flags = 0
 			, void (*fun)(char*, int, void*) = 0, void* userdata = 0);
-		template <class Destructor>
-		void append_send_buffer(char* buffer, int size, Destructor const& destructor)
+		void append_send_buffer(char* buffer, int size
+			, chained_buffer::free_buffer_fun destructor, void* userdata)
 		{
 #ifndef TORRENT_DISABLE_ENCRYPTION
 			if (m_rc4_encrypted)
 				m_enc_handler->encrypt(buffer, size);
 #endif
-			peer_connection::append_send_buffer(buffer, size, destructor, true);
+			peer_connection::append_send_buffer(buffer, size, destructor, userdata, true);
 		}
 
 private:
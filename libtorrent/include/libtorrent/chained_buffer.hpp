@@ -35,14 +35,13 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/config.hpp"
 
-#include <boost/function/function1.hpp>
 #include <boost/version.hpp>
+#include <boost/noncopyable.hpp>
 #if BOOST_VERSION < 103500
 #include <asio/buffer.hpp>
 #else
 #include <boost/asio/buffer.hpp>
 #endif
-#include <list>
 #include <string.h> // for memcpy
 
 namespace libtorrent
@@ -50,18 +49,24 @@ namespace libtorrent
 #if BOOST_VERSION >= 103500
 	namespace asio = boost::asio;
 #endif
-	struct TORRENT_EXTRA_EXPORT chained_buffer
+	struct TORRENT_EXTRA_EXPORT chained_buffer : boost::noncopyable
 	{
-		chained_buffer(): m_bytes(0), m_capacity(0)
+		chained_buffer(): m_vec(0), m_ring_size(0), m_first(0), m_num_buffers(0)
+			, m_bytes(0), m_capacity(0)
 		{
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 			m_destructed = false;
 #endif
 		}
 
+		// frees a buffer once it has been sent. userdata is
+		// the pointer passed to append_buffer() along with it
+		typedef void (*free_buffer_fun)(char* buf, void* userdata);
+
 		struct buffer_t
 		{
-			boost::function<void(char*)> free; // destructs the buffer
+			free_buffer_fun free; // destructs the buffer, may be 0
+			void* userdata; // passed to free
 			char* buf; // the first byte of the buffer
 			int size; // the total size of the buffer
 
@@ -69,6 +74,29 @@ namespace libtorrent
 			int used_size; // this is the number of bytes to send/receive
 		};
 
+		// the most buffers build_iovec() returns. This is the
+		// most asio passes to a single system call
+		enum { max_iovec = 64 };
+
+		// the buffers returned by build_iovec(). This refers to
+		// storage in the chained_buffer, and is valid until the
+		// next call to build_iovec()
+		struct buffer_sequence
+		{
+			typedef asio::const_buffer value_type;
+			typedef asio::const_buffer const* const_iterator;
+
+			buffer_sequence(const_iterator b, const_iterator e)
+				: m_begin(b), m_end(e) {}
+
+			const_iterator begin() const { return m_begin; }
+			const_iterator end() const { return m_end; }
+
+		private:
+			const_iterator m_begin;
+			const_iterator m_end;
+		};
+
 		bool empty() const { return m_bytes == 0; }
 		int size() const { return m_bytes; }
 		int capacity() const { return m_capacity; }
@@ -76,7 +104,7 @@ namespace libtorrent
 		void pop_front(int bytes_to_pop);
 
 		void append_buffer(char* buffer, int s, int used_size
-			, boost::function<void(char*)> const& destructor);
+			, free_buffer_fun destructor, void* userdata = 0);
 
 		// returns the number of bytes available at the
 		// end of the last chained buffer.
@@ -92,15 +120,30 @@ namespace libtorrent
 		// enough room, returns 0
 		char* allocate_appendix(int s);
 
-		std::list<asio::const_buffer> const& build_iovec(int to_send);
+		// returns the buffers holding the first to_send bytes,
+		// or the first max_iovec buffers if they hold less
+		buffer_sequence build_iovec(int to_send);
 
 		~chained_buffer();
 
 	private:
 
-		// this is the list of all the buffers we want to
-		// send
-		std::list<buffer_t> m_vec;
+		buffer_t& at(int i)
+		{ return m_vec[(m_first + i) & (m_ring_size - 1)]; }
+
+		// grows the ring to fit one more buffer
+		void grow();
+
+		// this is a ring of all the buffers we want to send. Its
+		// size is a power of 2 and it only grows, so once it's
+		// large enough, queuing buffers doesn't allocate memory
+		buffer_t* m_vec;
+		int m_ring_size;
+
+		// the index of the first buffer in the ring, and the
+		// number of buffers in it
+		int m_first;
+		int m_num_buffers;
 
 		// this is the number of bytes in the send buf.
 		// this will always be equal to the sum of the
@@ -113,7 +156,7 @@ namespace libtorrent
 
 		// this is the vector of buffers used when
 		// invoking the async write call
-		std::list<asio::const_buffer> m_tmp_vec;
+		asio::const_buffer m_tmp_vec[max_iovec];
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		bool m_destructed;
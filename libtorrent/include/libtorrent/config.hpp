@@ -202,6 +202,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_USE_IFCONF 1
 #define TORRENT_HAS_SALEN 0
 #define TORRENT_USE_POSIX_MEMALIGN 1
+// recvmmsg() and sendmmsg() to read and write
+// batches of UDP packets
+#ifndef TORRENT_USE_MMSG
+#define TORRENT_USE_MMSG 1
+#endif
 
 // ==== MINGW ===
 #elif defined __MINGW32__
@@ -417,6 +422,10 @@ inline int snprintf(char* buf, int len, char const* fmt, ...)
 #define TORRENT_USE_IFADDRS 0
 #endif
 
+#ifndef TORRENT_USE_MMSG
+#define TORRENT_USE_MMSG 0
+#endif
+
 #ifndef TORRENT_USE_IPV6
 #define TORRENT_USE_IPV6 1
 #endif
@@ -429,6 +438,14 @@ inline int snprintf(char* buf, int len, char const* fmt, ...)
 #define TORRENT_USE_WRITEV 1
 #endif
 
+#ifndef TORRENT_USE_MMAP
+#if defined TORRENT_WINDOWS || defined TORRENT_BEOS
+#define TORRENT_USE_MMAP 0
+#else
+#define TORRENT_USE_MMAP 1
+#endif
+#endif
+
 #ifndef TORRENT_USE_READV
 #define TORRENT_USE_READV 1
 #endif
@@ -40,6 +40,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/session_settings.hpp"
 #include "libtorrent/allocator.hpp"
 
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+#include <map>
+#endif
+
 #ifdef TORRENT_DISK_STATS
 #include <fstream>
 #endif
@@ -53,9 +57,7 @@ namespace libtorrent
 	struct TORRENT_EXTRA_EXPORT disk_buffer_pool : boost::noncopyable
 	{
 		disk_buffer_pool(int block_size);
-#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		~disk_buffer_pool();
-#endif
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS || defined TORRENT_DISK_STATS
 		bool is_disk_buffer(char* buffer
@@ -82,6 +84,10 @@ namespace libtorrent
 
 		int in_use() const { return m_in_use; }
 
+		// the number of slabs currently allocated and the number of
+		// blocks in them that are not in use
+		void slab_stats(int& slabs, int& free_blocks) const;
+
 	protected:
 
 		void free_buffer_impl(char* buf, mutex::scoped_lock& l);
@@ -97,6 +103,66 @@ namespace libtorrent
 
 	private:
 
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+		// disk buffers are carved out of slabs of this many bytes.
+		// 2 MiB is the size of a huge page on x86
+		enum { slab_size = 2 * 1024 * 1024 };
+
+		struct disk_slab
+		{
+			// the start of the slab
+			char* base;
+
+			// the first free block in this slab. Free blocks are
+			// linked through a pointer stored in their first bytes
+			char* free_list;
+
+			// links in the list of slabs with free blocks
+			// (m_partial_slabs). Only valid while num_free > 0
+			disk_slab* prev_partial;
+			disk_slab* next_partial;
+
+			// the number of blocks at the end of the slab that
+			// have never been handed out. They are not on the free
+			// list, to avoid touching their pages until they're used
+			int num_untouched;
+
+			// the number of blocks in this slab not in use, including
+			// the untouched ones
+			int num_free;
+
+			// true if this slab was mapped with MAP_HUGETLB, in which
+			// case it must be unmapped rather than freed
+			bool huge_page;
+
+			// true if this slab is mlocked
+			bool locked;
+		};
+
+		char* allocate_slab_block(mutex::scoped_lock& l);
+		bool free_slab_block(char* buf, mutex::scoped_lock& l);
+		bool add_slab(mutex::scoped_lock& l);
+
+		typedef std::map<char*, disk_slab> slab_map_t;
+		void release_slab(slab_map_t::iterator i, mutex::scoped_lock& l);
+		void free_slab_memory(char* base, disk_slab const& s);
+
+		// all slabs, indexed by their start address
+		slab_map_t m_slabs;
+
+		void link_partial_slab(disk_slab& s);
+		void unlink_partial_slab(disk_slab& s);
+
+		// the first of the slabs that have at least one free block,
+		// linked through their headers and ordered by address. Blocks
+		// are always allocated from the slab with the lowest address,
+		// to let the other slabs drain and be released
+		disk_slab* m_partial_slabs;
+
+		// the total number of free blocks in all slabs
+		int m_slab_free_blocks;
+#endif
+
 		mutable mutex m_pool_mutex;
 
 #if defined TORRENT_DISK_STATS || defined TORRENT_STATS
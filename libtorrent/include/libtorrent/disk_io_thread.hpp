@@ -46,20 +46,25 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/config.hpp"
 #include "libtorrent/thread.hpp"
 #include "libtorrent/disk_buffer_pool.hpp"
+#include "libtorrent/hash_pool.hpp"
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/member.hpp>
 #include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
 #include <boost/multi_index/mem_fun.hpp>
+#include <boost/multi_index/composite_key.hpp>
 
 namespace libtorrent
 {
 	using boost::multi_index::multi_index_container;
 	using boost::multi_index::ordered_non_unique;
 	using boost::multi_index::ordered_unique;
+	using boost::multi_index::sequenced;
 	using boost::multi_index::indexed_by;
 	using boost::multi_index::member;
 	using boost::multi_index::const_mem_fun;
+	using boost::multi_index::composite_key;
 
 	struct cached_piece_info
 	{
@@ -101,6 +106,8 @@ namespace libtorrent
 			, update_settings
 			, read_and_hash
 			, cache_piece
+			, update_read_cursor
+			, file_priority
 #ifndef TORRENT_NO_DEPRECATE
 			, finalize_file
 #endif
@@ -114,7 +121,8 @@ namespace libtorrent
 		// arguments used for read and write
 		int piece, offset;
 		// used for move_storage and rename_file. On errors, this is set
-		// to the error message
+		// to the error message. For file_priority, it holds one byte per
+		// file with its priority
 		std::string str;
 
 		// on error, this is set to the path of the
@@ -123,7 +131,8 @@ namespace libtorrent
 
 		// if this is > 0, it specifies the max number of blocks to read
 		// ahead in the read cache for this access. This is only valid
-		// for 'read' actions
+		// for 'read' actions. For 'update_read_cursor' it's the number
+		// of pieces to keep cached ahead of the cursor (0 removes it)
 		int max_cache_line;
 
 		// if this is > 0, it may increase the minimum time the cache
@@ -177,6 +186,14 @@ namespace libtorrent
 			, cumulative_sort_time(0)
 			, total_read_back(0)
 			, read_queue_size(0)
+			, ghost_hits(0)
+			, protected_read_cache_size(0)
+			, disk_pool_slabs(0)
+			, disk_pool_free_blocks(0)
+			, file_pool_hits(0)
+			, file_pool_misses(0)
+			, file_pool_evictions(0)
+			, open_files(0)
 		{}
 
 		// the number of 16kB blocks written
@@ -222,6 +239,32 @@ namespace libtorrent
 		boost::uint32_t cumulative_sort_time;
 		int total_read_back;
 		int read_queue_size;
+
+		// the number of read cache misses on pieces that had
+		// recently been evicted from the probationary part of
+		// the read cache. Only counted with the 2Q read cache
+		size_type ghost_hits;
+
+		// the number of blocks in the read cache that belong to
+		// pieces that have been referenced more than once, and
+		// are protected from being flushed by sequential scans
+		int protected_read_cache_size;
+
+		// the number of slabs disk buffers are allocated from, and
+		// the number of unused blocks in them. This indicates how
+		// fragmented the disk buffer pool is
+		int disk_pool_slabs;
+		int disk_pool_free_blocks;
+
+		// the number of times a file was found already open in the
+		// file pool, had to be opened, and the number of files closed
+		// to make room for others
+		size_type file_pool_hits;
+		size_type file_pool_misses;
+		size_type file_pool_evictions;
+
+		// the number of files in the file pool
+		int open_files;
 	};
 	
 	// this is a singleton consisting of the thread and a queue
@@ -294,6 +337,11 @@ namespace libtorrent
 			// is used to determine if flushing a range would force us
 			// to read it back later when hashing
 			int next_block_to_hash;
+			// only used by the 2Q read cache. This is true if the piece
+			// was read back shortly after it was evicted from the
+			// probationary queue. Protected pieces are only evicted
+			// once the probationary pieces fit in their share of the cache
+			bool protect;
 			
 			std::pair<void*, int> storage_piece_pair() const
 			{ return std::pair<void*, int>(storage.get(), piece); }
@@ -305,11 +353,53 @@ namespace libtorrent
 				, &cached_piece_entry::storage_piece_pair> >
 				, ordered_non_unique<member<cached_piece_entry, ptime
 					, &cached_piece_entry::expire> >
+				, ordered_non_unique<composite_key<cached_piece_entry
+					, member<cached_piece_entry, bool, &cached_piece_entry::protect>
+					, member<cached_piece_entry, ptime, &cached_piece_entry::expire> > >
 				> 
 			> cache_t;
 
 		typedef cache_t::nth_index<0>::type cache_piece_index_t;
 		typedef cache_t::nth_index<1>::type cache_lru_index_t;
+		typedef cache_t::nth_index<2>::type cache_queue_index_t;
+
+		// a piece that was recently evicted from the read cache. Only
+		// the key is kept, no data. If the piece is read again while
+		// it's still in the ghost list, it's inserted as protected
+		struct ghost_piece_entry
+		{
+			void* storage;
+			int piece;
+			int num_blocks;
+
+			std::pair<void*, int> storage_piece_pair() const
+			{ return std::pair<void*, int>(storage, piece); }
+		};
+
+		typedef multi_index_container<
+			ghost_piece_entry, indexed_by<
+				sequenced<>
+				, ordered_unique<const_mem_fun<ghost_piece_entry, std::pair<void*, int>
+				, &ghost_piece_entry::storage_piece_pair> >
+				>
+			> ghost_list_t;
+
+		typedef ghost_list_t::nth_index<1>::type ghost_piece_index_t;
+
+		// the read position of a consumer streaming a torrent. The
+		// pieces [piece, piece + num_pieces) are prefetched into the
+		// read cache and pinned until the cursor moves past them
+		struct read_cursor
+		{
+			void* storage;
+			int cursor;
+			int piece;
+			int num_pieces;
+			// the pieces [piece, queued_end) have had a cache_piece
+			// job posted already. They're pinned, so they don't
+			// need to be posted again while the window covers them
+			int queued_end;
+		};
 
 	private:
 
@@ -346,6 +436,13 @@ namespace libtorrent
 		int flush_contiguous_blocks(cached_piece_entry& p
 			, mutex::scoped_lock& l, int lower_limit = 0, bool avoid_readback = false);
 		int flush_range(cached_piece_entry& p, int start, int end, mutex::scoped_lock& l);
+		// writes the blocks [start, end) of p, merged with the cached
+		// blocks of the neighbouring pieces that continue the run
+		int flush_extent(cached_piece_entry& p, int start, int end
+			, int& num_write_calls, mutex::scoped_lock& l);
+		// flushes the pieces in the order they are laid out on disk
+		int flush_pieces(std::vector<cache_piece_index_t::iterator> const& pieces
+			, mutex::scoped_lock& l);
 		int cache_block(disk_io_job& j
 			, boost::function<void(int,disk_io_job const&)>& handler
 			, int cache_expire
@@ -354,10 +451,17 @@ namespace libtorrent
 		// read cache operations
 		int clear_oldest_read_piece(int num_blocks, ignore_t ignore
 			, mutex::scoped_lock& l);
+		cache_lru_index_t::iterator oldest_read_piece(bool protect
+			, ignore_t ignore, mutex::scoped_lock& l);
+		void add_read_ghost(cached_piece_entry const& p, mutex::scoped_lock& l);
+		bool hit_read_ghost(void* storage, int piece, mutex::scoped_lock& l);
+		void clear_read_ghosts(void* storage, mutex::scoped_lock& l);
 		int read_into_piece(cached_piece_entry& p, int start_block
 			, int options, int num_blocks, mutex::scoped_lock& l);
 		int cache_read_block(disk_io_job const& j, mutex::scoped_lock& l);
 		int free_piece(cached_piece_entry& p, mutex::scoped_lock& l);
+		bool is_pinned(void* storage, int piece, mutex::scoped_lock& l) const;
+		void update_read_cursor(disk_io_job const& j);
 		int drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf
 			, mutex::scoped_lock& l);
 
@@ -388,6 +492,17 @@ namespace libtorrent
 		// read cache
 		cache_t m_read_pieces;
 
+		// pieces recently evicted from the probationary
+		// queue of the read cache, oldest first
+		ghost_list_t m_read_ghosts;
+
+		// the sum of num_blocks of all entries in m_read_ghosts
+		int m_ghost_blocks;
+
+		// streaming consumers. Pieces ahead of these cursors
+		// are never evicted from the read cache
+		std::vector<read_cursor> m_read_cursors;
+
 		void flip_stats(ptime now);
 
 		// total number of blocks in use by both the read
@@ -453,6 +568,10 @@ namespace libtorrent
 		// the session_impl object
 		file_pool& m_file_pool;
 
+		// threads helping to hash pieces when checking files.
+		// see session_settings::hashing_threads
+		hash_pool m_hash_pool;
+
 		// when completion notifications are queued, they're stuck
 		// in this list
 		std::list<std::pair<disk_io_job, int> > m_queued_completions;
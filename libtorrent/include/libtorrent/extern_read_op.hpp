@@ -36,6 +36,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/torrent_handle.hpp"
 #include "libtorrent/escape_string.hpp"
 #include "libtorrent/peer_info.hpp"
+#include "libtorrent/session.hpp"
+#include "libtorrent/status_diff.hpp"
 #include <boost/lambda/lambda.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
@@ -47,14 +49,19 @@ namespace libtorrent
 	class TORRENT_EXPORT extern_read_op : public boost::noncopyable
 	{
 	public:
-		extern_read_op(torrent_handle &h, session &s)
+		extern_read_op(torrent_handle &h, session &s, int cursor = 0)
 			: m_handle(h)
 			, m_ses(s)
+			, m_info_hash(h.info_hash())
 			, m_current_buffer(NULL)
 			, m_read_offset(0)
 			, m_read_size(NULL)
 			, m_request_size(0)
 			, m_cache_offset(-1)
+			, m_cursor(cursor)
+			, m_cursor_piece(-1)
+			, m_deadline_start(0)
+			, m_deadline_end(0)
 			, m_abort(false)
 		{ }
 
@@ -64,6 +71,17 @@ namespace libtorrent
 			m_abort = true;
 			m_notify_mutex.lock();
 			m_notify_mutex.unlock();
+
+			// let the pieces prefetched for this stream be evicted
+			TORRENT_TRY
+			{
+				if (m_handle.is_valid())
+				{
+					m_handle.clear_read_cursor(m_cursor);
+					reset_deadlines(m_deadline_start, m_deadline_end);
+				}
+			}
+			TORRENT_CATCH(std::exception&) {}
 		}
 
 
@@ -190,8 +208,8 @@ public:
 		BOOST_ASSERT(index >= 0 && index < info.num_pieces());
 		if (index >= info.num_pieces() || index < 0)
 			return ret;
-		torrent_status status = m_handle.status(torrent_handle::query_pieces);
-		bitfield &pieces = status.pieces;
+		torrent_status const& status = poll_status();
+		bitfield const& pieces = status.pieces;
 		if (!pieces.empty())
 		{
 			if (status.state != torrent_status::finished &&
@@ -232,9 +250,24 @@ public:
 				m_handle.prioritize_pieces(new_point);
 			}
 
+			// the pieces right ahead of the reader get a deadline. That
+			// makes the peers sending them latency critical, so they are
+			// served download bandwidth first
+			if (index != m_deadline_start || m_deadline_end == m_deadline_start)
+				set_deadlines(index, pieces, info);
+
 			// 如果有数据, 则进入读取.
 			if (pieces.get_bit(index))
 			{
+				// keep the pieces following this one in the read cache.
+				// the cursor only moves when the reader gets to a new
+				// piece, small reads within a piece don't post again
+				if (index != m_cursor_piece)
+				{
+					m_handle.set_read_cursor(m_cursor, index);
+					m_cursor_piece = index;
+				}
+
 				// 保存参数信息.
 				m_current_buffer = data;
 				m_read_offset = offset;
@@ -371,6 +404,46 @@ public:
 	}
 
 protected:
+	// sets a deadline on the pieces we don't have yet in the read-ahead
+	// window starting at 'index', and removes the deadlines of the pieces
+	// of the previous window that fell out of it
+	// brings m_status up to date and returns the status of this torrent.
+	// Only the fields and pieces that changed since the previous call
+	// are passed over from the network thread, rather than a full
+	// torrent_status with a copy of the pieces bitfield on every read
+	torrent_status const& poll_status()
+	{
+		m_ses.get_status_diff(&m_status_diff, &m_status_cursor
+			, torrent_handle::query_pieces);
+		if (!m_status_diff.empty())
+			apply_status_diff(&m_status_diff[0], int(m_status_diff.size()), m_status);
+		return m_status[m_info_hash];
+	}
+
+	void set_deadlines(int index, bitfield const& pieces, torrent_info const& info)
+	{
+		int window = m_ses.settings().read_cursor_readahead / info.piece_length();
+		if (window < 1) window = 1;
+		int const end = (std::min)(index + window, info.num_pieces());
+
+		if (m_deadline_start < index) reset_deadlines(m_deadline_start, (std::min)(m_deadline_end, index));
+		if (m_deadline_end > end) reset_deadlines((std::max)(m_deadline_start, end), m_deadline_end);
+
+		for (int i = index; i < end; ++i)
+		{
+			if (pieces.get_bit(i)) continue;
+			m_handle.set_piece_deadline(i, (i - index) * deadline_step);
+		}
+		m_deadline_start = index;
+		m_deadline_end = end;
+	}
+
+	void reset_deadlines(int start, int end)
+	{
+		for (int i = start; i < end; ++i)
+			m_handle.reset_piece_deadline(i);
+	}
+
    void on_read(char* data, size_type offset, size_type size)
    {
 	   boost::mutex::scoped_lock lock(m_notify_mutex);
@@ -397,6 +470,13 @@ private:
 	boost::condition m_notify;
 	torrent_handle &m_handle;
 	session &m_ses;
+	sha1_hash m_info_hash;
+
+	// the state of the torrents in the session, kept up to date by
+	// poll_status()
+	status_diff_cursor m_status_cursor;
+	std::map<sha1_hash, torrent_status> m_status;
+	std::vector<char> m_status_diff;
 	boost::filesystem::path m_file_path;
 	std::fstream m_file;
 	char *m_current_buffer;
@@ -404,6 +484,18 @@ private:
 	size_type *m_read_size;
 	size_type m_request_size;
 	int m_cache_offset;
+	int m_cursor;
+
+	// the piece the read cursor was last set to
+	int m_cursor_piece;
+
+	// the pieces [m_deadline_start, m_deadline_end) were given a deadline
+	// by set_deadlines(). Each piece is due deadline_step milliseconds
+	// after the one before it
+	enum { deadline_step = 500 };
+	int m_deadline_start;
+	int m_deadline_end;
+
 	bool m_abort;
 };
 
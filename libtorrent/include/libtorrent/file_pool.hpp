@@ -38,21 +38,27 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 
 #include <boost/intrusive_ptr.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/detail/atomic_count.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
 
-#include <map>
 #include "libtorrent/file.hpp"
-#include "libtorrent/ptime.hpp"
 #include "libtorrent/thread.hpp"
 #include "libtorrent/file_storage.hpp"
+#include "libtorrent/size_type.hpp"
 
 namespace libtorrent
 {
 	struct TORRENT_EXPORT file_pool : boost::noncopyable
 	{
+		// a size of -1 means default_size()
 		file_pool(int size = 40);
 		~file_pool();
 
@@ -64,28 +70,90 @@ namespace libtorrent
 		int size_limit() const { return m_size; }
 		void set_low_prio_io(bool b) { m_low_prio_io = b; }
 
-	private:
+		// the number of open_file() calls that found the file already
+		// open, the number that had to open it and the number of files
+		// that were closed to make room for others
+		void get_stats(size_type& hits, size_type& misses, size_type& evictions) const;
+
+		// the number of files open
+		int num_open_files() const;
+
+		// a pool size based on the number of files this process is
+		// allowed to have open. 20% of them go to the file pool, the
+		// rest are left for peer connections
+		static int default_size();
 
-		void remove_oldest();
+	private:
 
 		int m_size;
 		bool m_low_prio_io;
 
 		struct lru_file_entry
 		{
-			lru_file_entry(): key(0), last_use(time_now()), mode(0) {}
+			lru_file_entry(): key(0), mode(0), last_use(0) {}
+			// the storage pointer and file index
+			std::pair<void*, int> index;
 			mutable boost::intrusive_ptr<file> file_ptr;
 			void* key;
-			ptime last_use;
 			int mode;
+			// the value of m_use_counter when the file was last
+			// used. Used to find the least recently used file
+			// across all shards
+			long last_use;
+		};
+
+		// files are looked up by storage pointer and file index. The
+		// sequenced index is the LRU order, the most recently used file
+		// is at the back
+		typedef boost::multi_index::multi_index_container<
+			lru_file_entry, boost::multi_index::indexed_by<
+				boost::multi_index::hashed_unique<boost::multi_index::member<
+					lru_file_entry, std::pair<void*, int>, &lru_file_entry::index> >
+				, boost::multi_index::sequenced<>
+				>
+			> file_set;
+
+		typedef file_set::nth_index<0>::type file_index_t;
+		typedef file_set::nth_index<1>::type file_lru_t;
+
+		// the files are split up into shards by storage, each with its
+		// own lock, so that disk threads working on different torrents
+		// don't contend. All files of one storage are in the same shard,
+		// which makes closing them cheap. The pool size is shared by all
+		// shards, a single torrent may use all of it
+		struct shard
+		{
+			shard(): hits(0), misses(0), evictions(0) {}
+			mutable mutex m_mutex;
+			file_set files;
+			size_type hits;
+			size_type misses;
+			size_type evictions;
 		};
 
-		// maps storage pointer, file index pairs to the
-		// lru entry for the file
-		typedef std::map<std::pair<void*, int>, lru_file_entry> file_set;
-		
-		file_set m_files;
-		mutex m_mutex;
+		enum { num_shards = 16 };
+
+		shard& shard_for(void* st)
+		{ return m_shards[(std::size_t(st) / 64) % num_shards]; }
+
+		// opens the file, or returns it if it's already open.
+		// added is set to true if a new file was added to the
+		// pool. The shard must be locked
+		boost::intrusive_ptr<file> open_file_impl(shard& s, void* st
+			, std::string const& p, file_storage::iterator fe
+			, file_storage const& fs, int m, error_code& ec, bool& added);
+
+		// if there are more files open than the pool size, closes the
+		// least recently used one, in whichever shard it is, and returns
+		// true. No shard may be locked by the caller
+		bool remove_oldest();
+
+		shard m_shards[num_shards];
+
+		// the number of files open, in all shards
+		boost::detail::atomic_count m_num_open;
+		// incremented every time a file is used
+		boost::detail::atomic_count m_use_counter;
 
 #if TORRENT_CLOSE_MAY_BLOCK
 		void closer_thread_fun();
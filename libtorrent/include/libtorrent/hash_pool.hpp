@@ -0,0 +1,107 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_HASH_POOL_HPP_INCLUDED
+#define TORRENT_HASH_POOL_HPP_INCLUDED
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/thread.hpp"
+#include "libtorrent/peer_id.hpp" // for sha1_hash
+
+namespace libtorrent
+{
+	struct hash_job
+	{
+		hash_job(): buf(0), size(0), small_size(0) {}
+
+		char const* buf;
+		int size;
+		// if this is greater than 0, small_hash is set to the
+		// hash of the first small_size bytes of the buffer
+		int small_size;
+
+		sha1_hash hash;
+		sha1_hash small_hash;
+	};
+
+	// a set of threads that SHA-1 hash buffers in parallel. This is used
+	// by the disk thread when checking files, to not be limited by the
+	// hashing speed of a single core
+	struct TORRENT_EXTRA_EXPORT hash_pool : boost::noncopyable
+	{
+		hash_pool();
+		~hash_pool();
+
+		// the number of threads to hash with, including the thread
+		// calling hash(). 1 means no extra threads are started
+		void set_num_threads(int n);
+		int num_threads() const { return int(m_threads.size()) + 1; }
+
+		// hashes all the jobs and returns once they're all done. The
+		// calling thread takes part in the hashing
+		void hash(hash_job* jobs, int num_jobs);
+
+	private:
+
+		void thread_fun();
+		void stop_threads();
+		static void run_job(hash_job& j);
+
+		mutex m_mutex;
+
+		// signalled when there are new jobs, or when the
+		// threads should quit
+		condition_variable m_work_cond;
+
+		// signalled when the last outstanding job completes
+		condition_variable m_done_cond;
+
+		std::vector<boost::shared_ptr<thread> > m_threads;
+
+		// the jobs currently being hashed. m_next_job is the index
+		// of the next one to pick up, and m_outstanding is the number
+		// of jobs that have not completed yet
+		hash_job* m_jobs;
+		int m_num_jobs;
+		int m_next_job;
+		int m_outstanding;
+
+		bool m_abort;
+	};
+}
+
+#endif // TORRENT_HASH_POOL_HPP_INCLUDED
+
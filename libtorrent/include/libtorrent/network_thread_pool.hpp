@@ -0,0 +1,113 @@
+/*
+
+Copyright (c) 2013, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_NETWORK_THREAD_POOL_HPP_INCLUDED
+#define TORRENT_NETWORK_THREAD_POOL_HPP_INCLUDED
+
+#include <vector>
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/thread.hpp"
+#include "libtorrent/socket.hpp"
+#include "libtorrent/io_service.hpp"
+#include "libtorrent/chained_buffer.hpp"
+
+namespace libtorrent
+{
+	class peer_connection;
+
+	// a set of threads that write the send buffers of peer connections
+	// to their sockets. The network thread hands a buffer off and
+	// carries on, and the completion is posted back to it. Only the
+	// send calls run in the pool, all connection and torrent state is
+	// still only touched by the network thread
+	struct TORRENT_EXTRA_EXPORT network_thread_pool : boost::noncopyable
+	{
+		network_thread_pool(io_service& ios);
+		~network_thread_pool();
+
+		// 0 means no threads, in which case the network thread
+		// does all writes itself
+		void set_num_threads(int n);
+		int num_threads() const { return int(m_threads.size()); }
+
+		// writes as much of the buffers to the socket as it accepts
+		// without blocking, then posts peer_connection::on_pool_write()
+		// to the network thread. The buffers and the socket must stay
+		// valid until then
+		void post_write(boost::intrusive_ptr<peer_connection> const& peer
+			, tcp::socket::native_handle_type s
+			, chained_buffer::buffer_sequence const& vec);
+
+		// completes all outstanding writes and stops the threads
+		void stop() { set_num_threads(0); }
+
+	private:
+
+		struct write_job
+		{
+			boost::intrusive_ptr<peer_connection> peer;
+			tcp::socket::native_handle_type socket;
+			asio::const_buffer const* begin;
+			asio::const_buffer const* end;
+		};
+
+		void thread_fun();
+		void stop_threads();
+		void run_job(write_job const& j);
+
+		io_service& m_ios;
+
+		mutex m_mutex;
+
+		// signalled when there are new jobs, or when the
+		// threads should quit
+		condition_variable m_work_cond;
+
+		std::deque<write_job> m_queue;
+
+		std::vector<boost::shared_ptr<thread> > m_threads;
+
+		// keeps the io_service running while there are threads
+		// that may post completions to it
+		boost::shared_ptr<io_service::work> m_work;
+
+		bool m_abort;
+	};
+}
+
+#endif // TORRENT_NETWORK_THREAD_POOL_HPP_INCLUDED
+
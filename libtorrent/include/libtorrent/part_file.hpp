@@ -0,0 +1,128 @@
+/*
+
+Copyright (c) 2008-2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef TORRENT_PART_FILE_HPP_INCLUDED
+#define TORRENT_PART_FILE_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/thread.hpp"
+#include "libtorrent/size_type.hpp"
+#include "libtorrent/error_code.hpp"
+
+namespace libtorrent
+{
+	// pieces overlapping files with priority 0 are stored in the part
+	// file instead of in those files, so that unwanted files are never
+	// created. The part file holds a slot per stored piece, the slots of
+	// freed pieces are reused. All integers are big endian:
+	//
+	//  header:  "LTPF" | version (u32) | num pieces (u32) | piece size (u32)
+	//  index:   num pieces * slot (u32), 0xffffffff for pieces not stored
+	//  slots:   piece size bytes each, starting at the first multiple
+	//           of 1024 after the index
+	//
+	// the file is created on the first write. The index is read back the
+	// first time the part file is accessed. It's written every time a piece
+	// is added, freed slots are written by flush_metadata(). Once the part
+	// file holds no more pieces, flush_metadata() deletes it
+	struct TORRENT_EXTRA_EXPORT part_file : boost::noncopyable
+	{
+		// the part file is stored as 'name' in the directory 'path'
+		part_file(std::string const& path, std::string const& name
+			, int num_pieces, int piece_size);
+		~part_file();
+
+		// reads or writes the buffers at 'offset' into 'piece'. The
+		// range may not extend past the end of the piece. Reading a piece
+		// that isn't stored is an error
+		int writev(file::iovec_t const* bufs, int num_bufs, int piece, int offset, error_code& ec);
+		int readv(file::iovec_t const* bufs, int num_bufs, int piece, int offset, error_code& ec);
+
+		bool has_piece(int piece);
+
+		// drops the piece from the part file. Its slot is reused by the
+		// next piece that's written
+		void free_piece(int piece);
+
+		// copies the stored parts of the torrent range [offset, offset + size)
+		// into f, which is the file starting at 'offset' in the torrent
+		void export_file(file& f, size_type offset, size_type size, error_code& ec);
+
+		// moves the part file to the directory 'path'
+		void move_partfile(std::string const& path, error_code& ec);
+
+		// writes the index and closes the file
+		void flush_metadata(error_code& ec);
+
+		// deletes the part file, and forgets all stored pieces
+		void remove(error_code& ec);
+
+	private:
+
+		void load_index(mutex::scoped_lock& l);
+		void open_file(int mode, error_code& ec, mutex::scoped_lock& l);
+		void flush_metadata_impl(error_code& ec, mutex::scoped_lock& l);
+		void write_index(error_code& ec, mutex::scoped_lock& l);
+		size_type slot_offset(int slot) const
+		{ return m_header_size + size_type(slot) * m_piece_size; }
+
+		std::string m_path;
+		std::string m_name;
+		int m_num_pieces;
+		int m_piece_size;
+		int m_header_size;
+
+		// the slot each piece is stored in, or -1
+		std::vector<int> m_piece_to_slot;
+		// slots that were freed and can be reused
+		std::vector<int> m_free_slots;
+		// the number of slots in the file
+		int m_num_slots;
+
+		// the index has been read from disk
+		bool m_loaded;
+		// the index has changed since it was last written
+		bool m_dirty_metadata;
+
+		mutex m_mutex;
+		file m_file;
+	};
+}
+
+#endif // TORRENT_PART_FILE_HPP_INCLUDED
+
@@ -36,6 +36,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_PE_CRYPTO_HPP_INCLUDED
 
 #include "libtorrent/config.hpp"
+#include <boost/cstdint.hpp>
 
 #ifdef TORRENT_USE_GCRYPT
 #include <gcrypt.h>
@@ -44,10 +45,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <openssl/evp.h>
 #include <openssl/aes.h>
 #else
-// RC4 state from libtomcrypt
+// RC4 state from libtomcrypt. The permutation is kept in
+// 32 bit words, which is faster to index and swap than bytes
 struct rc4 {
 	int x, y;
-	unsigned char buf[256];
+	boost::uint32_t buf[256];
 };
 
 void TORRENT_EXTRA_EXPORT rc4_init(const unsigned char* in, unsigned long len, rc4 *state);
@@ -55,6 +57,7 @@ unsigned long TORRENT_EXTRA_EXPORT rc4_encrypt(unsigned char *out, unsigned long
 #endif
 
 #include "libtorrent/peer_id.hpp" // For sha1_hash
+#include "libtorrent/buffer.hpp"
 #include "libtorrent/assert.hpp"
 
 namespace libtorrent
@@ -63,6 +66,11 @@ namespace libtorrent
 	{
 	public:
 		dh_key_exchange();
+
+		// uses the 20 bytes at 'local_secret' as the private exponent
+		// instead of random ones. Only meant for testing
+		explicit dh_key_exchange(char const* local_secret);
+
 		bool good() const { return true; }
 
 		// Get local public key, always 96 bytes
@@ -78,6 +86,9 @@ namespace libtorrent
 		
 	private:
 
+		// computes the local key from the private exponent
+		void init(char const* local_secret);
+
 		int get_local_key_size() const
 		{ return sizeof(m_dh_local_key); }
 
@@ -93,6 +104,22 @@ namespace libtorrent
 		virtual void set_outgoing_key(unsigned char const* key, int len) = 0;
 		virtual void encrypt(char* pos, int len) = 0;
 		virtual void decrypt(char* pos, int len) = 0;
+
+		// encrypts or decrypts a scatter/gather vector of buffers
+		// as one contiguous stream. Handlers override these to
+		// run the whole vector through the cipher in a single call
+		virtual void encrypt_buffers(buffer::interval const* bufs, int num_bufs)
+		{
+			for (int i = 0; i < num_bufs; ++i)
+				if (bufs[i].left() > 0) encrypt(bufs[i].begin, bufs[i].left());
+		}
+
+		virtual void decrypt_buffers(buffer::interval const* bufs, int num_bufs)
+		{
+			for (int i = 0; i < num_bufs; ++i)
+				if (bufs[i].left() > 0) decrypt(bufs[i].begin, bufs[i].left());
+		}
+
 		virtual ~encryption_handler() {}
 	};
 
@@ -158,7 +185,44 @@ namespace libtorrent
 
 			TORRENT_ASSERT(len >= 0);
 			TORRENT_ASSERT(pos);
+			encrypt_impl(pos, len);
+		}
+
+		void decrypt(char* pos, int len)
+		{
+			if (!m_decrypt) return;
+
+			TORRENT_ASSERT(len >= 0);
+			TORRENT_ASSERT(pos);
+			decrypt_impl(pos, len);
+		}
+
+		void encrypt_buffers(buffer::interval const* bufs, int num_bufs)
+		{
+			if (!m_encrypt) return;
 
+			for (int i = 0; i < num_bufs; ++i)
+			{
+				if (bufs[i].left() <= 0) continue;
+				encrypt_impl(bufs[i].begin, bufs[i].left());
+			}
+		}
+
+		void decrypt_buffers(buffer::interval const* bufs, int num_bufs)
+		{
+			if (!m_decrypt) return;
+
+			for (int i = 0; i < num_bufs; ++i)
+			{
+				if (bufs[i].left() <= 0) continue;
+				decrypt_impl(bufs[i].begin, bufs[i].left());
+			}
+		}
+
+	private:
+
+		void encrypt_impl(char* pos, int len)
+		{
 #ifdef TORRENT_USE_GCRYPT
 			gcry_cipher_encrypt(m_rc4_outgoing, pos, len, 0, 0);
 #elif defined TORRENT_USE_OPENSSL
@@ -168,13 +232,8 @@ namespace libtorrent
 #endif
 		}
 
-		void decrypt(char* pos, int len)
+		void decrypt_impl(char* pos, int len)
 		{
-			if (!m_decrypt) return;
-
-			TORRENT_ASSERT(len >= 0);
-			TORRENT_ASSERT(pos);
-
 #ifdef TORRENT_USE_GCRYPT
 			gcry_cipher_decrypt(m_rc4_incoming, pos, len, 0, 0);
 #elif defined TORRENT_USE_OPENSSL
@@ -184,7 +243,6 @@ namespace libtorrent
 #endif
 		}
 
-	private:
 #ifdef TORRENT_USE_GCRYPT
 		gcry_cipher_hd_t m_rc4_incoming;
 		gcry_cipher_hd_t m_rc4_outgoing;
@@ -145,6 +145,7 @@ namespace libtorrent
 		, public boost::noncopyable
 	{
 	friend class invariant_access;
+	friend struct network_thread_pool;
 	public:
 
 		enum connection_type
@@ -533,6 +534,11 @@ namespace libtorrent
 
 		void assign_bandwidth(int channel, int amount);
 
+		// a connection is latency critical on the download
+		// channel while it has requests outstanding for time
+		// critical pieces
+		bool latency_critical(int channel) const;
+
 #if defined TORRENT_DEBUG && !defined TORRENT_DISABLE_INVARIANT_CHECKS
 		void check_invariant() const;
 #endif
@@ -573,8 +579,8 @@ namespace libtorrent
 		void log_buffer_usage(char* buffer, int size, char const* label);
 #endif
 
-		template <class Destructor>
-		void append_send_buffer(char* buffer, int size, Destructor const& destructor
+		void append_send_buffer(char* buffer, int size
+			, chained_buffer::free_buffer_fun destructor, void* userdata
 			, bool encrypted = false)
 		{
 #if defined TORRENT_DISK_STATS
@@ -585,7 +591,7 @@ namespace libtorrent
 			// encryption. bt_peer_connection overrides this function with
 			// its own version.
 			TORRENT_ASSERT(encrypted || type() != bittorrent_connection);
-			m_send_buffer.append_buffer(buffer, size, size, destructor);
+			m_send_buffer.append_buffer(buffer, size, size, destructor, userdata);
 		}
 
 		virtual void append_const_send_buffer(char const* buffer, int size);
@@ -679,9 +685,9 @@ namespace libtorrent
 			}
 			TORRENT_ASSERT(!m_disk_recv_buffer);
 			TORRENT_ASSERT(m_disk_recv_buffer_size == 0);
-			int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()));
-			return buffer::interval(&m_recv_buffer[0]
-				, &m_recv_buffer[0] + rcv_pos);
+			int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()) - m_recv_start);
+			return buffer::interval(&m_recv_buffer[0] + m_recv_start
+				, &m_recv_buffer[0] + m_recv_start + rcv_pos);
 		}
 
 		std::pair<buffer::interval, buffer::interval> wr_recv_buffers(int bytes);
@@ -694,9 +700,9 @@ namespace libtorrent
 				TORRENT_ASSERT(m_recv_pos == 0);
 				return buffer::interval(0,0);
 			}
-			int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()));
-			return buffer::const_interval(&m_recv_buffer[0]
-				, &m_recv_buffer[0] + rcv_pos);
+			int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()) - m_recv_start);
+			return buffer::const_interval(&m_recv_buffer[0] + m_recv_start
+				, &m_recv_buffer[0] + m_recv_start + rcv_pos);
 		}
 
 		bool allocate_disk_receive_buffer(int disk_buffer_size);
@@ -736,6 +742,10 @@ namespace libtorrent
 		// work to do.
 		void on_send_data(error_code const& error
 			, std::size_t bytes_transferred);
+		// called when one of the session's network threads has
+		// written the send buffer to the socket
+		void on_pool_write(error_code const& error
+			, int bytes_transferred, bool would_block);
 		void on_receive_data(error_code const& error
 			, std::size_t bytes_transferred);
 
@@ -971,6 +981,14 @@ namespace libtorrent
 		// we've received so far
 		int m_recv_pos;
 
+		// the offset into m_recv_buffer where the current
+		// packet starts. Messages that have been handled are
+		// cut off the front of the buffer by advancing this,
+		// instead of moving the rest of the buffer down. The
+		// buffer is only compacted once the next packet
+		// doesn't fit behind it
+		int m_recv_start;
+
 		int m_disk_recv_buffer_size;
 
 		// the number of bytes we are currently reading
@@ -1197,6 +1215,17 @@ namespace libtorrent
 		// other peers to compare it to.
 		bool m_exceeded_limit:1;
 
+		// set while one of the session's network threads is
+		// writing to the socket. The socket isn't closed until
+		// the write has completed
+		bool m_pool_write:1;
+
+		// set when the last write in a network thread filled up
+		// the socket's send buffer. The next write is made by the
+		// network thread, which waits for the socket to become
+		// writable
+		bool m_pool_would_block:1;
+
 		template <std::size_t Size>
 		struct handler_storage
 		{
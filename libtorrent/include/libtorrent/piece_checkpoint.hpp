@@ -0,0 +1,132 @@
+/*
+
+Copyright (c) 2008-2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef TORRENT_PIECE_CHECKPOINT_HPP_INCLUDED
+#define TORRENT_PIECE_CHECKPOINT_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/bitfield.hpp"
+#include "libtorrent/peer_id.hpp" // for sha1_hash
+#include "libtorrent/size_type.hpp"
+#include "libtorrent/error_code.hpp"
+
+namespace libtorrent
+{
+	// a small file per torrent recording which pieces have passed the
+	// hash check, written as they pass. Unlike resume data, it's kept
+	// up to date while the torrent is running, so that after a crash
+	// the pieces don't all have to be hashed again.
+	//
+	// the file is a fixed size snapshot followed by an append-only log.
+	// All integers are big endian:
+	//
+	//  header:      "LTCP" | version (u32) | info-hash (20 bytes)
+	//               | num pieces (u32) | num files (u32) | time (u64)
+	//  file table:  num files * (size (u64) | mtime (u64))
+	//  have bits:   (num pieces + 7) / 8 bytes
+	//  log:         any number of (piece (u32) | time (u64))
+	//
+	// a record at the end of the log cut short by a crash is ignored.
+	// The log is folded into the snapshot by write_snapshot()
+	struct TORRENT_EXTRA_EXPORT piece_checkpoint : boost::noncopyable
+	{
+		piece_checkpoint();
+
+		// sets up an empty checkpoint for the torrent, stored at path.
+		// No file is read or written. An empty path disables it
+		void init(std::string const& path, sha1_hash const& info_hash
+			, int num_pieces, int num_files);
+
+		// reads the checkpoint file. Returns false if it doesn't exist or
+		// doesn't belong to this torrent, in which case the checkpoint is
+		// left empty
+		bool load();
+
+		// rewrites the file with the current have bits and file table,
+		// dropping the log. The file is written to a temporary name and
+		// renamed, so a crash never leaves a torn snapshot behind
+		void write_snapshot(std::vector<std::pair<size_type, std::time_t> > const& files
+			, error_code& ec);
+
+		// appends a record for a piece that passed the hash check
+		void append(int piece, error_code& ec);
+
+		// deletes the file and clears the have bits
+		void remove(error_code& ec);
+
+		bool enabled() const { return !m_path.empty(); }
+		bool loaded() const { return m_loaded; }
+
+		bool have(int piece) const { return m_have.get_bit(piece); }
+		void set_have(int piece) { m_have.set_bit(piece); }
+		void clear_have() { m_have.clear_all(); }
+
+		// the number of records in the log
+		int log_size() const { return m_log_size; }
+
+		// the time of the last write to the checkpoint
+		std::time_t last_update() const { return m_last_update; }
+
+		// the sizes and modification times of the files when the
+		// snapshot was written
+		std::vector<std::pair<size_type, std::time_t> > const& files() const
+		{ return m_files; }
+
+	private:
+
+		int header_size() const;
+
+		std::string m_path;
+		sha1_hash m_info_hash;
+		int m_num_pieces;
+		int m_num_files;
+
+		bitfield m_have;
+		std::vector<std::pair<size_type, std::time_t> > m_files;
+
+		// the size of the file on disk, which is where the next
+		// record is appended
+		size_type m_file_size;
+		int m_log_size;
+		std::time_t m_last_update;
+		bool m_loaded;
+	};
+}
+
+#endif // TORRENT_PIECE_CHECKPOINT_HPP_INCLUDED
+
@@ -34,7 +34,19 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_POLICY_HPP_INCLUDED
 
 #include <algorithm>
-#include <deque>
+
+#ifdef _MSC_VER
+#pragma warning(push, 1)
+#endif
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
 #include "libtorrent/string_util.hpp" // for allocate_string_copy
 
 #include "libtorrent/peer.hpp"
@@ -364,46 +376,28 @@ namespace libtorrent
 
 		int num_peers() const { return m_peers.size(); }
 
-		struct peer_address_compare
+		// the key peers are looked up by. i2p peers all have the
+		// empty address, and are told apart by their destination
+		struct peer_address_key
 		{
-			bool operator()(
-				peer const* lhs, libtorrent::address const& rhs) const
-			{
-				return lhs->address() < rhs;
-			}
-
-			bool operator()(
-				libtorrent::address const& lhs, peer const* rhs) const
-			{
-				return lhs < rhs->address();
-			}
-
-#if TORRENT_USE_I2P
-			bool operator()(
-				peer const* lhs, char const* rhs) const
-			{
-				return strcmp(lhs->dest(), rhs) < 0;
-			}
-
-			bool operator()(
-				char const* lhs, peer const* rhs) const
-			{
-				return strcmp(lhs, rhs->dest()) < 0;
-			}
-#endif
+			typedef libtorrent::address result_type;
+			result_type operator()(peer const* p) const { return p->address(); }
+		};
 
-			bool operator()(
-				peer const* lhs, peer const* rhs) const
-			{
-#if TORRENT_USE_I2P
-				if (rhs->is_i2p_addr == lhs->is_i2p_addr)
-					return strcmp(lhs->dest(), rhs->dest()) < 0;
-#endif
-				return lhs->address() < rhs->address();
-			}
+		struct peer_address_hash
+		{
+			std::size_t operator()(libtorrent::address const& a) const;
 		};
 
-		typedef std::deque<peer*> peers_t;
+		// the peers in the order they were added, which is the order
+		// the connect candidate and erase scans go round in, and hashed
+		// by address. Adding, finding and removing a peer is constant time
+		typedef boost::multi_index::multi_index_container<
+			peer*, boost::multi_index::indexed_by<
+				boost::multi_index::sequenced<>
+				, boost::multi_index::hashed_non_unique<peer_address_key, peer_address_hash>
+				>
+			> peers_t;
 
 		typedef peers_t::iterator iterator;
 		typedef peers_t::const_iterator const_iterator;
@@ -412,17 +406,16 @@ namespace libtorrent
 		const_iterator begin_peer() const { return m_peers.begin(); }
 		const_iterator end_peer() const { return m_peers.end(); }
 
-		std::pair<iterator, iterator> find_peers(address const& a)
-		{
-			return std::equal_range(
-				m_peers.begin(), m_peers.end(), a, peer_address_compare());
-		}
+		typedef peers_t::nth_index<1>::type address_index_t;
+		typedef address_index_t::iterator address_iterator;
+		typedef address_index_t::const_iterator const_address_iterator;
 
-		std::pair<const_iterator, const_iterator> find_peers(address const& a) const
-		{
-			return std::equal_range(
-				m_peers.begin(), m_peers.end(), a, peer_address_compare());
-		}
+		// all the peers with address a
+		std::pair<address_iterator, address_iterator> find_peers(address const& a)
+		{ return m_peers.get<1>().equal_range(a); }
+
+		std::pair<const_address_iterator, const_address_iterator> find_peers(address const& a) const
+		{ return m_peers.get<1>().equal_range(a); }
 
 		bool connect_one_peer(int session_time);
 
@@ -439,7 +432,10 @@ namespace libtorrent
 
 		void update_peer(policy::peer* p, int src, int flags
 		, tcp::endpoint const& remote, char const* destination);
-		bool insert_peer(policy::peer* p, iterator iter, int flags);
+		bool insert_peer(policy::peer* p, int flags);
+
+		// destructs p and returns it to the session's pool
+		void free_peer(policy::peer* p);
 
 		bool compare_peer_erase(policy::peer const& lhs, policy::peer const& rhs) const;
 		bool compare_peer(policy::peer const& lhs, policy::peer const& rhs
@@ -469,7 +465,7 @@ namespace libtorrent
 
 		// since the peer list can grow too large
 		// to scan all of it, start at this iterator
-		int m_round_robin;
+		iterator m_round_robin;
 
 		// The number of peers in our peer list
 		// that are connect candidates. i.e. they're
@@ -57,6 +57,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alert.hpp" // alert::error_notification
 #include "libtorrent/add_torrent_params.hpp"
 #include "libtorrent/rss.hpp"
+#include "libtorrent/status_diff.hpp"
 #include "libtorrent/build_config.hpp"
 
 #include "libtorrent/storage.hpp"
@@ -195,6 +196,14 @@ namespace libtorrent
 			, boost::uint32_t flags = 0) const;
 		void post_torrent_updates();
 
+		// fills in 'diff' with the status fields of every torrent that
+		// changed since the last call with the same cursor. For the pieces,
+		// only the indices that completed and the ones that were lost
+		// (e.g. by a recheck or a failed hash check) are included. Use
+		// apply_status_diff() to decode it.
+		void get_status_diff(std::vector<char>* diff
+			, status_diff_cursor* cursor, boost::uint32_t flags = 0) const;
+
 		// returns a list of all torrents in this session
 		std::vector<torrent_handle> get_torrents() const;
 		
@@ -457,7 +466,10 @@ namespace libtorrent
 
 		// pop one alert from the alert queue, or do nothing
 		// and return a NULL pointer if there are no alerts
-		// in the queue
+		// in the queue.
+		// This copies the alert onto the heap. It's the slow
+		// compatibility path, prefer the std::vector overload of
+		// pop_alerts()
 		std::auto_ptr<alert> pop_alert();
 
 		// pop all alerts in the alert queue and returns them
@@ -467,8 +479,17 @@ namespace libtorrent
 		// in the dequeue is passed on to the caller of this function.
 		// when you're done with reacting to the alerts, you need to
 		// delete them all.
+		// Like pop_alert(), this copies every alert onto the heap and
+		// is only kept for compatibility
 		void pop_alerts(std::deque<alert*>* alerts);
 
+		// pop all alerts in the alert queue and returns pointers
+		// to them in 'alerts'. The alerts are still owned by the
+		// session and must not be deleted. They stay valid until
+		// the next call to this function, which is when their
+		// memory is reused for new alerts.
+		void pop_alerts(std::vector<alert*>* alerts);
+
 #ifndef TORRENT_NO_DEPRECATE
 		TORRENT_DEPRECATED_PREFIX
 		void set_severity_level(alert::severity_t s) TORRENT_DEPRECATED;
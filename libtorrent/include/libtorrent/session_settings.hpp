@@ -188,7 +188,8 @@ namespace libtorrent
 		// file descriptors a process may have open. It is
 		// usually a good idea to find this limit and set the
 		// number of connections and the number of files
-		// limits so their sum is slightly below it.
+		// limits so their sum is slightly below it. -1 means 20% of
+		// the number of files the process is allowed to have open
 		int file_pool_size;
 		
 		// false to not allow multiple connections from the same
@@ -854,6 +855,16 @@ namespace libtorrent
 		// in half
 		int utp_loss_multiplier;
 
+		// when true, uTP sockets spread the packets of their send
+		// window over a round trip instead of sending them in bursts
+		// as ACKs arrive
+		bool utp_pacing;
+
+		// the target delay, in milliseconds, for uTP connections of
+		// torrents that have pieces with deadlines (i.e. are streaming).
+		// 0 means they use utp_target_delay like all other connections
+		int utp_time_critical_target_delay;
+
 		enum bandwidth_mixed_algo_t
 		{
 			// disables the mixed mode bandwidth balancing
@@ -965,6 +976,50 @@ namespace libtorrent
 		// in the peer protocol handshake. If this is empty
 		// the user_agent is used
 		std::string handshake_client_version;
+
+		// the eviction policy of the read cache. read_cache_lru
+		// evicts the least recently used piece. read_cache_2q keeps
+		// pieces that have only been read once in a separate queue,
+		// so that a sequential scan cannot flush pieces that are
+		// being read repeatedly
+		enum read_cache_algo_t { read_cache_lru, read_cache_2q };
+		int read_cache_algorithm;
+
+		// when true, disk buffers are allocated from 2 MiB slabs
+		// (backed by huge pages where available) instead of being
+		// allocated one at a time from the heap
+		bool use_disk_cache_pool;
+
+		// the number of threads used to hash pieces when checking
+		// files, including the disk thread itself. With more than one,
+		// the disk thread reads ahead and hashes several pieces at a
+		// time in parallel
+		int hashing_threads;
+
+		// when the resume data doesn't match the files on disk, only
+		// check the pieces overlapping the files whose size or
+		// modification time changed, and trust the resume data for
+		// the rest
+		bool recheck_dirty_files_only;
+
+		// the directory to keep a checkpoint file per torrent in,
+		// recording the pieces that have passed the hash check as they
+		// do. After a crash, the pieces recorded in it don't need to be
+		// checked again. Empty disables checkpoints
+		std::string checkpoint_directory;
+
+		// the number of bytes to keep in the read cache ahead of each
+		// read cursor set by torrent_handle::set_read_cursor(). Those
+		// pieces are prefetched and not evicted until the cursor has
+		// moved past them. 0 disables prefetching
+		int read_cursor_readahead;
+
+		// the number of threads that write the send buffers of
+		// plain TCP peer connections to their sockets. 0 means all
+		// writes are made by the network thread. Message parsing,
+		// encryption and all other peer and torrent logic still run
+		// in the network thread
+		int network_threads;
 	};
 
 #ifndef TORRENT_DISABLE_DHT
@@ -0,0 +1,163 @@
+/*
+
+Copyright (c) 2013, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#ifndef TORRENT_STATUS_DIFF_HPP_INCLUDED
+#define TORRENT_STATUS_DIFF_HPP_INCLUDED
+
+#include <vector>
+#include <map>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/peer_id.hpp" // for sha1_hash
+#include "libtorrent/bitfield.hpp"
+#include "libtorrent/torrent_handle.hpp" // for torrent_status
+
+namespace libtorrent
+{
+	// the state one consumer of session::get_status_diff() has been
+	// told about. Each consumer needs its own cursor, and passes the
+	// same one to every call. A default constructed cursor makes the
+	// first diff contain every torrent
+	struct TORRENT_EXPORT status_diff_cursor
+	{
+		status_diff_cursor(): flags(0xffffffff) {}
+
+		struct torrent_entry
+		{
+			torrent_entry(): generation(0), total_transfer(0)
+				, num_peers(0), reported(false) {}
+
+			// the fields last reported for this torrent
+			torrent_status status;
+
+			// the pieces this torrent was last reported to have
+			bitfield pieces;
+
+			// the torrent's status generation, transferred bytes and
+			// number of peers when it was last looked at. If none of
+			// them changed, neither did its status
+			boost::uint32_t generation;
+			size_type total_transfer;
+			int num_peers;
+
+			// false until the torrent has been included in a diff
+			bool reported;
+		};
+
+		std::map<sha1_hash, torrent_entry> torrents;
+
+		// the flags passed to the last call. If they change, every
+		// torrent is looked at again
+		boost::uint32_t flags;
+	};
+
+	enum status_diff_flags_t
+	{
+		// passed to session::get_status_diff() along with the
+		// torrent_handle::query_* flags. The fields counting seconds
+		// (active_time, seeding_time, time_since_upload, next_announce
+		// etc.) change every second for most torrents, and are left
+		// out of the diff unless this is set
+		status_diff_time_counters = 0x10000
+	};
+
+	// the flags of a record in the diff
+	enum status_diff_record_t
+	{
+		// the torrent was not in the previous diff. All fields that
+		// are not included have their default value
+		status_diff_added = 1,
+
+		// the torrent is no longer in the session. The record ends
+		// after the flags
+		status_diff_removed = 2,
+
+		// the record ends with the pieces the torrent completed (and
+		// lost) since the previous diff
+		status_diff_pieces = 4
+	};
+
+	// compares the pieces last reported in 'reported' with the pieces
+	// of a torrent with 'num_pieces' pieces, where have(i) tells whether
+	// piece i is complete. The indices of the pieces that changed state
+	// are appended to 'completed' and 'lost', and 'reported' is updated
+	// in place. Returns true if anything changed, including the number
+	// of pieces
+	template <class Have>
+	bool diff_status_pieces(bitfield& reported, int num_pieces, Have const& have
+		, std::vector<int>& completed, std::vector<int>& lost)
+	{
+		bool changed = int(reported.size()) != num_pieces;
+		if (changed) reported.resize(num_pieces, false);
+		for (int i = 0; i < num_pieces; ++i)
+		{
+			bool const h = have(i);
+			if (h == reported.get_bit(i)) continue;
+			if (h)
+			{
+				completed.push_back(i);
+				reported.set_bit(i);
+			}
+			else
+			{
+				lost.push_back(i);
+				reported.clear_bit(i);
+			}
+			changed = true;
+		}
+		return changed;
+	}
+
+	// appends a record for the fields of 'st' that differ from what
+	// was last reported in 'e' and updates 'e'. If 'completed' and 'lost'
+	// are set, they're the pieces that changed state since the last
+	// report, as returned by diff_status_pieces() for e.pieces, and
+	// they're included too. Returns false if nothing changed, and no
+	// record was written.
+	TORRENT_EXTRA_EXPORT bool write_status_diff(std::vector<char>& buf
+		, status_diff_cursor::torrent_entry& e, torrent_status const& st
+		, boost::uint32_t flags, std::vector<int> const* completed = 0
+		, std::vector<int> const* lost = 0);
+
+	// appends a record saying the torrent is no longer in the session
+	TORRENT_EXTRA_EXPORT void write_status_removed(std::vector<char>& buf
+		, sha1_hash const& ih);
+
+	// applies a diff returned by session::get_status_diff() to 'torrents',
+	// keyed by info-hash. The handle member of the torrent_status objects
+	// is not part of the diff, use session::find_torrent() to look it up.
+	// Returns false if the diff is malformed, in which case 'torrents' may
+	// have been partially updated.
+	TORRENT_EXPORT bool apply_status_diff(char const* buf, int size
+		, std::map<sha1_hash, torrent_status>& torrents);
+}
+
+#endif // TORRENT_STATUS_DIFF_HPP_INCLUDED
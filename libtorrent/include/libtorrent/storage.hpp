@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_STORAGE_HPP_INCLUDE
 
 #include <vector>
+#include <deque>
 #include <sys/types.h>
 
 #ifdef _MSC_VER
@@ -62,6 +63,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/thread.hpp"
 #include "libtorrent/storage_defs.hpp"
 #include "libtorrent/allocator.hpp"
+#include "libtorrent/piece_checkpoint.hpp"
 
 namespace libtorrent
 {
@@ -70,6 +72,8 @@ namespace libtorrent
 	struct disk_io_job;
 	struct disk_buffer_pool;
 	struct session_settings;
+	struct hash_pool;
+	struct part_file;
 
 	TORRENT_EXTRA_EXPORT std::vector<std::pair<size_type, std::time_t> > get_filesizes(
 		file_storage const& t
@@ -114,7 +118,19 @@ namespace libtorrent
 		virtual int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
 		virtual int writev(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
 
+		// writes a buffer that starts at 'offset' in 'slot' and may run
+		// past the end of it, into the slots following it. 'slot_size' is
+		// the size of every slot but the last one in the torrent. The
+		// default implementation splits it up into one writev() per slot
+		virtual int writev_range(file::iovec_t const* bufs, int slot, int offset
+			, int num_bufs, int slot_size, int flags = file::random_access);
+
 		virtual void hint_read(int, int, int) {}
+
+		// called when the priorities of the files change. Files that are
+		// no longer unwanted (priority 0) need to be made complete
+		virtual void set_file_priority(std::vector<boost::uint8_t> const&) {}
+
 		// negative return value indicates an error
 		virtual int read(char* buf, int slot, int offset, int size) = 0;
 
@@ -137,6 +153,12 @@ namespace libtorrent
 		// write storage dependent fast resume entries
 		virtual bool write_resume_data(entry& rd) const = 0;
 
+		// if the last call to verify_resume_data() failed only because
+		// some files don't match the sizes or timestamps in the resume
+		// data, this returns true and sets the entries in dirty for those
+		// files. If it returns false, all files need to be checked
+		virtual bool dirty_files(std::vector<bool>& dirty) const { return false; }
+
 		// moves (or copies) the content in src_slot to dst_slot
 		virtual bool move_slot(int src_slot, int dst_slot) = 0;
 
@@ -204,12 +226,16 @@ namespace libtorrent
 		void hint_read(int slot, int offset, int len);
 		int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
 		int writev(file::iovec_t const* buf, int slot, int offset, int num_bufs, int flags = file::random_access);
+		int writev_range(file::iovec_t const* bufs, int slot, int offset
+			, int num_bufs, int slot_size, int flags = file::random_access);
+		void set_file_priority(std::vector<boost::uint8_t> const& prio);
 		size_type physical_offset(int slot, int offset);
 		bool move_slot(int src_slot, int dst_slot);
 		bool swap_slots(int slot1, int slot2);
 		bool swap_slots3(int slot1, int slot2, int slot3);
 		bool verify_resume_data(lazy_entry const& rd, error_code& error);
 		bool write_resume_data(entry& rd) const;
+		bool dirty_files(std::vector<bool>& dirty) const;
 
 		// this identifies a read or write operation
 		// so that default_storage::readwritev() knows what to
@@ -226,8 +252,10 @@ namespace libtorrent
 		};
 
 		void delete_one_file(std::string const& p);
+		// unless span_slots is true, the operation is truncated
+		// at the end of 'slot'
 		int readwritev(file::iovec_t const* bufs, int slot, int offset
-			, int num_bufs, fileop const&);
+			, int num_bufs, fileop const&, bool span_slots = false);
 
 		size_type read_unaligned(boost::intrusive_ptr<file> const& file_handle
 			, size_type file_offset, file::iovec_t const* bufs, int num_bufs, error_code& ec);
@@ -243,17 +271,91 @@ namespace libtorrent
 		boost::intrusive_ptr<file> open_file(file_storage::iterator fe, int mode
 			, error_code& ec) const;
 
+		// parts of pieces that belong to files with priority 0 are stored
+		// in the part file instead of creating those files
+		bool use_part_file(int file_index) const
+		{
+			return m_part_file && file_index < int(m_file_priority.size())
+				&& m_file_priority[file_index] == 0;
+		}
+		// returns true if any file the slot overlaps has priority 0
+		bool has_unwanted_file(int slot) const;
+
+		// copies what's already in the files into the part file slot of
+		// 'slot'. Either only for the file 'file_index', or for every
+		// unwanted file the slot overlaps if it's -1
+		void import_to_part_file(int slot, int file_index, error_code& ec);
+
 		std::vector<boost::uint8_t> m_file_priority;
 		std::string m_save_path;
+
+		std::string m_part_file_name;
+		boost::scoped_ptr<part_file> m_part_file;
 		// the file pool is typically stored in
 		// the session, to make all storage
 		// instances use the same pool
 		file_pool& m_pool;
 
+		// the files that didn't match the resume data in the last
+		// call to verify_resume_data()
+		std::vector<bool> m_dirty_files;
+
 		int m_page_size;
 		bool m_allocate_files;
 	};
 
+#if TORRENT_USE_MMAP
+	// this storage reads from files by mapping them into memory, which
+	// saves a system call and lets the kernel's page cache act as the
+	// block cache. It's meant for seeding and streaming of complete files,
+	// and is best combined with turning off the read cache. Writes go
+	// through default_storage, and reads from parts of files that are
+	// not on disk yet fall back to it as well.
+	// Note that if a file is truncated by another process while it's
+	// mapped, reading from it will crash the process with SIGBUS
+	class TORRENT_EXPORT mmap_storage : public default_storage
+	{
+	public:
+		mmap_storage(file_storage const& fs, file_storage const* mapped, std::string const& path
+			, file_pool& fp, std::vector<boost::uint8_t> const& file_prio);
+		~mmap_storage();
+
+		bool rename_file(int index, std::string const& new_filename);
+		bool release_files();
+		bool delete_files();
+		bool move_storage(std::string const& save_path);
+		void hint_read(int slot, int offset, int len);
+		int readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags = file::random_access);
+
+	private:
+
+		struct mapped_file
+		{
+			mapped_file(): base(0), size(0), last_read_end(-1), sequential(false) {}
+			char* base;
+			size_type size;
+			// the end of the last read from this file. A read starting
+			// here is considered sequential
+			size_type last_read_end;
+			// true if the mapping is currently advised as sequential
+			bool sequential;
+		};
+
+		// returns a pointer to the byte at file_offset in the file, if
+		// the file is mapped and at least size bytes large from there.
+		// The file is (re)mapped if necessary. Returns 0 if this part of
+		// the file can't be mapped
+		char const* map_range(file_storage::iterator fe, size_type file_offset, int size);
+
+		void unmap_file(int index);
+		void unmap_all();
+
+		// indexed by file index. Only files that have been read
+		// from have a mapping
+		std::vector<mapped_file> m_mappings;
+	};
+#endif
+
 	// this storage implementation does not write anything to disk
 	// and it pretends to read, and just leaves garbage in the buffers
 	// this is useful when simulating many clients on the same machine
@@ -311,8 +413,16 @@ namespace libtorrent
 		boost::intrusive_ptr<torrent_info const> info() const { return m_info; }
 		void write_resume_data(entry& rd) const;
 
+		enum check_fastresume_flags_t
+		{
+			// don't restore pieces from the checkpoint file, and delete it.
+			// Used when forcing a recheck
+			ignore_checkpoint = 1
+		};
+
 		void async_check_fastresume(lazy_entry const* resume_data
-			, boost::function<void(int, disk_io_job const&)> const& handler);
+			, boost::function<void(int, disk_io_job const&)> const& handler
+			, int flags = 0);
 		
 		void async_check_files(boost::function<void(int, disk_io_job const&)> const& handler);
 
@@ -334,6 +444,16 @@ namespace libtorrent
 			, boost::function<void(int, disk_io_job const&)> const& handler
 			, int cache_expiry = 0);
 
+		// moves the read cursor identified by 'cursor' to 'piece'. The
+		// disk thread prefetches num_pieces pieces from there and keeps
+		// them in the read cache. num_pieces = 0 removes the cursor
+		void async_set_read_cursor(int cursor, int piece, int num_pieces);
+
+		// passes new file priorities on to the storage. Files that were
+		// unwanted are moved out of the part file
+		void async_set_file_priority(std::vector<boost::uint8_t> const& prio
+			, boost::function<void(int, disk_io_job const&)> const& handler);
+
 		// returns the write queue size
 		int async_write(
 			peer_request const& r
@@ -342,9 +462,18 @@ namespace libtorrent
 
 		void async_hash(int piece, boost::function<void(int, disk_io_job const&)> const& f);
 
+		enum release_flags_t
+		{
+			// delete the checkpoint file as well. Used when the torrent
+			// is removed, since a checkpoint left behind would be picked
+			// up if the same torrent is added again
+			remove_checkpoint = 1
+		};
+
 		void async_release_files(
 			boost::function<void(int, disk_io_job const&)> const& handler
-			= boost::function<void(int, disk_io_job const&)>());
+			= boost::function<void(int, disk_io_job const&)>()
+			, int flags = 0);
 
 		void abort_disk_io();
 
@@ -396,16 +525,46 @@ namespace libtorrent
 		// helper functions for check_dastresume	
 		int check_no_fastresume(error_code& error);
 		int check_init_storage(error_code& error);
+
+		// sets up the piece tables for a full check where only the pieces
+		// marked check_piece in m_resume_pieces are hashed
+		void init_partial_check();
+
+		// sets up a full check that only hashes the pieces that overlap
+		// files that don't match the resume data. The other pieces are
+		// taken from the resume data. Returns false if this is not possible
+		bool init_dirty_files_check(lazy_entry const& rd);
+
+		// sets up a full check restoring the pieces recorded in the
+		// checkpoint. Only pieces overlapping files that are missing or
+		// were modified after the checkpoint was last written are hashed.
+		// Returns false if there's no checkpoint to use
+		bool init_checkpoint_check();
+
+		// the sizes and modification times of the files, as reported
+		// by the storage. Returns false if they're not available
+		bool file_stats(std::vector<std::pair<size_type, std::time_t> >& stats) const;
+
+		// writes a new checkpoint with the current have bits
+		void write_checkpoint();
+
+		// records a piece that passed the hash check in the checkpoint
+		void checkpoint_piece(int piece);
 		
 		// if error is set and return value is 'no_error' or 'need_full_check'
 		// the error message indicates that the fast resume data was rejected
 		// if 'fatal_disk_error' is returned, the error message indicates what
 		// when wrong in the disk access
-		int check_fastresume(lazy_entry const& rd, error_code& error);
+		int check_fastresume(lazy_entry const& rd, error_code& error, int flags = 0);
 
 		// this function returns true if the checking is complete
 		int check_files(int& current_slot, int& have_piece, error_code& error);
 
+		// reads the next pieces to be checked, up to about 'bytes' bytes,
+		// and hashes them using the pool. The following calls to
+		// check_files() use these hashes instead of reading the pieces
+		void hash_ahead(hash_pool& pool, int bytes);
+
 #ifndef TORRENT_NO_DEPRECATE
 		bool compact_allocation() const
 		{ return m_storage_mode == storage_mode_compact; }
@@ -437,6 +596,20 @@ namespace libtorrent
 			, int offset
 			, int num_bufs);
 
+		// like write_impl(), but the buffers may continue past the end
+		// of piece_index into the pieces following it. When those pieces
+		// are in adjacent slots, they are written with a single call
+		int write_range_impl(
+			file::iovec_t* bufs
+			, int piece_index
+			, int offset
+			, int num_bufs);
+
+		// feeds the buffers just written to the piece's partial hash,
+		// if they continue where it left off
+		void update_partial_hash(file::iovec_t const* bufs
+			, int piece_index, int offset, int num_bufs);
+
 		size_type physical_offset(int piece_index, int offset);
 
 		// returns the number of pieces left in the
@@ -452,10 +625,15 @@ namespace libtorrent
 		void switch_to_full_mode();
 		sha1_hash hash_for_piece_impl(int piece, int* readback = 0);
 
-		int release_files_impl() { return m_storage->release_files(); }
-		int delete_files_impl() { return m_storage->delete_files(); }
+		int release_files_impl(int flags);
+		int delete_files_impl();
 		int rename_file_impl(int index, std::string const& new_filename)
 		{ return m_storage->rename_file(index, new_filename); }
+		int set_file_priority_impl(std::vector<boost::uint8_t> const& prio)
+		{
+			m_storage->set_file_priority(prio);
+			return m_storage->error() ? -1 : 0;
+		}
 
 		int move_storage_impl(std::string const& save_path);
 
@@ -524,6 +702,38 @@ namespace libtorrent
 		// the piece that is in the scratch buffer
 		int m_scratch_piece;
 
+		// the hashes of slots computed by hash_ahead(), in slot order,
+		// waiting to be used by check_one_piece()
+		struct check_result
+		{
+			int slot;
+			sha1_hash hash;
+			sha1_hash small_hash;
+		};
+		std::deque<check_result> m_check_results;
+
+		// the buffer hash_ahead() reads pieces into
+		aligned_holder m_check_buffer;
+		int m_check_buffer_size;
+
+		enum
+		{
+			check_piece,
+			trusted_have,
+			trusted_missing
+		};
+
+		// when only the pieces overlapping files that changed since
+		// the resume data was saved are checked, this has one entry per
+		// piece saying whether it needs to be hashed, or if the resume
+		// data says we have it or not. Empty otherwise
+		std::vector<boost::uint8_t> m_resume_pieces;
+
+		// the pieces that have passed the hash check, kept on disk so
+		// that they survive a crash. Disabled unless
+		// session_settings::checkpoint_directory is set
+		piece_checkpoint m_checkpoint;
+
 		// the last piece we wrote to or read from
 		int m_last_piece;
 
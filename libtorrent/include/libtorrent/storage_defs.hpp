@@ -65,6 +65,12 @@ namespace libtorrent
 		file_storage const&, file_storage const* mapped, std::string const&, file_pool&
 		, std::vector<boost::uint8_t> const&);
 
+	// constructs an mmap_storage. On platforms without mmap()
+	// support this constructs a default_storage
+	TORRENT_EXPORT storage_interface* mmap_storage_constructor(
+		file_storage const&, file_storage const* mapped, std::string const&, file_pool&
+		, std::vector<boost::uint8_t> const&);
+
 }
 
 #endif
@@ -66,6 +66,7 @@ namespace libtorrent
 		void wait(mutex::scoped_lock& l);
 		void wait_for(mutex::scoped_lock& l, time_duration rel_time);
 		void notify_all();
+		void notify_one();
 	private:
 #ifdef BOOST_HAS_PTHREADS
 		pthread_cond_t m_cond;
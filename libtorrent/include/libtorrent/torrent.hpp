@@ -202,6 +202,9 @@ namespace libtorrent
 		void on_disk_read_complete(int ret, disk_io_job const& j,
 			peer_request r, boost::shared_ptr<read_piece_struct> rp, read_data_fun rdf);
 
+		void set_read_cursor(int cursor, int piece);
+		void clear_read_cursor(int cursor);
+
 		storage_mode_t storage_mode() const { return (storage_mode_t)m_storage_mode; }
 		storage_interface* get_storage()
 		{
@@ -239,6 +242,25 @@ namespace libtorrent
 
 		void second_tick(stat& accumulator, int tick_interval_ms);
 
+		// returns true if this torrent has anything to do on the session's
+		// second tick. Torrents without peers, that aren't about to connect
+		// to web seeds and whose transfer rates have faded out are idle
+		bool want_tick() const;
+
+		// adds this torrent to the session's list of torrents that are
+		// ticked, if it wants to be ticked. This needs to be called whenever
+		// want_tick() may have become true. Torrents are removed from the
+		// list by the session once they're idle
+		void update_want_tick();
+		void stop_ticking();
+
+		// adds the time that has passed since they were last updated to
+		// the active, finished and seeding time counters (and the time
+		// since the last scrape, upload and download). The counters are
+		// not advanced by the second tick for idle torrents, so this is
+		// called before they're read and before the torrent changes state
+		void update_time_counters() const;
+
 		std::string name() const;
 
 		stat statistics() const { return m_stat; }
@@ -321,12 +343,24 @@ namespace libtorrent
 		void reset_piece_deadline(int piece);
 		void update_piece_priorities();
 
+		bool has_time_critical_pieces() const
+		{ return !m_time_critical_pieces.empty(); }
+		bool is_time_critical_piece(int piece) const;
+
 		void status(torrent_status* st, boost::uint32_t flags);
 
 		// this torrent changed state, if the user is subscribing to
 		// it, add it to the m_state_updates list in session_impl
 		void state_updated();
 
+		// incremented every time state_updated() is called and every
+		// time a piece is completed or lost. session_impl::get_status_diff()
+		// only builds a torrent_status for torrents where this, or
+		// any of the counters below, changed since the last diff
+		boost::uint32_t status_generation() const { return m_status_generation; }
+		size_type total_transfer() const
+		{ return m_stat.total_upload() + m_stat.total_download(); }
+
 		void file_progress(std::vector<size_type>& fp, int flags = 0) const;
 
 		void use_interface(std::string net_interface);
@@ -483,7 +517,8 @@ namespace libtorrent
 		void announce_with_tracker(tracker_request::event_t e
 			= tracker_request::none
 			, address const& bind_interface = address_v4::any());
-		int seconds_since_last_scrape() const { return m_last_scrape; }
+		int seconds_since_last_scrape() const
+		{ update_time_counters(); return m_last_scrape; }
 
 #ifndef TORRENT_DISABLE_DHT
 		void dht_announce();
@@ -851,7 +886,7 @@ namespace libtorrent
 		static void print_size(logger& l);
 #endif
 
-		void update_last_upload() { m_last_upload = 0; }
+		void update_last_upload() { update_time_counters(); m_last_upload = 0; }
 
 		void set_apply_ip_filter(bool b);
 		bool apply_ip_filter() const { return m_apply_ip_filter; }
@@ -886,6 +921,7 @@ namespace libtorrent
 		void on_storage_moved(int ret, disk_io_job const& j);
 		void on_save_resume_data(int ret, disk_io_job const& j);
 		void on_file_renamed(int ret, disk_io_job const& j);
+		void on_file_priority(int ret, disk_io_job const& j);
 		void on_cache_flushed(int ret, disk_io_job const& j);
 
 		void on_piece_verified(int ret, disk_io_job const& j
@@ -934,6 +970,10 @@ namespace libtorrent
 		// recently was started, to avoid oscillation
 		ptime m_started;
 
+		// the time the time counters were last updated. See
+		// update_time_counters()
+		mutable ptime m_last_counter_update;
+
 		boost::intrusive_ptr<torrent_info> m_torrent_file;
 
 		// if this pointer is 0, the torrent is in
@@ -1140,6 +1180,13 @@ namespace libtorrent
 		// monotonically increasing number for each added torrent
 		int m_sequence_number;
 
+		// this torrent's index in the session's list of ticking
+		// torrents, or -1 if it's not in the list
+		int m_tick_index;
+
+		// see status_generation()
+		boost::uint32_t m_status_generation;
+
 		// ==============================
 		// The following members are specifically
 		// ordered to make the 24 bit members
@@ -1148,7 +1195,7 @@ namespace libtorrent
 		// ==============================
 
 		// the number of seconds we've been in upload mode
-		unsigned int m_upload_mode_time:24;
+		mutable unsigned int m_upload_mode_time:24;
 
 		// the state of this torrent (queued, checking, downloading, etc.)
 		unsigned int m_state:3;
@@ -1174,14 +1221,14 @@ namespace libtorrent
 		// total time we've been available on this torrent
 		// does not count when the torrent is stopped or paused
 		// in seconds
-		unsigned int m_active_time:24;
+		mutable unsigned int m_active_time:24;
 
 		// the index to the last tracker that worked
 		boost::int8_t m_last_working_tracker;
 
 		// total time we've been finished with this torrent
 		// does not count when the torrent is stopped or paused
-		unsigned int m_finished_time:24;
+		mutable unsigned int m_finished_time:24;
 
 		// in case the piece picker hasn't been constructed
 		// when this settings is set, this variable will keep
@@ -1235,7 +1282,7 @@ namespace libtorrent
 
 		// total time we've been available as a seed on this torrent
 		// does not count when the torrent is stopped or paused
-		unsigned int m_seeding_time:24;
+		mutable unsigned int m_seeding_time:24;
 
 		// this is a counter that is decreased every
 		// second, and when it reaches 0, the policy::pulse()
@@ -1328,15 +1375,15 @@ namespace libtorrent
 
 		// the number of seconds since the last piece passed for
 		// this torrent
-		boost::uint32_t m_last_download:24;
+		mutable boost::uint32_t m_last_download:24;
 
 		// the number of seconds since the last byte was uploaded
 		// from this torrent
-		boost::uint32_t m_last_upload:24;
+		mutable boost::uint32_t m_last_upload:24;
 
 		// the number of seconds since the last scrape request to
 		// one of the trackers in this torrent
-		boost::uint16_t m_last_scrape;
+		mutable boost::uint16_t m_last_scrape;
 
 		// the scrape data from the tracker response, this
 		// is optional and may be 0xffffff
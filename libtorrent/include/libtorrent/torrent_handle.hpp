@@ -170,6 +170,8 @@ namespace libtorrent
 		void read_piece(int piece) const;
 		// jackarain: ݶȡӿ.
 		void read_piece(int piece, read_data_fun rdf) const;
+		void set_read_cursor(int cursor, int piece) const;
+		void clear_read_cursor(int cursor) const;
 		bool have_piece(int piece) const;
 
 		void get_full_peer_list(std::vector<peer_list_entry>& v) const;
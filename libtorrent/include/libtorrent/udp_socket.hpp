@@ -70,7 +70,10 @@ namespace libtorrent
 		udp_socket(io_service& ios, connection_queue& cc);
 		~udp_socket();
 
-		enum flags_t { dont_drop = 1, peer_connection = 2 };
+		// dont_fragment sends the packet with the DF bit set. Such
+		// packets are never batched, so that errors like EMSGSIZE
+		// are reported back to the caller
+		enum flags_t { dont_drop = 1, peer_connection = 2, dont_fragment = 4 };
 
 		bool is_open() const
 		{
@@ -169,11 +172,24 @@ namespace libtorrent
 		void call_writable_handler();
 
 		void on_writable(error_code const& ec, udp::socket* s);
+		void wait_writable(udp::socket* s);
 
 		void setup_read(udp::socket* s);
 		void on_read(error_code const& ec, udp::socket* s);
 		void on_read_impl(udp::socket* sock, udp::endpoint const& ep
-			, error_code const& e, std::size_t bytes_transferred);
+			, error_code const& e, char const* buf, std::size_t bytes_transferred);
+
+#if TORRENT_USE_MMSG
+		// the max number of packets read or written by a
+		// single recvmmsg() or sendmmsg() call
+		enum { udp_batch_size = 32 };
+
+		bool read_batch(udp::socket* s);
+		void queue_packet(udp::endpoint const& ep, char const* p, int len);
+		void flush_send_batch();
+		void report_send_error();
+		udp::socket* socket_for(udp::endpoint const& ep);
+#endif
 		void on_name_lookup(error_code const& e, tcp::resolver::iterator i);
 		void on_timeout();
 		void on_connect(int ticket);
@@ -222,6 +238,36 @@ namespace libtorrent
 		udp::socket m_ipv6_sock;
 #endif
 
+#if TORRENT_USE_MMSG
+		// the receive buffer for recvmmsg(), with one slot of
+		// m_batch_buf_size bytes per packet. This is separate
+		// from m_buf since observers may resize that while
+		// a batch is being handled
+		char* m_batch_buf;
+		int m_batch_buf_size;
+
+		// packets sent while a batch of incoming packets is
+		// being handled are queued up here, and sent with a
+		// single sendmmsg() call once all of them have been
+		// handled. Packets that couldn't be sent because the
+		// socket buffer was full also stay here until the
+		// socket becomes writable
+		buffer m_send_batch;
+		udp::endpoint m_send_batch_ep[udp_batch_size];
+		int m_send_batch_len[udp_batch_size];
+		int m_send_batch_count;
+
+		// the first error sendmmsg() failed with, other than the
+		// socket buffer being full, and the destination of that
+		// packet. It's passed on to the observers once it's safe
+		// to call them
+		error_code m_send_error;
+		udp::endpoint m_send_error_ep;
+
+		// true while packets are being queued in m_send_batch
+		bool m_batch_sends;
+#endif
+
 		boost::uint16_t m_bind_port;
 		boost::uint8_t m_v4_outstanding;
 #if TORRENT_USE_IPV6
@@ -33,11 +33,13 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_UTP_SOCKET_MANAGER_HPP_INCLUDED
 #define TORRENT_UTP_SOCKET_MANAGER_HPP_INCLUDED
 
-#include <map>
+#include <vector>
+#include <boost/cstdint.hpp>
 
 #include "libtorrent/socket_type.hpp"
 #include "libtorrent/session_status.hpp"
 #include "libtorrent/enum_net.hpp"
+#include "libtorrent/deadline_timer.hpp"
 
 namespace libtorrent
 {
@@ -74,8 +76,15 @@ namespace libtorrent
 			, error_code& ec, int flags = 0);
 		void subscribe_writable(utp_socket_impl* s);
 
-		// internal, used by utp_stream
-		void remove_socket(boost::uint16_t id);
+		// the socket will be given another chance to send
+		// in utp_pacing_interval milliseconds
+		void subscribe_pacing(utp_socket_impl* s);
+
+		// internal, used by utp_stream. Sockets are indexed by
+		// their remote endpoint and receive ID. They have to be
+		// unlinked before either changes, and linked again after
+		void link_socket(utp_socket_impl* s);
+		void unlink_socket(utp_socket_impl* s);
 
 		utp_socket_impl* new_utp_socket(utp_stream* str);
 		int gain_factor() const { return m_sett.utp_gain_factor; }
@@ -87,40 +96,88 @@ namespace libtorrent
 		int min_timeout() const { return m_sett.utp_min_timeout; }
 		int loss_multiplier() const { return m_sett.utp_loss_multiplier; }
 		bool allow_dynamic_sock_buf() const { return m_sett.utp_dynamic_sock_buf; }
+		bool pacing() const { return m_sett.utp_pacing; }
 
 		void mtu_for_dest(address const& addr, int& link_mtu, int& utp_mtu);
 		void set_sock_buf(int size);
-		int num_sockets() const { return m_utp_sockets.size(); }
+		int num_sockets() const { return m_num_sockets; }
 
 		void defer_ack(utp_socket_impl* s);
 		void subscribe_drained(utp_socket_impl* s);
 
+		// buffers for uTP packets with room for 'size' bytes of
+		// packet data. Buffers up to a full ethernet MTU are
+		// recycled through free lists instead of being returned
+		// to the heap. 'size' passed to release_packet() must be
+		// the same as the one the buffer was allocated with
+		void* allocate_packet(int size);
+		void release_packet(void* p, int size);
+
 	private:
+
+		utp_socket_impl* find_socket(udp::endpoint const& ep, boost::uint16_t id) const;
+		void rebuild_socket_table();
+		void unsubscribe_drained(utp_socket_impl* s);
+		void on_pacing_timer(error_code const& ec);
+
 		udp_socket& m_sock;
 		incoming_utp_callback_t m_cb;
 
-		// replace with a hash-map
-		typedef std::multimap<boost::uint16_t, utp_socket_impl*> socket_map_t;
-		socket_map_t m_utp_sockets;
+		struct socket_entry
+		{
+			// the hash of the socket's remote endpoint and receive ID
+			boost::uint32_t hash;
+			// 0 for empty slots
+			utp_socket_impl* socket;
+		};
+
+		// all uTP sockets, in an open addressing hash table keyed
+		// by remote endpoint and receive ID, with linear probing.
+		// The size is always a power of 2. Removed sockets leave
+		// a tombstone behind until the table is rebuilt, to keep
+		// probe sequences intact and to allow removing sockets
+		// while iterating over the table
+		std::vector<socket_entry> m_utp_sockets;
+
+		// the number of sockets in m_utp_sockets
+		int m_num_sockets;
+
+		// the number of slots in m_utp_sockets that are
+		// not empty, i.e. sockets and tombstones
+		int m_used_slots;
 
 		// this is a list of sockets that needs to send an ack.
 		// once the UDP socket is drained, all of these will
 		// have a chance to do that. This is to avoid sending
-		// an ack for every single packet
-		std::vector<utp_socket_impl*> m_deferred_acks;
+		// an ack for every single packet. It's an intrusive
+		// list linked through the sockets themselves
+		utp_socket_impl* m_deferred_acks;
+		utp_socket_impl* m_deferred_acks_tail;
 
 		// sockets that have received or sent packets this
 		// round, may subscribe to the event of draining the
 		// UDP socket. At that point they may call the
 		// user callback function to indicate bytes have been
-		// sent or received.
-		std::vector<utp_socket_impl*> m_drained_event;
+		// sent or received. This is an intrusive list too
+		utp_socket_impl* m_drained_event;
+		utp_socket_impl* m_drained_event_tail;
 		
 		// list of sockets that received EWOULDBLOCK from the
 		// underlying socket. They are notified when the socket
 		// becomes writable again
 		std::vector<utp_socket_impl*> m_stalled_sockets;
 
+		// sockets that were held back by their pacing rate.
+		// They are notified when m_pacing_timer fires
+		std::vector<utp_socket_impl*> m_paced_sockets;
+		deadline_timer m_pacing_timer;
+		bool m_pacing_timer_active;
+
+		// the free lists of packet buffers, one per size class.
+		// see allocate_packet()
+		enum { num_packet_pools = 2 };
+		std::vector<void*> m_packet_pool[num_packet_pools];
+
 		// the last socket we received a packet on
 		utp_socket_impl* m_last_socket;
 
@@ -137,6 +137,10 @@ namespace libtorrent
 
 struct utp_socket_impl;
 
+// the granularity of uTP packet pacing, in milliseconds. Sockets
+// held back by their pacing rate get a chance to send this often
+enum { utp_pacing_interval = 5 };
+
 utp_socket_impl* construct_utp_impl(boost::uint16_t recv_id
 	, boost::uint16_t send_id, void* userdata
 	, utp_socket_manager* sm);
@@ -150,10 +154,20 @@ bool utp_incoming_packet(utp_socket_impl* s, char const* p
 bool utp_match(utp_socket_impl* s, udp::endpoint const& ep, boost::uint16_t id);
 udp::endpoint utp_remote_endpoint(utp_socket_impl* s);
 boost::uint16_t utp_receive_id(utp_socket_impl* s);
+int utp_packet_overhead();
+utp_socket_impl*& utp_next_deferred_ack(utp_socket_impl* s);
+utp_socket_impl*& utp_next_drained(utp_socket_impl* s);
+bool utp_subscribed_drained(utp_socket_impl const* s);
 int utp_socket_state(utp_socket_impl const* s);
 void utp_send_ack(utp_socket_impl* s);
 void utp_socket_drained(utp_socket_impl* s);
 void utp_writable(utp_socket_impl* s);
+void utp_pacing_tick(utp_socket_impl* s);
+
+// the number of packets, counting from 'first', that a selective ACK
+// up to 'last_ack' marks as lost
+TORRENT_EXTRA_EXPORT int utp_sack_lost_packets(packet_buffer const& outbuf
+	, boost::uint16_t first, boost::uint16_t last_ack);
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
 int socket_impl_size();
@@ -229,6 +243,10 @@ public:
 	int send_delay() const;
 	int recv_delay() const;
 
+	// overrides the session's uTP target delay for this
+	// socket. 0 means use the session's setting
+	void set_target_delay(int ms);
+
 	void do_connect(tcp::endpoint const& ep, connect_handler_t h);
 
 	endpoint_type local_endpoint() const
@@ -109,6 +109,12 @@ namespace libtorrent
 
 		bool maybe_harvest_block();
 
+		// appends size bytes from buf to the partial block in
+		// m_piece. If buf is 0, zeroes are appended. Returns
+		// false if we failed to allocate a disk buffer for it,
+		// in which case the connection has been disconnected
+		bool append_piece(char const* buf, int size);
+
 		// returns the block currently being
 		// downloaded. And the progress of that
 		// block. If the peer isn't downloading
@@ -123,11 +129,13 @@ namespace libtorrent
 		std::string m_url;
 			
 		// this is used for intermediate storage of pieces
-		// that are received in more than one HTTP response
-		// TODO: 1 if we make this be a disk_buffer_holder instead
-		// we would save a copy sometimes
-		// use allocate_disk_receive_buffer and release_disk_receive_buffer
-		std::vector<char> m_piece;
+		// that are received in more than one HTTP response.
+		// It's a disk buffer, so that the block can be handed
+		// to the disk thread as-is once it's complete
+		disk_buffer_holder m_piece;
+
+		// the number of bytes of the block in m_piece
+		int m_piece_size;
 		
 		// the number of bytes received in the current HTTP
 		// response. used to know where in the buffer the
@@ -33,6 +33,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/pch.hpp"
 
 #include <string>
+#include <cstdlib> // for malloc
+#include <algorithm> // for max
 
 #include "libtorrent/config.hpp"
 #include "libtorrent/alert.hpp"
@@ -50,6 +52,7 @@ namespace libtorrent {
 	alert::alert() : m_timestamp(time_now()) {}
 	alert::~alert() {}
 	ptime alert::timestamp() const { return m_timestamp; }
+	alert* alert::clone_into(char*) const { return clone().release(); }
 
 
 	std::string torrent_alert::message() const
@@ -342,34 +345,111 @@ namespace libtorrent {
 
 
 
+	namespace
+	{
+		// the size of the chunks of memory alerts are
+		// constructed in
+		const int alert_chunk_size = 64 * 1024;
+
+		// the max number of unused chunks to keep around
+		const int max_free_alert_chunks = 8;
+	}
+
 	alert_manager::alert_manager(io_service& ios, int queue_limit, boost::uint32_t alert_mask)
-		: m_alert_mask(alert_mask)
+		: m_alerts_first(0)
+		, m_chunk_used(0)
+		, m_alert_mask(alert_mask)
 		, m_queue_size_limit(queue_limit)
 		, m_ios(ios)
 	{}
 
 	alert_manager::~alert_manager()
 	{
-		while (!m_alerts.empty())
+		for (std::vector<alert*>::iterator i = m_alerts.begin() + m_alerts_first
+			, end(m_alerts.end()); i != end; ++i)
 		{
-			TORRENT_ASSERT(alert_cast<save_resume_data_alert>(m_alerts.front()) == 0
+			TORRENT_ASSERT(alert_cast<save_resume_data_alert>(*i) == 0
 				&& "shutting down session with remaining resume data alerts in the alert queue. "
 				"You proabably wany to make sure you always wait for all resume data "
 				"alerts before shutting down");
-			delete m_alerts.front();
-			m_alerts.pop_front();
 		}
+		free_alerts(m_alerts, m_chunks);
+		free_alerts(m_handed_out, m_handed_out_chunks);
+		for (std::vector<alert_chunk>::iterator i = m_free_chunks.begin()
+			, end(m_free_chunks.end()); i != end; ++i)
+			free(i->buf);
+	}
+
+	// returns space for an alert of 'size' bytes in the chunks
+	// of the queued alerts. Must be called with m_mutex held
+	char* alert_manager::allocate_alert(int size)
+	{
+		// keep every alert aligned to 16 bytes
+		size = (size + 15) & ~15;
+
+		if (m_chunks.empty() || m_chunk_used + size > m_chunks.back().size)
+		{
+			alert_chunk c;
+			if (size <= alert_chunk_size && !m_free_chunks.empty())
+			{
+				c = m_free_chunks.back();
+				m_free_chunks.pop_back();
+			}
+			else
+			{
+				c.size = (std::max)(size, alert_chunk_size);
+				c.buf = (char*)malloc(c.size);
+				if (c.buf == 0) return 0;
+			}
+			m_chunks.push_back(c);
+			m_chunk_used = 0;
+		}
+
+		char* ret = m_chunks.back().buf + m_chunk_used;
+		m_chunk_used += size;
+		return ret;
+	}
+
+	// alerts living in the chunks are only destructed, the ones
+	// that didn't fit in them are on the heap
+	void alert_manager::destruct_alert(alert* a)
+	{
+		if (a->allocation_size() == 0) delete a;
+		else a->~alert();
+	}
+
+	// destructs the alerts and releases the chunks they live in
+	void alert_manager::free_alerts(std::vector<alert*>& alerts
+		, std::vector<alert_chunk>& chunks)
+	{
+		for (std::vector<alert*>::iterator i = alerts.begin()
+			, end(alerts.end()); i != end; ++i)
+			if (*i) destruct_alert(*i);
+		alerts.clear();
+		if (&alerts == &m_alerts) m_alerts_first = 0;
+
+		for (std::vector<alert_chunk>::iterator i = chunks.begin()
+			, end(chunks.end()); i != end; ++i)
+		{
+			if (i->size == alert_chunk_size
+				&& int(m_free_chunks.size()) < max_free_alert_chunks)
+				m_free_chunks.push_back(*i);
+			else
+				free(i->buf);
+		}
+		chunks.clear();
+		if (&chunks == &m_chunks) m_chunk_used = 0;
 	}
 
 	alert const* alert_manager::wait_for_alert(time_duration max_wait)
 	{
 		mutex::scoped_lock lock(m_mutex);
 
-		if (!m_alerts.empty()) return m_alerts.front();
+		if (m_alerts_first < m_alerts.size()) return m_alerts[m_alerts_first];
 		
 		// this call can be interrupted prematurely by other signals
 		m_condition.wait_for(lock, max_wait);
-		if (!m_alerts.empty()) return m_alerts.front();
+		if (m_alerts_first < m_alerts.size()) return m_alerts[m_alerts_first];
 
 		return NULL;
 	}
@@ -381,7 +461,10 @@ namespace libtorrent {
 		m_dispatch = fun;
 
 		std::deque<alert*> alerts;
-		m_alerts.swap(alerts);
+		for (std::vector<alert*>::iterator i = m_alerts.begin() + m_alerts_first
+			, end(m_alerts.end()); i != end; ++i)
+			alerts.push_back((*i)->clone().release());
+		free_alerts(m_alerts, m_chunks);
 		lock.unlock();
 
 		while (!alerts.empty())
@@ -415,13 +498,11 @@ namespace libtorrent {
 #endif
 
 		mutex::scoped_lock lock(m_mutex);
-		post_impl(a, lock);
+		post_impl(*a, lock);
 	}
 
 	void alert_manager::post_alert(const alert& alert_)
 	{
-		std::auto_ptr<alert> a(alert_.clone());
-
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		for (ses_extension_list_t::iterator i = m_ses_extensions.begin()
 			, end(m_ses_extensions.end()); i != end; ++i)
@@ -433,22 +514,30 @@ namespace libtorrent {
 #endif
 
 		mutex::scoped_lock lock(m_mutex);
-		post_impl(a, lock);
+		post_impl(alert_, lock);
 	}
 		
-	void alert_manager::post_impl(std::auto_ptr<alert>& alert_, mutex::scoped_lock& l)
+	void alert_manager::post_impl(alert const& alert_, mutex::scoped_lock& l)
 	{
 		if (m_dispatch)
 		{
-			TORRENT_ASSERT(m_alerts.empty());
+			TORRENT_ASSERT(m_alerts_first == m_alerts.size());
+			std::auto_ptr<alert> a(alert_.clone());
 			TORRENT_TRY {
-				m_dispatch(alert_);
+				m_dispatch(a);
 			} TORRENT_CATCH(std::exception&) {}
 		}
-		else if (m_alerts.size() < m_queue_size_limit || !alert_->discardable())
+		else if (m_alerts.size() - m_alerts_first < m_queue_size_limit || !alert_.discardable())
 		{
-			m_alerts.push_back(alert_.release());
-			if (m_alerts.size() == 1)
+			int size = alert_.allocation_size();
+			char* buf = 0;
+			if (size > 0)
+			{
+				buf = allocate_alert(size);
+				if (buf == 0) return;
+			}
+			m_alerts.push_back(alert_.clone_into(buf));
+			if (m_alerts.size() - m_alerts_first == 1)
 				m_condition.notify_all();
 		}
 	}
@@ -464,26 +553,53 @@ namespace libtorrent {
 	{
 		mutex::scoped_lock lock(m_mutex);
 		
-		if (m_alerts.empty())
+		if (m_alerts_first == m_alerts.size())
 			return std::auto_ptr<alert>(0);
 
-		alert* result = m_alerts.front();
-		m_alerts.pop_front();
-		return std::auto_ptr<alert>(result);
+		// the caller takes ownership of the alert, so it has
+		// to be copied out of the chunks
+		alert*& a = m_alerts[m_alerts_first++];
+		std::auto_ptr<alert> result = a->clone();
+		destruct_alert(a);
+		a = 0;
+
+		// the chunks can only be reused once all
+		// alerts in them are gone
+		if (m_alerts_first == m_alerts.size()) free_alerts(m_alerts, m_chunks);
+		return result;
 	}
 
 	void alert_manager::get_all(std::deque<alert*>* alerts)
 	{
 		mutex::scoped_lock lock(m_mutex);
-		if (m_alerts.empty()) return;
-		m_alerts.swap(*alerts);
+		if (m_alerts_first == m_alerts.size()) return;
+		for (std::vector<alert*>::iterator i = m_alerts.begin() + m_alerts_first
+			, end(m_alerts.end()); i != end; ++i)
+			alerts->push_back((*i)->clone().release());
+		free_alerts(m_alerts, m_chunks);
+	}
+
+	void alert_manager::get_all(std::vector<alert*>* alerts)
+	{
+		mutex::scoped_lock lock(m_mutex);
+
+		// the alerts handed out last time are no longer
+		// referenced by the caller
+		free_alerts(m_handed_out, m_handed_out_chunks);
+
+		m_handed_out.swap(m_alerts);
+		m_handed_out_chunks.swap(m_chunks);
+		m_chunk_used = 0;
+
+		alerts->assign(m_handed_out.begin() + m_alerts_first, m_handed_out.end());
+		m_alerts_first = 0;
 	}
 
 	bool alert_manager::pending() const
 	{
 		mutex::scoped_lock lock(m_mutex);
 		
-		return !m_alerts.empty();
+		return m_alerts_first < m_alerts.size();
 	}
 
 	size_t alert_manager::set_alert_queue_size_limit(size_t queue_size_limit_)
@@ -36,11 +36,14 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace libtorrent
 {
 	bandwidth_channel::bandwidth_channel()
-		: tmp(0)
+		: queue_index(-1)
 		, distribute_quota(0)
 		, m_quota_left(0)
 		, m_limit(0)
-	{}
+	{
+		for (int i = 0; i < num_classes; ++i)
+			queued_priority[i] = 0;
+	}
 
 	// 0 means infinite
 	void bandwidth_channel::throttle(int limit)
@@ -33,6 +33,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/bandwidth_manager.hpp"
 #include "libtorrent/time.hpp"
 
+#include <map>
+#include <set>
+
 namespace libtorrent
 {
 
@@ -52,20 +55,80 @@ namespace libtorrent
 #endif
 	}
 
+	bandwidth_manager::~bandwidth_manager()
+	{
+		// the channels may outlive us
+		for (int c = 0; c < bandwidth_channel::num_classes; ++c)
+		{
+			for (queue_t::iterator i = m_queue[c].begin()
+				, end(m_queue[c].end()); i != end; ++i)
+				remove_from_channels(*i);
+		}
+	}
+
 	void bandwidth_manager::close()
 	{
 		m_abort = true;
-		m_queue.clear();
+		for (int c = 0; c < bandwidth_channel::num_classes; ++c)
+		{
+			for (queue_t::iterator i = m_queue[c].begin()
+				, end(m_queue[c].end()); i != end; ++i)
+				remove_from_channels(*i);
+			m_queue[c].clear();
+		}
+		TORRENT_ASSERT(m_channels.empty());
 		m_queued_bytes = 0;
 	}
 
+	void bandwidth_manager::add_to_channels(bw_request const& r)
+	{
+		for (int j = 0; j < 5 && r.channel[j]; ++j)
+		{
+			bandwidth_channel* bwc = r.channel[j];
+			if (bwc->queue_index == -1)
+			{
+				bwc->queue_index = m_channels.size();
+				m_channels.push_back(bwc);
+			}
+			TORRENT_ASSERT(m_channels[bwc->queue_index] == bwc);
+			int& queued = bwc->queued_priority[r.bandwidth_class];
+			TORRENT_ASSERT(INT_MAX - queued > r.priority);
+			queued += r.priority;
+		}
+	}
+
+	void bandwidth_manager::remove_from_channels(bw_request const& r)
+	{
+		for (int j = 0; j < 5 && r.channel[j]; ++j)
+		{
+			bandwidth_channel* bwc = r.channel[j];
+			int& queued = bwc->queued_priority[r.bandwidth_class];
+			TORRENT_ASSERT(queued >= r.priority);
+			TORRENT_ASSERT(m_channels[bwc->queue_index] == bwc);
+			queued -= r.priority;
+			if (bwc->queued_priority[bandwidth_channel::background] > 0
+				|| bwc->queued_priority[bandwidth_channel::latency_critical] > 0)
+				continue;
+
+			// move the last channel into this one's slot
+			bandwidth_channel* last = m_channels.back();
+			m_channels[bwc->queue_index] = last;
+			last->queue_index = bwc->queue_index;
+			m_channels.pop_back();
+			bwc->queue_index = -1;
+		}
+	}
+
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 	bool bandwidth_manager::is_queued(bandwidth_socket const* peer) const
 	{
-		for (queue_t::const_iterator i = m_queue.begin()
-			, end(m_queue.end()); i != end; ++i)
+		for (int c = 0; c < bandwidth_channel::num_classes; ++c)
 		{
-			if (i->peer.get() == peer) return true;
+			for (queue_t::const_iterator i = m_queue[c].begin()
+				, end(m_queue[c].end()); i != end; ++i)
+			{
+				if (i->peer.get() == peer) return true;
+			}
 		}
 		return false;
 	}
@@ -73,7 +136,8 @@ namespace libtorrent
 
 	int bandwidth_manager::queue_size() const
 	{
-		return m_queue.size();
+		return m_queue[bandwidth_channel::background].size()
+			+ m_queue[bandwidth_channel::latency_critical].size();
 	}
 
 	int bandwidth_manager::queued_bytes() const
@@ -115,8 +179,11 @@ namespace libtorrent
 			// the queue, just satisfy the request immediately
 			return blk;
 		}
+		if (peer->latency_critical(m_channel))
+			bwr.bandwidth_class = bandwidth_channel::latency_critical;
 		m_queued_bytes += blk;
-		m_queue.push_back(bwr);
+		add_to_channels(bwr);
+		m_queue[bwr.bandwidth_class].push_back(bwr);
 		return 0;
 	}
 
@@ -124,31 +191,42 @@ namespace libtorrent
 	void bandwidth_manager::check_invariant() const
 	{
 		int queued = 0;
-		for (queue_t::const_iterator i = m_queue.begin()
-			, end(m_queue.end()); i != end; ++i)
+		std::map<bandwidth_channel const*, int> priority[bandwidth_channel::num_classes];
+		std::set<bandwidth_channel const*> channels;
+		for (int c = 0; c < bandwidth_channel::num_classes; ++c)
 		{
-			queued += i->request_size - i->assigned;
+			for (queue_t::const_iterator i = m_queue[c].begin()
+				, end(m_queue[c].end()); i != end; ++i)
+			{
+				TORRENT_ASSERT(i->bandwidth_class == c);
+				queued += i->request_size - i->assigned;
+				for (int j = 0; j < 5 && i->channel[j]; ++j)
+				{
+					priority[c][i->channel[j]] += i->priority;
+					channels.insert(i->channel[j]);
+				}
+			}
 		}
 		TORRENT_ASSERT(queued == m_queued_bytes);
+
+		TORRENT_ASSERT(channels.size() == m_channels.size());
+		for (int i = 0; i < int(m_channels.size()); ++i)
+		{
+			bandwidth_channel const* bwc = m_channels[i];
+			TORRENT_ASSERT(bwc->queue_index == i);
+			for (int c = 0; c < bandwidth_channel::num_classes; ++c)
+				TORRENT_ASSERT(bwc->queued_priority[c] == priority[c][bwc]);
+		}
 	}
 #endif
 
-	void bandwidth_manager::update_quotas(time_duration const& dt)
+	void bandwidth_manager::assign_bandwidth(queue_t& queue)
 	{
-		if (m_abort) return;
-		if (m_queue.empty()) return;
-
-		INVARIANT_CHECK;
-
-		int dt_milliseconds = total_milliseconds(dt);
-		if (dt_milliseconds > 3000) dt_milliseconds = 3000;
-
-		// for each bandwidth channel, call update_quota(dt)
-
-		std::vector<bandwidth_channel*> channels;
-
-		for (queue_t::iterator i = m_queue.begin();
-			i != m_queue.end();)
+		// assign bandwidth to all requests in a single pass, moving
+		// the ones that are still waiting towards the front
+		queue_t::iterator out = queue.begin();
+		for (queue_t::iterator i = queue.begin()
+			, end(queue.end()); i != end; ++i)
 		{
 			if (i->peer->is_disconnecting())
 			{
@@ -161,63 +239,78 @@ namespace libtorrent
 					bandwidth_channel* bwc = i->channel[j];
 					bwc->return_quota(i->assigned);
 				}
-
-				i = m_queue.erase(i);
+				remove_from_channels(*i);
 				continue;
 			}
-			for (int j = 0; j < 5 && i->channel[j]; ++j)
+
+			int a = i->assign_bandwidth();
+			if (i->assigned == i->request_size
+				|| (i->ttl <= 0 && i->assigned > 0))
 			{
-				bandwidth_channel* bwc = i->channel[j];
-				bwc->tmp = 0;
+				a += i->request_size - i->assigned;
+				TORRENT_ASSERT(i->assigned <= i->request_size);
+				m_completed.push_back(*i);
 			}
-			++i;
-		}
-
-		for (queue_t::iterator i = m_queue.begin()
-			, end(m_queue.end()); i != end; ++i)
-		{
-			for (int j = 0; j < 5 && i->channel[j]; ++j)
+			else
 			{
-				bandwidth_channel* bwc = i->channel[j];
-				if (bwc->tmp == 0) channels.push_back(bwc);
-				TORRENT_ASSERT(INT_MAX - bwc->tmp > i->priority);
-				bwc->tmp += i->priority;
+				if (out != i) *out = *i;
+				++out;
 			}
+			m_queued_bytes -= a;
 		}
+		queue.erase(out, queue.end());
+	}
 
-		for (std::vector<bandwidth_channel*>::iterator i = channels.begin()
-			, end(channels.end()); i != end; ++i)
+	void bandwidth_manager::update_quotas(time_duration const& dt)
+	{
+		if (m_abort) return;
+		if (m_channels.empty()) return;
+
+		INVARIANT_CHECK;
+
+		int dt_milliseconds = total_milliseconds(dt);
+		if (dt_milliseconds > 3000) dt_milliseconds = 3000;
+
+		// refill the channels that have requests queued. The sum of
+		// the priorities of each channel's requests is kept up to
+		// date as requests are queued and completed, so this doesn't
+		// need to look at the queue
+		for (std::vector<bandwidth_channel*>::iterator i = m_channels.begin()
+			, end(m_channels.end()); i != end; ++i)
 		{
 			(*i)->update_quota(dt_milliseconds);
 		}
 
-		queue_t tm;
+		TORRENT_ASSERT(m_completed.empty());
 
-		for (queue_t::iterator i = m_queue.begin();
-			i != m_queue.end();)
+		// latency critical requests are served first and split the
+		// full quota of their channels between them. The background
+		// requests share whatever they leave
+		queue_t& latency_queue = m_queue[bandwidth_channel::latency_critical];
+		if (!latency_queue.empty())
 		{
-			int a = i->assign_bandwidth();
-			if (i->assigned == i->request_size
-				|| (i->ttl <= 0 && i->assigned > 0))
+			assign_bandwidth(latency_queue);
+			for (std::vector<bandwidth_channel*>::iterator i = m_channels.begin()
+				, end(m_channels.end()); i != end; ++i)
 			{
-				a += i->request_size - i->assigned;
-				TORRENT_ASSERT(i->assigned <= i->request_size);
-				tm.push_back(*i);
-				i = m_queue.erase(i);
+				if ((*i)->throttle() == 0) continue;
+				(*i)->distribute_quota = (*i)->quota_left();
 			}
-			else
-			{
-				++i;
-			}
-			m_queued_bytes -= a;
 		}
+		assign_bandwidth(m_queue[bandwidth_channel::background]);
 
-		while (!tm.empty())
+		// the completed requests keep their share of the channels
+		// until every request has been assigned bandwidth for this
+		// round, so they're removed from the channels now
+		for (queue_t::iterator i = m_completed.begin()
+			, end(m_completed.end()); i != end; ++i)
+			remove_from_channels(*i);
+
+		while (!m_completed.empty())
 		{
-			bw_request& bwr = tm.back();
+			bw_request& bwr = m_completed.back();
 			bwr.peer->assign_bandwidth(m_channel, bwr.assigned);
-			tm.pop_back();
+			m_completed.pop_back();
 		}
 	}
 }
-
@@ -41,6 +41,7 @@ namespace libtorrent
 		, int blk, int prio)
 		: peer(pe)
 		, priority(prio)
+		, bandwidth_class(bandwidth_channel::background)
 		, assigned(0)
 		, request_size(blk)
 		, ttl(20)
@@ -60,9 +61,10 @@ namespace libtorrent
 		for (int j = 0; j < 5 && channel[j]; ++j)
 		{
 			if (channel[j]->throttle() == 0) continue;
-			if (channel[j]->tmp == 0) continue;
+			int const queued = channel[j]->queued_priority[bandwidth_class];
+			TORRENT_ASSERT(queued >= priority);
 			quota = (std::min)(int(boost::int64_t(channel[j]->distribute_quota)
-				* priority / channel[j]->tmp), quota);
+				* priority / queued), quota);
 		}
 		assigned += quota;
 		for (int j = 0; j < 5 && channel[j]; ++j)
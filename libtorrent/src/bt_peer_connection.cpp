@@ -602,6 +602,11 @@ namespace libtorrent
 #endif
 	}
 
+	void free_malloc_buffer(char* buf, void*) { ::free(buf); }
+
+	void free_disk_send_buffer(char* buf, void* ses)
+	{ static_cast<aux::session_impl*>(ses)->free_disk_buffer(buf); }
+
 	void bt_peer_connection::append_const_send_buffer(char const* buffer, int size)
 	{
 #ifndef TORRENT_DISABLE_ENCRYPTION
@@ -611,7 +616,7 @@ namespace libtorrent
 			// since we'll mutate it
 			char* buf = (char*)malloc(size);
 			memcpy(buf, buffer, size);
-			bt_peer_connection::append_send_buffer(buf, size, boost::bind(&::free, _1));
+			bt_peer_connection::append_send_buffer(buf, size, &free_malloc_buffer, 0);
 		}
 		else
 #endif
@@ -2314,9 +2319,7 @@ namespace libtorrent
 			send_buffer(msg, 13);
 		}
 
-		append_send_buffer(buffer.get(), r.length
-			, boost::bind(&session_impl::free_disk_buffer
-			, boost::ref(m_ses), _1));
+		append_send_buffer(buffer.get(), r.length, &free_disk_send_buffer, &m_ses);
 		buffer.release();
 
 		m_payloads.push_back(range(send_buffer_size() - r.length, r.length));
@@ -2367,8 +2370,8 @@ namespace libtorrent
 		if (m_rc4_encrypted && m_encrypted)
 		{
 			std::pair<buffer::interval, buffer::interval> wr_buf = wr_recv_buffers(bytes_transferred);
-			m_enc_handler->decrypt(wr_buf.first.begin, wr_buf.first.left());
-			if (wr_buf.second.left()) m_enc_handler->decrypt(wr_buf.second.begin, wr_buf.second.left());
+			buffer::interval bufs[2] = { wr_buf.first, wr_buf.second };
+			m_enc_handler->decrypt_buffers(bufs, 2);
 		}
 #endif
 
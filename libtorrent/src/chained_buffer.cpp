@@ -38,9 +38,9 @@ namespace libtorrent
 	void chained_buffer::pop_front(int bytes_to_pop)
 	{
 		TORRENT_ASSERT(bytes_to_pop <= m_bytes);
-		while (bytes_to_pop > 0 && !m_vec.empty())
+		while (bytes_to_pop > 0 && m_num_buffers > 0)
 		{
-			buffer_t& b = m_vec.front();
+			buffer_t& b = at(0);
 			if (b.used_size > bytes_to_pop)
 			{
 				b.start += bytes_to_pop;
@@ -52,28 +52,43 @@ namespace libtorrent
 				break;
 			}
 
-			b.free(b.buf);
+			if (b.free) b.free(b.buf, b.userdata);
 			m_bytes -= b.used_size;
 			m_capacity -= b.size;
 			bytes_to_pop -= b.used_size;
 			TORRENT_ASSERT(m_bytes >= 0);
 			TORRENT_ASSERT(m_capacity >= 0);
 			TORRENT_ASSERT(m_bytes <= m_capacity);
-			m_vec.pop_front();
+			m_first = (m_first + 1) & (m_ring_size - 1);
+			--m_num_buffers;
 		}
 	}
 
+	void chained_buffer::grow()
+	{
+		int new_size = m_ring_size == 0 ? 8 : m_ring_size * 2;
+		buffer_t* new_vec = new buffer_t[new_size];
+		for (int i = 0; i < m_num_buffers; ++i)
+			new_vec[i] = at(i);
+		delete[] m_vec;
+		m_vec = new_vec;
+		m_ring_size = new_size;
+		m_first = 0;
+	}
+
 	void chained_buffer::append_buffer(char* buffer, int s, int used_size
-		, boost::function<void(char*)> const& destructor)
+		, free_buffer_fun destructor, void* userdata)
 	{
 		TORRENT_ASSERT(s >= used_size);
-		buffer_t b;
+		if (m_num_buffers == m_ring_size) grow();
+		buffer_t& b = at(m_num_buffers);
 		b.buf = buffer;
 		b.size = s;
 		b.start = buffer;
 		b.used_size = used_size;
 		b.free = destructor;
-		m_vec.push_back(b);
+		b.userdata = userdata;
+		++m_num_buffers;
 
 		m_bytes += used_size;
 		m_capacity += s;
@@ -84,8 +99,8 @@ namespace libtorrent
 	// end of the last chained buffer.
 	int chained_buffer::space_in_last_buffer()
 	{
-		if (m_vec.empty()) return 0;
-		buffer_t& b = m_vec.back();
+		if (m_num_buffers == 0) return 0;
+		buffer_t& b = at(m_num_buffers - 1);
 		return b.size - b.used_size - (b.start - b.buf);
 	}
 
@@ -105,8 +120,8 @@ namespace libtorrent
 	// enough room, returns 0
 	char* chained_buffer::allocate_appendix(int s)
 	{
-		if (m_vec.empty()) return 0;
-		buffer_t& b = m_vec.back();
+		if (m_num_buffers == 0) return 0;
+		buffer_t& b = at(m_num_buffers - 1);
 		char* insert = b.start + b.used_size;
 		if (insert + s > b.buf + b.size) return 0;
 		b.used_size += s;
@@ -115,24 +130,23 @@ namespace libtorrent
 		return insert;
 	}
 
-	std::list<asio::const_buffer> const& chained_buffer::build_iovec(int to_send)
+	chained_buffer::buffer_sequence chained_buffer::build_iovec(int to_send)
 	{
-		m_tmp_vec.clear();
-
-		for (std::list<buffer_t>::iterator i = m_vec.begin()
-			, end(m_vec.end()); to_send > 0 && i != end; ++i)
+		int num = 0;
+		for (int i = 0; to_send > 0 && i < m_num_buffers && num < max_iovec; ++i)
 		{
-			if (i->used_size > to_send)
+			buffer_t& b = at(i);
+			if (b.used_size > to_send)
 			{
 				TORRENT_ASSERT(to_send > 0);
-				m_tmp_vec.push_back(asio::const_buffer(i->start, to_send));
+				m_tmp_vec[num++] = asio::const_buffer(b.start, to_send);
 				break;
 			}
-			TORRENT_ASSERT(i->used_size > 0);
-			m_tmp_vec.push_back(asio::const_buffer(i->start, i->used_size));
-			to_send -= i->used_size;
+			TORRENT_ASSERT(b.used_size > 0);
+			m_tmp_vec[num++] = asio::const_buffer(b.start, b.used_size);
+			to_send -= b.used_size;
 		}
-		return m_tmp_vec;
+		return buffer_sequence(m_tmp_vec, m_tmp_vec + num);
 	}
 
 	chained_buffer::~chained_buffer()
@@ -143,15 +157,17 @@ namespace libtorrent
 #endif
 		TORRENT_ASSERT(m_bytes >= 0);
 		TORRENT_ASSERT(m_capacity >= 0);
-		for (std::list<buffer_t>::iterator i = m_vec.begin()
-			, end(m_vec.end()); i != end; ++i)
+		for (int i = 0; i < m_num_buffers; ++i)
 		{
-			i->free(i->buf);
+			buffer_t& b = at(i);
+			if (b.free) b.free(b.buf, b.userdata);
 		}
+		delete[] m_vec;
 #ifdef TORRENT_DEBUG
 		m_bytes = -1;
 		m_capacity = -1;
-		m_vec.clear();
+		m_vec = 0;
+		m_num_buffers = 0;
 #endif
 	}
 
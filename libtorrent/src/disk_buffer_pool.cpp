@@ -33,8 +33,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/disk_buffer_pool.hpp"
 #include "libtorrent/assert.hpp"
 #include <algorithm>
+#include <stdlib.h> // posix_memalign/free
 
-#if TORRENT_USE_MLOCK && !defined TORRENT_WINDOWS
+#if (TORRENT_USE_MLOCK || !defined TORRENT_DISABLE_POOL_ALLOCATOR) \
+	&& !defined TORRENT_WINDOWS && !defined TORRENT_BEOS
 #include <sys/mman.h>
 #endif
 
@@ -47,6 +49,10 @@ namespace libtorrent
 	disk_buffer_pool::disk_buffer_pool(int block_size)
 		: m_block_size(block_size)
 		, m_in_use(0)
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+		, m_partial_slabs(0)
+		, m_slab_free_blocks(0)
+#endif
 	{
 #if defined TORRENT_DISK_STATS || defined TORRENT_STATS
 		m_allocations = 0;
@@ -63,14 +69,202 @@ namespace libtorrent
 #endif
 	}
 
-#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 	disk_buffer_pool::~disk_buffer_pool()
 	{
 		TORRENT_ASSERT(m_magic == 0x1337);
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+		// buffers still out at this point are leaked anyway
+		mutex::scoped_lock l(m_pool_mutex);
+		for (slab_map_t::iterator i = m_slabs.begin(); i != m_slabs.end(); ++i)
+			free_slab_memory(i->first, i->second);
+		m_slabs.clear();
+#endif
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		m_magic = 0;
+#endif
 	}
+
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+	bool disk_buffer_pool::add_slab(mutex::scoped_lock& l)
+	{
+		TORRENT_ASSERT(slab_size % m_block_size == 0);
+		disk_slab s;
+		s.huge_page = false;
+		s.locked = false;
+		char* base = 0;
+
+#if defined TORRENT_LINUX && defined MAP_HUGETLB
+		// this only succeeds if the system has huge pages reserved
+		void* p = mmap(0, slab_size, PROT_READ | PROT_WRITE
+			, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			base = (char*)p;
+			s.huge_page = true;
+		}
+#endif
+
+		if (base == 0)
+		{
+#if TORRENT_USE_POSIX_MEMALIGN
+			// align the slab to its size, to let the kernel back it
+			// by a single transparent huge page
+			void* p;
+			if (posix_memalign(&p, slab_size, slab_size) != 0) p = 0;
+			base = (char*)p;
+#else
+			base = page_aligned_allocator::malloc(slab_size);
+#endif
+			if (base == 0) return false;
+#if defined MADV_HUGEPAGE
+			madvise(base, slab_size, MADV_HUGEPAGE);
+#endif
+		}
+
+#if TORRENT_USE_MLOCK
+		if (m_settings.lock_disk_cache)
+		{
+#ifdef TORRENT_WINDOWS
+			VirtualLock(base, slab_size);
+#else
+			mlock(base, slab_size);
+#endif
+			s.locked = true;
+		}
 #endif
 
+		s.base = base;
+		s.free_list = 0;
+		s.num_untouched = slab_size / m_block_size;
+		s.num_free = s.num_untouched;
+		// the slab header lives in the map node, which doesn't move
+		link_partial_slab(m_slabs.insert(std::make_pair(base, s)).first->second);
+		m_slab_free_blocks += s.num_free;
+		return true;
+	}
+
+	// inserts s in m_partial_slabs, keeping the list ordered by address.
+	// This walks the slabs with free blocks below s, but only happens
+	// when a slab gets its first free block
+	void disk_buffer_pool::link_partial_slab(disk_slab& s)
+	{
+		disk_slab* prev = 0;
+		disk_slab* next = m_partial_slabs;
+		while (next && next->base < s.base)
+		{
+			prev = next;
+			next = next->next_partial;
+		}
+		s.prev_partial = prev;
+		s.next_partial = next;
+		if (next) next->prev_partial = &s;
+		if (prev) prev->next_partial = &s;
+		else m_partial_slabs = &s;
+	}
+
+	void disk_buffer_pool::unlink_partial_slab(disk_slab& s)
+	{
+		if (s.next_partial) s.next_partial->prev_partial = s.prev_partial;
+		if (s.prev_partial) s.prev_partial->next_partial = s.next_partial;
+		else m_partial_slabs = s.next_partial;
+	}
+
+	void disk_buffer_pool::release_slab(slab_map_t::iterator i, mutex::scoped_lock& l)
+	{
+		TORRENT_ASSERT(i->second.num_free == slab_size / m_block_size);
+		m_slab_free_blocks -= i->second.num_free;
+		unlink_partial_slab(i->second);
+		free_slab_memory(i->first, i->second);
+		m_slabs.erase(i);
+	}
+
+	void disk_buffer_pool::free_slab_memory(char* base, disk_slab const& s)
+	{
+#if TORRENT_USE_MLOCK
+		if (s.locked)
+		{
+#ifdef TORRENT_WINDOWS
+			VirtualUnlock(base, slab_size);
+#else
+			munlock(base, slab_size);
+#endif
+		}
+#endif
+#if defined TORRENT_LINUX && defined MAP_HUGETLB
+		if (s.huge_page)
+		{
+			munmap(base, slab_size);
+			return;
+		}
+#endif
+#if TORRENT_USE_POSIX_MEMALIGN
+		::free(base);
+#else
+		page_aligned_allocator::free(base);
+#endif
+	}
+
+	char* disk_buffer_pool::allocate_slab_block(mutex::scoped_lock& l)
+	{
+		if (m_partial_slabs == 0 && !add_slab(l)) return 0;
+
+		disk_slab& s = *m_partial_slabs;
+		TORRENT_ASSERT(s.num_free > 0);
+		char* ret;
+		if (s.free_list)
+		{
+			ret = s.free_list;
+			s.free_list = *(char**)ret;
+		}
+		else
+		{
+			TORRENT_ASSERT(s.num_untouched > 0);
+			ret = s.base + slab_size - s.num_untouched * m_block_size;
+			--s.num_untouched;
+		}
+		--s.num_free;
+		--m_slab_free_blocks;
+		if (s.num_free == 0) unlink_partial_slab(s);
+		return ret;
+	}
+
+	// returns false if the buffer does not belong to any slab
+	bool disk_buffer_pool::free_slab_block(char* buf, mutex::scoped_lock& l)
+	{
+		slab_map_t::iterator i = m_slabs.upper_bound(buf);
+		if (i == m_slabs.begin()) return false;
+		--i;
+		if (buf >= i->first + slab_size) return false;
+
+		disk_slab& s = i->second;
+		TORRENT_ASSERT((buf - i->first) % m_block_size == 0);
+		*(char**)buf = s.free_list;
+		s.free_list = buf;
+		if (s.num_free == 0) link_partial_slab(s);
+		++s.num_free;
+		++m_slab_free_blocks;
+
+		// keep at most one slab's worth of free blocks around
+		// before handing empty slabs back to the system
+		if (s.num_free == slab_size / m_block_size
+			&& m_slab_free_blocks - s.num_free >= s.num_free)
+			release_slab(i, l);
+		return true;
+	}
+#endif
+
+	void disk_buffer_pool::slab_stats(int& slabs, int& free_blocks) const
+	{
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+		mutex::scoped_lock l(m_pool_mutex);
+		slabs = m_slabs.size();
+		free_blocks = m_slab_free_blocks;
+#else
+		slabs = 0;
+		free_blocks = 0;
+#endif
+	}
+
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS || defined TORRENT_DISK_STATS
 	bool disk_buffer_pool::is_disk_buffer(char* buffer
 		, mutex::scoped_lock& l) const
@@ -94,10 +288,22 @@ namespace libtorrent
 	{
 		mutex::scoped_lock l(m_pool_mutex);
 		TORRENT_ASSERT(m_magic == 0x1337);
-		char* ret = page_aligned_allocator::malloc(m_block_size);
+		char* ret = 0;
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+		if (m_settings.use_disk_cache_pool)
+		{
+			ret = allocate_slab_block(l);
+		}
+		else
+#endif
+		{
+			ret = page_aligned_allocator::malloc(m_block_size);
+		}
+		if (ret == 0) return 0;
 		++m_in_use;
 #if TORRENT_USE_MLOCK
-		if (m_settings.lock_disk_cache)
+		// slabs are locked as a whole
+		if (m_settings.lock_disk_cache && !m_settings.use_disk_cache_pool)
 		{
 #ifdef TORRENT_WINDOWS
 			VirtualLock(ret, m_block_size);
@@ -174,6 +380,13 @@ namespace libtorrent
 		--m_categories[category];
 		m_log << log_time() << " " << category << ": " << m_categories[category] << "\n";
 		m_buf_to_category.erase(buf);
+#endif
+		--m_in_use;
+
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+		// the setting may have changed since the buffer was allocated,
+		// so look at where it came from rather than at the setting
+		if (free_slab_block(buf, l)) return;
 #endif
 #if TORRENT_USE_MLOCK
 		if (m_settings.lock_disk_cache)
@@ -186,12 +399,22 @@ namespace libtorrent
 		}
 #endif
 		page_aligned_allocator::free(buf);
-		--m_in_use;
 	}
 
 	void disk_buffer_pool::release_memory()
 	{
 		TORRENT_ASSERT(m_magic == 0x1337);
+#ifndef TORRENT_DISABLE_POOL_ALLOCATOR
+		mutex::scoped_lock l(m_pool_mutex);
+		for (slab_map_t::iterator i = m_slabs.begin(); i != m_slabs.end();)
+		{
+			slab_map_t::iterator next = i;
+			++next;
+			if (i->second.num_free == slab_size / m_block_size)
+				release_slab(i, l);
+			i = next;
+		}
+#endif
 	}
 }
 
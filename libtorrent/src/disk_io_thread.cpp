@@ -42,7 +42,6 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/error.hpp"
 #include "libtorrent/file_pool.hpp"
-#include <boost/scoped_array.hpp>
 #include <boost/bind.hpp>
 
 #include "libtorrent/time.hpp"
@@ -80,6 +79,7 @@ namespace libtorrent
 		, m_waiting_to_shutdown(false)
 		, m_queue_buffer_size(0)
 		, m_last_file_check(time_now_hires())
+		, m_ghost_blocks(0)
 		, m_last_stats_flip(time_now())
 		, m_physical_ram(0)
 		, m_exceeded_write_queue(false)
@@ -183,6 +183,10 @@ namespace libtorrent
 		m_cache_stats.queued_bytes = m_queue_buffer_size;
 
 		cache_status ret = m_cache_stats;
+		slab_stats(ret.disk_pool_slabs, ret.disk_pool_free_blocks);
+		m_file_pool.get_stats(ret.file_pool_hits, ret.file_pool_misses
+			, ret.file_pool_evictions);
+		ret.open_files = m_file_pool.num_open_files();
 
 		ret.job_queue_length = m_jobs.size() + m_sorted_read_jobs.size();
 		ret.read_queue_size = m_sorted_read_jobs.size();
@@ -253,12 +257,18 @@ namespace libtorrent
 		INVARIANT_CHECK;
 		// flush write cache
 		cache_lru_index_t& widx = m_pieces.get<1>();
-		cache_lru_index_t::iterator i = widx.begin();
 		time_duration cut_off = seconds(m_settings.cache_expiry);
-		while (i != widx.end() && now - i->expire > cut_off)
+		std::vector<cache_piece_index_t::iterator> expired;
+		for (cache_lru_index_t::iterator i = widx.begin();
+			i != widx.end() && now - i->expire > cut_off; ++i)
+			expired.push_back(m_pieces.project<0>(i));
+		flush_pieces(expired, l);
+
+		for (std::vector<cache_piece_index_t::iterator>::iterator k = expired.begin()
+			, end(expired.end()); k != end; ++k)
 		{
+			cache_piece_index_t::iterator i = *k;
 			TORRENT_ASSERT(i->storage);
-			flush_range(const_cast<cached_piece_entry&>(*i), 0, INT_MAX, l);
 			TORRENT_ASSERT(i->num_blocks == 0);
 
 			// we want to keep the piece in here to have an accurate
@@ -274,8 +284,7 @@ namespace libtorrent
 				erase = i->next_block_to_hash == blocks_in_piece;
 			}
 
-			if (erase) widx.erase(i++);
-			else ++i;
+			if (erase) m_pieces.erase(i);
 		}
 
 		if (m_settings.explicit_read_cache) return;
@@ -283,9 +292,14 @@ namespace libtorrent
 		// flush read cache
 		std::vector<char*> bufs;
 		cache_lru_index_t& ridx = m_read_pieces.get<1>();
-		i = ridx.begin();
+		cache_lru_index_t::iterator i = ridx.begin();
 		while (i != ridx.end() && now - i->expire > cut_off)
 		{
+			if (is_pinned(i->storage.get(), i->piece, l))
+			{
+				++i;
+				continue;
+			}
 			drain_piece_bufs(const_cast<cached_piece_entry&>(*i), bufs, l);
 			ridx.erase(i++);
 		}
@@ -308,6 +322,7 @@ namespace libtorrent
 			--p.num_blocks;
 			--m_cache_stats.cache_size;
 			--m_cache_stats.read_cache_size;
+			if (p.protect) --m_cache_stats.protected_read_cache_size;
 		}
 		return ret;
 	}
@@ -331,11 +346,181 @@ namespace libtorrent
 			--p.num_blocks;
 			--m_cache_stats.cache_size;
 			--m_cache_stats.read_cache_size;
+			if (p.protect) --m_cache_stats.protected_read_cache_size;
 		}
 		if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
 		return ret;
 	}
 
+	// returns the least recently used piece in either the protected
+	// or the probationary queue of the read cache, skipping the
+	// ignored piece and pinned pieces. Returns end() if there is
+	// no such piece
+	disk_io_thread::cache_lru_index_t::iterator disk_io_thread::oldest_read_piece(
+		bool protect, ignore_t ignore, mutex::scoped_lock& l)
+	{
+		cache_queue_index_t& qidx = m_read_pieces.get<2>();
+		cache_queue_index_t::iterator i = qidx.lower_bound(boost::make_tuple(protect));
+		while (i != qidx.end() && i->protect == protect
+			&& ((i->piece == ignore.piece && i->storage == ignore.storage)
+				|| is_pinned(i->storage.get(), i->piece, l)))
+			++i;
+		if (i == qidx.end() || i->protect != protect)
+			return m_read_pieces.get<1>().end();
+		return m_read_pieces.project<1>(i);
+	}
+
+	// remembers the key of a piece that's being evicted from the
+	// probationary queue. The ghost list holds keys for about half
+	// as many blocks as fit in the cache
+	void disk_io_thread::add_read_ghost(cached_piece_entry const& p
+		, mutex::scoped_lock& l)
+	{
+		ghost_piece_entry e;
+		e.storage = p.storage.get();
+		e.piece = p.piece;
+		e.num_blocks = (p.storage->info()->piece_size(p.piece)
+			+ m_block_size - 1) / m_block_size;
+		if (!m_read_ghosts.push_back(e).second) return;
+		m_ghost_blocks += e.num_blocks;
+
+		while (m_ghost_blocks > m_settings.cache_size / 2
+			&& !m_read_ghosts.empty())
+		{
+			m_ghost_blocks -= m_read_ghosts.front().num_blocks;
+			m_read_ghosts.pop_front();
+		}
+	}
+
+	// returns true if the piece was in the ghost list, i.e. it
+	// was evicted recently. The entry is removed
+	bool disk_io_thread::hit_read_ghost(void* storage, int piece
+		, mutex::scoped_lock& l)
+	{
+		ghost_piece_index_t& idx = m_read_ghosts.get<1>();
+		ghost_piece_index_t::iterator i = idx.find(std::pair<void*, int>(storage, piece));
+		if (i == idx.end()) return false;
+		m_ghost_blocks -= i->num_blocks;
+		idx.erase(i);
+		++m_cache_stats.ghost_hits;
+		return true;
+	}
+
+	void disk_io_thread::clear_read_ghosts(void* storage, mutex::scoped_lock& l)
+	{
+		ghost_piece_index_t& idx = m_read_ghosts.get<1>();
+		ghost_piece_index_t::iterator start = idx.lower_bound(std::pair<void*, int>(storage, 0));
+		ghost_piece_index_t::iterator end = idx.upper_bound(std::pair<void*, int>(storage, INT_MAX));
+		for (ghost_piece_index_t::iterator i = start; i != end; ++i)
+			m_ghost_blocks -= i->num_blocks;
+		idx.erase(start, end);
+	}
+
+	// returns true if the piece is ahead of a read cursor, and
+	// must not be evicted from the read cache
+	bool disk_io_thread::is_pinned(void* storage, int piece
+		, mutex::scoped_lock& l) const
+	{
+		for (std::vector<read_cursor>::const_iterator i = m_read_cursors.begin()
+			, end(m_read_cursors.end()); i != end; ++i)
+		{
+			if (i->storage == storage
+				&& piece >= i->piece
+				&& piece < i->piece + i->num_pieces)
+				return true;
+		}
+		return false;
+	}
+
+	// moves (or adds or removes) a read cursor and queues up
+	// large sequential reads of the pieces ahead of it that aren't
+	// fully in the read cache yet
+	void disk_io_thread::update_read_cursor(disk_io_job const& j)
+	{
+		mutex::scoped_lock l(m_piece_mutex);
+
+		std::vector<read_cursor>::iterator c = m_read_cursors.begin();
+		for (; c != m_read_cursors.end(); ++c)
+			if (c->storage == j.storage.get() && c->cursor == j.offset) break;
+
+		if (j.max_cache_line <= 0 || j.piece < 0
+			|| j.piece >= j.storage->info()->num_pieces())
+		{
+			if (c != m_read_cursors.end()) m_read_cursors.erase(c);
+			return;
+		}
+
+		if (c == m_read_cursors.end())
+		{
+			read_cursor rc;
+			rc.storage = j.storage.get();
+			rc.cursor = j.offset;
+			rc.piece = j.piece;
+			rc.num_pieces = 0;
+			rc.queued_end = j.piece;
+			m_read_cursors.push_back(rc);
+			c = m_read_cursors.end() - 1;
+		}
+
+		torrent_info const& ti = *j.storage->info();
+
+		// don't let the cursors pin more than half of the cache
+		int blocks_per_piece = (ti.piece_length() + m_block_size - 1) / m_block_size;
+		int max_pieces = m_settings.cache_size / 2 / blocks_per_piece
+			/ int(m_read_cursors.size());
+		// if the cursor jumped (backwards, or past what was queued
+		// before) the pieces in the new window were not posted yet
+		if (j.piece < c->piece || j.piece > c->queued_end)
+			c->queued_end = j.piece;
+		c->piece = j.piece;
+		c->num_pieces = (std::min)(j.max_cache_line, (std::max)(max_pieces, 1));
+		if (c->piece + c->num_pieces > ti.num_pieces())
+			c->num_pieces = ti.num_pieces() - c->piece;
+
+		// only the part of the window that wasn't queued by a previous
+		// call. A reader issuing many small reads would otherwise post
+		// the same prefetches over and over. If the window shrunk, the
+		// pieces past its end aren't pinned anymore, and are posted
+		// again when it grows back
+		int const end = c->piece + c->num_pieces;
+		int const first = (std::max)(c->piece, (std::min)(c->queued_end, end));
+		c->queued_end = end;
+
+		std::vector<int> pieces;
+		cache_piece_index_t& idx = m_read_pieces.get<0>();
+		for (int i = first; i < end; ++i)
+		{
+			cache_piece_index_t::iterator p = idx.find(std::pair<void*, int>(j.storage.get(), i));
+			int blocks_in_piece = (ti.piece_size(i) + m_block_size - 1) / m_block_size;
+			if (p != idx.end() && p->num_blocks == blocks_in_piece) continue;
+			pieces.push_back(i);
+		}
+		l.unlock();
+
+		if (pieces.empty()) return;
+
+		// let the OS start reading the whole range, while the
+		// pieces are read into the cache one at a time
+		for (std::vector<int>::iterator i = pieces.begin()
+			, end(pieces.end()); i != end; ++i)
+			j.storage->hint_read_impl(*i, 0, ti.piece_size(*i));
+
+		if (!m_settings.use_read_cache) return;
+
+		mutex::scoped_lock jl(m_queue_mutex);
+		if (m_abort) return;
+		for (std::vector<int>::iterator i = pieces.begin()
+			, end(pieces.end()); i != end; ++i)
+		{
+			disk_io_job cj;
+			cj.storage = j.storage;
+			cj.action = disk_io_job::cache_piece;
+			cj.piece = *i;
+			cj.cache_min_time = j.cache_min_time;
+			add_job(cj, jl);
+		}
+	}
+
 	// returns the number of blocks that were freed
 	int disk_io_thread::clear_oldest_read_piece(
 		int num_blocks, ignore_t ignore, mutex::scoped_lock& l)
@@ -346,9 +531,27 @@ namespace libtorrent
 		if (idx.empty()) return 0;
 
 		cache_lru_index_t::iterator i = idx.begin();
-		if (i->piece == ignore.piece && i->storage == ignore.storage)
+		bool const use_2q = m_settings.read_cache_algorithm
+			== session_settings::read_cache_2q;
+		if (use_2q)
 		{
-			++i;
+			// evict from the probationary queue (pieces only referenced
+			// once) as long as it holds more than a quarter of the read
+			// cache. This keeps a sequential scan from flushing pieces
+			// that are referenced repeatedly
+			int probation_blocks = m_cache_stats.read_cache_size
+				- m_cache_stats.protected_read_cache_size;
+			bool evict_protected = probation_blocks * 4 <= m_cache_stats.read_cache_size;
+			i = oldest_read_piece(evict_protected, ignore, l);
+			if (i == idx.end()) i = oldest_read_piece(!evict_protected, ignore, l);
+			if (i == idx.end()) return 0;
+		}
+		else
+		{
+			while (i != idx.end()
+				&& ((i->piece == ignore.piece && i->storage == ignore.storage)
+					|| is_pinned(i->storage.get(), i->piece, l)))
+				++i;
 			if (i == idx.end()) return 0;
 		}
 
@@ -385,6 +588,7 @@ namespace libtorrent
 					--const_cast<cached_piece_entry&>(*i).num_blocks;
 					--m_cache_stats.cache_size;
 					--m_cache_stats.read_cache_size;
+					if (i->protect) --m_cache_stats.protected_read_cache_size;
 					--num_blocks;
 					if (!num_blocks) break;
 				}
@@ -397,10 +601,15 @@ namespace libtorrent
 				--const_cast<cached_piece_entry&>(*i).num_blocks;
 				--m_cache_stats.cache_size;
 				--m_cache_stats.read_cache_size;
+				if (i->protect) --m_cache_stats.protected_read_cache_size;
 				--num_blocks;
 			}
 		}
-		if (i->num_blocks == 0) idx.erase(i);
+		if (i->num_blocks == 0)
+		{
+			if (use_2q && !i->protect) add_read_ghost(*i, l);
+			idx.erase(i);
+		}
 
 		if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
 		return blocks;
@@ -501,16 +710,21 @@ namespace libtorrent
 
 		if (m_settings.disk_cache_algorithm == session_settings::lru)
 		{
+			// pick the least recently used pieces, and write them in
+			// the order they are laid out on disk
 			cache_lru_index_t& idx = m_pieces.get<1>();
-			while (blocks > 0)
+			std::vector<cache_piece_index_t::iterator> pieces;
+			int num_blocks = 0;
+			for (cache_lru_index_t::iterator i = idx.begin();
+				i != idx.end() && num_blocks < blocks; ++i)
 			{
-				cache_lru_index_t::iterator i = idx.begin();
-				if (i == idx.end()) return ret;
-				tmp = flush_range(const_cast<cached_piece_entry&>(*i), 0, INT_MAX, l);
-				idx.erase(i);
-				blocks -= tmp;
-				ret += tmp;
+				pieces.push_back(m_pieces.project<0>(i));
+				num_blocks += i->num_blocks;
 			}
+			ret += flush_pieces(pieces, l);
+			for (std::vector<cache_piece_index_t::iterator>::iterator i = pieces.begin()
+				, end(pieces.end()); i != end; ++i)
+				m_pieces.erase(*i);
 		}
 		else if (m_settings.disk_cache_algorithm == session_settings::largest_contiguous)
 		{
@@ -534,9 +748,10 @@ namespace libtorrent
 				cache_lru_index_t::iterator piece = i;
 				++i;
 
-				if (!piece->blocks[p.next_block_to_hash].buf) continue;
 				int piece_size = p.storage->info()->piece_size(p.piece);
 				int blocks_in_piece = (piece_size + m_block_size - 1) / m_block_size;
+				if (p.next_block_to_hash >= blocks_in_piece
+					|| !piece->blocks[p.next_block_to_hash].buf) continue;
 				int start = p.next_block_to_hash;
 				int end = start + 1;
 				while (end < blocks_in_piece && p.blocks[end].buf) ++end;
@@ -581,112 +796,262 @@ namespace libtorrent
 		TORRENT_ASSERT(piece_size > 0);
 		
 		int blocks_in_piece = (piece_size + m_block_size - 1) / m_block_size;
-		int buffer_size = 0;
-		int offset = 0;
-
-		boost::scoped_array<char> buf;
-		file::iovec_t* iov = 0;
-		int iov_counter = 0;
-		if (m_settings.coalesce_writes) buf.reset(new (std::nothrow) char[piece_size]);
-		else iov = TORRENT_ALLOCA(file::iovec_t, blocks_in_piece);
-
 		end = (std::min)(end, blocks_in_piece);
+
+		int ret = 0;
 		int num_write_calls = 0;
 		ptime write_start = time_now_hires();
-		for (int i = start; i <= end; ++i)
+		for (int i = start; i < end;)
 		{
-			if (i == end || p.blocks[i].buf == 0)
+			if (p.blocks[i].buf == 0)
 			{
-				if (buffer_size == 0) continue;
-			
-				TORRENT_ASSERT(buffer_size <= i * m_block_size);
-				l.unlock();
-				if (iov)
-				{
-					int ret = p.storage->write_impl(iov, p.piece, (std::min)(
-						i * m_block_size, piece_size) - buffer_size, iov_counter);
-					iov_counter = 0;
-					if (ret > 0) ++num_write_calls;
-				}
-				else
-				{
-					TORRENT_ASSERT(buf);
-					file::iovec_t b = { buf.get(), buffer_size };
-					int ret = p.storage->write_impl(&b, p.piece, (std::min)(
-						i * m_block_size, piece_size) - buffer_size, 1);
-					if (ret > 0) ++num_write_calls;
-				}
-				l.lock();
-				++m_cache_stats.writes;
-//				std::cerr << " flushing p: " << p.piece << " bytes: " << buffer_size << std::endl;
-				buffer_size = 0;
-				offset = 0;
+				++i;
 				continue;
 			}
-			int block_size = (std::min)(piece_size - i * m_block_size, m_block_size);
-			TORRENT_ASSERT(offset + block_size <= piece_size);
-			TORRENT_ASSERT(offset + block_size > 0);
-			if (iov)
+			int run_end = i + 1;
+			while (run_end < end && p.blocks[run_end].buf) ++run_end;
+			ret += flush_extent(p, i, run_end, num_write_calls, l);
+			i = run_end;
+		}
+
+		ptime done = time_now_hires();
+
+		if (num_write_calls > 0)
+		{
+			m_write_time.add_sample(total_microseconds(done - write_start) / num_write_calls);
+			m_cache_stats.cumulative_write_time += total_milliseconds(done - write_start);
+		}
+
+//		std::cerr << " flushing p: " << p.piece << " cached_blocks: " << m_cache_stats.cache_size << std::endl;
+#ifdef TORRENT_DEBUG
+		for (int i = start; i < end; ++i)
+			TORRENT_ASSERT(p.blocks[i].buf == 0);
+#endif
+		return ret;
+	}
+
+	// rounds a buffer size up to a multiple of the page size
+	static int round_to_page(int size)
+	{
+		int page = page_size();
+		return (size + page - 1) & ~(page - 1);
+	}
+
+	// the most blocks that are merged into a single write
+	enum { max_flush_extent = 512 };
+
+	// a range of blocks of one piece, that's part of a write
+	// spanning several pieces
+	struct flush_segment
+	{
+		disk_io_thread::cached_piece_entry* p;
+		int start;
+		int end;
+	};
+
+	int disk_io_thread::flush_extent(cached_piece_entry& p
+		, int start, int end, int& num_write_calls, mutex::scoped_lock& l)
+	{
+		TORRENT_ASSERT(start < end);
+
+		torrent_info const& ti = *p.storage->info();
+		int piece_length = ti.piece_length();
+		int full_piece_blocks = (piece_length + m_block_size - 1) / m_block_size;
+		std::vector<flush_segment> extent;
+		flush_segment s = { &p, start, end };
+		extent.push_back(s);
+		int num_blocks = end - start;
+
+		// blocks are only merged across pieces when every block is
+		// within a single piece
+		bool merge = (piece_length % m_block_size) == 0;
+		cache_piece_index_t& idx = m_pieces.get<0>();
+
+		// extend the extent backwards with the tail of the previous piece,
+		// but only if it runs unbroken from the next block to hash to the
+		// end of the piece. That way its partial hash picks up where it
+		// left off and the piece won't have to be read back
+		while (merge && extent.front().start == 0 && extent.front().p->piece > 0)
+		{
+			cache_piece_index_t::iterator i = idx.find(std::pair<void*, int>(
+				p.storage.get(), extent.front().p->piece - 1));
+			if (i == idx.end()) break;
+			cached_piece_entry& prev = const_cast<cached_piece_entry&>(*i);
+			int first = full_piece_blocks;
+			while (first > prev.next_block_to_hash && prev.blocks[first - 1].buf) --first;
+			if (first == full_piece_blocks || first != prev.next_block_to_hash) break;
+			if (num_blocks + full_piece_blocks - first > max_flush_extent) break;
+			flush_segment s = { &prev, first, full_piece_blocks };
+			extent.insert(extent.begin(), s);
+			num_blocks += full_piece_blocks - first;
+		}
+
+		// and forward with the leading blocks of the next piece, as long
+		// as none of the next piece has been written yet
+		while (merge && extent.back().p->piece + 1 < ti.num_pieces()
+			&& num_blocks < max_flush_extent)
+		{
+			cached_piece_entry& last = *extent.back().p;
+			if (extent.back().end < (ti.piece_size(last.piece) + m_block_size - 1) / m_block_size)
+				break;
+			cache_piece_index_t::iterator i = idx.find(std::pair<void*, int>(
+				p.storage.get(), last.piece + 1));
+			if (i == idx.end()) break;
+			cached_piece_entry& next = const_cast<cached_piece_entry&>(*i);
+			if (next.next_block_to_hash != 0) break;
+			int next_blocks = (ti.piece_size(next.piece) + m_block_size - 1) / m_block_size;
+			int n = 0;
+			while (n < next_blocks && next.blocks[n].buf
+				&& num_blocks + n < max_flush_extent) ++n;
+			if (n == 0) break;
+			flush_segment s = { &next, 0, n };
+			extent.push_back(s);
+			num_blocks += n;
+		}
+
+		file::iovec_t* iov = TORRENT_ALLOCA(file::iovec_t, num_blocks);
+		int iov_counter = 0;
+		int buffer_size = 0;
+		for (std::vector<flush_segment>::iterator k = extent.begin(); k != extent.end(); ++k)
+		{
+			cached_piece_entry& e = *k->p;
+			int piece_size = ti.piece_size(e.piece);
+			for (int i = k->start; i < k->end; ++i)
 			{
-				TORRENT_ASSERT(!buf);
-				iov[iov_counter].iov_base = p.blocks[i].buf;
+				TORRENT_ASSERT(e.blocks[i].buf);
+				int block_size = (std::min)(piece_size - i * m_block_size, m_block_size);
+				TORRENT_ASSERT(block_size > 0);
+				iov[iov_counter].iov_base = e.blocks[i].buf;
 				iov[iov_counter].iov_len = block_size;
 				++iov_counter;
+				buffer_size += block_size;
+				TORRENT_ASSERT(e.num_blocks > 0);
+				--e.num_blocks;
+				++m_cache_stats.blocks_written;
+				--m_cache_stats.cache_size;
+				if (i == e.next_block_to_hash) ++e.next_block_to_hash;
 			}
-			else
+		}
+		TORRENT_ASSERT(iov_counter == num_blocks);
+
+		// if writes are coalesced, copy each piece's part of the extent
+		// into one contiguous buffer. The buffer still needs one iovec per
+		// piece, for the partial hashes to be updated per piece. It's page
+		// aligned and padded to whole pages, for files opened without the
+		// OS cache to write the unaligned tail of a file straight from it
+		aligned_holder buf;
+		if (m_settings.coalesce_writes)
+			buf.reset(page_aligned_allocator::malloc(round_to_page(buffer_size)));
+		if (buf.get())
+		{
+			int offset = 0;
+			int b = 0;
+			for (int k = 0; k < int(extent.size()); ++k)
 			{
-				TORRENT_ASSERT(buf);
-				TORRENT_ASSERT(iov == 0);
-				std::memcpy(buf.get() + offset, p.blocks[i].buf, block_size);
-				offset += m_block_size;
+				file::iovec_t piece_buf = { buf.get() + offset, 0 };
+				for (int i = extent[k].start; i < extent[k].end; ++i, ++b)
+				{
+					std::memcpy(buf.get() + offset, iov[b].iov_base, iov[b].iov_len);
+					offset += iov[b].iov_len;
+					piece_buf.iov_len += iov[b].iov_len;
+				}
+				iov[k] = piece_buf;
 			}
-			buffer_size += block_size;
-			TORRENT_ASSERT(p.num_blocks > 0);
-			--p.num_blocks;
-			++m_cache_stats.blocks_written;
-			--m_cache_stats.cache_size;
-			if (i == p.next_block_to_hash) ++p.next_block_to_hash;
+			iov_counter = extent.size();
 		}
 
-		ptime done = time_now_hires();
+		boost::intrusive_ptr<piece_manager> storage = p.storage;
+		int first_piece = extent.front().p->piece;
+		int first_offset = extent.front().start * m_block_size;
+		l.unlock();
+		int written = storage->write_range_impl(iov, first_piece, first_offset, iov_counter);
+		if (written > 0) ++num_write_calls;
+		l.lock();
+		++m_cache_stats.writes;
+//		std::cerr << " flushing p: " << first_piece << " bytes: " << buffer_size << std::endl;
 
 		int ret = 0;
 		disk_io_job j;
-		j.storage = p.storage;
+		j.storage = storage;
 		j.action = disk_io_job::write;
 		j.buffer = 0;
-		j.piece = p.piece;
 		test_error(j);
 		std::vector<char*> buffers;
-		for (int i = start; i < end; ++i)
+		for (std::vector<flush_segment>::iterator k = extent.begin(); k != extent.end(); ++k)
 		{
-			if (p.blocks[i].buf == 0) continue;
-			j.buffer_size = (std::min)(piece_size - i * m_block_size, m_block_size);
-			int result = j.error ? -1 : j.buffer_size;
-			j.offset = i * m_block_size;
-			j.callback = p.blocks[i].callback;
-			buffers.push_back(p.blocks[i].buf);
-			post_callback(j, result);
-			p.blocks[i].callback.clear();
-			p.blocks[i].buf = 0;
-			++ret;
+			cached_piece_entry& e = *k->p;
+			int piece_size = ti.piece_size(e.piece);
+			j.piece = e.piece;
+			for (int i = k->start; i < k->end; ++i)
+			{
+				TORRENT_ASSERT(e.blocks[i].buf);
+				j.buffer_size = (std::min)(piece_size - i * m_block_size, m_block_size);
+				int result = j.error ? -1 : j.buffer_size;
+				j.offset = i * m_block_size;
+				j.callback = e.blocks[i].callback;
+				buffers.push_back(e.blocks[i].buf);
+				post_callback(j, result);
+				e.blocks[i].callback.clear();
+				e.blocks[i].buf = 0;
+				++ret;
+			}
+			e.num_contiguous_blocks = contiguous_blocks(e);
 		}
 		if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
+		return ret;
+	}
 
-		if (num_write_calls > 0)
+	struct disk_order_entry
+	{
+		void* storage;
+		size_type offset;
+		int piece;
+		int index;
+
+		bool operator<(disk_order_entry const& rhs) const
 		{
-			m_write_time.add_sample(total_microseconds(done - write_start) / num_write_calls);
-			m_cache_stats.cumulative_write_time += total_milliseconds(done - write_start);
+			if (storage != rhs.storage) return storage < rhs.storage;
+			if (offset != rhs.offset) return offset < rhs.offset;
+			return piece < rhs.piece;
 		}
-		if (ret > 0)
-			p.num_contiguous_blocks = contiguous_blocks(p);
+	};
 
-		TORRENT_ASSERT(buffer_size == 0);
-//		std::cerr << " flushing p: " << p.piece << " cached_blocks: " << m_cache_stats.cache_size << std::endl;
-#ifdef TORRENT_DEBUG
-		for (int i = start; i < end; ++i)
-			TORRENT_ASSERT(p.blocks[i].buf == 0);
-#endif
+	int disk_io_thread::flush_pieces(std::vector<cache_piece_index_t::iterator> const& pieces
+		, mutex::scoped_lock& l)
+	{
+		if (pieces.empty()) return 0;
+
+		std::vector<boost::intrusive_ptr<piece_manager> > storages;
+		std::vector<disk_order_entry> order;
+		storages.reserve(pieces.size());
+		order.reserve(pieces.size());
+		for (int i = 0; i < int(pieces.size()); ++i)
+		{
+			storages.push_back(pieces[i]->storage);
+			disk_order_entry e = { pieces[i]->storage.get(), 0, pieces[i]->piece, i };
+			order.push_back(e);
+		}
+
+		// looking up the physical offset may open files, don't
+		// hold the cache lock while doing it
+		l.unlock();
+		for (int i = 0; i < int(order.size()); ++i)
+			order[i].offset = storages[i]->physical_offset(order[i].piece, 0);
+		l.lock();
+
+		std::sort(order.begin(), order.end());
+
+		// the runs that continue into the following pieces are merged
+		// into single writes, which leaves those pieces empty by the
+		// time they come up here
+		int ret = 0;
+		for (std::vector<disk_order_entry>::iterator i = order.begin()
+			, end(order.end()); i != end; ++i)
+		{
+			cached_piece_entry& p = const_cast<cached_piece_entry&>(*pieces[i->index]);
+			if (p.num_blocks == 0) continue;
+			ret += flush_range(p, 0, INT_MAX, l);
+		}
 		return ret;
 	}
 
@@ -718,6 +1083,7 @@ namespace libtorrent
 		p.num_blocks = 1;
 		p.num_contiguous_blocks = 1;
 		p.next_block_to_hash = 0;
+		p.protect = false;
 		p.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
 		if (!p.blocks) return -1;
 		int block = j.offset / m_block_size;
@@ -750,7 +1116,7 @@ namespace libtorrent
 
 		int ret = 0;
 
-		boost::scoped_array<char> buf;
+		aligned_holder buf;
 		for (int i = start_block; i < blocks_in_piece
 			&& ((options & ignore_cache_size)
 				|| in_use() < m_settings.cache_size); ++i)
@@ -766,6 +1132,7 @@ namespace libtorrent
 				--p.num_blocks;
 				--m_cache_stats.cache_size;
 				--m_cache_stats.read_cache_size;
+				if (p.protect) --m_cache_stats.protected_read_cache_size;
 			}
 			p.blocks[i].buf = allocate_buffer("read cache");
 
@@ -778,6 +1145,7 @@ namespace libtorrent
 			++p.num_blocks;
 			++m_cache_stats.cache_size;
 			++m_cache_stats.read_cache_size;
+			if (p.protect) ++m_cache_stats.protected_read_cache_size;
 			++end_block;
 			++num_read;
 			iov[iov_counter].iov_base = p.blocks[i].buf;
@@ -805,10 +1173,12 @@ namespace libtorrent
 		TORRENT_ASSERT(buffer_size <= piece_size);
 		TORRENT_ASSERT(buffer_size + start_block * m_block_size <= piece_size);
 
+		// the buffer is page aligned and padded to whole pages, for
+		// files opened without the OS cache to be read straight into it
 		if (m_settings.coalesce_reads)
-			buf.reset(new (std::nothrow) char[buffer_size]);
+			buf.reset(page_aligned_allocator::malloc(round_to_page(buffer_size)));
 
-		if (buf)
+		if (buf.get())
 		{
 			l.unlock();
 			file::iovec_t b = { buf.get(), buffer_size };
@@ -883,11 +1253,24 @@ namespace libtorrent
 		int blocks_in_piece = (piece_size + m_block_size - 1) / m_block_size;
 
 		int start_block = j.offset / m_block_size;
+		int cache_space = (std::max)((m_settings.cache_size
+			+ m_cache_stats.read_cache_size - in_use())/2, 3);
+		int cache_line = m_settings.read_cache_line_size;
+
+		// when reads bypass the OS cache, nothing below us reads ahead
+		// or keeps what we read. Read the whole piece as one aligned
+		// extent, as long as it fits, to serve the requests that follow
+		// from the cache
+		if (m_settings.disk_io_read_mode != session_settings::enable_os_cache
+			&& j.max_cache_line == 0 && cache_space >= blocks_in_piece)
+		{
+			start_block = 0;
+			cache_line = blocks_in_piece;
+		}
 
 		int blocks_to_read = blocks_in_piece - start_block;
-		blocks_to_read = (std::min)(blocks_to_read, (std::max)((m_settings.cache_size
-			+ m_cache_stats.read_cache_size - in_use())/2, 3));
-		blocks_to_read = (std::min)(blocks_to_read, m_settings.read_cache_line_size);
+		blocks_to_read = (std::min)(blocks_to_read, cache_space);
+		blocks_to_read = (std::min)(blocks_to_read, cache_line);
 		if (j.max_cache_line > 0) blocks_to_read = (std::min)(blocks_to_read, j.max_cache_line);
 
 		if (in_use() + blocks_to_read > m_settings.cache_size)
@@ -905,6 +1288,8 @@ namespace libtorrent
 		p.num_blocks = 0;
 		p.num_contiguous_blocks = 0;
 		p.next_block_to_hash = 0;
+		p.protect = m_settings.read_cache_algorithm == session_settings::read_cache_2q
+			&& hit_read_ghost(j.storage.get(), j.piece, l);
 		p.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
 		if (!p.blocks) return -1;
 
@@ -947,6 +1332,7 @@ namespace libtorrent
 		}
 	
 		int cached_read_blocks = 0;
+		int protected_read_blocks = 0;
 		for (cache_t::const_iterator i = m_read_pieces.begin()
 			, end(m_read_pieces.end()); i != end; ++i)
 		{
@@ -968,9 +1354,11 @@ namespace libtorrent
 			}
 //			TORRENT_ASSERT(blocks == p.num_blocks);
 			cached_read_blocks += blocks;
+			if (p.protect) protected_read_blocks += blocks;
 		}
 
 		TORRENT_ASSERT(cached_read_blocks == m_cache_stats.read_cache_size);
+		TORRENT_ASSERT(protected_read_blocks == m_cache_stats.protected_read_cache_size);
 		TORRENT_ASSERT(cached_read_blocks + cached_write_blocks == m_cache_stats.cache_size);
 
 #ifdef TORRENT_DISK_STATS
@@ -1029,6 +1417,8 @@ namespace libtorrent
 			pe.num_blocks = 0;
 			pe.num_contiguous_blocks = 0;
 			pe.next_block_to_hash = 0;
+			pe.protect = m_settings.read_cache_algorithm == session_settings::read_cache_2q
+				&& hit_read_ghost(j.storage.get(), j.piece, l);
 			pe.blocks.reset(new (std::nothrow) cached_block_entry[blocks_in_piece]);
 			if (!pe.blocks) return -1;
 			ret = read_into_piece(pe, 0, options, INT_MAX, l);
@@ -1180,7 +1570,8 @@ namespace libtorrent
 			int blocks_to_read = end_block - block;
 			blocks_to_read = (std::min)(blocks_to_read, (std::max)((m_settings.cache_size
 				+ m_cache_stats.read_cache_size - in_use())/2, 3));
-			blocks_to_read = (std::min)(blocks_to_read, m_settings.read_cache_line_size);
+			if (m_settings.disk_io_read_mode == session_settings::enable_os_cache)
+				blocks_to_read = (std::min)(blocks_to_read, m_settings.read_cache_line_size);
 			blocks_to_read = (std::max)(blocks_to_read, min_blocks_to_read);
 			if (j.max_cache_line > 0) blocks_to_read = (std::min)(blocks_to_read, j.max_cache_line);
 			
@@ -1228,6 +1619,7 @@ namespace libtorrent
 					--p.num_blocks;
 					--m_cache_stats.cache_size;
 					--m_cache_stats.read_cache_size;
+					if (p.protect) --m_cache_stats.protected_read_cache_size;
 				}
 			}
 			++block;
@@ -1420,6 +1812,8 @@ namespace libtorrent
 		, cancel_on_abort // update_settings
 		, read_operation + cancel_on_abort // read_and_hash
 		, read_operation + cancel_on_abort // cache_piece
+		, 0 // update_read_cursor
+		, 0 // file_priority
 #ifndef TORRENT_NO_DEPRECATE
 		, 0 // finalize_file
 #endif
@@ -1554,6 +1948,8 @@ namespace libtorrent
 
 				m_pieces.clear();
 				m_read_pieces.clear();
+				m_read_ghosts.clear();
+				m_read_cursors.clear();
 				// release the io_service to allow the run() call to return
 				// we do this once we stop posting new callbacks to it.
 				m_work.reset();
@@ -1779,6 +2175,7 @@ namespace libtorrent
 					delete s;
 
 					m_file_pool.resize(m_settings.file_pool_size);
+					m_hash_pool.set_num_threads(m_settings.hashing_threads);
 #if defined __APPLE__ && defined __MACH__ && MAC_OS_X_VERSION_MIN_REQUIRED >= 1050
 					setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD
 						, m_settings.low_prio_disk ? IOPOL_THROTTLE : IOPOL_DEFAULT);
@@ -1859,6 +2256,13 @@ namespace libtorrent
 							++i;
 						}
 					}
+					clear_read_ghosts(j.storage.get(), l);
+					for (std::vector<read_cursor>::iterator i = m_read_cursors.begin();
+						i != m_read_cursors.end();)
+					{
+						if (i->storage == j.storage.get()) i = m_read_cursors.erase(i);
+						else ++i;
+					}
 					l.unlock();
 					if (!buffers.empty()) free_multiple_buffers(&buffers[0], buffers.size());
 					release_memory();
@@ -2175,6 +2579,17 @@ namespace libtorrent
 					INVARIANT_CHECK;
 					TORRENT_ASSERT(j.buffer == 0);
 
+					// pieces prefetched for a read cursor may push
+					// other pieces out of the read cache
+					if (is_pinned(j.storage.get(), j.piece, l))
+					{
+						int blocks_in_piece = (j.storage->info()->piece_size(j.piece)
+							+ m_block_size - 1) / m_block_size;
+						if (in_use() + blocks_in_piece > m_settings.cache_size)
+							flush_cache_blocks(l, in_use() + blocks_in_piece - m_settings.cache_size
+								, ignore_t(j.piece, j.storage.get()), dont_flush_write_blocks);
+					}
+
 					cache_piece_index_t::iterator p;
 					bool hit;
 					ret = cache_piece(j, p, hit, 0, l);
@@ -2183,6 +2598,24 @@ namespace libtorrent
 					if (ret < 0) test_error(j);
 					break;
 				}
+				case disk_io_job::update_read_cursor:
+				{
+#ifdef TORRENT_DISK_STATS
+					m_log << log_time() << " read_cursor " << j.piece << std::endl;
+#endif
+					update_read_cursor(j);
+					break;
+				}
+				case disk_io_job::file_priority:
+				{
+#ifdef TORRENT_DISK_STATS
+					m_log << log_time() << " file_priority" << std::endl;
+#endif
+					std::vector<boost::uint8_t> prio(j.str.begin(), j.str.end());
+					ret = j.storage->set_file_priority_impl(prio);
+					if (ret != 0) test_error(j);
+					break;
+				}
 				case disk_io_job::hash:
 				{
 #ifdef TORRENT_DISK_STATS
@@ -2228,6 +2661,7 @@ namespace libtorrent
 
 					ret = (j.storage->info()->hash_for_piece(j.piece) == h)?0:-2;
 					if (ret == -2) j.storage->mark_failed(j.piece);
+					else j.storage->checkpoint_piece(j.piece);
 
 					ptime done = time_now_hires();
 					m_hash_time.add_sample(total_microseconds(done - hash_start));
@@ -2274,7 +2708,7 @@ namespace libtorrent
 					l.unlock();
 					release_memory();
 
-					ret = j.storage->release_files_impl();
+					ret = j.storage->release_files_impl(j.offset);
 					if (ret != 0) test_error(j);
 					break;
 				}
@@ -2301,6 +2735,7 @@ namespace libtorrent
 							++i;
 						}
 					}
+					clear_read_ghosts(j.storage.get(), l);
 					l.unlock();
 					release_memory();
 					ret = 0;
@@ -2356,7 +2791,7 @@ namespace libtorrent
 #endif
 					lazy_entry const* rd = (lazy_entry const*)j.buffer;
 					TORRENT_ASSERT(rd != 0);
-					ret = j.storage->check_fastresume(*rd, j.error);
+					ret = j.storage->check_fastresume(*rd, j.error, j.offset);
 					test_error(j);
 					break;
 				}
@@ -2366,6 +2801,12 @@ namespace libtorrent
 					m_log << log_time() << " check_files" << std::endl;
 #endif
 					int piece_size = j.storage->info()->piece_length();
+
+					// read and hash the pieces for this round up-front,
+					// using all hashing threads
+					if (m_settings.hashing_threads > 1)
+						j.storage->hash_ahead(m_hash_pool, 4 * 1024 * 1024);
+
 					for (int processed = 0; processed < 4 * 1024 * 1024; processed += piece_size)
 					{
 						ptime now = time_now_hires();
@@ -38,12 +38,20 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/file_storage.hpp" // for file_entry
 
+#include <climits>
+
+#if TORRENT_USE_RLIMIT
+#include <sys/resource.h>
+#endif
+
 namespace libtorrent
 {
 	
 	file_pool::file_pool(int size)
-		: m_size(size)
+		: m_size(size == -1 ? default_size() : size)
 		, m_low_prio_io(true)
+		, m_num_open(0)
+		, m_use_counter(0)
 #if TORRENT_CLOSE_MAY_BLOCK
 		, m_stop_thread(false)
 		, m_closer_thread(boost::bind(&file_pool::closer_thread_fun, this))
@@ -168,6 +176,22 @@ namespace libtorrent
 	}
 #endif // TORRENT_WINDOWS
 
+	int file_pool::default_size()
+	{
+#if TORRENT_USE_RLIMIT
+		struct rlimit rl;
+		if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+		{
+			// deduct some margin for epoll/kqueue, log files,
+			// futexes, shared objects etc.
+			int limit = int((std::min)(rlim_t(rl.rlim_cur), rlim_t(INT_MAX)));
+			limit -= 20;
+			return (std::max)(limit * 2 / 10, 4);
+		}
+#endif
+		return 40;
+	}
+
 	boost::intrusive_ptr<file> file_pool::open_file(void* st, std::string const& p
 		, file_storage::iterator fe, file_storage const& fs, int m, error_code& ec)
 	{
@@ -175,12 +199,36 @@ namespace libtorrent
 		TORRENT_ASSERT(is_complete(p));
 		TORRENT_ASSERT((m & file::rw_mask) == file::read_only
 			|| (m & file::rw_mask) == file::read_write);
-		mutex::scoped_lock l(m_mutex);
-		file_set::iterator i = m_files.find(std::make_pair(st, fs.file_index(*fe)));
-		if (i != m_files.end())
+		shard& s = shard_for(st);
+		boost::intrusive_ptr<file> ret;
+		bool added = false;
 		{
-			lru_file_entry& e = i->second;
-			e.last_use = time_now();
+			mutex::scoped_lock l(s.m_mutex);
+			ret = open_file_impl(s, st, p, fe, fs, m, ec, added);
+		}
+
+		// a cache hit doesn't change the number of open files. After a
+		// miss, the least recently used file may be in another shard.
+		// Only one shard is locked at a time, so this is done once the
+		// shard of this storage is unlocked
+		if (added && long(m_num_open) > m_size)
+			while (remove_oldest());
+		return ret;
+	}
+
+	boost::intrusive_ptr<file> file_pool::open_file_impl(shard& s, void* st
+		, std::string const& p, file_storage::iterator fe
+		, file_storage const& fs, int m, error_code& ec, bool& added)
+	{
+		file_index_t& idx = s.files.get<0>();
+		file_index_t::iterator i = idx.find(std::make_pair(st, fs.file_index(*fe)));
+		if (i != idx.end())
+		{
+			lru_file_entry& e = const_cast<lru_file_entry&>(*i);
+
+			// move it to the most recently used end
+			file_lru_t& lru = s.files.get<1>();
+			lru.relocate(lru.end(), s.files.project<1>(i));
 
 			if (e.key != st && ((e.mode & file::rw_mask) != file::read_only
 				|| (m & file::rw_mask) != file::read_only))
@@ -217,7 +265,8 @@ namespace libtorrent
 				std::string full_path = combine_path(p, fs.file_path(*fe));
 				if (!e.file_ptr->open(full_path, m, ec))
 				{
-					m_files.erase(i);
+					idx.erase(i);
+					--m_num_open;
 					return boost::intrusive_ptr<file>();
 				}
 #ifdef TORRENT_WINDOWS
@@ -228,15 +277,15 @@ namespace libtorrent
 				e.mode = m;
 			}
 			TORRENT_ASSERT((e.mode & file::no_buffer) == (m & file::no_buffer));
+			e.last_use = ++m_use_counter;
+			++s.hits;
 			return e.file_ptr;
 		}
-		// the file is not in our cache
-		if ((int)m_files.size() >= m_size)
-		{
-			// the file cache is at its maximum size, close
-			// the least recently used (lru) file from it
-			remove_oldest();
-		}
+		++s.misses;
+
+		// the file is not in our cache. If that makes the pool
+		// exceed its size, open_file() closes the least recently
+		// used file afterwards
 		lru_file_entry e;
 		e.file_ptr.reset(new (std::nothrow)file);
 		if (!e.file_ptr)
@@ -253,56 +302,98 @@ namespace libtorrent
 #endif
 		e.mode = m;
 		e.key = st;
-		m_files.insert(std::make_pair(std::make_pair(st, fs.file_index(*fe)), e));
+		e.index = std::make_pair(st, fs.file_index(*fe));
+		e.last_use = ++m_use_counter;
+		s.files.get<1>().push_back(e);
+		++m_num_open;
+		added = true;
 		TORRENT_ASSERT(e.file_ptr->is_open());
 		return e.file_ptr;
 	}
 
-	void file_pool::remove_oldest()
+	bool file_pool::remove_oldest()
 	{
-		file_set::iterator i = std::min_element(m_files.begin(), m_files.end()
-			, boost::bind(&lru_file_entry::last_use, boost::bind(&file_set::value_type::second, _1))
-				< boost::bind(&lru_file_entry::last_use, boost::bind(&file_set::value_type::second, _2)));
-		if (i == m_files.end()) return;
+		// m_size is only changed with all shards locked, so this
+		// unlocked check is just a hint to avoid locking every shard.
+		// It's repeated below, under the lock of the victim's shard
+		if (long(m_num_open) <= m_size) return false;
+
+		// find the shard whose least recently used file is the oldest
+		int oldest = -1;
+		long oldest_use = 0;
+		for (int i = 0; i < num_shards; ++i)
+		{
+			mutex::scoped_lock l(m_shards[i].m_mutex);
+			file_lru_t& lru = m_shards[i].files.get<1>();
+			if (lru.empty()) continue;
+			if (oldest != -1 && lru.front().last_use >= oldest_use) continue;
+			oldest = i;
+			oldest_use = lru.front().last_use;
+		}
+		if (oldest == -1) return false;
+
+		shard& s = m_shards[oldest];
+		mutex::scoped_lock sl(s.m_mutex);
+		if (long(m_num_open) <= m_size) return false;
+		file_lru_t& lru = s.files.get<1>();
+		// another thread may have closed it in the meantime
+		if (lru.empty()) return true;
 
 #if TORRENT_CLOSE_MAY_BLOCK
 		mutex::scoped_lock l(m_closer_mutex);
-		m_queued_for_close.push_back(i->second.file_ptr);
+		m_queued_for_close.push_back(lru.front().file_ptr);
 		l.unlock();
 #endif
-		m_files.erase(i);
+		lru.pop_front();
+		--m_num_open;
+		++s.evictions;
+		return true;
 	}
 
 	void file_pool::release(void* st, int file_index)
 	{
-		mutex::scoped_lock l(m_mutex);
-		file_set::iterator i = m_files.find(std::make_pair(st, file_index));
-		if (i == m_files.end()) return;
+		shard& s = shard_for(st);
+		mutex::scoped_lock l(s.m_mutex);
+		file_index_t& idx = s.files.get<0>();
+		file_index_t::iterator i = idx.find(std::make_pair(st, file_index));
+		if (i == idx.end()) return;
 		
 #if TORRENT_CLOSE_MAY_BLOCK
 		mutex::scoped_lock l2(m_closer_mutex);
-		m_queued_for_close.push_back(i->second.file_ptr);
+		m_queued_for_close.push_back(i->file_ptr);
 		l2.unlock();
 #endif
-		m_files.erase(i);
+		idx.erase(i);
+		--m_num_open;
 	}
 
 	// closes files belonging to the specified
 	// storage. If 0 is passed, all files are closed
 	void file_pool::release(void* st)
 	{
-		mutex::scoped_lock l(m_mutex);
 		if (st == 0)
 		{
-			m_files.clear();
+			for (int i = 0; i < num_shards; ++i)
+			{
+				mutex::scoped_lock l(m_shards[i].m_mutex);
+				for (int n = int(m_shards[i].files.size()); n > 0; --n)
+					--m_num_open;
+				m_shards[i].files.clear();
+			}
 			return;
 		}
 
-		for (file_set::iterator i = m_files.begin();
-			i != m_files.end();)
+		// all files of a storage are in the same shard
+		shard& s = shard_for(st);
+		mutex::scoped_lock l(s.m_mutex);
+		file_lru_t& lru = s.files.get<1>();
+		for (file_lru_t::iterator i = lru.begin(); i != lru.end();)
 		{
-			if (i->second.key == st)
-				m_files.erase(i++);
+			if (i->key == st)
+			{
+				i = lru.erase(i);
+				--m_num_open;
+			}
 			else
 				++i;
 		}
@@ -310,15 +401,43 @@ namespace libtorrent
 
 	void file_pool::resize(int size)
 	{
+		if (size == -1) size = default_size();
 		TORRENT_ASSERT(size > 0);
 		if (size == m_size) return;
-		mutex::scoped_lock l(m_mutex);
+
+		// lock all shards, always in the same order
+		for (int i = 0; i < num_shards; ++i)
+			m_shards[i].m_mutex.lock();
 		m_size = size;
-		if (int(m_files.size()) <= m_size) return;
+		for (int i = num_shards - 1; i >= 0; --i)
+			m_shards[i].m_mutex.unlock();
+
+		while (remove_oldest());
+	}
 
-		// close the least recently used files
-		while (int(m_files.size()) > m_size)
-			remove_oldest();
+	void file_pool::get_stats(size_type& hits, size_type& misses, size_type& evictions) const
+	{
+		hits = 0;
+		misses = 0;
+		evictions = 0;
+		for (int i = 0; i < num_shards; ++i)
+		{
+			mutex::scoped_lock l(m_shards[i].m_mutex);
+			hits += m_shards[i].hits;
+			misses += m_shards[i].misses;
+			evictions += m_shards[i].evictions;
+		}
+	}
+
+	int file_pool::num_open_files() const
+	{
+		int ret = 0;
+		for (int i = 0; i < num_shards; ++i)
+		{
+			mutex::scoped_lock l(m_shards[i].m_mutex);
+			ret += int(m_shards[i].files.size());
+		}
+		return ret;
 	}
 
 }
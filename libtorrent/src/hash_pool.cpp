@@ -0,0 +1,146 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/hash_pool.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <boost/bind.hpp>
+
+namespace libtorrent
+{
+	hash_pool::hash_pool()
+		: m_jobs(0)
+		, m_num_jobs(0)
+		, m_next_job(0)
+		, m_outstanding(0)
+		, m_abort(false)
+	{}
+
+	hash_pool::~hash_pool()
+	{
+		stop_threads();
+	}
+
+	void hash_pool::set_num_threads(int n)
+	{
+		if (n < 1) n = 1;
+		if (n == num_threads()) return;
+
+		// threads are only resized between calls to hash(), so
+		// there's no outstanding work to worry about
+		stop_threads();
+		for (int i = 1; i < n; ++i)
+		{
+			m_threads.push_back(boost::shared_ptr<thread>(
+				new thread(boost::bind(&hash_pool::thread_fun, this))));
+		}
+	}
+
+	void hash_pool::stop_threads()
+	{
+		mutex::scoped_lock l(m_mutex);
+		m_abort = true;
+		m_work_cond.notify_all();
+		l.unlock();
+
+		for (std::vector<boost::shared_ptr<thread> >::iterator i = m_threads.begin()
+			, end(m_threads.end()); i != end; ++i)
+			(*i)->join();
+		m_threads.clear();
+
+		l.lock();
+		m_abort = false;
+	}
+
+	void hash_pool::run_job(hash_job& j)
+	{
+		hasher h;
+		if (j.small_size > 0 && j.small_size < j.size)
+		{
+			h.update(j.buf, j.small_size);
+			j.small_hash = hasher(h).final();
+			h.update(j.buf + j.small_size, j.size - j.small_size);
+		}
+		else
+		{
+			h.update(j.buf, j.size);
+		}
+		j.hash = h.final();
+	}
+
+	void hash_pool::hash(hash_job* jobs, int num_jobs)
+	{
+		if (num_jobs == 0) return;
+
+		mutex::scoped_lock l(m_mutex);
+		TORRENT_ASSERT(m_outstanding == 0);
+		m_jobs = jobs;
+		m_num_jobs = num_jobs;
+		m_next_job = 0;
+		m_outstanding = num_jobs;
+		if (!m_threads.empty()) m_work_cond.notify_all();
+
+		while (m_next_job < m_num_jobs)
+		{
+			hash_job& j = m_jobs[m_next_job++];
+			l.unlock();
+			run_job(j);
+			l.lock();
+			--m_outstanding;
+		}
+
+		while (m_outstanding > 0) m_done_cond.wait(l);
+
+		m_jobs = 0;
+		m_num_jobs = 0;
+		m_next_job = 0;
+	}
+
+	void hash_pool::thread_fun()
+	{
+		mutex::scoped_lock l(m_mutex);
+		for (;;)
+		{
+			while (!m_abort && m_next_job >= m_num_jobs)
+				m_work_cond.wait(l);
+			if (m_abort) return;
+
+			hash_job& j = m_jobs[m_next_job++];
+			l.unlock();
+			run_job(j);
+			l.lock();
+			if (--m_outstanding == 0) m_done_cond.notify_all();
+		}
+	}
+}
+
@@ -0,0 +1,207 @@
+/*
+
+Copyright (c) 2013, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/network_thread_pool.hpp"
+#include "libtorrent/peer_connection.hpp"
+#include "libtorrent/error_code.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <boost/bind.hpp>
+
+#ifndef TORRENT_WINDOWS
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+namespace libtorrent
+{
+	network_thread_pool::network_thread_pool(io_service& ios)
+		: m_ios(ios)
+		, m_abort(false)
+	{}
+
+	network_thread_pool::~network_thread_pool()
+	{
+		stop_threads();
+	}
+
+	void network_thread_pool::set_num_threads(int n)
+	{
+#ifdef TORRENT_WINDOWS
+		// the writes are made with sendmsg(), all writes on
+		// windows are made by the network thread
+		n = 0;
+#endif
+		if (n < 0) n = 0;
+		if (n == num_threads()) return;
+
+		// the threads complete all queued writes before
+		// they quit, so no job is lost when resizing
+		stop_threads();
+		if (n == 0) return;
+
+		m_work.reset(new io_service::work(m_ios));
+		for (int i = 0; i < n; ++i)
+		{
+			m_threads.push_back(boost::shared_ptr<thread>(
+				new thread(boost::bind(&network_thread_pool::thread_fun, this))));
+		}
+	}
+
+	void network_thread_pool::stop_threads()
+	{
+		mutex::scoped_lock l(m_mutex);
+		m_abort = true;
+		m_work_cond.notify_all();
+		l.unlock();
+
+		for (std::vector<boost::shared_ptr<thread> >::iterator i = m_threads.begin()
+			, end(m_threads.end()); i != end; ++i)
+			(*i)->join();
+		m_threads.clear();
+		m_work.reset();
+
+		l.lock();
+		TORRENT_ASSERT(m_queue.empty());
+		m_abort = false;
+	}
+
+	void network_thread_pool::post_write(boost::intrusive_ptr<peer_connection> const& peer
+		, tcp::socket::native_handle_type s
+		, chained_buffer::buffer_sequence const& vec)
+	{
+		TORRENT_ASSERT(!m_threads.empty());
+
+		mutex::scoped_lock l(m_mutex);
+		m_queue.push_back(write_job());
+		write_job& j = m_queue.back();
+		j.peer = peer;
+		j.socket = s;
+		j.begin = vec.begin();
+		j.end = vec.end();
+		// one job only needs one thread
+		m_work_cond.notify_one();
+	}
+
+	void network_thread_pool::thread_fun()
+	{
+		mutex::scoped_lock l(m_mutex);
+		for (;;)
+		{
+			while (!m_abort && m_queue.empty())
+				m_work_cond.wait(l);
+			if (m_queue.empty()) return;
+
+			write_job j = m_queue.front();
+			m_queue.pop_front();
+			l.unlock();
+			run_job(j);
+			l.lock();
+		}
+	}
+
+	void network_thread_pool::run_job(write_job const& j)
+	{
+		error_code ec;
+		int bytes_transferred = 0;
+		bool would_block = false;
+
+#ifndef TORRENT_WINDOWS
+		// asio makes the socket non-blocking, but don't depend on
+		// that. A pool thread must never block in sendmsg()
+#ifdef MSG_NOSIGNAL
+		int const flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+#else
+		int const flags = MSG_DONTWAIT;
+#endif
+		typedef asio::const_buffer const* iter;
+
+		// the buffer to continue from, and the number of bytes
+		// of it that have been sent already
+		iter i = j.begin;
+		std::size_t offset = 0;
+
+		while (i != j.end)
+		{
+			iovec iov[64];
+			int num_bufs = 0;
+			std::size_t batch_size = 0;
+			std::size_t skip = offset;
+			for (iter k = i; k != j.end && num_bufs < 64; ++k, ++num_bufs)
+			{
+				iov[num_bufs].iov_base = const_cast<char*>(
+					asio::buffer_cast<char const*>(*k)) + skip;
+				iov[num_bufs].iov_len = asio::buffer_size(*k) - skip;
+				batch_size += iov[num_bufs].iov_len;
+				skip = 0;
+			}
+
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = num_bufs;
+			int ret = ::sendmsg(j.socket, &msg, flags);
+			if (ret < 0)
+			{
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK) would_block = true;
+				else ec.assign(errno, get_system_category());
+				break;
+			}
+			bytes_transferred += ret;
+
+			std::size_t left = ret;
+			while (i != j.end && left >= asio::buffer_size(*i) - offset)
+			{
+				left -= asio::buffer_size(*i) - offset;
+				offset = 0;
+				++i;
+			}
+			offset += left;
+
+			// a short write means the socket's send buffer is full
+			if (std::size_t(ret) < batch_size)
+			{
+				would_block = true;
+				break;
+			}
+		}
+#endif
+
+		m_ios.post(boost::bind(&peer_connection::on_pool_write, j.peer
+			, ec, bytes_transferred, would_block));
+	}
+}
+
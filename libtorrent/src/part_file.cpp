@@ -0,0 +1,355 @@
+/*
+
+Copyright (c) 2008-2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include "libtorrent/pch.hpp"
+
+#include "libtorrent/part_file.hpp"
+#include "libtorrent/io.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <boost/scoped_array.hpp>
+#include <cstring>
+
+namespace libtorrent
+{
+	namespace
+	{
+		char const part_file_magic[] = "LTPF";
+		enum
+		{
+			part_file_version = 1,
+			// magic, version, num pieces, piece size
+			fixed_header_size = 4 + 4 + 4 + 4
+		};
+
+		boost::uint32_t const no_slot = 0xffffffff;
+
+#if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
+		int bufs_size(file::iovec_t const* bufs, int num_bufs)
+		{
+			int size = 0;
+			for (file::iovec_t const* i = bufs, *end(bufs + num_bufs); i < end; ++i)
+				size += i->iov_len;
+			return size;
+		}
+#endif
+	}
+
+	part_file::part_file(std::string const& path, std::string const& name
+		, int num_pieces, int piece_size)
+		: m_path(path)
+		, m_name(name)
+		, m_num_pieces(num_pieces)
+		, m_piece_size(piece_size)
+		, m_header_size((fixed_header_size + num_pieces * 4 + 1023) & ~1023)
+		, m_num_slots(0)
+		, m_loaded(false)
+		, m_dirty_metadata(false)
+	{
+		TORRENT_ASSERT(num_pieces >= 0);
+		TORRENT_ASSERT(piece_size > 0);
+	}
+
+	part_file::~part_file()
+	{
+		error_code ec;
+		mutex::scoped_lock l(m_mutex);
+		flush_metadata_impl(ec, l);
+	}
+
+	void part_file::load_index(mutex::scoped_lock& l)
+	{
+		if (m_loaded) return;
+		m_loaded = true;
+		m_piece_to_slot.assign(m_num_pieces, -1);
+		m_free_slots.clear();
+		m_num_slots = 0;
+
+		error_code ec;
+		file f;
+		if (!f.open(combine_path(m_path, m_name), file::read_only, ec)) return;
+		std::vector<char> buf(m_header_size);
+		file::iovec_t b = { &buf[0], buf.size() };
+		if (f.readv(0, &b, 1, ec) != m_header_size || ec) return;
+
+		char const* ptr = &buf[0];
+		if (std::memcmp(ptr, part_file_magic, 4) != 0) return;
+		ptr += 4;
+		if (detail::read_uint32(ptr) != part_file_version) return;
+		if (int(detail::read_uint32(ptr)) != m_num_pieces) return;
+		if (int(detail::read_uint32(ptr)) != m_piece_size) return;
+
+		std::vector<bool> used;
+		for (int i = 0; i < m_num_pieces; ++i)
+		{
+			boost::uint32_t slot = detail::read_uint32(ptr);
+			if (slot == no_slot) continue;
+			if (slot >= boost::uint32_t(m_num_pieces)
+				|| (slot < used.size() && used[slot]))
+			{
+				// the index is corrupt, don't trust any of it
+				m_piece_to_slot.assign(m_num_pieces, -1);
+				m_num_slots = 0;
+				return;
+			}
+			if (slot >= used.size()) used.resize(slot + 1, false);
+			used[slot] = true;
+			m_piece_to_slot[i] = slot;
+		}
+		m_num_slots = used.size();
+
+		// the slots no piece maps to can be reused
+		for (int i = 0; i < m_num_slots; ++i)
+			if (!used[i]) m_free_slots.push_back(i);
+	}
+
+	void part_file::open_file(int mode, error_code& ec, mutex::scoped_lock& l)
+	{
+		if (m_file.is_open()
+			&& ((m_file.open_mode() & file::rw_mask) == file::read_write
+				|| mode == file::read_only))
+			return;
+
+		m_file.close();
+		std::string fn = combine_path(m_path, m_name);
+		m_file.open(fn, mode, ec);
+		if (mode == file::read_write
+			&& ec == boost::system::errc::no_such_file_or_directory)
+		{
+			// the directory doesn't exist yet
+			ec.clear();
+			create_directories(m_path, ec);
+			if (ec) return;
+			m_file.open(fn, mode, ec);
+		}
+	}
+
+	void part_file::write_index(error_code& ec, mutex::scoped_lock& l)
+	{
+		open_file(file::read_write, ec, l);
+		if (ec) return;
+
+		std::vector<char> buf(m_header_size, 0);
+		char* ptr = &buf[0];
+		std::memcpy(ptr, part_file_magic, 4);
+		ptr += 4;
+		detail::write_uint32(part_file_version, ptr);
+		detail::write_uint32(m_num_pieces, ptr);
+		detail::write_uint32(m_piece_size, ptr);
+		for (int i = 0; i < m_num_pieces; ++i)
+		{
+			int slot = m_piece_to_slot[i];
+			detail::write_uint32(slot == -1 ? no_slot : boost::uint32_t(slot), ptr);
+		}
+
+		file::iovec_t b = { &buf[0], buf.size() };
+		if (m_file.writev(0, &b, 1, ec) != m_header_size && !ec)
+			ec = error_code(boost::system::errc::io_error, get_posix_category());
+		if (!ec) m_dirty_metadata = false;
+	}
+
+	int part_file::writev(file::iovec_t const* bufs, int num_bufs, int piece
+		, int offset, error_code& ec)
+	{
+		TORRENT_ASSERT(piece >= 0 && piece < m_num_pieces);
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(offset + bufs_size(bufs, num_bufs) <= m_piece_size);
+
+		mutex::scoped_lock l(m_mutex);
+		load_index(l);
+
+		int slot = m_piece_to_slot[piece];
+		if (slot == -1)
+		{
+			if (!m_free_slots.empty())
+			{
+				slot = m_free_slots.back();
+				m_free_slots.pop_back();
+			}
+			else
+			{
+				slot = m_num_slots++;
+			}
+			m_piece_to_slot[piece] = slot;
+
+			// the index is written before the data, so that a crash
+			// never leaves a piece behind that can't be found
+			write_index(ec, l);
+			if (ec) return -1;
+		}
+
+		open_file(file::read_write, ec, l);
+		if (ec) return -1;
+		return int(m_file.writev(slot_offset(slot) + offset, bufs, num_bufs, ec));
+	}
+
+	int part_file::readv(file::iovec_t const* bufs, int num_bufs, int piece
+		, int offset, error_code& ec)
+	{
+		TORRENT_ASSERT(piece >= 0 && piece < m_num_pieces);
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(offset + bufs_size(bufs, num_bufs) <= m_piece_size);
+
+		mutex::scoped_lock l(m_mutex);
+		load_index(l);
+
+		int slot = m_piece_to_slot[piece];
+		if (slot == -1)
+		{
+			ec = error_code(boost::system::errc::no_such_file_or_directory
+				, get_posix_category());
+			return -1;
+		}
+
+		open_file(file::read_only, ec, l);
+		if (ec) return -1;
+		return int(m_file.readv(slot_offset(slot) + offset, bufs, num_bufs, ec));
+	}
+
+	bool part_file::has_piece(int piece)
+	{
+		TORRENT_ASSERT(piece >= 0 && piece < m_num_pieces);
+		mutex::scoped_lock l(m_mutex);
+		load_index(l);
+		return m_piece_to_slot[piece] != -1;
+	}
+
+	void part_file::free_piece(int piece)
+	{
+		TORRENT_ASSERT(piece >= 0 && piece < m_num_pieces);
+		mutex::scoped_lock l(m_mutex);
+		load_index(l);
+
+		int slot = m_piece_to_slot[piece];
+		if (slot == -1) return;
+		m_piece_to_slot[piece] = -1;
+		m_free_slots.push_back(slot);
+		m_dirty_metadata = true;
+	}
+
+	void part_file::export_file(file& f, size_type offset, size_type size, error_code& ec)
+	{
+		if (size <= 0) return;
+
+		mutex::scoped_lock l(m_mutex);
+		load_index(l);
+
+		int first_piece = int(offset / m_piece_size);
+		int end_piece = int((offset + size + m_piece_size - 1) / m_piece_size);
+		TORRENT_ASSERT(end_piece <= m_num_pieces);
+
+		boost::scoped_array<char> buf;
+		for (int piece = first_piece; piece < end_piece; ++piece)
+		{
+			int slot = m_piece_to_slot[piece];
+			if (slot == -1) continue;
+
+			// the part of the piece that overlaps the file
+			size_type piece_start = size_type(piece) * m_piece_size;
+			size_type start = (std::max)(piece_start, offset);
+			size_type stop = (std::min)(piece_start + m_piece_size, offset + size);
+
+			if (!buf) buf.reset(new char[m_piece_size]);
+
+			open_file(file::read_only, ec, l);
+			if (ec) return;
+			file::iovec_t b = { buf.get(), size_t(stop - start) };
+			int ret = int(m_file.readv(slot_offset(slot) + start - piece_start, &b, 1, ec));
+			if (ec) return;
+			// the last slot may not have been written all the way
+			if (ret <= 0) continue;
+			b.iov_len = ret;
+			if (f.writev(start - offset, &b, 1, ec) != ret && !ec)
+				ec = error_code(boost::system::errc::io_error, get_posix_category());
+			if (ec) return;
+		}
+	}
+
+	void part_file::move_partfile(std::string const& path, error_code& ec)
+	{
+		mutex::scoped_lock l(m_mutex);
+		flush_metadata_impl(ec, l);
+		if (ec) return;
+
+		std::string old_path = combine_path(m_path, m_name);
+		if (exists(old_path))
+		{
+			create_directories(path, ec);
+			if (ec) return;
+			rename(old_path, combine_path(path, m_name), ec);
+			if (ec) return;
+		}
+		m_path = path;
+	}
+
+	void part_file::flush_metadata(error_code& ec)
+	{
+		mutex::scoped_lock l(m_mutex);
+		flush_metadata_impl(ec, l);
+	}
+
+	void part_file::flush_metadata_impl(error_code& ec, mutex::scoped_lock& l)
+	{
+		if (!m_loaded) return;
+
+		if (int(m_free_slots.size()) == m_num_slots)
+		{
+			// there are no pieces left in the part file, it can go
+			m_file.close();
+			m_free_slots.clear();
+			m_num_slots = 0;
+			m_dirty_metadata = false;
+			std::string fn = combine_path(m_path, m_name);
+			if (exists(fn)) libtorrent::remove(fn, ec);
+			return;
+		}
+
+		if (m_dirty_metadata) write_index(ec, l);
+		m_file.close();
+	}
+
+	void part_file::remove(error_code& ec)
+	{
+		mutex::scoped_lock l(m_mutex);
+		m_file.close();
+		m_piece_to_slot.assign(m_num_pieces, -1);
+		m_free_slots.clear();
+		m_num_slots = 0;
+		m_loaded = true;
+		m_dirty_metadata = false;
+
+		std::string fn = combine_path(m_path, m_name);
+		if (exists(fn)) libtorrent::remove(fn, ec);
+	}
+}
+
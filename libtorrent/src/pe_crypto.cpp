@@ -34,6 +34,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/cstdint.hpp>
 #include <algorithm>
+#include <cstring>
 
 #if defined TORRENT_USE_GCRYPT
 #include <gcrypt.h>
@@ -41,10 +42,16 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <openssl/bn.h>
 #include "libtorrent/random.hpp"
 #elif defined TORRENT_USE_TOMMATH
+#include "libtorrent/random.hpp"
+#ifdef __SIZEOF_INT128__
+// with a 128 bit integer type, the fixed size Montgomery arithmetic
+// below is faster than libtommath's generic code
+#define TORRENT_FIXED_SIZE_DH
+#else
 extern "C" {
 #include "libtorrent/tommath.h"
 }
-#include "libtorrent/random.hpp"
+#endif
 #endif
 
 #include "libtorrent/pe_crypto.hpp"
@@ -65,16 +72,256 @@ namespace libtorrent
 			0xE4, 0x85, 0xB5, 0x76, 0x62, 0x5E, 0x7E, 0xC6, 0xF4, 0x4C, 0x42, 0xE9,
 			0xA6, 0x3A, 0x36, 0x21, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09, 0x05, 0x63
 		};
+
+		// the number of random bytes in our private DH exponent. The MSE
+		// spec requires at least 128 bits, and anything beyond 180 bits
+		// isn't believed to add any security. Keeping it short makes the
+		// modular exponentiations several times cheaper than using all
+		// 768 bits
+		const int dh_secret_bytes = 20;
+
+#ifdef TORRENT_FIXED_SIZE_DH
+		// modular arithmetic on fixed size numbers in Montgomery form.
+		// Numbers are arrays of num_limbs words of type Limb, least
+		// significant word first. DLimb must be twice as wide as Limb.
+		// Since the size is known at compile time, all the loops have
+		// fixed trip counts and nothing is allocated
+		template <int Bits, typename Limb, typename DLimb>
+		struct montgomery
+		{
+			typedef Limb limb_t;
+			typedef DLimb dlimb_t;
+			enum
+			{
+				limb_bits = sizeof(limb_t) * 8,
+				num_limbs = Bits / limb_bits,
+				num_bytes = Bits / 8
+			};
+
+			// m is the modulus as a big endian number of num_bytes
+			// bytes. It must be odd
+			explicit montgomery(unsigned char const* m)
+			{
+				from_bytes(m, m_mod);
+				TORRENT_ASSERT(m_mod[0] & 1);
+
+				// Newton's iteration for m^-1 mod 2^limb_bits. Each
+				// step doubles the number of correct bits
+				limb_t inv = 1;
+				for (int i = 0; i < 6; ++i) inv *= 2 - m_mod[0] * inv;
+				m_n0 = limb_t(0) - inv;
+
+				// R = 2^Bits. Calculate R mod m (which is 1 in Montgomery
+				// form) and R^2 mod m (used to convert numbers into
+				// Montgomery form) by doubling
+				limb_t r[num_limbs];
+				std::memset(r, 0, sizeof(r));
+				r[0] = 1;
+				for (int i = 0; i < Bits; ++i) add(r, r, r);
+				std::memcpy(m_one, r, sizeof(r));
+				for (int i = 0; i < Bits; ++i) add(r, r, r);
+				std::memcpy(m_r2, r, sizeof(r));
+			}
+
+			static void from_bytes(unsigned char const* in, limb_t* out)
+			{
+				for (int i = 0; i < num_limbs; ++i)
+				{
+					unsigned char const* p = in + num_bytes - sizeof(limb_t) * (i + 1);
+					limb_t v = 0;
+					for (int k = 0; k < int(sizeof(limb_t)); ++k)
+						v = (v << 8) | p[k];
+					out[i] = v;
+				}
+			}
+
+			static void to_bytes(limb_t const* in, unsigned char* out)
+			{
+				for (int i = 0; i < num_limbs; ++i)
+				{
+					unsigned char* p = out + num_bytes - sizeof(limb_t) * (i + 1);
+					limb_t v = in[i];
+					for (int k = sizeof(limb_t) - 1; k >= 0; --k)
+					{
+						p[k] = v & 0xff;
+						v >>= 8;
+					}
+				}
+			}
+
+			void to_mont(limb_t const* a, limb_t* out) const
+			{ mul(a, m_r2, out); }
+
+			void from_mont(limb_t const* a, limb_t* out) const
+			{
+				limb_t one[num_limbs];
+				std::memset(one, 0, sizeof(one));
+				one[0] = 1;
+				mul(a, one, out);
+			}
+
+			// out = a + b mod m. a and b must be less than m
+			void add(limb_t const* a, limb_t const* b, limb_t* out) const
+			{
+				dlimb_t c = 0;
+				for (int i = 0; i < num_limbs; ++i)
+				{
+					c += dlimb_t(a[i]) + b[i];
+					out[i] = limb_t(c);
+					c >>= limb_bits;
+				}
+				reduce(out, c != 0);
+			}
+
+			// out = a * b / R mod m, using coarsely integrated operand
+			// scanning. a must be less than R and b less than m. out
+			// may alias a or b
+			void mul(limb_t const* a, limb_t const* b, limb_t* out) const
+			{
+				limb_t t[num_limbs + 2];
+				std::memset(t, 0, sizeof(t));
+				for (int i = 0; i < num_limbs; ++i)
+				{
+					dlimb_t c = 0;
+					for (int j = 0; j < num_limbs; ++j)
+					{
+						c += t[j] + dlimb_t(a[j]) * b[i];
+						t[j] = limb_t(c);
+						c >>= limb_bits;
+					}
+					c += t[num_limbs];
+					t[num_limbs] = limb_t(c);
+					t[num_limbs + 1] = limb_t(c >> limb_bits);
+
+					// add the multiple of m that clears the lowest
+					// word, and shift it out
+					limb_t const q = t[0] * m_n0;
+					c = (t[0] + dlimb_t(q) * m_mod[0]) >> limb_bits;
+					for (int j = 1; j < num_limbs; ++j)
+					{
+						c += t[j] + dlimb_t(q) * m_mod[j];
+						t[j - 1] = limb_t(c);
+						c >>= limb_bits;
+					}
+					c += t[num_limbs];
+					t[num_limbs - 1] = limb_t(c);
+					t[num_limbs] = t[num_limbs + 1] + limb_t(c >> limb_bits);
+				}
+				std::memcpy(out, t, num_limbs * sizeof(limb_t));
+				reduce(out, t[num_limbs] != 0);
+			}
+
+			// out = base ^ e mod m. base and out are in Montgomery form.
+			// e is a big endian number of e_len bytes. Uses a fixed
+			// window of 4 bits
+			void pow(limb_t const* base, unsigned char const* e, int e_len
+				, limb_t* out) const
+			{
+				limb_t table[16][num_limbs];
+				std::memcpy(table[0], m_one, sizeof(m_one));
+				std::memcpy(table[1], base, sizeof(m_one));
+				for (int i = 2; i < 16; ++i) mul(table[i - 1], base, table[i]);
+
+				// squaring one is pointless, skip leading zeroes
+				while (e_len > 0 && *e == 0) { ++e; --e_len; }
+
+				limb_t r[num_limbs];
+				std::memcpy(r, m_one, sizeof(r));
+				for (int i = 0; i < e_len; ++i)
+				{
+					for (int shift = 4; shift >= 0; shift -= 4)
+					{
+						for (int k = 0; k < 4; ++k) mul(r, r, r);
+						int const w = (e[i] >> shift) & 0xf;
+						if (w) mul(r, table[w], r);
+					}
+				}
+				std::memcpy(out, r, sizeof(r));
+			}
+
+			// out = 2 ^ e mod m, in Montgomery form. Multiplying by
+			// the generator is just a modular addition
+			void pow2(unsigned char const* e, int e_len, limb_t* out) const
+			{
+				while (e_len > 0 && *e == 0) { ++e; --e_len; }
+
+				limb_t r[num_limbs];
+				std::memcpy(r, m_one, sizeof(r));
+				for (int i = 0; i < e_len; ++i)
+				{
+					for (int bit = 7; bit >= 0; --bit)
+					{
+						mul(r, r, r);
+						if (e[i] & (1 << bit)) add(r, r, r);
+					}
+				}
+				std::memcpy(out, r, sizeof(r));
+			}
+
+		private:
+
+			// subtracts m from a if a (with the carry out of its top
+			// word) is greater than or equal to m
+			void reduce(limb_t* a, bool carry) const
+			{
+				if (!carry)
+				{
+					for (int i = num_limbs - 1; i >= 0; --i)
+					{
+						if (a[i] > m_mod[i]) break;
+						if (a[i] < m_mod[i]) return;
+					}
+				}
+				limb_t borrow = 0;
+				for (int i = 0; i < num_limbs; ++i)
+				{
+					limb_t const d = a[i] - m_mod[i] - borrow;
+					borrow = (a[i] < m_mod[i]) || (a[i] - m_mod[i] < borrow);
+					a[i] = d;
+				}
+			}
+
+			limb_t m_mod[num_limbs];
+			limb_t m_one[num_limbs];
+			limb_t m_r2[num_limbs];
+			limb_t m_n0;
+		};
+
+		__extension__ typedef unsigned __int128 uint128_t;
+		typedef montgomery<sizeof(dh_prime) * 8, boost::uint64_t, uint128_t> dh_mont;
+		dh_mont const dh_modulus(dh_prime);
+#endif
 	}
 
 
 	// Set the prime P and the generator, generate local public key
 	dh_key_exchange::dh_key_exchange()
 	{
-#ifdef TORRENT_USE_GCRYPT
 		// create local key
-		gcry_randomize(m_dh_local_secret, sizeof(m_dh_local_secret), GCRY_STRONG_RANDOM);
+		char local_secret[dh_secret_bytes];
+#ifdef TORRENT_USE_GCRYPT
+		gcry_randomize(local_secret, dh_secret_bytes, GCRY_STRONG_RANDOM);
+#else
+		for (int i = 0; i < dh_secret_bytes; ++i)
+			local_secret[i] = random();
+#endif
+		init(local_secret);
+	}
+
+	dh_key_exchange::dh_key_exchange(char const* local_secret)
+	{
+		init(local_secret);
+	}
+
+	void dh_key_exchange::init(char const* local_secret)
+	{
+		// the private exponent is only dh_secret_bytes long, the
+		// leading bytes of the secret are zero
+		memset(m_dh_local_secret, 0, sizeof(m_dh_local_secret) - dh_secret_bytes);
+		memcpy(m_dh_local_secret + sizeof(m_dh_local_secret) - dh_secret_bytes
+			, local_secret, dh_secret_bytes);
 
+#ifdef TORRENT_USE_GCRYPT
 		// build gcrypt big ints from the prime and the secret
 		gcry_mpi_t prime = 0;
 		gcry_mpi_t secret = 0;
@@ -109,10 +356,6 @@ get_out:
 		if (secret) gcry_mpi_release(secret);
 
 #elif defined TORRENT_USE_OPENSSL
-		// create local key
-		for (int i = 0; i < sizeof(m_dh_local_secret); ++i)
-			m_dh_local_secret[i] = random();
-
 		BIGNUM* prime = 0;
 		BIGNUM* secret = 0;
 		BIGNUM* key = 0;
@@ -143,11 +386,17 @@ get_out:
 		if (key) BN_free(key);
 		if (secret) BN_free(secret);
 		if (prime) BN_free(prime);
-#elif defined TORRENT_USE_TOMMATH
-		// create local key
-		for (int i = 0; i < int(sizeof(m_dh_local_secret)); ++i)
-			m_dh_local_secret[i] = random();
+#elif defined TORRENT_FIXED_SIZE_DH
+		// generator is 2
+		// key = (2 ^ secret) % prime
+		dh_mont::limb_t key[dh_mont::num_limbs];
+		dh_modulus.pow2((unsigned char const*)m_dh_local_secret
+			, sizeof(m_dh_local_secret), key);
+		dh_modulus.from_mont(key, key);
 
+		// key is now our local key
+		dh_mont::to_bytes(key, (unsigned char*)m_dh_local_key);
+#elif defined TORRENT_USE_TOMMATH
 		mp_int prime;
 		mp_int secret;
 		mp_int key;
@@ -258,6 +507,16 @@ get_out:
 		BN_free(remote_key);
 		BN_free(secret);
 		BN_free(prime);
+#elif defined TORRENT_FIXED_SIZE_DH
+		dh_mont::limb_t remote_key[dh_mont::num_limbs];
+		dh_mont::from_bytes((unsigned char const*)remote_pubkey, remote_key);
+		dh_modulus.to_mont(remote_key, remote_key);
+		dh_modulus.pow(remote_key, (unsigned char const*)m_dh_local_secret
+			, sizeof(m_dh_local_secret), remote_key);
+		dh_modulus.from_mont(remote_key, remote_key);
+
+		// remote_key is now the shared secret
+		dh_mont::to_bytes(remote_key, (unsigned char*)m_dh_shared_secret);
 #elif defined TORRENT_USE_TOMMATH
 		mp_int prime;
 		mp_int secret;
@@ -310,21 +569,17 @@ get_out:
 
 void rc4_init(const unsigned char* in, unsigned long len, rc4 *state)
 {
-	unsigned char key[256], tmp, *s;
+	unsigned char key[256];
+	boost::uint32_t tmp, *s;
 	int keylen, x, y, j;
 
 	TORRENT_ASSERT(state != 0);
 	TORRENT_ASSERT(len <= 256);
 
-	state->x = 0;
-	while (len--) {
-		state->buf[state->x++] = *in++;
-	}
-
 	/* extract the key */
+	memcpy(key, in, len);
+	keylen = len;
 	s = state->buf;
-	memcpy(key, s, 256);
-	keylen = state->x;
 
 	/* make RC4 perm and shuffle */
 	for (x = 0; x < 256; x++) {
@@ -344,7 +599,7 @@ void rc4_init(const unsigned char* in, unsigned long len, rc4 *state)
 
 unsigned long rc4_encrypt(unsigned char *out, unsigned long outlen, rc4 *state)
 {
-	unsigned char x, y, *s, tmp;
+	boost::uint32_t x, y, sx, sy, *s;
 	unsigned long n;
 
 	TORRENT_ASSERT(out != 0);
@@ -354,12 +609,37 @@ unsigned long rc4_encrypt(unsigned char *out, unsigned long outlen, rc4 *state)
 	x = state->x;
 	y = state->y;
 	s = state->buf;
+
+	/* generate the key stream 8 bytes at a time and xor it
+	   into the output a whole word at a time */
+	while (outlen >= 8) {
+		unsigned char ks[8];
+		boost::uint64_t k, d;
+		for (int i = 0; i < 8; ++i) {
+			x = (x + 1) & 255;
+			sx = s[x];
+			y = (y + sx) & 255;
+			sy = s[y];
+			s[x] = sy;
+			s[y] = sx;
+			ks[i] = s[(sx + sy) & 255];
+		}
+		memcpy(&k, ks, 8);
+		memcpy(&d, out, 8);
+		d ^= k;
+		memcpy(out, &d, 8);
+		out += 8;
+		outlen -= 8;
+	}
+
 	while (outlen--) {
 		x = (x + 1) & 255;
-		y = (y + s[x]) & 255;
-		tmp = s[x]; s[x] = s[y]; s[y] = tmp;
-		tmp = (s[x] + s[y]) & 255;
-		*out++ ^= s[tmp];
+		sx = s[x];
+		y = (y + sx) & 255;
+		sy = s[y];
+		s[x] = sy;
+		s[y] = sx;
+		*out++ ^= s[(sx + sy) & 255];
 	}
 	state->x = x;
 	state->y = y;
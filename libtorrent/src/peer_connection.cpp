@@ -150,6 +150,7 @@ namespace libtorrent
 		, m_packet_size(0)
 		, m_soft_packet_size(0)
 		, m_recv_pos(0)
+		, m_recv_start(0)
 		, m_disk_recv_buffer_size(0)
 		, m_reading_bytes(0)
 		, m_num_invalid_requests(0)
@@ -195,6 +196,8 @@ namespace libtorrent
 		, m_corked(false)
 		, m_has_metadata(true)
 		, m_exceeded_limit(false)
+		, m_pool_write(false)
+		, m_pool_would_block(false)
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		, m_in_constructor(true)
 		, m_disconnect_started(false)
@@ -3597,7 +3600,9 @@ namespace libtorrent
 		m_disconnecting = true;
 		error_code e;
 
-		async_shutdown(*m_socket, m_socket);
+		// if one of the network threads is writing to the socket,
+		// it's closed once the write completes
+		if (!m_pool_write) async_shutdown(*m_socket, m_socket);
 
 		m_ses.close_connection(this, ec);
 
@@ -3864,18 +3869,25 @@ namespace libtorrent
 		INVARIANT_CHECK;
 
 		TORRENT_ASSERT(packet_size > 0);
-		TORRENT_ASSERT(int(m_recv_buffer.size()) >= size);
-		TORRENT_ASSERT(int(m_recv_buffer.size()) >= m_recv_pos);
+		TORRENT_ASSERT(int(m_recv_buffer.size()) >= m_recv_start + size);
+		TORRENT_ASSERT(int(m_recv_buffer.size()) >= m_recv_start + m_recv_pos);
 		TORRENT_ASSERT(m_recv_pos >= size + offset);
 		TORRENT_ASSERT(offset >= 0);
 
-		if (size > 0)		
-			std::memmove(&m_recv_buffer[0] + offset, &m_recv_buffer[0] + offset + size, m_recv_pos - size - offset);
+		// cutting off the front of the buffer is just a matter of
+		// moving the start forward. Only cuts from the middle of
+		// the buffer need to move the bytes following it
+		if (offset == 0)
+			m_recv_start += size;
+		else if (size > 0)
+			std::memmove(&m_recv_buffer[0] + m_recv_start + offset
+				, &m_recv_buffer[0] + m_recv_start + offset + size, m_recv_pos - size - offset);
 
 		m_recv_pos -= size;
+		if (m_recv_pos == 0) m_recv_start = 0;
 
 #ifdef TORRENT_DEBUG
-		std::fill(m_recv_buffer.begin() + m_recv_pos, m_recv_buffer.end(), 0);
+		std::fill(m_recv_buffer.begin() + m_recv_start + m_recv_pos, m_recv_buffer.end(), 0);
 #endif
 
 		m_packet_size = packet_size;
@@ -4034,6 +4046,15 @@ namespace libtorrent
 			return;
 		}
 
+		// uTP connections of torrents that are streaming (i.e. have
+		// pieces with deadlines) may use a different target delay
+		utp_stream* utp = m_socket->get<utp_stream>();
+		if (utp)
+		{
+			utp->set_target_delay(t->has_time_critical_pieces()
+				? m_ses.m_settings.utp_time_critical_target_delay : 0);
+		}
+
 		if (m_endgame_mode
 			&& m_interesting
 			&& m_download_queue.empty()
@@ -4558,6 +4579,22 @@ namespace libtorrent
 		}
 	}
 
+	bool peer_connection::latency_critical(int channel) const
+	{
+		if (channel != download_channel) return false;
+		if (m_download_queue.empty()) return false;
+
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		if (!t || !t->has_time_critical_pieces()) return false;
+
+		for (std::vector<pending_block>::const_iterator i = m_download_queue.begin()
+			, end(m_download_queue.end()); i != end; ++i)
+		{
+			if (t->is_time_critical_piece(i->block.piece_index)) return true;
+		}
+		return false;
+	}
+
 	int peer_connection::request_upload_bandwidth(
 		bandwidth_channel* bwc1
 		, bandwidth_channel* bwc2
@@ -4787,13 +4824,30 @@ namespace libtorrent
 #ifdef TORRENT_VERBOSE_LOGGING
 		peer_log(">>> ASYNC_WRITE [ bytes: %d ]", amount_to_send);
 #endif
-		std::list<asio::const_buffer> const& vec = m_send_buffer.build_iovec(amount_to_send);
+		chained_buffer::buffer_sequence vec = m_send_buffer.build_iovec(amount_to_send);
+
+		stream_socket* s = m_socket->get<stream_socket>();
+		if (s && m_ses.m_net_thread_pool.num_threads() > 0 && !m_pool_would_block)
+		{
+			// plain TCP connections are written to by the network
+			// thread pool. The send buffer isn't touched until
+			// on_pool_write() is called
 #if defined TORRENT_ASIO_DEBUGGING
-		add_outstanding_async("peer_connection::on_send_data");
+			add_outstanding_async("peer_connection::on_send_data");
 #endif
-		m_socket->async_write_some(
-			vec, make_write_handler(boost::bind(
-				&peer_connection::on_send_data, self(), _1, _2)));
+			m_ses.m_net_thread_pool.post_write(self(), s->native_handle(), vec);
+			m_pool_write = true;
+		}
+		else
+		{
+			m_pool_would_block = false;
+#if defined TORRENT_ASIO_DEBUGGING
+			add_outstanding_async("peer_connection::on_send_data");
+#endif
+			m_socket->async_write_some(
+				vec, make_write_handler(boost::bind(
+					&peer_connection::on_send_data, self(), _1, _2)));
+		}
 
 		m_channel_state[upload_channel] |= peer_info::bw_network;
 	}
@@ -4910,16 +4964,30 @@ namespace libtorrent
 
 		int regular_buffer_size = m_packet_size - m_disk_recv_buffer_size;
 
-		if (int(m_recv_buffer.size()) < regular_buffer_size)
-			m_recv_buffer.resize(round_up8(regular_buffer_size));
+		if (int(m_recv_buffer.size()) < m_recv_start + regular_buffer_size)
+		{
+			// the rest of the packet doesn't fit behind the messages
+			// that have been cut off the front of the buffer. Move
+			// what we have of it down to the start of the buffer
+			if (m_recv_start > 0)
+			{
+				std::memmove(&m_recv_buffer[0], &m_recv_buffer[0] + m_recv_start
+					, (std::min)(m_recv_pos, regular_buffer_size));
+				m_recv_start = 0;
+			}
+			if (int(m_recv_buffer.size()) < regular_buffer_size)
+				m_recv_buffer.resize(round_up8(regular_buffer_size));
+		}
+
+		char* recv_buf = m_recv_buffer.empty() ? 0 : &m_recv_buffer[0] + m_recv_start;
 
 		boost::array<asio::mutable_buffer, 2> vec;
 		int num_bufs = 0;
 		if (!m_disk_recv_buffer || regular_buffer_size >= m_recv_pos + max_receive)
 		{
 			// only receive into regular buffer
-			TORRENT_ASSERT(m_recv_pos + max_receive <= int(m_recv_buffer.size()));
-			vec[0] = asio::buffer(&m_recv_buffer[m_recv_pos], max_receive);
+			TORRENT_ASSERT(m_recv_start + m_recv_pos + max_receive <= int(m_recv_buffer.size()));
+			vec[0] = asio::buffer(recv_buf + m_recv_pos, max_receive);
 			num_bufs = 1;
 		}
 		else if (m_recv_pos >= regular_buffer_size)
@@ -4938,7 +5006,7 @@ namespace libtorrent
 			TORRENT_ASSERT(max_receive - regular_buffer_size
 				+ m_recv_pos <= m_disk_recv_buffer_size);
 
-			vec[0] = asio::buffer(&m_recv_buffer[m_recv_pos]
+			vec[0] = asio::buffer(recv_buf + m_recv_pos
 				, regular_buffer_size - m_recv_pos);
 			vec[1] = asio::buffer(m_disk_recv_buffer.get()
 				, max_receive - regular_buffer_size + m_recv_pos);
@@ -4997,10 +5065,11 @@ namespace libtorrent
 		std::pair<buffer::interval, buffer::interval> vec;
 		int regular_buffer_size = m_packet_size - m_disk_recv_buffer_size;
 		TORRENT_ASSERT(regular_buffer_size >= 0);
+		char* recv_buf = m_recv_buffer.empty() ? 0 : &m_recv_buffer[0] + m_recv_start;
 		if (!m_disk_recv_buffer || regular_buffer_size >= m_recv_pos)
 		{
-			vec.first = buffer::interval(&m_recv_buffer[0]
-				+ m_recv_pos - bytes, &m_recv_buffer[0] + m_recv_pos);
+			vec.first = buffer::interval(recv_buf
+				+ m_recv_pos - bytes, recv_buf + m_recv_pos);
 			vec.second = buffer::interval(0,0);
 		}
 		else if (m_recv_pos - bytes >= regular_buffer_size)
@@ -5014,8 +5083,8 @@ namespace libtorrent
 		{
 			TORRENT_ASSERT(m_recv_pos - bytes < regular_buffer_size);
 			TORRENT_ASSERT(m_recv_pos > regular_buffer_size);
-			vec.first = buffer::interval(&m_recv_buffer[0] + m_recv_pos - bytes
-				, &m_recv_buffer[0] + regular_buffer_size);
+			vec.first = buffer::interval(recv_buf + m_recv_pos - bytes
+				, recv_buf + regular_buffer_size);
 			vec.second = buffer::interval(m_disk_recv_buffer.get()
 				, m_disk_recv_buffer.get() + m_recv_pos - regular_buffer_size);
 		}
@@ -5033,14 +5102,16 @@ namespace libtorrent
 			return;
 		}
 		m_recv_pos = 0;
+		m_recv_start = 0;
 		m_packet_size = packet_size;
 	}
 
-	void nop(char*) {}
+	void free_send_buffer(char* buf, void* ses)
+	{ static_cast<aux::session_impl*>(ses)->free_buffer(buf); }
 
 	void peer_connection::append_const_send_buffer(char const* buffer, int size)
 	{
-		m_send_buffer.append_buffer((char*)buffer, size, size, &nop);
+		m_send_buffer.append_buffer((char*)buffer, size, size, 0);
 #if defined TORRENT_STATS && defined TORRENT_DISK_STATS
 		m_ses.m_buffer_usage_logger << log_time() << " append_const_send_buffer: " << size << std::endl;
 		m_ses.log_buffer_usage();
@@ -5090,7 +5161,7 @@ namespace libtorrent
 			buf += buf_size;
 			size -= buf_size;
 			m_send_buffer.append_buffer(chain_buf, aux::session_impl::send_buffer_size, buf_size
-				, boost::bind(&session_impl::free_buffer, boost::ref(m_ses), _1));
+				, &free_send_buffer, &m_ses);
 			++i;
 		}
 		setup_send();
@@ -5188,7 +5259,7 @@ namespace libtorrent
 
 			m_last_receive = time_now();
 			m_recv_pos += bytes_transferred;
-			TORRENT_ASSERT(m_recv_pos <= int(m_recv_buffer.size()
+			TORRENT_ASSERT(m_recv_start + m_recv_pos <= int(m_recv_buffer.size()
 				+ m_disk_recv_buffer_size));
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
@@ -5495,6 +5566,20 @@ namespace libtorrent
 	// SEND DATA
 	// --------------------------
 
+	void peer_connection::on_pool_write(error_code const& error
+		, int bytes_transferred, bool would_block)
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		TORRENT_ASSERT(m_pool_write);
+		m_pool_write = false;
+
+		// the socket was left open for the write to complete
+		if (m_disconnecting) async_shutdown(*m_socket, m_socket);
+
+		m_pool_would_block = would_block;
+		on_send_data(error, bytes_transferred);
+	}
+
 	void peer_connection::on_send_data(error_code const& error
 		, std::size_t bytes_transferred)
 	{
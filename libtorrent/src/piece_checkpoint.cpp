@@ -0,0 +1,248 @@
+/*
+
+Copyright (c) 2008-2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include "libtorrent/pch.hpp"
+
+#include "libtorrent/piece_checkpoint.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/io.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <cstring>
+
+namespace libtorrent
+{
+	namespace
+	{
+		char const checkpoint_magic[] = "LTCP";
+		enum
+		{
+			checkpoint_version = 1,
+			// magic, version, info-hash, num pieces, num files, time
+			fixed_header_size = 4 + 4 + 20 + 4 + 4 + 8,
+			file_entry_size = 8 + 8,
+			record_size = 4 + 8
+		};
+	}
+
+	piece_checkpoint::piece_checkpoint()
+		: m_num_pieces(0)
+		, m_num_files(0)
+		, m_file_size(0)
+		, m_log_size(0)
+		, m_last_update(0)
+		, m_loaded(false)
+	{}
+
+	void piece_checkpoint::init(std::string const& path, sha1_hash const& info_hash
+		, int num_pieces, int num_files)
+	{
+		m_path = path;
+		m_info_hash = info_hash;
+		m_num_pieces = num_pieces;
+		m_num_files = num_files;
+		m_have.resize(num_pieces, false);
+		m_have.clear_all();
+		m_files.clear();
+		m_file_size = 0;
+		m_log_size = 0;
+		m_last_update = 0;
+		m_loaded = false;
+	}
+
+	int piece_checkpoint::header_size() const
+	{
+		return fixed_header_size + m_num_files * file_entry_size
+			+ (m_num_pieces + 7) / 8;
+	}
+
+	bool piece_checkpoint::load()
+	{
+		if (!enabled()) return false;
+
+		error_code ec;
+		file f;
+		if (!f.open(m_path, file::read_only, ec)) return false;
+		size_type size = f.get_size(ec);
+		if (ec || size < header_size()) return false;
+
+		// the log never grows much beyond the number of pieces
+		// before it's compacted, anything bigger is not ours
+		if (size > header_size() + size_type(m_num_pieces) * record_size * 4)
+			return false;
+
+		std::vector<char> buf(size);
+		file::iovec_t b = { &buf[0], size_t(size) };
+		if (f.readv(0, &b, 1, ec) != size || ec) return false;
+
+		char const* ptr = &buf[0];
+		if (std::memcmp(ptr, checkpoint_magic, 4) != 0) return false;
+		ptr += 4;
+		if (detail::read_uint32(ptr) != checkpoint_version) return false;
+		if (std::memcmp(ptr, &m_info_hash[0], 20) != 0) return false;
+		ptr += 20;
+		if (int(detail::read_uint32(ptr)) != m_num_pieces) return false;
+		if (int(detail::read_uint32(ptr)) != m_num_files) return false;
+		m_last_update = std::time_t(detail::read_uint64(ptr));
+
+		m_files.resize(m_num_files);
+		for (int i = 0; i < m_num_files; ++i)
+		{
+			m_files[i].first = size_type(detail::read_uint64(ptr));
+			m_files[i].second = std::time_t(detail::read_uint64(ptr));
+		}
+
+		m_have.assign(ptr, m_num_pieces);
+		ptr += (m_num_pieces + 7) / 8;
+
+		char const* end = &buf[0] + size;
+		m_log_size = 0;
+		while (end - ptr >= record_size)
+		{
+			char const* rec = ptr;
+			int piece = int(detail::read_uint32(rec));
+			std::time_t t = std::time_t(detail::read_uint64(rec));
+			// a record that doesn't make sense means the rest of
+			// the log can't be trusted
+			if (piece < 0 || piece >= m_num_pieces) break;
+			m_have.set_bit(piece);
+			if (t > m_last_update) m_last_update = t;
+			++m_log_size;
+			ptr = rec;
+		}
+		// new records are appended right after the last valid one
+		m_file_size = ptr - &buf[0];
+		m_loaded = true;
+		return true;
+	}
+
+	void piece_checkpoint::write_snapshot(
+		std::vector<std::pair<size_type, std::time_t> > const& files
+		, error_code& ec)
+	{
+		if (!enabled()) return;
+		TORRENT_ASSERT(int(files.size()) == m_num_files);
+
+		m_files = files;
+		m_last_update = time(0);
+
+		std::vector<char> buf(header_size());
+		char* ptr = &buf[0];
+		std::memcpy(ptr, checkpoint_magic, 4);
+		ptr += 4;
+		detail::write_uint32(checkpoint_version, ptr);
+		std::memcpy(ptr, &m_info_hash[0], 20);
+		ptr += 20;
+		detail::write_uint32(m_num_pieces, ptr);
+		detail::write_uint32(m_num_files, ptr);
+		detail::write_uint64(m_last_update, ptr);
+		for (int i = 0; i < m_num_files; ++i)
+		{
+			detail::write_uint64(m_files[i].first, ptr);
+			detail::write_uint64(m_files[i].second, ptr);
+		}
+		if (m_num_pieces > 0)
+			std::memcpy(ptr, m_have.bytes(), (m_num_pieces + 7) / 8);
+
+		std::string parent = parent_path(m_path);
+		if (!parent.empty())
+		{
+			create_directories(parent, ec);
+			if (ec) return;
+		}
+
+		std::string tmp = m_path + ".tmp";
+		{
+			file f;
+			if (!f.open(tmp, file::write_only, ec)) return;
+			file::iovec_t b = { &buf[0], buf.size() };
+			if (f.writev(0, &b, 1, ec) != size_type(buf.size()) || ec)
+			{
+				if (!ec) ec = error_code(boost::system::errc::io_error
+					, get_posix_category());
+				return;
+			}
+			// in case a bigger temporary file was left behind
+			if (!f.set_size(buf.size(), ec)) return;
+		}
+
+#ifdef TORRENT_WINDOWS
+		// rename doesn't replace existing files on windows
+		error_code ignore;
+		libtorrent::remove(m_path, ignore);
+#endif
+		rename(tmp, m_path, ec);
+		if (ec) return;
+
+		m_file_size = buf.size();
+		m_log_size = 0;
+	}
+
+	void piece_checkpoint::append(int piece, error_code& ec)
+	{
+		TORRENT_ASSERT(piece >= 0 && piece < m_num_pieces);
+		if (!enabled()) return;
+
+		m_have.set_bit(piece);
+
+		// there's nothing to append to until a snapshot is written
+		if (m_file_size == 0) return;
+
+		m_last_update = time(0);
+
+		char rec[record_size];
+		char* ptr = rec;
+		detail::write_uint32(piece, ptr);
+		detail::write_uint64(m_last_update, ptr);
+
+		file f;
+		if (!f.open(m_path, file::write_only, ec)) return;
+		file::iovec_t b = { rec, record_size };
+		if (f.writev(m_file_size, &b, 1, ec) != record_size || ec) return;
+		m_file_size += record_size;
+		++m_log_size;
+	}
+
+	void piece_checkpoint::remove(error_code& ec)
+	{
+		m_have.clear_all();
+		m_files.clear();
+		m_file_size = 0;
+		m_log_size = 0;
+		m_loaded = false;
+		if (!enabled()) return;
+		if (!exists(m_path)) return;
+		libtorrent::remove(m_path, ec);
+	}
+}
+
@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <boost/bind.hpp>
 #include <boost/utility.hpp>
+#include <boost/functional/hash.hpp>
 
 #ifdef _MSC_VER
 #pragma warning(pop)
@@ -437,7 +438,7 @@ namespace libtorrent
 	policy::policy(torrent* t)
 		: m_torrent(t)
 		, m_locked_peer(NULL)
-		, m_round_robin(0)
+		, m_round_robin(m_peers.end())
 		, m_num_connect_candidates(0)
 		, m_num_seeds(0)
 		, m_finished(false)
@@ -468,10 +469,9 @@ namespace libtorrent
 			if (ses.m_alerts.should_post<peer_blocked_alert>())
 				ses.m_alerts.post_alert(peer_blocked_alert(m_torrent->get_handle(), (*i)->address()));
 
-			int current = i - m_peers.begin();
-			TORRENT_ASSERT(current >= 0);
 			TORRENT_ASSERT(m_peers.size() > 0);
 			TORRENT_ASSERT(i != m_peers.end());
+			iterator next = boost::next(i);
 
 			if ((*i)->connection)
 			{
@@ -484,7 +484,7 @@ namespace libtorrent
 				// what *i refers to has changed, i.e. cur was deleted
 				if (m_peers.size() < count)
 				{
-					i = m_peers.begin() + current;
+					i = next;
 					continue;
 				}
 				TORRENT_ASSERT((*i)->connection == 0
@@ -492,7 +492,7 @@ namespace libtorrent
 			}
 
 			erase_peer(i);
-			i = m_peers.begin() + current;
+			i = next;
 		}
 	}
 
@@ -502,10 +502,10 @@ namespace libtorrent
 
 		TORRENT_ASSERT(p->in_use);
 
-		std::pair<iterator, iterator> range = find_peers(p->address());
-		iterator iter = std::find_if(range.first, range.second, match_peer_endpoint(p->ip()));
+		std::pair<address_iterator, address_iterator> range = find_peers(p->address());
+		address_iterator iter = std::find(range.first, range.second, p);
 		if (iter == range.second) return;
-		erase_peer(iter);
+		erase_peer(m_peers.project<0>(iter));
 	}
 
 	// any peer that is erased from m_peers will be
@@ -527,41 +527,55 @@ namespace libtorrent
 			--m_num_connect_candidates;
 		}
 		TORRENT_ASSERT(m_num_connect_candidates < int(m_peers.size()));
-		if (m_round_robin > i - m_peers.begin()) --m_round_robin;
-		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+		if (m_round_robin == i) ++m_round_robin;
 
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 		TORRENT_ASSERT((*i)->in_use);
 		(*i)->in_use = false;
 #endif
 
+		free_peer(*i);
+		m_peers.erase(i);
+	}
+
+	// peer entries are allocated from the session's pools. The
+	// ipv4 and ipv6 pools return memory in constant time, unlike
+	// object_pool::destroy() which keeps its free list sorted
+	void policy::free_peer(policy::peer* p)
+	{
+		aux::session_impl& ses = m_torrent->session();
 #if TORRENT_USE_IPV6
-		if ((*i)->is_v6_addr)
+		if (p->is_v6_addr)
 		{
-			TORRENT_ASSERT(m_torrent->session().m_ipv6_peer_pool.is_from(
-				static_cast<ipv6_peer*>(*i)));
-			m_torrent->session().m_ipv6_peer_pool.destroy(
-				static_cast<ipv6_peer*>(*i));
+			TORRENT_ASSERT(ses.m_ipv6_peer_pool.is_from(p));
+			static_cast<ipv6_peer*>(p)->~ipv6_peer();
+			ses.m_ipv6_peer_pool.free(p);
+			return;
 		}
-		else
 #endif
 #if TORRENT_USE_I2P
-		if ((*i)->is_i2p_addr)
+		if (p->is_i2p_addr)
 		{
-			TORRENT_ASSERT(m_torrent->session().m_i2p_peer_pool.is_from(
-				static_cast<i2p_peer*>(*i)));
-			m_torrent->session().m_i2p_peer_pool.destroy(
-				static_cast<i2p_peer*>(*i));
+			TORRENT_ASSERT(ses.m_i2p_peer_pool.is_from(static_cast<i2p_peer*>(p)));
+			ses.m_i2p_peer_pool.destroy(static_cast<i2p_peer*>(p));
+			return;
 		}
-		else
 #endif
+		TORRENT_ASSERT(ses.m_ipv4_peer_pool.is_from(p));
+		static_cast<ipv4_peer*>(p)->~ipv4_peer();
+		ses.m_ipv4_peer_pool.free(p);
+	}
+
+	std::size_t policy::peer_address_hash::operator()(address const& a) const
+	{
+#if TORRENT_USE_IPV6
+		if (a.is_v6())
 		{
-			TORRENT_ASSERT(m_torrent->session().m_ipv4_peer_pool.is_from(
-				static_cast<ipv4_peer*>(*i)));
-			m_torrent->session().m_ipv4_peer_pool.destroy(
-				static_cast<ipv4_peer*>(*i));
+			address_v6::bytes_type b = a.to_v6().to_bytes();
+			return boost::hash_range(b.begin(), b.end());
 		}
-		m_peers.erase(i);
+#endif
+		return boost::hash_value(a.to_v4().to_ulong());
 	}
 
 	bool policy::should_erase_immediately(peer const& p) const
@@ -599,12 +613,14 @@ namespace libtorrent
 
 		if (max_peerlist_size == 0 || m_peers.empty()) return;
 
-		int erase_candidate = -1;
-		int force_erase_candidate = -1;
+		iterator erase_candidate = m_peers.end();
+		iterator force_erase_candidate = m_peers.end();
 
 		TORRENT_ASSERT(m_finished == m_torrent->is_finished());
 
-		int round_robin = random() % m_peers.size();
+		// the list can't be indexed at random. Start where the
+		// connect candidate scan is, which keeps going round
+		iterator round_robin = m_round_robin;
 
 		int low_watermark = max_peerlist_size * 95 / 100;
 		if (low_watermark == max_peerlist_size) --low_watermark;
@@ -615,22 +631,19 @@ namespace libtorrent
 			if (int(m_peers.size()) < low_watermark)
 				break;
 
-			if (round_robin == int(m_peers.size())) round_robin = 0;
+			if (round_robin == m_peers.end()) round_robin = m_peers.begin();
 
-			peer& pe = *m_peers[round_robin];
+			peer& pe = **round_robin;
 			TORRENT_ASSERT(pe.in_use);
-			int current = round_robin;
+			iterator current = round_robin++;
 
 			if (is_erase_candidate(pe, m_finished)
-				&& (erase_candidate == -1
-					|| !compare_peer_erase(*m_peers[erase_candidate], pe)))
+				&& (erase_candidate == m_peers.end()
+					|| !compare_peer_erase(**erase_candidate, pe)))
 			{
 				if (should_erase_immediately(pe))
 				{
-					if (erase_candidate > current) --erase_candidate;
-					if (force_erase_candidate > current) --force_erase_candidate;
-					TORRENT_ASSERT(current >= 0 && current < int(m_peers.size()));
-					erase_peer(m_peers.begin() + current);
+					erase_peer(current);
 					continue;
 				}
 				else
@@ -639,24 +652,20 @@ namespace libtorrent
 				}
 			}
 			if (is_force_erase_candidate(pe)
-				&& (force_erase_candidate == -1
-					|| !compare_peer_erase(*m_peers[force_erase_candidate], pe)))
+				&& (force_erase_candidate == m_peers.end()
+					|| !compare_peer_erase(**force_erase_candidate, pe)))
 			{
 				force_erase_candidate = current;
 			}
-
-			++round_robin;
 		}
 		
-		if (erase_candidate > -1)
+		if (erase_candidate != m_peers.end())
 		{
-			TORRENT_ASSERT(erase_candidate >= 0 && erase_candidate < int(m_peers.size()));
-			erase_peer(m_peers.begin() + erase_candidate);
+			erase_peer(erase_candidate);
 		}
-		else if ((flags & force_erase) && force_erase_candidate > -1)
+		else if ((flags & force_erase) && force_erase_candidate != m_peers.end())
 		{
-			TORRENT_ASSERT(force_erase_candidate >= 0 && force_erase_candidate < int(m_peers.size()));
-			erase_peer(m_peers.begin() + force_erase_candidate);
+			erase_peer(force_erase_candidate);
 		}
 	}
 
@@ -736,8 +745,8 @@ namespace libtorrent
 	{
 		INVARIANT_CHECK;
 
-		int candidate = -1;
-		int erase_candidate = -1;
+		iterator candidate = m_peers.end();
+		iterator erase_candidate = m_peers.end();
 
 		TORRENT_ASSERT(m_finished == m_torrent->is_finished());
 
@@ -745,8 +754,6 @@ namespace libtorrent
 		external_ip const& external = m_torrent->session().external_address();
 		int external_port = m_torrent->session().listen_port();
 
-		if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
-
 #ifndef TORRENT_DISABLE_DHT
 		bool pinged = false;
 #endif
@@ -758,11 +765,11 @@ namespace libtorrent
 		for (int iterations = (std::min)(int(m_peers.size()), 300);
 			iterations > 0; --iterations)
 		{
-			if (m_round_robin >= int(m_peers.size())) m_round_robin = 0;
+			if (m_round_robin == m_peers.end()) m_round_robin = m_peers.begin();
 
-			peer& pe = *m_peers[m_round_robin];
+			peer& pe = **m_round_robin;
 			TORRENT_ASSERT(pe.in_use);
-			int current = m_round_robin;
+			iterator current = m_round_robin;
 
 #ifndef TORRENT_DISABLE_DHT
 			// try to send a DHT ping to this peer
@@ -784,14 +791,13 @@ namespace libtorrent
 				&& max_peerlist_size > 0)
 			{
 				if (is_erase_candidate(pe, m_finished)
-					&& (erase_candidate == -1
-						|| !compare_peer_erase(*m_peers[erase_candidate], pe)))
+					&& (erase_candidate == m_peers.end()
+						|| !compare_peer_erase(**erase_candidate, pe)))
 				{
 					if (should_erase_immediately(pe))
 					{
-						if (erase_candidate > current) --erase_candidate;
-						if (candidate > current) --candidate;
-						erase_peer(m_peers.begin() + current);
+						// this moves m_round_robin to the next peer
+						erase_peer(current);
 						continue;
 					}
 					else
@@ -809,8 +815,8 @@ namespace libtorrent
 			// case, it returns true if the current candidate is better than
 			// pe, which is the peer m_round_robin points to. If it is, just
 			// keep looking.
-			if (candidate != -1
-				&& compare_peer(*m_peers[candidate], pe, external, external_port)) continue;
+			if (candidate != m_peers.end()
+				&& compare_peer(**candidate, pe, external, external_port)) continue;
 
 			if (pe.last_connected
 				&& session_time - pe.last_connected <
@@ -820,28 +826,28 @@ namespace libtorrent
 			candidate = current;
 		}
 		
-		if (erase_candidate > -1)
+		// the erase candidate is never a connect candidate
+		if (erase_candidate != m_peers.end())
 		{
-			if (candidate > erase_candidate) --candidate;
-			erase_peer(m_peers.begin() + erase_candidate);
+			TORRENT_ASSERT(erase_candidate != candidate);
+			erase_peer(erase_candidate);
 		}
 
 #if defined TORRENT_LOGGING || defined TORRENT_VERBOSE_LOGGING
-		if (candidate != -1)
+		if (candidate != m_peers.end())
 		{
 			(*m_torrent->session().m_logger) << time_now_string()
 				<< " *** FOUND CONNECTION CANDIDATE ["
-				" ip: " << m_peers[candidate]->ip() <<
-				" d: " << cidr_distance(external.external_address(m_peers[candidate]->address()), m_peers[candidate]->address()) <<
-				" rank: " << m_peers[candidate]->rank(external, external_port) <<
-				" external: " << external.external_address(m_peers[candidate]->address()) <<
-				" t: " << (session_time - m_peers[candidate]->last_connected) <<
+				" ip: " << (*candidate)->ip() <<
+				" d: " << cidr_distance(external.external_address((*candidate)->address()), (*candidate)->address()) <<
+				" rank: " << (*candidate)->rank(external, external_port) <<
+				" external: " << external.external_address((*candidate)->address()) <<
+				" t: " << (session_time - (*candidate)->last_connected) <<
 				" ]\n";
 		}
 #endif
 
-		if (candidate == -1) return m_peers.end();
-		return m_peers.begin() + candidate;
+		return candidate;
 	}
 
 	bool policy::new_connection(peer_connection& c, int session_time)
@@ -867,42 +873,26 @@ namespace libtorrent
 		}
 #endif
 
-		iterator iter;
+		address_iterator iter;
 		peer* i = 0;
 
 		bool found = false;
+		std::pair<address_iterator, address_iterator> range = find_peers(c.remote().address());
 		if (m_torrent->settings().allow_multiple_connections_per_ip)
 		{
 			tcp::endpoint remote = c.remote();
-			std::pair<iterator, iterator> range = find_peers(remote.address());
 			iter = std::find_if(range.first, range.second, match_peer_endpoint(remote));
-	
-			if (iter != range.second)
-			{
-				TORRENT_ASSERT((*iter)->in_use);
-				found = true;
-			}
 		}
 		else
 		{
-			iter = std::lower_bound(
-				m_peers.begin(), m_peers.end()
-				, c.remote().address(), peer_address_compare()
-			);
-
-			if (iter != m_peers.end() && (*iter)->address() == c.remote().address())
-			{
-				TORRENT_ASSERT((*iter)->in_use);
-				found = true;
-			}
+			iter = range.first;
 		}
 
-		// make sure the iterator we got is properly sorted relative
-		// to the connection's address
-//		TORRENT_ASSERT(m_peers.empty()
-//			|| (iter == m_peers.end() && (*(iter-1))->address() < c.remote().address())
-//			|| (iter != m_peers.end() && c.remote().address() < (*iter)->address())
-//			|| (iter != m_peers.end() && iter != m_peers.begin() && (*(iter-1))->address() < c.remote().address()));
+		if (iter != range.second)
+		{
+			TORRENT_ASSERT((*iter)->in_use);
+			found = true;
+		}
 
 		aux::session_impl& ses = m_torrent->session();
 
@@ -1041,7 +1031,6 @@ namespace libtorrent
 
 			if (int(m_peers.size()) >= m_torrent->settings().max_peerlist_size)
 			{
-				// this may invalidate our iterator!
 				erase_peers(force_erase);
 				if (int(m_peers.size()) >= m_torrent->settings().max_peerlist_size)
 				{
@@ -1060,11 +1049,6 @@ namespace libtorrent
 					c.disconnect(errors::too_many_connections);
 					return false;
 				}
-				// restore it
-				iter = std::lower_bound(
-					m_peers.begin(), m_peers.end()
-					, c.remote().address(), peer_address_compare()
-				);
 			}
 
 #if TORRENT_USE_IPV6
@@ -1095,11 +1079,9 @@ namespace libtorrent
 			p->in_use = true;
 #endif
 
-			iter = m_peers.insert(iter, p);
-
-			if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
+			m_peers.push_back(p);
 
-			i = *iter;
+			i = p;
 #ifndef TORRENT_DISABLE_GEO_IP
 			int as = ses.as_for_ip(c.remote().address());
 #ifdef TORRENT_DEBUG
@@ -1149,8 +1131,8 @@ namespace libtorrent
 		if (m_torrent->settings().allow_multiple_connections_per_ip)
 		{
 			tcp::endpoint remote(p->address(), port);
-			std::pair<iterator, iterator> range = find_peers(remote.address());
-			iterator i = std::find_if(range.first, range.second
+			std::pair<address_iterator, address_iterator> range = find_peers(remote.address());
+			address_iterator i = std::find_if(range.first, range.second
 				, match_peer_endpoint(remote));
 			if (i != range.second)
 			{
@@ -1180,14 +1162,14 @@ namespace libtorrent
 					erase_peer(p);
 					return false;
 				}
-				erase_peer(i);
+				erase_peer(m_peers.project<0>(i));
 			}
 		}
 #ifdef TORRENT_DEBUG
 		else
 		{
-			std::pair<iterator, iterator> range = find_peers(p->address());
-			TORRENT_ASSERT(range.second - range.first == 1);
+			std::pair<address_iterator, address_iterator> range = find_peers(p->address());
+			TORRENT_ASSERT(std::distance(range.first, range.second) == 1);
 		}
 #endif
 
@@ -1241,7 +1223,7 @@ namespace libtorrent
 		TORRENT_ASSERT(m_num_seeds <= int(m_peers.size()));
 	}
 
-	bool policy::insert_peer(policy::peer* p, iterator iter, int flags)
+	bool policy::insert_peer(policy::peer* p, int flags)
 	{
 		TORRENT_ASSERT(p);
 		TORRENT_ASSERT(p->in_use);
@@ -1258,26 +1240,9 @@ namespace libtorrent
 			erase_peers();
 			if (int(m_peers.size()) >= max_peerlist_size)
 				return 0;
-
-			// since some peers were removed, we need to
-			// update the iterator to make it valid again
-#if TORRENT_USE_I2P
-			if (p->is_i2p_addr)
-			{
-				iter = std::lower_bound(
-					m_peers.begin(), m_peers.end()
-					, p->dest(), peer_address_compare());
-			}
-			else
-#endif
-			iter = std::lower_bound(
-				m_peers.begin(), m_peers.end()
-				, p->address(), peer_address_compare());
 		}
 
-		iter = m_peers.insert(iter, p);
-
-		if (m_round_robin >= iter - m_peers.begin()) ++m_round_robin;
+		m_peers.push_back(p);
 
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		if (flags & 0x01) p->pe_support = true;
@@ -1370,14 +1335,18 @@ namespace libtorrent
 	{
 		INVARIANT_CHECK;
 	
+		// i2p peers don't have an address, they're all
+		// indexed under the empty one
 		bool found = false;
-		iterator iter = std::lower_bound(
-			m_peers.begin(), m_peers.end()
-			, destination, peer_address_compare()
-		);
-
-		if (iter != m_peers.end() && strcmp((*iter)->dest(), destination) == 0)
+		std::pair<address_iterator, address_iterator> range = find_peers(address());
+		address_iterator iter = range.first;
+		for (; iter != range.second; ++iter)
+		{
+			if (!(*iter)->is_i2p_addr) continue;
+			if (strcmp((*iter)->dest(), destination) != 0) continue;
 			found = true;
+			break;
+		}
 
 		peer* p = 0;
 
@@ -1394,13 +1363,12 @@ namespace libtorrent
 			p->in_use = true;
 #endif
 
-			if (!insert_peer(p, iter, flags))
+			if (!insert_peer(p, flags))
 			{
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 				p->in_use = false;
 #endif
-
-				m_torrent->session().m_i2p_peer_pool.destroy((i2p_peer*)p);
+				free_peer(p);
 				return 0;
 			}
 		}
@@ -1475,25 +1443,16 @@ namespace libtorrent
 			return 0;
 		}
 
-		iterator iter;
+		address_iterator iter;
 		peer* p = 0;
 
 		bool found = false;
+		std::pair<address_iterator, address_iterator> range = find_peers(remote.address());
 		if (m_torrent->settings().allow_multiple_connections_per_ip)
-		{
-			std::pair<iterator, iterator> range = find_peers(remote.address());
 			iter = std::find_if(range.first, range.second, match_peer_endpoint(remote));
-			if (iter != range.second) found = true;
-		}
 		else
-		{
-			iter = std::lower_bound(
-				m_peers.begin(), m_peers.end()
-				, remote.address(), peer_address_compare()
-			);
-
-			if (iter != m_peers.end() && (*iter)->address() == remote.address()) found = true;
-		}
+			iter = range.first;
+		if (iter != range.second) found = true;
 
 		if (!found)
 		{
@@ -1527,16 +1486,12 @@ namespace libtorrent
 			p->in_use = true;
 #endif
 
-			if (!insert_peer(p, iter, flags))
+			if (!insert_peer(p, flags))
 			{
 #if defined TORRENT_DEBUG || TORRENT_RELEASE_ASSERTS
 				p->in_use = false;
 #endif
-#if TORRENT_USE_IPV6
-				if (is_v6) m_torrent->session().m_ipv6_peer_pool.destroy((ipv6_peer*)p);
-				else
-#endif
-				m_torrent->session().m_ipv4_peer_pool.destroy((ipv4_peer*)p);
+				free_peer(p);
 				return 0;
 			}
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -1728,19 +1683,9 @@ namespace libtorrent
 		int connect_candidates = 0;
 
 		std::set<tcp::endpoint> unique_test;
-		const_iterator prev = m_peers.end();
 		for (const_iterator i = m_peers.begin();
 			i != m_peers.end(); ++i)
 		{
-			if (prev != m_peers.end()) ++prev;
-			if (i == m_peers.begin() + 1) prev = m_peers.begin();
-			if (prev != m_peers.end())
-			{
-				if (m_torrent->settings().allow_multiple_connections_per_ip)
-					TORRENT_ASSERT(!((*i)->address() < (*prev)->address()));
-				else
-					TORRENT_ASSERT((*prev)->address() < (*i)->address());
-			}
 			peer const& p = **i;
 			TORRENT_ASSERT(p.in_use);
 			if (is_connect_candidate(p, m_finished)) ++connect_candidates;
@@ -1749,8 +1694,8 @@ namespace libtorrent
 #endif
 			if (!m_torrent->settings().allow_multiple_connections_per_ip)
 			{
-				std::pair<const_iterator, const_iterator> range = find_peers(p.address());
-				TORRENT_ASSERT(range.second - range.first == 1);
+				std::pair<const_address_iterator, const_address_iterator> range = find_peers(p.address());
+				TORRENT_ASSERT(std::distance(range.first, range.second) == 1);
 			}
 			else
 			{
@@ -253,6 +253,10 @@ namespace libtorrent
 		// flush all blocks in-order
 		set.disk_cache_algorithm = session_settings::avoid_readback;
 
+		// don't let peers reading through a torrent once flush
+		// the pieces that are popular among many peers
+		set.read_cache_algorithm = session_settings::read_cache_2q;
+
 		set.explicit_read_cache = false;
 		// prevent fast pieces to interfere with suggested pieces
 		// since we unchoke everyone, we don't need fast pieces anyway
@@ -601,6 +605,12 @@ namespace libtorrent
 		TORRENT_SYNC_CALL2(refresh_torrent_status, ret, flags);
 	}
 
+	void session::get_status_diff(std::vector<char>* diff
+		, status_diff_cursor* cursor, boost::uint32_t flags) const
+	{
+		TORRENT_SYNC_CALL3(get_status_diff, diff, cursor, flags);
+	}
+
 	void session::post_torrent_updates()
 	{
 		TORRENT_ASYNC_CALL(post_torrent_updates);
@@ -1052,6 +1062,11 @@ namespace libtorrent
 		m_impl->pop_alerts(alerts);
 	}
 
+	void session::pop_alerts(std::vector<alert*>* alerts)
+	{
+		m_impl->pop_alerts(alerts);
+	}
+
 	alert const* session::wait_for_alert(time_duration max_wait)
 	{
 		return m_impl->wait_for_alert(max_wait);
@@ -1143,7 +1158,7 @@ namespace libtorrent
 		, urlseed_timeout(20)
 		, urlseed_pipeline_size(5)
 		, urlseed_wait_retry(30)
-		, file_pool_size(40)
+		, file_pool_size(-1)
 		, allow_multiple_connections_per_ip(false)
 		, max_failcount(3)
 		, min_reconnect_time(60)
@@ -1290,6 +1305,8 @@ namespace libtorrent
 #endif
 		, utp_dynamic_sock_buf(false) // this doesn't seem quite reliable yet
 		, utp_loss_multiplier(50) // specified in percent
+		, utp_pacing(true)
+		, utp_time_critical_target_delay(0) // milliseconds
 		, mixed_mode_algorithm(peer_proportional)
 		, rate_limit_utp(true)
 		, listen_queue_size(5)
@@ -1312,6 +1329,12 @@ namespace libtorrent
 		, support_share_mode(true)
 		, support_merkle_torrents(false)
 		, report_redundant_bytes(true)
+		, read_cache_algorithm(read_cache_lru)
+		, use_disk_cache_pool(true)
+		, hashing_threads(1)
+		, recheck_dirty_files_only(false)
+		, read_cursor_readahead(8 * 1024 * 1024)
+		, network_threads(0)
 	{}
 
 	session_settings::~session_settings() {}
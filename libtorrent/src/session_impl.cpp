@@ -432,6 +432,8 @@ namespace aux {
 		TORRENT_SETTING(integer, utp_delayed_ack)
 #endif
 		TORRENT_SETTING(boolean, utp_dynamic_sock_buf)
+		TORRENT_SETTING(boolean, utp_pacing)
+		TORRENT_SETTING(integer, utp_time_critical_target_delay)
 		TORRENT_SETTING(integer, mixed_mode_algorithm)
 		TORRENT_SETTING(boolean, rate_limit_utp)
 		TORRENT_SETTING(integer, listen_queue_size)
@@ -451,6 +453,13 @@ namespace aux {
 		TORRENT_SETTING(integer, tracker_backoff)
 		TORRENT_SETTING(boolean, ban_web_seeds)
 		TORRENT_SETTING(integer, max_http_recv_buffer_size)
+		TORRENT_SETTING(integer, read_cache_algorithm)
+		TORRENT_SETTING(boolean, use_disk_cache_pool)
+		TORRENT_SETTING(integer, hashing_threads)
+		TORRENT_SETTING(boolean, recheck_dirty_files_only)
+		TORRENT_SETTING(std_string, checkpoint_directory)
+		TORRENT_SETTING(integer, read_cursor_readahead)
+		TORRENT_SETTING(integer, network_threads)
 	};
 
 #undef TORRENT_SETTING
@@ -598,9 +607,9 @@ namespace aux {
 		, char const* listen_interface
 		, boost::uint32_t alert_mask
 		)
-		: m_ipv4_peer_pool(500)
+		: m_ipv4_peer_pool(sizeof(policy::ipv4_peer), 500)
 #if TORRENT_USE_IPV6
-		, m_ipv6_peer_pool(500)
+		, m_ipv6_peer_pool(sizeof(policy::ipv6_peer), 500)
 #endif
 #ifndef TORRENT_DISABLE_POOL_ALLOCATOR
 		, m_send_buffers(send_buffer_size)
@@ -612,6 +621,7 @@ namespace aux {
 #endif
 		, m_alerts(m_io_service, m_settings.alert_queue_size, alert_mask)
 		, m_disk_thread(m_io_service, boost::bind(&session_impl::on_disk_queue, this), m_files)
+		, m_net_thread_pool(m_io_service)
 		, m_half_open(m_io_service)
 		, m_download_rate(peer_connection::download_channel)
 #ifdef TORRENT_VERBOSE_BANDWIDTH_LIMIT
@@ -1745,6 +1755,12 @@ namespace aux {
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 		session_log(" *** session paused ***");
 #endif
+		// bring the torrents' time counters up to date before they
+		// stop counting
+		for (torrent_map::iterator i = m_torrents.begin()
+			, end(m_torrents.end()); i != end; ++i)
+			i->second->update_time_counters();
+
 		m_paused = true;
 		for (torrent_map::iterator i = m_torrents.begin()
 			, end(m_torrents.end()); i != end; ++i)
@@ -1759,6 +1775,11 @@ namespace aux {
 		TORRENT_ASSERT(is_network_thread());
 
 		if (!m_paused) return;
+		// the time the session was paused doesn't count
+		for (torrent_map::iterator i = m_torrents.begin()
+			, end(m_torrents.end()); i != end; ++i)
+			i->second->update_time_counters();
+
 		m_paused = false;
 		for (torrent_map::iterator i = m_torrents.begin()
 			, end(m_torrents.end()); i != end; ++i)
@@ -1821,6 +1842,7 @@ namespace aux {
 		{
 			i->second->abort();
 		}
+		TORRENT_ASSERT(m_ticking_torrents.empty());
 
 #if defined(TORRENT_VERBOSE_LOGGING) || defined(TORRENT_LOGGING)
 		session_log(" aborting all tracker requests");
@@ -1855,6 +1877,7 @@ namespace aux {
 			(*m_connections.begin())->disconnect(errors::stopping_torrent);
 			TORRENT_ASSERT_VAL(conn == int(m_connections.size()) + 1, conn);
 		}
+		m_pending_handshakes.clear();
 
 #if defined(TORRENT_VERBOSE_LOGGING) || defined(TORRENT_LOGGING)
 		session_log(" connection queue: %d", m_half_open.size());
@@ -1879,6 +1902,10 @@ namespace aux {
 		m_country_db = 0;
 #endif
 
+		// the outstanding writes are completed and their
+		// completions posted before the threads quit
+		m_net_thread_pool.stop();
+
 		m_disk_thread.abort();
 	}
 
@@ -1919,7 +1946,7 @@ namespace aux {
 		INVARIANT_CHECK;
 		TORRENT_ASSERT(is_network_thread());
 
-		TORRENT_ASSERT_VAL(s.file_pool_size > 0, s.file_pool_size);
+		TORRENT_ASSERT_VAL(s.file_pool_size > 0 || s.file_pool_size == -1, s.file_pool_size);
 
 		// less than 5 seconds unchoke interval is insane
 		TORRENT_ASSERT_VAL(s.unchoke_interval >= 5, s.unchoke_interval);
@@ -1949,6 +1976,11 @@ namespace aux {
 			|| m_settings.allow_reordered_disk_operations != s.allow_reordered_disk_operations
 			|| m_settings.file_pool_size != s.file_pool_size
 			|| m_settings.volatile_read_cache != s.volatile_read_cache
+			|| m_settings.read_cache_algorithm != s.read_cache_algorithm
+			|| m_settings.use_disk_cache_pool != s.use_disk_cache_pool
+			|| m_settings.hashing_threads != s.hashing_threads
+			|| m_settings.recheck_dirty_files_only != s.recheck_dirty_files_only
+			|| m_settings.checkpoint_directory != s.checkpoint_directory
 			|| m_settings.no_atime_storage!= s.no_atime_storage
 			|| m_settings.ignore_resume_timestamps != s.ignore_resume_timestamps
 			|| m_settings.no_recheck_incomplete_resume != s.no_recheck_incomplete_resume
@@ -2039,6 +2071,9 @@ namespace aux {
 		if (m_settings.alert_queue_size != s.alert_queue_size)
 			m_alerts.set_alert_queue_size_limit(s.alert_queue_size);
 
+		if (m_settings.network_threads != s.network_threads)
+			m_net_thread_pool.set_num_threads(s.network_threads);
+
 		if (m_settings.dht_upload_rate_limit != s.dht_upload_rate_limit)
 			m_udp_socket.set_rate_limit(s.dht_upload_rate_limit);
 
@@ -2853,6 +2888,7 @@ retry:
 				c->peer_exceeds_limit();
 
 			m_connections.insert(c);
+			m_pending_handshakes.push_back(c);
 			c->start();
 			// update the next disk peer round-robin cursor
 			if (m_next_disk_peer == m_connections.end()) m_next_disk_peer = m_connections.begin();
@@ -3204,75 +3240,68 @@ retry:
 		// check for incoming connections that might have timed out
 		// --------------------------------------------------------------
 
-		for (connection_map::iterator i = m_connections.begin();
-			i != m_connections.end();)
+		// incoming connections are queued in the order they were accepted,
+		// so we're done as soon as we find one that hasn't timed out yet
+		while (!m_pending_handshakes.empty())
 		{
-			peer_connection* p = (*i).get();
-			++i;
+			boost::intrusive_ptr<peer_connection> p = m_pending_handshakes.front();
 			// ignore connections that already have a torrent, since they
 			// are ticked through the torrents' second_tick
-			if (!p->associated_torrent().expired()) continue;
-			// TODO: have a separate list for these connections, instead of having to loop through all of them
-			if (m_last_tick - p->connected_time() > seconds(m_settings.handshake_timeout))
+			if (!p->is_disconnecting() && p->associated_torrent().expired())
+			{
+				if (m_last_tick - p->connected_time() <= seconds(m_settings.handshake_timeout))
+					break;
 				p->disconnect(errors::timed_out);
+			}
+			m_pending_handshakes.pop_front();
 		}
 
 		// --------------------------------------------------------------
-		// second_tick every torrent
+		// second_tick every torrent that has something to do
 		// --------------------------------------------------------------
 
+		// torrents that aren't ticked don't have any peers, so they can't
+		// be held back by their upload limit. They count as uncongested
 		int congested_torrents = 0;
-		int uncongested_torrents = 0;
 
-		// count the number of seeding torrents vs. downloading
-		// torrents we are running
-		int num_seeds = 0;
+		// count the number of downloading torrents we are ticking
+		// and their peers
 		int num_downloads = 0;
-
-		// count the number of peers of downloading torrents
 		int num_downloads_peers = 0;
 
-		torrent_map::iterator least_recently_scraped = m_torrents.end();
-		int num_paused_auto_managed = 0;
-
-		int num_checking = 0;
-		int num_queued = 0;
-		for (torrent_map::iterator i = m_torrents.begin();
-			i != m_torrents.end();)
+		for (int i = 0; i < int(m_ticking_torrents.size());)
 		{
-			torrent& t = *i->second;
+			torrent& t = *m_ticking_torrents[i];
 			TORRENT_ASSERT(!t.is_aborted());
 			if (t.statistics().upload_rate() * 11 / 10 > t.upload_limit())
 				++congested_torrents;
-			else
-				++uncongested_torrents;
 
-			if (t.state() == torrent_status::checking_files) ++num_checking;
-			else if (t.state() == torrent_status::queued_for_checking && !t.is_paused()) ++num_queued;
-
-			if (t.is_auto_managed() && t.is_paused() && !t.has_error())
-			{
-				++num_paused_auto_managed;
-				if (least_recently_scraped == m_torrents.end()
-					|| least_recently_scraped->second->seconds_since_last_scrape()
-						< t.seconds_since_last_scrape())
-				{
-					least_recently_scraped = i;
-				}
-			}
-
-			if (t.is_finished())
-			{
-				++num_seeds;
-			}
-			else
+			if (!t.is_finished())
 			{
 				++num_downloads;
 				num_downloads_peers += t.num_peers();
 			}
 
 			t.second_tick(m_stat, tick_interval_ms);
-			++i;
+
+			// a torrent that's left without peers or pending work stops
+			// being ticked, until it gets a peer or is resumed. Removing
+			// it moves the last torrent into this slot
+			if (t.want_tick()) ++i;
+			else t.stop_ticking();
+		}
+		int uncongested_torrents = int(m_torrents.size()) - congested_torrents;
+
+		// the torrents being checked and waiting to be checked
+		// are all in the checking queue
+		int num_checking = 0;
+		int num_queued = 0;
+		for (check_queue_t::iterator i = m_queued_for_checking.begin()
+			, end(m_queued_for_checking.end()); i != end; ++i)
+		{
+			torrent& t = **i;
+			if (t.state() == torrent_status::checking_files) ++num_checking;
+			else if (t.state() == torrent_status::queued_for_checking && !t.is_paused()) ++num_queued;
 		}
 
 		// some people claim that there sometimes can be cases where
@@ -3342,10 +3371,6 @@ retry:
 	
 		m_stat.second_tick(tick_interval_ms);
 
-		TORRENT_ASSERT(least_recently_scraped == m_torrents.end()
-			|| (least_recently_scraped->second->is_paused()
-			&& least_recently_scraped->second->is_auto_managed()));
-
 #ifdef TORRENT_STATS
 
 		if (m_stats_logging_enabled)
@@ -3363,6 +3388,23 @@ retry:
 			--m_auto_scrape_time_scaler;
 			if (m_auto_scrape_time_scaler <= 0)
 			{
+				torrent_map::iterator least_recently_scraped = m_torrents.end();
+				int num_paused_auto_managed = 0;
+				for (torrent_map::iterator i = m_torrents.begin()
+					, end(m_torrents.end()); i != end; ++i)
+				{
+					torrent& t = *i->second;
+					if (!t.is_auto_managed() || !t.is_paused() || t.has_error()) continue;
+
+					++num_paused_auto_managed;
+					if (least_recently_scraped == m_torrents.end()
+						|| least_recently_scraped->second->seconds_since_last_scrape()
+							< t.seconds_since_last_scrape())
+					{
+						least_recently_scraped = i;
+					}
+				}
+
 				m_auto_scrape_time_scaler = m_settings.auto_scrape_interval
 					/ (std::max)(1, num_paused_auto_managed);
 				if (m_auto_scrape_time_scaler < m_settings.auto_scrape_min_interval)
@@ -4921,6 +4963,90 @@ retry:
 			t->status(&*i, flags);
 		}
 	}
+
+	void session_impl::get_status_diff(std::vector<char>* diff
+		, status_diff_cursor* cursor, boost::uint32_t flags) const
+	{
+		diff->clear();
+
+		typedef std::map<sha1_hash, status_diff_cursor::torrent_entry> entries_t;
+		entries_t& entries = cursor->torrents;
+
+		// the pieces bitfield is diffed separately, against the
+		// one last reported through the cursor
+		boost::uint32_t const status_flags = flags & ~(torrent_handle::query_pieces
+			| torrent_handle::query_verified_pieces | torrent_handle::query_torrent_file);
+		bool const query_pieces = (flags & torrent_handle::query_pieces) != 0;
+
+		// the time counters change every second, so torrents can only
+		// be skipped without them. Neither can they if the caller asks
+		// for different fields than last time
+		bool const check_changed = (flags & status_diff_time_counters) == 0
+			&& cursor->flags == flags;
+		cursor->flags = flags;
+
+		std::vector<int> completed;
+		std::vector<int> lost;
+
+		// both m_torrents and the cursor are ordered by info-hash, walk
+		// them side by side to find added and removed torrents
+		entries_t::iterator e = entries.begin();
+		for (torrent_map::const_iterator i = m_torrents.begin()
+			, end(m_torrents.end()); i != end; ++i)
+		{
+			while (e != entries.end() && e->first < i->first)
+			{
+				write_status_removed(*diff, e->first);
+				entries.erase(e++);
+			}
+
+			torrent& t = *i->second;
+			if (t.is_aborted()) continue;
+
+			if (e == entries.end() || e->first != i->first)
+				e = entries.insert(e, std::make_pair(i->first, status_diff_cursor::torrent_entry()));
+
+			status_diff_cursor::torrent_entry& te = e->second;
+			++e;
+
+			// everything torrent_status reports changes either along with
+			// the status generation (state changes, pieces completed or
+			// lost, tracker responses etc.), the bytes transferred or the
+			// number of peers. If none of them did, there's nothing to diff
+			if (check_changed && te.reported
+				&& te.generation == t.status_generation()
+				&& te.total_transfer == t.total_transfer()
+				&& te.num_peers == t.num_peers())
+				continue;
+
+			te.generation = t.status_generation();
+			te.total_transfer = t.total_transfer();
+			te.num_peers = t.num_peers();
+
+			// the pieces are compared against the piece picker
+			// directly, rather than a copy of the have-bitfield
+			bool pieces_changed = false;
+			if (query_pieces)
+			{
+				completed.clear();
+				lost.clear();
+				pieces_changed = diff_status_pieces(te.pieces
+					, t.valid_metadata() ? t.torrent_file().num_pieces() : 0
+					, boost::bind(&torrent::have_piece, &t, _1), completed, lost);
+			}
+
+			torrent_status st;
+			t.status(&st, status_flags);
+			write_status_diff(*diff, te, st, flags
+				, pieces_changed ? &completed : 0, pieces_changed ? &lost : 0);
+		}
+
+		while (e != entries.end())
+		{
+			write_status_removed(*diff, e->first);
+			entries.erase(e++);
+		}
+	}
 	
 	void session_impl::post_torrent_updates()
 	{
@@ -5919,7 +6045,8 @@ retry:
 			if (getrlimit(RLIMIT_NOFILE, &l) == 0
 				&& l.rlim_cur != RLIM_INFINITY)
 			{
-				m_settings.connections_limit = l.rlim_cur - m_settings.file_pool_size;
+				m_settings.connections_limit = l.rlim_cur - (m_settings.file_pool_size == -1
+					? file_pool::default_size() : m_settings.file_pool_size);
 				if (m_settings.connections_limit < 5) m_settings.connections_limit = 5;
 			}
 #endif
@@ -5998,6 +6125,11 @@ retry:
 		m_alerts.get_all(alerts);
 	}
 
+	void session_impl::pop_alerts(std::vector<alert*>* alerts)
+	{
+		m_alerts.get_all(alerts);
+	}
+
 	alert const* session_impl::wait_for_alert(time_duration max_wait)
 	{
 		return m_alerts.wait_for_alert(max_wait);
@@ -238,7 +238,7 @@ namespace
 			h.update(j.buffer, j.buffer_size);
 			h.update((char const*)&m_salt, sizeof(m_salt));
 
-			std::pair<policy::iterator, policy::iterator> range
+			std::pair<policy::address_iterator, policy::address_iterator> range
 				= m_torrent.get_policy().find_peers(a);
 
 			// there is no peer with this address anymore
@@ -0,0 +1,360 @@
+/*
+
+Copyright (c) 2013, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/pch.hpp"
+
+#include "libtorrent/status_diff.hpp"
+#include "libtorrent/io.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <cstring>
+#include <cstddef> // for offsetof
+#include <algorithm>
+#include <iterator>
+
+namespace libtorrent
+{
+	namespace
+	{
+		enum { diff_string, diff_bool, diff_int, diff_size, diff_time, diff_seconds };
+
+		// this is used to map torrent_status fields to
+		// bits in the field mask of a diff record
+		struct status_diff_field
+		{
+			int offset; // struct offset
+			int type;
+
+			// the field is only compared when this flag is passed
+			// to get_status_diff(). 0 means it's always compared
+			boost::uint32_t flag;
+		};
+
+#define TORRENT_STATUS_FIELD(t, x, f) {offsetof(torrent_status, x), t, f},
+
+		// the position of a field in this table is its bit in the field
+		// mask. Only append to it, to keep the format stable
+		status_diff_field const status_diff_map[] =
+		{
+			TORRENT_STATUS_FIELD(diff_int, state, 0)
+			TORRENT_STATUS_FIELD(diff_bool, paused, 0)
+			TORRENT_STATUS_FIELD(diff_bool, auto_managed, 0)
+			TORRENT_STATUS_FIELD(diff_bool, sequential_download, 0)
+			TORRENT_STATUS_FIELD(diff_bool, user_defined_download, 0)
+			TORRENT_STATUS_FIELD(diff_bool, is_seeding, 0)
+			TORRENT_STATUS_FIELD(diff_bool, is_finished, 0)
+			TORRENT_STATUS_FIELD(diff_bool, has_metadata, 0)
+			TORRENT_STATUS_FIELD(diff_int, progress_ppm, 0)
+			TORRENT_STATUS_FIELD(diff_string, error, 0)
+			TORRENT_STATUS_FIELD(diff_string, save_path, torrent_handle::query_save_path)
+			TORRENT_STATUS_FIELD(diff_string, name, torrent_handle::query_name)
+			TORRENT_STATUS_FIELD(diff_seconds, next_announce, status_diff_time_counters)
+			TORRENT_STATUS_FIELD(diff_string, current_tracker, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_download, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_upload, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_payload_download, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_payload_upload, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_failed_bytes, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_redundant_bytes, 0)
+			TORRENT_STATUS_FIELD(diff_int, download_rate, 0)
+			TORRENT_STATUS_FIELD(diff_int, upload_rate, 0)
+			TORRENT_STATUS_FIELD(diff_int, download_payload_rate, 0)
+			TORRENT_STATUS_FIELD(diff_int, upload_payload_rate, 0)
+			TORRENT_STATUS_FIELD(diff_int, num_seeds, 0)
+			TORRENT_STATUS_FIELD(diff_int, num_peers, 0)
+			TORRENT_STATUS_FIELD(diff_int, num_complete, 0)
+			TORRENT_STATUS_FIELD(diff_int, num_incomplete, 0)
+			TORRENT_STATUS_FIELD(diff_int, list_seeds, 0)
+			TORRENT_STATUS_FIELD(diff_int, list_peers, 0)
+			TORRENT_STATUS_FIELD(diff_int, connect_candidates, 0)
+			TORRENT_STATUS_FIELD(diff_int, num_pieces, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_done, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_wanted_done, 0)
+			TORRENT_STATUS_FIELD(diff_size, total_wanted, 0)
+			TORRENT_STATUS_FIELD(diff_int, distributed_full_copies, 0)
+			TORRENT_STATUS_FIELD(diff_int, distributed_fraction, 0)
+			TORRENT_STATUS_FIELD(diff_int, block_size, 0)
+			TORRENT_STATUS_FIELD(diff_int, num_uploads, 0)
+			TORRENT_STATUS_FIELD(diff_int, num_connections, 0)
+			TORRENT_STATUS_FIELD(diff_int, uploads_limit, 0)
+			TORRENT_STATUS_FIELD(diff_int, connections_limit, 0)
+			TORRENT_STATUS_FIELD(diff_int, storage_mode, 0)
+			TORRENT_STATUS_FIELD(diff_int, up_bandwidth_queue, 0)
+			TORRENT_STATUS_FIELD(diff_int, down_bandwidth_queue, 0)
+			TORRENT_STATUS_FIELD(diff_size, all_time_upload, 0)
+			TORRENT_STATUS_FIELD(diff_size, all_time_download, 0)
+			TORRENT_STATUS_FIELD(diff_int, active_time, status_diff_time_counters)
+			TORRENT_STATUS_FIELD(diff_int, finished_time, status_diff_time_counters)
+			TORRENT_STATUS_FIELD(diff_int, seeding_time, status_diff_time_counters)
+			TORRENT_STATUS_FIELD(diff_int, seed_rank, 0)
+			TORRENT_STATUS_FIELD(diff_int, last_scrape, status_diff_time_counters)
+			TORRENT_STATUS_FIELD(diff_bool, has_incoming, 0)
+			TORRENT_STATUS_FIELD(diff_int, sparse_regions, 0)
+			TORRENT_STATUS_FIELD(diff_bool, seed_mode, 0)
+			TORRENT_STATUS_FIELD(diff_bool, upload_mode, 0)
+			TORRENT_STATUS_FIELD(diff_bool, share_mode, 0)
+			TORRENT_STATUS_FIELD(diff_bool, super_seeding, 0)
+			TORRENT_STATUS_FIELD(diff_int, priority, 0)
+			TORRENT_STATUS_FIELD(diff_time, added_time, 0)
+			TORRENT_STATUS_FIELD(diff_time, completed_time, 0)
+			TORRENT_STATUS_FIELD(diff_time, last_seen_complete, 0)
+			TORRENT_STATUS_FIELD(diff_int, time_since_upload, status_diff_time_counters)
+			TORRENT_STATUS_FIELD(diff_int, time_since_download, status_diff_time_counters)
+			TORRENT_STATUS_FIELD(diff_int, queue_position, 0)
+			TORRENT_STATUS_FIELD(diff_bool, need_save_resume, 0)
+			TORRENT_STATUS_FIELD(diff_bool, ip_filter_applies, 0)
+			TORRENT_STATUS_FIELD(diff_int, listen_port, 0)
+		};
+
+#undef TORRENT_STATUS_FIELD
+
+		const int num_status_diff_fields = sizeof(status_diff_map) / sizeof(status_diff_map[0]);
+
+		// the number of bytes of the field mask in a record
+		const int field_mask_size = (num_status_diff_fields + 7) / 8;
+
+		template <class OutIt>
+		void write_pieces(std::vector<int> const& pieces, OutIt& out)
+		{
+			detail::write_uint32(pieces.size(), out);
+			for (std::vector<int>::const_iterator i = pieces.begin()
+				, end(pieces.end()); i != end; ++i)
+				detail::write_uint32(*i, out);
+		}
+
+		bool read_pieces(char const*& buf, char const* end, bitfield& pieces, bool val)
+		{
+			if (end - buf < 4) return false;
+			boost::uint32_t num = detail::read_uint32(buf);
+			if (boost::uint32_t(end - buf) / 4 < num) return false;
+			for (boost::uint32_t i = 0; i < num; ++i)
+			{
+				boost::uint32_t index = detail::read_uint32(buf);
+				if (index >= pieces.size()) return false;
+				if (val) pieces.set_bit(index);
+				else pieces.clear_bit(index);
+			}
+			return true;
+		}
+	}
+
+	bool write_status_diff(std::vector<char>& buf
+		, status_diff_cursor::torrent_entry& e, torrent_status const& st
+		, boost::uint32_t flags, std::vector<int> const* completed
+		, std::vector<int> const* lost)
+	{
+		// the info-hash, the record flags and the field mask are
+		// filled in once we know which fields changed
+		std::size_t const start = buf.size();
+		buf.resize(start + 20 + 1 + field_mask_size);
+		std::back_insert_iterator<std::vector<char> > out(buf);
+
+		int record = e.reported ? 0 : status_diff_added;
+		bool changed = false;
+		char mask[field_mask_size];
+		std::memset(mask, 0, sizeof(mask));
+
+		for (int i = 0; i < num_status_diff_fields; ++i)
+		{
+			status_diff_field const& f = status_diff_map[i];
+			if (f.flag != 0 && (flags & f.flag) == 0) continue;
+
+			void const* src = ((char const*)&st) + f.offset;
+			void* dst = ((char*)&e.status) + f.offset;
+			switch (f.type)
+			{
+				case diff_string:
+				{
+					std::string const& s = *((std::string const*)src);
+					if (s == *((std::string*)dst)) continue;
+					*((std::string*)dst) = s;
+					int len = (std::min)(int(s.size()), 0xffff);
+					detail::write_uint16(len, out);
+					buf.insert(buf.end(), s.begin(), s.begin() + len);
+					break;
+				}
+				case diff_bool:
+					if (*((bool const*)src) == *((bool*)dst)) continue;
+					*((bool*)dst) = *((bool const*)src);
+					detail::write_uint8(*((bool const*)src), out);
+					break;
+				case diff_int:
+					if (*((int const*)src) == *((int*)dst)) continue;
+					*((int*)dst) = *((int const*)src);
+					detail::write_int32(*((int const*)src), out);
+					break;
+				case diff_size:
+					if (*((size_type const*)src) == *((size_type*)dst)) continue;
+					*((size_type*)dst) = *((size_type const*)src);
+					detail::write_int64(*((size_type const*)src), out);
+					break;
+				case diff_time:
+					if (*((time_t const*)src) == *((time_t*)dst)) continue;
+					*((time_t*)dst) = *((time_t const*)src);
+					detail::write_int64(*((time_t const*)src), out);
+					break;
+				case diff_seconds:
+				{
+					typedef boost::posix_time::time_duration duration;
+					int s = ((duration const*)src)->total_seconds();
+					if (s == ((duration*)dst)->total_seconds()) continue;
+					*((duration*)dst) = boost::posix_time::seconds(s);
+					detail::write_int32(s, out);
+					break;
+				}
+				default: TORRENT_ASSERT(false);
+			}
+			mask[i / 8] |= 0x80 >> (i & 7);
+			changed = true;
+		}
+
+		if (completed && lost)
+		{
+			record |= status_diff_pieces;
+			detail::write_uint32(e.pieces.size(), out);
+			write_pieces(*completed, out);
+			write_pieces(*lost, out);
+		}
+
+		if (!changed && record == 0)
+		{
+			buf.resize(start);
+			return false;
+		}
+
+		e.reported = true;
+		char* ptr = &buf[start];
+		std::memcpy(ptr, &st.info_hash[0], 20);
+		ptr += 20;
+		detail::write_uint8(record, ptr);
+		std::memcpy(ptr, mask, field_mask_size);
+		return true;
+	}
+
+	void write_status_removed(std::vector<char>& buf, sha1_hash const& ih)
+	{
+		buf.insert(buf.end(), ih.begin(), ih.end());
+		buf.push_back(status_diff_removed);
+	}
+
+	bool apply_status_diff(char const* buf, int size
+		, std::map<sha1_hash, torrent_status>& torrents)
+	{
+		char const* const end = buf + size;
+		while (buf < end)
+		{
+			if (end - buf < 20 + 1) return false;
+			sha1_hash ih;
+			std::memcpy(&ih[0], buf, 20);
+			buf += 20;
+			int record = detail::read_uint8(buf);
+
+			if (record & status_diff_removed)
+			{
+				torrents.erase(ih);
+				continue;
+			}
+
+			if (end - buf < field_mask_size) return false;
+			char const* mask = buf;
+			buf += field_mask_size;
+
+			torrent_status& st = torrents[ih];
+			if (record & status_diff_added) st = torrent_status();
+			st.info_hash = ih;
+
+			for (int i = 0; i < num_status_diff_fields; ++i)
+			{
+				if ((mask[i / 8] & (0x80 >> (i & 7))) == 0) continue;
+
+				status_diff_field const& f = status_diff_map[i];
+				void* dst = ((char*)&st) + f.offset;
+				switch (f.type)
+				{
+					case diff_string:
+					{
+						if (end - buf < 2) return false;
+						int len = detail::read_uint16(buf);
+						if (end - buf < len) return false;
+						((std::string*)dst)->assign(buf, len);
+						buf += len;
+						break;
+					}
+					case diff_bool:
+						if (end - buf < 1) return false;
+						*((bool*)dst) = detail::read_uint8(buf) != 0;
+						break;
+					case diff_int:
+						if (end - buf < 4) return false;
+						*((int*)dst) = detail::read_int32(buf);
+						break;
+					case diff_size:
+						if (end - buf < 8) return false;
+						*((size_type*)dst) = detail::read_int64(buf);
+						break;
+					case diff_time:
+						if (end - buf < 8) return false;
+						*((time_t*)dst) = time_t(detail::read_int64(buf));
+						break;
+					case diff_seconds:
+						if (end - buf < 4) return false;
+						*((boost::posix_time::time_duration*)dst)
+							= boost::posix_time::seconds(detail::read_int32(buf));
+						break;
+					default: TORRENT_ASSERT(false);
+				}
+			}
+
+			// the floating point fields are not part of the diff,
+			// they're derived the same way torrent::status() does
+#if !TORRENT_NO_FPU
+			st.progress = st.progress_ppm / 1000000.f;
+			if (st.distributed_full_copies < 0)
+				st.distributed_copies = -1.f;
+			else
+				st.distributed_copies = st.distributed_full_copies
+					+ float(st.distributed_fraction) / 1000;
+#endif
+
+			if (record & status_diff_pieces)
+			{
+				if (end - buf < 4) return false;
+				boost::uint32_t num_pieces = detail::read_uint32(buf);
+				if (int(num_pieces) < 0) return false;
+				st.pieces.resize(num_pieces, false);
+				if (!read_pieces(buf, end, st.pieces, true)) return false;
+				if (!read_pieces(buf, end, st.pieces, false)) return false;
+			}
+		}
+		return true;
+	}
+}
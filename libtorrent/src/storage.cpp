@@ -84,6 +84,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <sys/statfs.h>
 #endif
 
+#if TORRENT_USE_MMAP
+#include <sys/mman.h>
+#endif
+
 #if defined(__FreeBSD__)
 // for statfs()
 #include <sys/param.h>
@@ -92,6 +96,8 @@ POSSIBILITY OF SUCH DAMAGE.
 
 // for convert_to_wstring and convert_to_native
 #include "libtorrent/escape_string.hpp"
+#include "libtorrent/hash_pool.hpp"
+#include "libtorrent/part_file.hpp"
 
 namespace libtorrent
 {
@@ -135,12 +141,15 @@ namespace libtorrent
 		ignore_timestamps = 2
 	};
 
+	// if dirty is set, all files are compared, and the ones that don't
+	// match are flagged in it
 	bool match_filesizes(
 		file_storage const& fs
 		, std::string p
 		, std::vector<std::pair<size_type, std::time_t> > const& sizes
 		, int flags
-		, error_code& error)
+		, error_code& error
+		, std::vector<bool>* dirty = 0)
 	{
 		if ((int)sizes.size() != fs.num_files())
 		{
@@ -149,6 +158,9 @@ namespace libtorrent
 		}
 		p = complete(p);
 
+		bool ret = true;
+		if (dirty) dirty->assign(fs.num_files(), false);
+
 		std::vector<std::pair<size_type, std::time_t> >::const_iterator size_iter
 			= sizes.begin();
 		for (file_storage::iterator i = fs.begin()
@@ -172,7 +184,10 @@ namespace libtorrent
 				|| (!(flags & compact_mode) && size < size_iter->first))
 			{
 				error = errors::mismatching_file_size;
-				return false;
+				if (!dirty) return false;
+				(*dirty)[i - fs.begin()] = true;
+				ret = false;
+				continue;
 			}
 
 			if (flags & ignore_timestamps) continue;
@@ -187,10 +202,12 @@ namespace libtorrent
 				(!(flags & compact_mode) && (time > size_iter->second + 5 * 60 || time < size_iter->second - 1)))
 			{
 				error = errors::mismatching_file_timestamp;
-				return false;
+				if (!dirty) return false;
+				(*dirty)[i - fs.begin()] = true;
+				ret = false;
 			}
 		}
-		return true;
+		return ret;
 	}
 
 	void storage_interface::set_error(std::string const& file, error_code const& ec) const
@@ -230,6 +247,34 @@ namespace libtorrent
 		return ret;
 	}
 
+	int storage_interface::writev_range(file::iovec_t const* bufs, int slot
+		, int offset, int num_bufs, int slot_size, int flags)
+	{
+		int ret = 0;
+		file::iovec_t const* end = bufs + num_bufs;
+		while (bufs < end)
+		{
+			// collect the buffers that belong to this slot. A buffer is
+			// not expected to straddle a slot boundary
+			file::iovec_t const* i = bufs;
+			int size = 0;
+			while (i < end && offset + size < slot_size)
+			{
+				size += i->iov_len;
+				++i;
+			}
+			TORRENT_ASSERT(offset + size <= slot_size || i == end);
+			int r = writev(bufs, slot, offset, i - bufs, flags);
+			if (r < 0) return r;
+			ret += r;
+			if (r != size) return ret;
+			bufs = i;
+			++slot;
+			offset = 0;
+		}
+		return ret;
+	}
+
 	int copy_bufs(file::iovec_t const* bufs, int bytes, file::iovec_t* target)
 	{
 		int size = 0;
@@ -395,6 +440,15 @@ namespace libtorrent
 
 		TORRENT_ASSERT(m_files.begin() != m_files.end());
 		m_save_path = complete(path);
+
+		// the part file isn't touched until something is written
+		// to a file with priority 0
+		m_part_file_name = "." + m_files.name() + ".parts";
+		if (m_files.num_pieces() > 0)
+		{
+			m_part_file.reset(new part_file(m_save_path, m_part_file_name
+				, m_files.num_pieces(), m_files.piece_length()));
+		}
 	}
 
 	default_storage::~default_storage() { m_pool.release(this); }
@@ -462,7 +516,6 @@ namespace libtorrent
 			ec.clear();
 		}
 
-		std::vector<boost::uint8_t>().swap(m_file_priority);
 		// close files that were opened in write mode
 		m_pool.release(this);
 
@@ -475,6 +528,9 @@ namespace libtorrent
 
 	bool default_storage::has_any_file()
 	{
+		if (m_part_file && exists(combine_path(m_save_path, m_part_file_name)))
+			return true;
+
 		file_storage::iterator i = files().begin();
 		file_storage::iterator end = files().end();
 
@@ -532,6 +588,17 @@ namespace libtorrent
 	bool default_storage::release_files()
 	{
 		m_pool.release(this);
+
+		if (m_part_file)
+		{
+			error_code ec;
+			m_part_file->flush_metadata(ec);
+			if (ec)
+			{
+				set_error(combine_path(m_save_path, m_part_file_name), ec);
+				return true;
+			}
+		}
 		return false;
 	}
 
@@ -549,6 +616,13 @@ namespace libtorrent
 		// make sure we don't have the files open
 		m_pool.release(this);
 
+		if (m_part_file)
+		{
+			error_code ec;
+			m_part_file->remove(ec);
+			if (ec) set_error(combine_path(m_save_path, m_part_file_name), ec);
+		}
+
 		// delete the files from disk
 		std::set<std::string> directories;
 		typedef std::set<std::string>::iterator iter_t;
@@ -629,6 +703,8 @@ namespace libtorrent
 
 	bool default_storage::verify_resume_data(lazy_entry const& rd, error_code& error)
 	{
+		m_dirty_files.clear();
+
 		// TODO: make this more generic to not just work if files have been
 		// renamed, but also if they have been merged into a single file for instance
 		// maybe use the same format as .torrent files and reuse some code from torrent_info
@@ -744,8 +820,15 @@ namespace libtorrent
 		int flags = (full_allocation_mode ? 0 : compact_mode)
 			| (settings().ignore_resume_timestamps ? ignore_timestamps : 0);
 
-		return match_filesizes(files(), m_save_path, file_sizes, flags, error);
+		return match_filesizes(files(), m_save_path, file_sizes, flags, error
+			, &m_dirty_files);
+	}
 
+	bool default_storage::dirty_files(std::vector<bool>& dirty) const
+	{
+		if (m_dirty_files.empty()) return false;
+		dirty = m_dirty_files;
+		return true;
 	}
 
 	// returns true on success
@@ -798,6 +881,17 @@ namespace libtorrent
 			}
 		}
 
+		if (ret && m_part_file)
+		{
+			ec.clear();
+			m_part_file->move_partfile(save_path, ec);
+			if (ec)
+			{
+				set_error(combine_path(m_save_path, m_part_file_name), ec);
+				ret = false;
+			}
+		}
+
 		if (ret) m_save_path = save_path;
 
 		return ret;
@@ -947,6 +1041,153 @@ ret:
 #endif
 	}
 
+	int default_storage::writev_range(file::iovec_t const* bufs, int slot, int offset
+		, int num_bufs, int slot_size, int flags)
+	{
+		// the part file is addressed by slot, so writes touching
+		// unwanted files go one slot at a time
+		if (m_part_file && std::find(m_file_priority.begin()
+			, m_file_priority.end(), 0) != m_file_priority.end())
+		{
+			return storage_interface::writev_range(bufs, slot, offset
+				, num_bufs, slot_size, flags);
+		}
+
+		// the files are laid out back to back in torrent order, so
+		// the range maps to the files without regard to the slots
+		fileop op = { &file::writev, &default_storage::write_unaligned
+			, m_settings ? settings().disk_io_write_mode : 0, file::read_write | flags };
+		return readwritev(bufs, slot, offset, num_bufs, op, true);
+	}
+
+	bool default_storage::has_unwanted_file(int slot) const
+	{
+		std::vector<file_slice> slices = files().map_block(slot, 0
+			, files().piece_size(slot));
+		for (std::vector<file_slice>::iterator i = slices.begin()
+			, end(slices.end()); i != end; ++i)
+		{
+			if (files().at(i->file_index).pad_file) continue;
+			if (use_part_file(i->file_index)) return true;
+		}
+		return false;
+	}
+
+	void default_storage::import_to_part_file(int slot, int file_index, error_code& ec)
+	{
+		file_storage const& fs = files();
+		size_type const slot_start = size_type(slot) * fs.piece_length();
+		std::vector<file_slice> slices = fs.map_block(slot, 0, fs.piece_size(slot));
+		std::vector<char> buf;
+		for (std::vector<file_slice>::iterator i = slices.begin()
+			, end(slices.end()); i != end; ++i)
+		{
+			if (file_index >= 0 && i->file_index != file_index) continue;
+			file_storage::iterator fe = fs.begin() + i->file_index;
+			if (fe->pad_file || i->size == 0 || !use_part_file(i->file_index)) continue;
+
+			// if the file was never created, there's nothing to copy
+			error_code fec;
+			boost::intrusive_ptr<file> f = open_file(fe, file::read_only, fec);
+			if (fec) continue;
+
+			buf.resize(i->size);
+			file::iovec_t b = { &buf[0], size_t(i->size) };
+			size_type ret = f->readv(fs.file_base(*fe) + i->offset, &b, 1, fec);
+			if (fec) { ec = fec; return; }
+			if (ret <= 0) continue;
+
+			b.iov_len = size_t(ret);
+			int offset = int(fs.file_offset(*fe) + i->offset - slot_start);
+			m_part_file->writev(&b, 1, slot, offset, ec);
+			if (ec) return;
+		}
+	}
+
+	void default_storage::set_file_priority(std::vector<boost::uint8_t> const& prio)
+	{
+		// files past the end of the list have priority 1
+		if (prio.size() > m_file_priority.size())
+			m_file_priority.resize(prio.size(), 1);
+
+		std::vector<int> wanted;
+		std::vector<int> unwanted;
+		for (int i = 0; i < int(prio.size()); ++i)
+		{
+			if (m_file_priority[i] == 0 && prio[i] != 0) wanted.push_back(i);
+			if (m_file_priority[i] != 0 && prio[i] == 0) unwanted.push_back(i);
+			m_file_priority[i] = prio[i];
+		}
+
+		if (!m_part_file) return;
+
+		file_storage const& fs = files();
+		int piece_length = fs.piece_length();
+
+		// pieces that already have a part file slot are read from it
+		// entirely, so the parts of them the files that became unwanted
+		// have on disk must be copied in. Pieces without a slot get
+		// theirs copied when they're first written to the part file
+		for (std::vector<int>::iterator i = unwanted.begin(), end(unwanted.end());
+			i != end; ++i)
+		{
+			file_storage::iterator fe = fs.begin() + *i;
+			if (fe->pad_file || fe->size == 0) continue;
+
+			int first = int(fs.file_offset(*fe) / piece_length);
+			int last = int((fs.file_offset(*fe) + fe->size - 1) / piece_length);
+			for (int p = first; p <= last; ++p)
+			{
+				if (!m_part_file->has_piece(p)) continue;
+				error_code ec;
+				import_to_part_file(p, *i, ec);
+				if (ec)
+				{
+					set_error(combine_path(m_save_path, fs.file_path(*fe)), ec);
+					return;
+				}
+			}
+		}
+
+		// move the parts of the files that are wanted now out of
+		// the part file, into the files themselves
+		for (std::vector<int>::iterator i = wanted.begin(), end(wanted.end());
+			i != end; ++i)
+		{
+			file_storage::iterator fe = fs.begin() + *i;
+			if (fe->pad_file || fe->size == 0) continue;
+
+			error_code ec;
+			std::string path = combine_path(m_save_path, fs.file_path(*fe));
+			boost::intrusive_ptr<file> f = open_file(fe, file::read_write, ec);
+			if (ec == boost::system::errc::no_such_file_or_directory)
+			{
+				ec.clear();
+				create_directories(parent_path(path), ec);
+				if (!ec) f = open_file(fe, file::read_write, ec);
+			}
+			if (!ec) m_part_file->export_file(*f, fs.file_offset(*fe), fe->size, ec);
+			if (ec)
+			{
+				set_error(path, ec);
+				return;
+			}
+
+			// the pieces that don't overlap any unwanted
+			// file anymore are done with the part file
+			int first = int(fs.file_offset(*fe) / piece_length);
+			int last = int((fs.file_offset(*fe) + fe->size - 1) / piece_length);
+			for (int p = first; p <= last; ++p)
+			{
+				if (!has_unwanted_file(p)) m_part_file->free_piece(p);
+			}
+		}
+
+		error_code ec;
+		m_part_file->flush_metadata(ec);
+		if (ec) set_error(combine_path(m_save_path, m_part_file_name), ec);
+	}
+
 	size_type default_storage::physical_offset(int slot, int offset)
 	{
 		TORRENT_ASSERT(slot >= 0);
@@ -1068,7 +1309,7 @@ ret:
 	// is a template, and the fileop decides what to do with the
 	// file and the buffers.
 	int default_storage::readwritev(file::iovec_t const* bufs, int slot, int offset
-		, int num_bufs, fileop const& op)
+		, int num_bufs, fileop const& op, bool span_slots)
 	{
 		TORRENT_ASSERT(bufs != 0);
 		TORRENT_ASSERT(slot >= 0);
@@ -1103,7 +1344,7 @@ ret:
 		int bytes_left = size;
 		int slot_size = static_cast<int>(m_files.piece_size(slot));
 
-		if (offset + bytes_left > slot_size)
+		if (!span_slots && offset + bytes_left > slot_size)
 			bytes_left = slot_size - offset;
 
 		TORRENT_ASSERT(bytes_left >= 0);
@@ -1153,6 +1394,46 @@ ret:
 				continue;
 			}
 
+			if (use_part_file(files().file_index(*file_iter)))
+			{
+				size_type slice_start = files().file_offset(*file_iter) + file_offset;
+				int part_slot = int(slice_start / m_files.piece_length());
+				int part_offset = int(slice_start % m_files.piece_length());
+				bool write = (op.mode & file::rw_mask) != file::read_only;
+
+				// the file may have been downloaded before it was made
+				// unwanted, only read from the part file what's in it
+				if (write || m_part_file->has_piece(part_slot))
+				{
+					int num_tmp_bufs = copy_bufs(current_buf, file_bytes_left, tmp_bufs);
+					error_code ec;
+					// the files may have parts of this piece from when
+					// they were wanted. From now on the piece is read
+					// from the part file, so those parts go there too
+					if (write && !m_part_file->has_piece(part_slot))
+						import_to_part_file(part_slot, -1, ec);
+					if (ec)
+					{
+						set_error(combine_path(m_save_path, m_part_file_name), ec);
+						return -1;
+					}
+					int bytes_transferred = write
+						? m_part_file->writev(tmp_bufs, num_tmp_bufs, part_slot, part_offset, ec)
+						: m_part_file->readv(tmp_bufs, num_tmp_bufs, part_slot, part_offset, ec);
+					if (ec)
+					{
+						set_error(combine_path(m_save_path, m_part_file_name), ec);
+						return -1;
+					}
+					if (file_bytes_left != bytes_transferred)
+						return bytes_transferred;
+
+					advance_bufs(current_buf, file_bytes_left);
+					file_offset = 0;
+					continue;
+				}
+			}
+
 			error_code ec;
 			file_handle = open_file(file_iter, op.mode, ec);
 			if (((op.mode & file::rw_mask) == file::read_write) && ec == boost::system::errc::no_such_file_or_directory)
@@ -1350,7 +1631,15 @@ ret:
 	boost::intrusive_ptr<file> default_storage::open_file(file_storage::iterator fe, int mode
 		, error_code& ec) const
 	{
-		int cache_setting = m_settings ? settings().disk_io_write_mode : 0;
+		// files opened for reading follow the read mode. The file pool
+		// reopens a file when this changes, so direct I/O wants both
+		// modes to disable the OS cache
+		int cache_setting = 0;
+		if (m_settings)
+		{
+			cache_setting = (mode & file::rw_mask) == file::read_only
+				? settings().disk_io_read_mode : settings().disk_io_write_mode;
+		}
 		if (cache_setting == session_settings::disable_os_cache
 			|| (cache_setting == session_settings::disable_os_cache_for_aligned_files
 			&& ((fe->offset + files().file_base(*fe)) & (m_page_size-1)) == 0))
@@ -1370,6 +1659,209 @@ ret:
 		return new default_storage(fs, mapped, path, fp, file_prio);
 	}
 
+#if TORRENT_USE_MMAP
+	mmap_storage::mmap_storage(file_storage const& fs, file_storage const* mapped
+		, std::string const& path, file_pool& fp, std::vector<boost::uint8_t> const& file_prio)
+		: default_storage(fs, mapped, path, fp, file_prio)
+	{}
+
+	mmap_storage::~mmap_storage() { unmap_all(); }
+
+	void mmap_storage::unmap_file(int index)
+	{
+		if (index >= int(m_mappings.size())) return;
+		mapped_file& m = m_mappings[index];
+		if (m.base) munmap(m.base, m.size);
+		m = mapped_file();
+	}
+
+	void mmap_storage::unmap_all()
+	{
+		for (int i = 0; i < int(m_mappings.size()); ++i)
+			unmap_file(i);
+		m_mappings.clear();
+	}
+
+	char const* mmap_storage::map_range(file_storage::iterator fe
+		, size_type file_offset, int size)
+	{
+		int index = fe - files().begin();
+		if (int(m_mappings.size()) <= index) m_mappings.resize(files().num_files());
+		mapped_file& m = m_mappings[index];
+		size_type start = files().file_base(*fe) + file_offset;
+		if (m.base && start + size <= m.size) return m.base + start;
+
+		// either the file isn't mapped yet, or it has grown since it
+		// was mapped. Map the whole file as it is on disk now
+		unmap_file(index);
+		error_code ec;
+		boost::intrusive_ptr<file> f = open_file(fe, file::read_only | file::random_access, ec);
+		if (!f || ec) return 0;
+		size_type file_size = f->get_size(ec);
+		if (ec || file_size < start + size) return 0;
+		// the file may not fit in the address space
+		if (size_type(size_t(file_size)) != file_size) return 0;
+
+		void* p = mmap(0, file_size, PROT_READ, MAP_SHARED, f->native_handle(), 0);
+		if (p == MAP_FAILED) return 0;
+		m.base = (char*)p;
+		m.size = file_size;
+		return m.base + start;
+	}
+
+	int mmap_storage::readv(file::iovec_t const* bufs, int slot, int offset
+		, int num_bufs, int flags)
+	{
+		TORRENT_ASSERT(bufs != 0);
+		TORRENT_ASSERT(slot >= 0);
+		TORRENT_ASSERT(slot < m_files.num_pieces());
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(num_bufs > 0);
+
+		int size = bufs_size(bufs, num_bufs);
+		size_type start = slot * (size_type)m_files.piece_length() + offset;
+		TORRENT_ASSERT(start + size <= m_files.total_size());
+
+		file_storage::iterator file_iter = files().file_at_offset(start);
+		TORRENT_ASSERT(file_iter != files().end());
+		size_type file_offset = start - files().file_offset(*file_iter);
+
+		int bytes_left = size;
+		int slot_size = static_cast<int>(m_files.piece_size(slot));
+		if (offset + bytes_left > slot_size)
+			bytes_left = slot_size - offset;
+
+		file::iovec_t* tmp_bufs = TORRENT_ALLOCA(file::iovec_t, num_bufs);
+		file::iovec_t* current_buf = TORRENT_ALLOCA(file::iovec_t, num_bufs);
+		copy_bufs(bufs, size, current_buf);
+		int file_bytes_left;
+		for (;bytes_left > 0; ++file_iter, bytes_left -= file_bytes_left)
+		{
+			TORRENT_ASSERT(file_iter != files().end());
+
+			file_bytes_left = bytes_left;
+			if (file_offset + file_bytes_left > file_iter->size)
+				file_bytes_left = (std::max)(static_cast<int>(file_iter->size - file_offset), 0);
+
+			if (file_bytes_left == 0) continue;
+
+			int num_tmp_bufs = copy_bufs(current_buf, file_bytes_left, tmp_bufs);
+			if (file_iter->pad_file)
+			{
+				clear_bufs(tmp_bufs, num_tmp_bufs);
+				advance_bufs(current_buf, file_bytes_left);
+				file_offset = 0;
+				continue;
+			}
+
+			// unwanted files may be stored in the part file
+			if (use_part_file(files().file_index(*file_iter)))
+				return default_storage::readv(bufs, slot, offset, num_bufs, flags);
+
+			char const* src = map_range(file_iter, file_offset, file_bytes_left);
+
+			// this part of the file isn't on disk (yet). Let the
+			// regular code path deal with it (and report the error)
+			if (src == 0) return default_storage::readv(bufs, slot, offset, num_bufs, flags);
+
+			// tell the kernel whether to read ahead in this file, based
+			// on whether this read picks up where the last one ended
+			mapped_file& m = m_mappings[file_iter - files().begin()];
+			size_type read_start = src - m.base;
+			bool sequential = read_start == m.last_read_end;
+			if (sequential != m.sequential)
+			{
+				madvise(m.base, m.size, sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+				m.sequential = sequential;
+			}
+			m.last_read_end = read_start + file_bytes_left;
+
+			for (file::iovec_t const* i = tmp_bufs, *end(tmp_bufs + num_tmp_bufs);
+				i < end; ++i)
+			{
+				std::memcpy(i->iov_base, src, i->iov_len);
+				src += i->iov_len;
+			}
+			advance_bufs(current_buf, file_bytes_left);
+			file_offset = 0;
+		}
+		return size;
+	}
+
+	void mmap_storage::hint_read(int slot, int offset, int size)
+	{
+		size_type start = slot * (size_type)m_files.piece_length() + offset;
+		TORRENT_ASSERT(start + size <= m_files.total_size());
+
+		file_storage::iterator file_iter = files().file_at_offset(start);
+		TORRENT_ASSERT(file_iter != files().end());
+		size_type file_offset = start - files().file_offset(*file_iter);
+
+		int bytes_left = size;
+		int slot_size = static_cast<int>(m_files.piece_size(slot));
+		if (offset + bytes_left > slot_size)
+			bytes_left = slot_size - offset;
+
+		int file_bytes_left;
+		for (;bytes_left > 0; ++file_iter, bytes_left -= file_bytes_left)
+		{
+			TORRENT_ASSERT(file_iter != files().end());
+
+			file_bytes_left = bytes_left;
+			if (file_offset + file_bytes_left > file_iter->size)
+				file_bytes_left = (std::max)(static_cast<int>(file_iter->size - file_offset), 0);
+
+			if (file_bytes_left == 0 || file_iter->pad_file) continue;
+
+			// failing to hint is not a big deal, the read will
+			// fall back to default_storage in that case anyway
+			char const* p = map_range(file_iter, file_offset, file_bytes_left);
+			file_offset = 0;
+			if (p == 0) continue;
+
+			// madvise() requires a page aligned address
+			uintptr_t page_start = uintptr_t(p) & ~uintptr_t(m_page_size - 1);
+			madvise((void*)page_start, file_bytes_left + (uintptr_t(p) - page_start)
+				, MADV_WILLNEED);
+		}
+	}
+
+	bool mmap_storage::rename_file(int index, std::string const& new_filename)
+	{
+		unmap_file(index);
+		return default_storage::rename_file(index, new_filename);
+	}
+
+	bool mmap_storage::release_files()
+	{
+		unmap_all();
+		return default_storage::release_files();
+	}
+
+	bool mmap_storage::delete_files()
+	{
+		unmap_all();
+		return default_storage::delete_files();
+	}
+
+	bool mmap_storage::move_storage(std::string const& save_path)
+	{
+		unmap_all();
+		return default_storage::move_storage(save_path);
+	}
+#endif
+
+	storage_interface* mmap_storage_constructor(file_storage const& fs
+		, file_storage const* mapped, std::string const& path, file_pool& fp
+		, std::vector<boost::uint8_t> const& file_prio)
+	{
+#if TORRENT_USE_MMAP
+		return new mmap_storage(fs, mapped, path, fp, file_prio);
+#else
+		return new default_storage(fs, mapped, path, fp, file_prio);
+#endif
+	}
+
 	int disabled_storage::readv(file::iovec_t const* bufs, int slot, int offset, int num_bufs, int flags)
 	{
 #ifdef TORRENT_DISK_STATS
@@ -1444,6 +1936,7 @@ ret:
 		, m_current_slot(0)
 		, m_out_of_place(false)
 		, m_scratch_piece(-1)
+		, m_check_buffer_size(0)
 		, m_last_piece(-1)
 		, m_storage_constructor(sc)
 		, m_io_thread(io)
@@ -1475,11 +1968,14 @@ ret:
 	}
 
 	void piece_manager::async_release_files(
-		boost::function<void(int, disk_io_job const&)> const& handler)
+		boost::function<void(int, disk_io_job const&)> const& handler
+		, int flags)
 	{
 		disk_io_job j;
 		j.storage = this;
 		j.action = disk_io_job::release_files;
+		// the offset field carries the release_flags_t
+		j.offset = flags;
 		m_io_thread.add_job(j, handler);
 	}
 
@@ -1508,13 +2004,16 @@ ret:
 	}
 
 	void piece_manager::async_check_fastresume(lazy_entry const* resume_data
-		, boost::function<void(int, disk_io_job const&)> const& handler)
+		, boost::function<void(int, disk_io_job const&)> const& handler
+		, int flags)
 	{
 		TORRENT_ASSERT(resume_data != 0);
 		disk_io_job j;
 		j.storage = this;
 		j.action = disk_io_job::check_fastresume;
 		j.buffer = (char*)resume_data;
+		// the offset field carries the check_fastresume_flags_t
+		j.offset = flags;
 		m_io_thread.add_job(j, handler);
 	}
 
@@ -1576,6 +2075,27 @@ ret:
 		m_io_thread.add_job(j, handler);
 	}
 
+	void piece_manager::async_set_read_cursor(int cursor, int piece, int num_pieces)
+	{
+		disk_io_job j;
+		j.storage = this;
+		j.action = disk_io_job::update_read_cursor;
+		j.piece = piece;
+		j.offset = cursor;
+		j.max_cache_line = num_pieces;
+		m_io_thread.add_job(j);
+	}
+
+	void piece_manager::async_set_file_priority(std::vector<boost::uint8_t> const& prio
+		, boost::function<void(int, disk_io_job const&)> const& handler)
+	{
+		disk_io_job j;
+		j.storage = this;
+		j.action = disk_io_job::file_priority;
+		j.str.assign(prio.begin(), prio.end());
+		m_io_thread.add_job(j, handler);
+	}
+
 	void piece_manager::async_read(
 		peer_request const& r
 		, boost::function<void(int, disk_io_job const&)> const& handler
@@ -1765,7 +2285,86 @@ ret:
 		// only save the partial hash if the write succeeds
 		if (ret != size) return ret;
 
-		if (m_storage->settings().disable_hash_checks) return ret;
+		update_partial_hash(iov, piece_index, offset, num_bufs);
+		return ret;
+	}
+
+	int piece_manager::write_range_impl(
+		file::iovec_t* bufs
+	  , int piece_index
+	  , int offset
+	  , int num_bufs)
+	{
+		TORRENT_ASSERT(bufs);
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(num_bufs > 0);
+		TORRENT_ASSERT(piece_index >= 0 && piece_index < m_files.num_pieces());
+
+		int size = bufs_size(bufs, num_bufs);
+		int piece_size = m_files.piece_length();
+		if (offset + size <= m_files.piece_size(piece_index))
+			return write_impl(bufs, piece_index, offset, num_bufs);
+
+		// split the buffers up at the piece boundaries. The buffers are
+		// whole blocks, so none of them straddles two pieces
+		std::vector<std::pair<int, int> > ranges;
+		int first_slot = -1;
+		bool adjacent = true;
+		int buf_pos = 0;
+		for (int piece = piece_index, start = offset; buf_pos < num_bufs; ++piece, start = 0)
+		{
+			TORRENT_ASSERT(piece < m_files.num_pieces());
+			int n = 0;
+			for (int bytes = start; buf_pos + n < num_bufs && bytes < piece_size; ++n)
+				bytes += bufs[buf_pos + n].iov_len;
+			ranges.push_back(std::make_pair(buf_pos, n));
+			buf_pos += n;
+
+			int slot = allocate_slot_for_piece(piece);
+			if (first_slot == -1) first_slot = slot;
+			else if (slot != first_slot + piece - piece_index) adjacent = false;
+		}
+
+		file::iovec_t* iov = TORRENT_ALLOCA(file::iovec_t, num_bufs);
+		std::copy(bufs, bufs + num_bufs, iov);
+		m_last_piece = piece_index + ranges.size() - 1;
+
+		int ret = 0;
+		if (adjacent)
+		{
+			ret = m_storage->writev_range(bufs, first_slot, offset, num_bufs, piece_size);
+			// only save the partial hash if the write succeeds
+			if (ret != size) return ret;
+		}
+		else
+		{
+			// the pieces are not in adjacent slots (compact allocation)
+			// write them one at a time
+			for (int i = 0; i < int(ranges.size()); ++i)
+			{
+				int r = write_impl(bufs + ranges[i].first, piece_index + i
+					, i == 0 ? offset : 0, ranges[i].second);
+				if (r < 0) return r;
+				ret += r;
+				if (r != bufs_size(bufs + ranges[i].first, ranges[i].second)) return ret;
+			}
+			return ret;
+		}
+
+		for (int i = 0; i < int(ranges.size()); ++i)
+		{
+			update_partial_hash(iov + ranges[i].first, piece_index + i
+				, i == 0 ? offset : 0, ranges[i].second);
+		}
+		return ret;
+	}
+
+	void piece_manager::update_partial_hash(file::iovec_t const* bufs
+		, int piece_index, int offset, int num_bufs)
+	{
+		if (m_storage->settings().disable_hash_checks) return;
+
+		int size = bufs_size(bufs, num_bufs);
 
 		if (offset == 0)
 		{
@@ -1773,7 +2372,7 @@ ret:
 			TORRENT_ASSERT(ph.offset == 0);
 			ph.offset = size;
 
-			for (file::iovec_t* i = iov, *end(iov + num_bufs); i < end; ++i)
+			for (file::iovec_t const* i = bufs, *end(bufs + num_bufs); i < end; ++i)
 				ph.h.update((char const*)i->iov_base, i->iov_len);
 
 		}
@@ -1798,7 +2397,7 @@ ret:
 						<< " entries: " << m_piece_hasher.size()
 						<< " ]" << std::endl;
 #endif
-					for (file::iovec_t* b = iov, *end(iov + num_bufs); b < end; ++b)
+					for (file::iovec_t const* b = bufs, *end(bufs + num_bufs); b < end; ++b)
 					{
 						i->second.h.update((char const*)b->iov_base, b->iov_len);
 						i->second.offset += b->iov_len;
@@ -1830,8 +2429,6 @@ ret:
 			}
 #endif
 		}
-		
-		return ret;
 	}
 
 	size_type piece_manager::physical_offset(
@@ -1956,6 +2553,13 @@ ret:
 
 	int piece_manager::check_no_fastresume(error_code& error)
 	{
+		// after a crash there's no (up to date) resume data, but
+		// the checkpoint may still tell us which pieces we have
+		if (m_checkpoint.loaded() && init_checkpoint_check())
+			return need_full_check;
+
+		m_resume_pieces.clear();
+		m_checkpoint.clear_have();
 		bool has_files = false;
 		if (!m_storage->settings().no_recheck_incomplete_resume)
 		{
@@ -2008,6 +2612,11 @@ ret:
 		m_state = state_finished;
 		m_scratch_buffer.reset();
 		m_scratch_buffer2.reset();
+		m_check_buffer.reset();
+		m_check_buffer_size = 0;
+		m_check_results.clear();
+		std::vector<boost::uint8_t>().swap(m_resume_pieces);
+		write_checkpoint();
 		if (m_storage_mode != internal_storage_mode_compact_deprecated)
 		{
 			// if no piece is out of place
@@ -2026,7 +2635,7 @@ ret:
 	// isn't return false and the full check
 	// will be run
 	int piece_manager::check_fastresume(
-		lazy_entry const& rd, error_code& error)
+		lazy_entry const& rd, error_code& error, int flags)
 	{
 		mutex::scoped_lock lock(m_mutex);
 
@@ -2036,6 +2645,28 @@ ret:
 		
 		m_current_slot = 0;
 
+		// the checkpoint only records which pieces we have, so it can't
+		// be used in compact mode, where pieces may be in any slot
+		std::string checkpoint_path;
+		std::string const& checkpoint_dir = m_storage->settings().checkpoint_directory;
+		if (!checkpoint_dir.empty()
+			&& m_storage_mode != internal_storage_mode_compact_deprecated)
+		{
+			checkpoint_path = combine_path(checkpoint_dir
+				, to_hex(m_info->info_hash().to_string()) + ".checkpoint");
+		}
+		m_checkpoint.init(checkpoint_path, m_info->info_hash()
+			, m_files.num_pieces(), m_files.num_files());
+		if (flags & ignore_checkpoint)
+		{
+			error_code ec;
+			m_checkpoint.remove(ec);
+		}
+		else
+		{
+			m_checkpoint.load();
+		}
+
 		// if we don't have any resume data, return
 		if (rd.type() == lazy_entry::none_t) return check_no_fastresume(error);
 
@@ -2059,7 +2690,22 @@ ret:
 			storage_mode = storage_mode_sparse;
 
 		if (!m_storage->verify_resume_data(rd, error))
+		{
+			// the checkpoint is more recent than the resume data
+			if (m_checkpoint.loaded() && init_checkpoint_check())
+				return need_full_check;
+
+			// if only some files changed since the resume data was saved,
+			// there's no need to check the pieces of the other ones
+			if ((error == error_code(errors::mismatching_file_size)
+					|| error == error_code(errors::mismatching_file_timestamp))
+				&& m_storage->settings().recheck_dirty_files_only
+				&& storage_mode != internal_storage_mode_compact_deprecated
+				&& m_storage_mode != internal_storage_mode_compact_deprecated
+				&& init_dirty_files_check(rd))
+				return need_full_check;
 			return check_no_fastresume(error);
+		}
 
 		// assume no piece is out of place (i.e. in a slot
 		// other than the one it should be in)
@@ -2205,9 +2851,265 @@ ret:
 			if (m_unallocated_slots.empty()) switch_to_full_mode();
 		}
 
+		// start the checkpoint over from the resume data
+		if (m_checkpoint.enabled())
+		{
+			m_checkpoint.clear_have();
+			lazy_entry const* pieces = rd.dict_find_string("pieces");
+			if (pieces && pieces->string_length() == m_files.num_pieces())
+			{
+				char const* have_pieces = pieces->string_ptr();
+				for (int i = 0; i < m_files.num_pieces(); ++i)
+					if (have_pieces[i] & 1) m_checkpoint.set_have(i);
+			}
+			else
+			{
+				error_code ec;
+				m_checkpoint.remove(ec);
+			}
+		}
+
 		return check_init_storage(error);
 	}
 
+	bool piece_manager::init_dirty_files_check(lazy_entry const& rd)
+	{
+		std::vector<bool> dirty;
+		if (!m_storage->dirty_files(dirty)) return false;
+		if (int(dirty.size()) != m_files.num_files()) return false;
+
+		lazy_entry const* pieces = rd.dict_find_string("pieces");
+		if (pieces == 0 || pieces->string_length() != m_files.num_pieces())
+			return false;
+
+		int num_pieces = m_files.num_pieces();
+		char const* have_pieces = pieces->string_ptr();
+		m_resume_pieces.resize(num_pieces);
+		for (int i = 0; i < num_pieces; ++i)
+			m_resume_pieces[i] = (have_pieces[i] & 1) ? trusted_have : trusted_missing;
+
+		// every piece overlapping a file that changed needs to be hashed
+		size_type file_offset = 0;
+		for (file_storage::iterator i = m_files.begin()
+			, end(m_files.end()); i != end; ++i)
+		{
+			size_type file_size = i->size;
+			if (dirty[i - m_files.begin()] && !i->pad_file && file_size > 0)
+			{
+				int first = int(file_offset / m_files.piece_length());
+				int last = int((file_offset + file_size - 1) / m_files.piece_length());
+				for (int p = first; p <= last; ++p) m_resume_pieces[p] = check_piece;
+			}
+			file_offset += file_size;
+		}
+
+		init_partial_check();
+		return true;
+	}
+
+	bool piece_manager::init_checkpoint_check()
+	{
+		std::vector<std::pair<size_type, std::time_t> > stats;
+		if (!file_stats(stats)) return false;
+
+		int const num_pieces = m_files.num_pieces();
+		m_resume_pieces.resize(num_pieces);
+		for (int i = 0; i < num_pieces; ++i)
+			m_resume_pieces[i] = m_checkpoint.have(i) ? trusted_have : trusted_missing;
+
+		// files modified after the checkpoint was last written to may
+		// have been changed behind our back. Allow some slack for writes
+		// that were still in flight at the time
+		std::time_t const limit = m_checkpoint.last_update() + 5 * 60;
+		std::vector<std::pair<size_type, std::time_t> > const& snapshot
+			= m_checkpoint.files();
+
+		size_type file_offset = 0;
+		for (file_storage::iterator i = m_files.begin()
+			, end(m_files.end()); i != end; ++i)
+		{
+			int const index = i - m_files.begin();
+			size_type const start = file_offset;
+			file_offset += i->size;
+			if (i->pad_file || i->size == 0) continue;
+
+			int const first = int(start / m_files.piece_length());
+			int const last = int((file_offset - 1) / m_files.piece_length());
+
+			// the number of bytes of this file covered by pieces we have
+			size_type needed = 0;
+			for (int p = last; p >= first; --p)
+			{
+				if (!m_checkpoint.have(p)) continue;
+				needed = (std::min)(size_type(p + 1) * m_files.piece_length()
+					, file_offset) - start;
+				break;
+			}
+
+			bool const unchanged = int(snapshot.size()) == m_files.num_files()
+				&& snapshot[index] == stats[index];
+			if (stats[index].first >= needed
+				&& (unchanged || stats[index].second <= limit))
+				continue;
+
+			for (int p = first; p <= last; ++p) m_resume_pieces[p] = check_piece;
+		}
+
+		init_partial_check();
+		return true;
+	}
+
+	void piece_manager::init_partial_check()
+	{
+		int const num_pieces = m_files.num_pieces();
+		m_state = state_full_check;
+		m_current_slot = 0;
+		m_piece_to_slot.clear();
+		m_piece_to_slot.resize(num_pieces, has_no_slot);
+		m_slot_to_piece.clear();
+		m_slot_to_piece.resize(num_pieces, unallocated);
+		// the have bits are rebuilt by the check
+		m_checkpoint.clear_have();
+	}
+
+	bool piece_manager::file_stats(std::vector<std::pair<size_type, std::time_t> >& stats) const
+	{
+		// the storage knows where the files actually are, and
+		// reports their sizes and timestamps in the resume data
+		entry rd(entry::dictionary_t);
+		m_storage->write_resume_data(rd);
+		entry const* sizes = rd.find_key("file sizes");
+		if (sizes == 0 || sizes->type() != entry::list_t) return false;
+
+		stats.clear();
+		for (entry::list_type::const_iterator i = sizes->list().begin()
+			, end(sizes->list().end()); i != end; ++i)
+		{
+			if (i->type() != entry::list_t || i->list().size() != 2
+				|| i->list().front().type() != entry::int_t
+				|| i->list().back().type() != entry::int_t)
+				return false;
+			stats.push_back(std::make_pair(size_type(i->list().front().integer())
+				, std::time_t(i->list().back().integer())));
+		}
+		return int(stats.size()) == m_files.num_files();
+	}
+
+	void piece_manager::write_checkpoint()
+	{
+		if (!m_checkpoint.enabled()) return;
+
+		std::vector<std::pair<size_type, std::time_t> > stats;
+		if (!file_stats(stats))
+			stats.assign(m_files.num_files(), std::pair<size_type, std::time_t>(0, 0));
+
+		// the checkpoint is only an optimization. If it can't be written
+		// the worst case is a full check after a crash
+		error_code ec;
+		m_checkpoint.write_snapshot(stats, ec);
+	}
+
+	void piece_manager::checkpoint_piece(int piece)
+	{
+		mutex::scoped_lock lock(m_mutex);
+		if (!m_checkpoint.enabled() || m_state != state_finished) return;
+
+		error_code ec;
+		m_checkpoint.append(piece, ec);
+
+		// each piece only passes once, so this is only hit if pieces
+		// are rechecked. Fold the log into the bitfield then
+		if (m_checkpoint.log_size() > m_files.num_pieces()) write_checkpoint();
+	}
+
+	int piece_manager::release_files_impl(int flags)
+	{
+		if (flags & remove_checkpoint)
+		{
+			mutex::scoped_lock lock(m_mutex);
+			error_code ec;
+			m_checkpoint.remove(ec);
+		}
+		return m_storage->release_files();
+	}
+
+	int piece_manager::delete_files_impl()
+	{
+		error_code ec;
+		m_checkpoint.remove(ec);
+		return m_storage->delete_files();
+	}
+
+	void piece_manager::hash_ahead(hash_pool& pool, int bytes)
+	{
+		mutex::scoped_lock lock(m_mutex);
+
+		// only the plain case, where every piece is expected to be in
+		// its own slot, is supported. Anything else is left to
+		// check_one_piece()
+		if (m_state != state_full_check) return;
+		if (m_storage_mode == internal_storage_mode_compact_deprecated) return;
+		if (m_out_of_place) return;
+		if (!m_check_results.empty()) return;
+
+		int const num_pieces = m_files.num_pieces();
+		int const piece_size = m_files.piece_length();
+		int const small_piece_size = m_files.piece_size(num_pieces - 1);
+		int const max_slots = (std::max)(bytes / piece_size, 1);
+
+		if (m_check_buffer_size < max_slots * piece_size)
+		{
+			m_check_buffer.reset(page_aligned_allocator::malloc(max_slots * piece_size));
+			m_check_buffer_size = m_check_buffer.get() ? max_slots * piece_size : 0;
+			if (m_check_buffer_size == 0) return;
+		}
+
+		std::vector<hash_job> jobs;
+		std::vector<int> slots;
+		jobs.reserve(max_slots);
+		slots.reserve(max_slots);
+		char* buf = m_check_buffer.get();
+		int slot = m_current_slot;
+		for (; slot < num_pieces && int(jobs.size()) < max_slots; ++slot)
+		{
+			if (!m_resume_pieces.empty() && m_resume_pieces[slot] != check_piece)
+				continue;
+
+			int size = m_files.piece_size(slot);
+			file::iovec_t b = { buf, size_t(size) };
+			// deliberately pass in 0 as flags, to disable random_access
+			if (m_storage->readv(&b, slot, 0, 1, 0) != size)
+			{
+				// leave this slot to check_one_piece(), which knows
+				// how to deal with missing files and sparse regions
+				clear_error();
+				break;
+			}
+			hash_job j;
+			j.buf = buf;
+			j.size = size;
+			if (size != small_piece_size) j.small_size = small_piece_size;
+			jobs.push_back(j);
+			slots.push_back(slot);
+			buf += size;
+		}
+
+		// let the OS start reading the next batch while we're hashing
+		if (slot < num_pieces) m_storage->hint_read(slot, 0, m_files.piece_size(slot));
+
+		if (jobs.empty()) return;
+		pool.hash(&jobs[0], int(jobs.size()));
+
+		for (int i = 0; i < int(jobs.size()); ++i)
+		{
+			check_result r;
+			r.slot = slots[i];
+			r.hash = jobs[i].hash;
+			r.small_hash = jobs[i].small_hash;
+			m_check_results.push_back(r);
+		}
+	}
+
 /*
    state chart:
 
@@ -2351,6 +3253,7 @@ ret:
 
 		int skip = check_one_piece(have_piece);
 		TORRENT_ASSERT(m_current_slot <= m_files.num_pieces());
+		if (have_piece >= 0) m_checkpoint.set_have(have_piece);
 
 		if (skip == -1)
 		{
@@ -2455,6 +3358,23 @@ ret:
 		TORRENT_ASSERT(int(m_slot_to_piece.size()) == m_files.num_pieces());
 		TORRENT_ASSERT(have_piece == -1);
 
+		// pieces the resume data is trusted for, because
+		// the files they overlap haven't changed
+		if (!m_resume_pieces.empty() && m_resume_pieces[m_current_slot] != check_piece)
+		{
+			if (m_resume_pieces[m_current_slot] == trusted_have)
+			{
+				have_piece = m_current_slot;
+				m_piece_to_slot[m_current_slot] = m_current_slot;
+				m_slot_to_piece[m_current_slot] = m_current_slot;
+			}
+			else
+			{
+				m_slot_to_piece[m_current_slot] = unassigned;
+			}
+			return 0;
+		}
+
 		// initialization for the full check
 		if (m_hash_to_piece.empty())
 		{
@@ -2462,42 +3382,60 @@ ret:
 				m_hash_to_piece.insert(std::pair<const sha1_hash, int>(m_info->hash_for_piece(i), i));
 		}
 
-		partial_hash ph;
-		int num_read = 0;
-		int piece_size = m_files.piece_size(m_current_slot);
-		int small_piece_size = m_files.piece_size(m_files.num_pieces() - 1);
-		bool read_short = true;
+		// drop hashes from hash_ahead() for slots we've skipped past. If
+		// pieces are being moved around, the slots may no longer contain
+		// what was hashed
+		while (!m_check_results.empty() && m_check_results.front().slot < m_current_slot)
+			m_check_results.pop_front();
+		if (m_out_of_place) m_check_results.clear();
+
+		sha1_hash large_hash;
 		sha1_hash small_hash;
-		if (piece_size == small_piece_size)
+		if (!m_check_results.empty() && m_check_results.front().slot == m_current_slot)
 		{
-			num_read = hash_for_slot(m_current_slot, ph, piece_size, 0, 0);
+			large_hash = m_check_results.front().hash;
+			small_hash = m_check_results.front().small_hash;
+			m_check_results.pop_front();
 		}
 		else
 		{
-			num_read = hash_for_slot(m_current_slot, ph, piece_size
-				, small_piece_size, &small_hash);
-		}
-		read_short = num_read != piece_size;
+			partial_hash ph;
+			int num_read = 0;
+			int piece_size = m_files.piece_size(m_current_slot);
+			int small_piece_size = m_files.piece_size(m_files.num_pieces() - 1);
+			bool read_short = true;
+			if (piece_size == small_piece_size)
+			{
+				num_read = hash_for_slot(m_current_slot, ph, piece_size, 0, 0);
+			}
+			else
+			{
+				num_read = hash_for_slot(m_current_slot, ph, piece_size
+					, small_piece_size, &small_hash);
+			}
+			read_short = num_read != piece_size;
 
-		if (read_short)
-		{
-			if (m_storage->error()
+			if (read_short)
+			{
+				if (m_storage->error()
 #ifdef TORRENT_WINDOWS
-				&& m_storage->error() != error_code(ERROR_PATH_NOT_FOUND, get_system_category())
-				&& m_storage->error() != error_code(ERROR_FILE_NOT_FOUND, get_system_category())
-				&& m_storage->error() != error_code(ERROR_HANDLE_EOF, get_system_category())
-				&& m_storage->error() != error_code(ERROR_INVALID_HANDLE, get_system_category()))
+					&& m_storage->error() != error_code(ERROR_PATH_NOT_FOUND, get_system_category())
+					&& m_storage->error() != error_code(ERROR_FILE_NOT_FOUND, get_system_category())
+					&& m_storage->error() != error_code(ERROR_HANDLE_EOF, get_system_category())
+					&& m_storage->error() != error_code(ERROR_INVALID_HANDLE, get_system_category()))
 #else
-				&& m_storage->error() != error_code(ENOENT, get_posix_category()))
+					&& m_storage->error() != error_code(ENOENT, get_posix_category()))
 #endif
-			{
-				return -1;
+				{
+					return -1;
+				}
+				// if the file is incomplete, skip the rest of it
+				return skip_file();
 			}
-			// if the file is incomplete, skip the rest of it
-			return skip_file();
+
+			large_hash = ph.h.final();
 		}
 
-		sha1_hash large_hash = ph.h.final();
 		int piece_index = identify_data(large_hash, small_hash, m_current_slot);
 
 		if (piece_index >= 0) have_piece = piece_index;
@@ -93,6 +93,11 @@ namespace libtorrent
 	{
 		pthread_cond_broadcast(&m_cond);
 	}
+
+	void condition_variable::notify_one()
+	{
+		pthread_cond_signal(&m_cond);
+	}
 #elif defined TORRENT_WINDOWS || defined TORRENT_CYGWIN
 	condition_variable::condition_variable()
 		: m_num_waiters(0)
@@ -129,6 +134,11 @@ namespace libtorrent
 	{
 		ReleaseSemaphore(m_sem, m_num_waiters, 0);
 	}
+
+	void condition_variable::notify_one()
+	{
+		if (m_num_waiters > 0) ReleaseSemaphore(m_sem, 1, 0);
+	}
 #elif defined TORRENT_BEOS
 	condition_variable::condition_variable()
 		: m_num_waiters(0)
@@ -165,6 +175,11 @@ namespace libtorrent
 	{
 		release_sem_etc(m_sem, m_num_waiters, 0);
 	}
+
+	void condition_variable::notify_one()
+	{
+		if (m_num_waiters > 0) release_sem_etc(m_sem, 1, 0);
+	}
 #else
 #error not implemented
 #endif
@@ -347,6 +347,7 @@ namespace libtorrent
 		, m_total_uploaded(0)
 		, m_total_downloaded(0)
 		, m_started(time_now())
+		, m_last_counter_update(time_now())
 		, m_storage(0)
 		, m_num_connecting(0)
 		, m_tracker_timer(ses.m_io_service)
@@ -371,6 +372,8 @@ namespace libtorrent
 		, m_total_failed_bytes(0)
 		, m_total_redundant_bytes(0)
 		, m_sequence_number(seq)
+		, m_tick_index(-1)
+		, m_status_generation(0)
 		, m_upload_mode_time(0)
 		, m_state(torrent_status::checking_resume_data)
 		, m_storage_mode(p.storage_mode)
@@ -967,6 +970,9 @@ namespace libtorrent
 			m_apply_ip_filter = true;
 		}
 
+		// in case the torrent was never aborted
+		stop_ticking();
+
 		TORRENT_ASSERT(m_ses.is_network_thread());
 		// The invariant can't be maintained here, since the torrent
 		// is being destructed, all weak references to it have been
@@ -1048,6 +1054,31 @@ namespace libtorrent
 		}
 	}
 
+	void torrent::set_read_cursor(int cursor, int piece)
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		if (m_abort || !m_owning_storage || !valid_metadata()) return;
+		if (piece < 0 || piece >= m_torrent_file->num_pieces()) return;
+
+		// prefetch the pieces we have right after the cursor
+		int readahead = settings().read_cursor_readahead / m_torrent_file->piece_length();
+		if (settings().read_cursor_readahead > 0 && readahead < 1) readahead = 1;
+		int num_pieces = 0;
+		while (num_pieces < readahead
+			&& piece + num_pieces < m_torrent_file->num_pieces()
+			&& have_piece(piece + num_pieces))
+			++num_pieces;
+
+		m_owning_storage->async_set_read_cursor(cursor, piece, num_pieces);
+	}
+
+	void torrent::clear_read_cursor(int cursor)
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+		if (!m_owning_storage) return;
+		m_owning_storage->async_set_read_cursor(cursor, 0, 0);
+	}
+
 	void torrent::send_share_mode()
 	{
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -1100,7 +1131,9 @@ namespace libtorrent
 	{
 		if (b == m_upload_mode) return;
 
+		update_time_counters();
 		m_upload_mode = b;
+		update_want_tick();
 
 		state_updated();
 		send_upload_only();
@@ -2029,7 +2062,10 @@ namespace libtorrent
 						if (piece < 0 || piece > torrent_file().num_pieces()) continue;
 
 						if (m_picker->have_piece(piece))
+						{
 							m_picker->we_dont_have(piece);
+							++m_status_generation;
+						}
 
 						std::string bitmask = e->dict_find_string_value("bitmask");
 						if (bitmask.empty()) continue;
@@ -2125,7 +2161,7 @@ namespace libtorrent
 		lazy_entry().swap(m_resume_entry);
 		m_storage->async_check_fastresume(&m_resume_entry
 			, boost::bind(&torrent::on_force_recheck
-			, shared_from_this(), _1, _2));
+			, shared_from_this(), _1, _2), piece_manager::ignore_checkpoint);
 	}
 
 	void torrent::on_force_recheck(int ret, disk_io_job const& j)
@@ -2540,6 +2576,7 @@ namespace libtorrent
 	void torrent::scrape_tracker()
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
+		update_time_counters();
 		m_last_scrape = 0;
 
 		if (m_trackers.empty()) return;
@@ -2675,7 +2712,10 @@ namespace libtorrent
 		update_tracker_timer(now);
 
 		if (complete >= 0 && incomplete >= 0)
+		{
+			update_time_counters();
 			m_last_scrape = 0;
+		}
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 		debug_log("TRACKER RESPONSE\n"
@@ -3312,6 +3352,7 @@ namespace libtorrent
 		remove_time_critical_piece(index, true);
 
 		m_picker->we_have(index);
+		++m_status_generation;
 	}
 
 	void torrent::piece_passed(int index)
@@ -3447,6 +3488,7 @@ namespace libtorrent
 			// is deallocated by the torrent once it starts seeding
 		}
 
+		update_time_counters();
 		m_last_download = 0;
 
 		if (m_share_mode)
@@ -3641,6 +3683,7 @@ namespace libtorrent
 		if (m_abort) return;
 
 		m_abort = true;
+		stop_ticking();
 
 		update_guage();
 
@@ -3664,8 +3707,16 @@ namespace libtorrent
 		if (m_owning_storage.get())
 		{
 			m_storage->abort_disk_io();
+
+			// the checkpoint is stale once the torrent is removed. When
+			// the session shuts down, it's only kept if the resume data
+			// is out of date, to speed up the next check
+			int flags = 0;
+			if (!m_ses.is_aborted() || !m_need_save_resume_data)
+				flags |= piece_manager::remove_checkpoint;
 			m_storage->async_release_files(
-				boost::bind(&torrent::on_cache_flushed, shared_from_this(), _1, _2));
+				boost::bind(&torrent::on_cache_flushed, shared_from_this(), _1, _2)
+				, flags);
 		}
 		else
 		{
@@ -3810,6 +3861,17 @@ namespace libtorrent
 		}
 	}
 
+	void torrent::on_file_priority(int ret, disk_io_job const& j)
+	{
+		TORRENT_ASSERT(m_ses.is_network_thread());
+
+		// this fails if the data for a file that was unwanted
+		// can't be moved out of the part file
+		if (ret == 0) return;
+		if (alerts().should_post<file_error_alert>())
+			alerts().post_alert(file_error_alert(j.error_file, get_handle(), j.error));
+	}
+
 	void torrent::on_torrent_paused(int ret, disk_io_job const& j)
 	{
 		TORRENT_ASSERT(m_ses.is_network_thread());
@@ -3882,6 +3944,7 @@ namespace libtorrent
 		std::deque<time_critical_piece>::iterator i = std::upper_bound(m_time_critical_pieces.begin()
 			, m_time_critical_pieces.end(), p);
 		m_time_critical_pieces.insert(i, p);
+		update_want_tick();
 
 		// just in case this piece had priority 0
 		if (m_picker->piece_priority(piece) == 0)
@@ -3911,6 +3974,16 @@ namespace libtorrent
 		remove_time_critical_piece(piece);
 	}
 
+	bool torrent::is_time_critical_piece(int piece) const
+	{
+		for (std::deque<time_critical_piece>::const_iterator i = m_time_critical_pieces.begin()
+			, end(m_time_critical_pieces.end()); i != end; ++i)
+		{
+			if (i->piece == piece) return true;
+		}
+		return false;
+	}
+
 	void torrent::remove_time_critical_piece(int piece, bool finished)
 	{
 		for (std::deque<time_critical_piece>::iterator i = m_time_critical_pieces.begin()
@@ -4005,6 +4078,7 @@ namespace libtorrent
 		TORRENT_ASSERT(index < m_torrent_file->num_pieces());
 		if (index < 0 || index >= m_torrent_file->num_pieces()) return;
 
+		update_time_counters();
 		bool was_finished = is_finished();
 		bool filter_updated = m_picker->set_piece_priority(index, priority);
 		TORRENT_ASSERT(num_have() >= m_picker->num_have_filtered());
@@ -4044,6 +4118,7 @@ namespace libtorrent
 
 		int index = 0;
 		bool filter_updated = false;
+		update_time_counters();
 		bool was_finished = is_finished();
 		for (std::vector<int>::const_iterator i = pieces.begin()
 			, end(pieces.end()); i != end; ++i, ++index)
@@ -4115,6 +4190,12 @@ namespace libtorrent
 		if (valid_metadata() && m_torrent_file->num_files() > int(m_file_priority.size()))
 			m_file_priority.resize(m_torrent_file->num_files(), 1);
 
+		if (m_owning_storage.get())
+		{
+			m_owning_storage->async_set_file_priority(m_file_priority
+				, boost::bind(&torrent::on_file_priority, shared_from_this(), _1, _2));
+		}
+
 		update_piece_priorities();
 	}
 
@@ -4135,6 +4216,13 @@ namespace libtorrent
 		}
 		if (m_file_priority[index] == prio) return;
 		m_file_priority[index] = prio;
+
+		if (m_owning_storage.get())
+		{
+			m_owning_storage->async_set_file_priority(m_file_priority
+				, boost::bind(&torrent::on_file_priority, shared_from_this(), _1, _2));
+		}
+
 		update_piece_priorities();
 	}
 	
@@ -4242,6 +4330,7 @@ namespace libtorrent
 
 		if (index < 0 || index >= m_torrent_file->num_pieces()) return;
 
+		update_time_counters();
 		bool was_finished = is_finished();
 		m_picker->set_piece_priority(index, filter ? 1 : 0);
 		update_peer_interest(was_finished);
@@ -4257,6 +4346,7 @@ namespace libtorrent
 
 		TORRENT_ASSERT(m_picker.get());
 
+		update_time_counters();
 		bool was_finished = is_finished();
 		int index = 0;
 		for (std::vector<bool>::const_iterator i = bitmask.begin()
@@ -4984,6 +5074,7 @@ namespace libtorrent
 			// add the newly connected peer to this torrent's peer list
 			m_connections.insert(boost::get_pointer(c));
 			m_ses.m_connections.insert(c);
+			update_want_tick();
 
 			TORRENT_ASSERT(!web->peer_info.connection);
 			web->peer_info.connection = c.get();
@@ -5356,6 +5447,8 @@ namespace libtorrent
 	
 	void torrent::write_resume_data(entry& ret) const
 	{
+		update_time_counters();
+
 		using namespace libtorrent::detail; // for write_*_endpoint()
 		ret["file-format"] = "libtorrent resume file";
 		ret["file-version"] = 1;
@@ -5906,6 +5999,7 @@ namespace libtorrent
 		// add the newly connected peer to this torrent's peer list
 		m_connections.insert(boost::get_pointer(c));
 		m_ses.m_connections.insert(c);
+		update_want_tick();
 		m_policy.set_connection(peerinfo, c.get());
 		c->start();
 
@@ -6166,6 +6260,7 @@ namespace libtorrent
 		}
 		TORRENT_ASSERT(m_connections.find(p) == m_connections.end());
 		m_connections.insert(p);
+		update_want_tick();
 #ifdef TORRENT_DEBUG
 		error_code ec;
 		TORRENT_ASSERT(p->remote() == p->get_socket()->remote_endpoint(ec) || ec);
@@ -6553,6 +6648,7 @@ namespace libtorrent
 		}
 
 		m_files_checked = true;
+		update_want_tick();
 
 		start_announcing();
 	}
@@ -6755,22 +6851,6 @@ namespace libtorrent
 			TORRENT_ASSERT(m_abort || m_error || !m_picker || m_picker->num_pieces() == 0);
 		}
 
-#ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
-		// make sure we haven't modified the peer object
-		// in a way that breaks the sort order
-		if (m_policy.begin_peer() != m_policy.end_peer())
-		{
-			policy::const_iterator i = m_policy.begin_peer();
-			policy::const_iterator prev = i++;
-			policy::const_iterator end(m_policy.end_peer());
-			policy::peer_address_compare cmp;
-			for (; i != end; ++i, ++prev)
-			{
-				TORRENT_ASSERT(!cmp(*i, *prev));
-			}
-		}
-#endif
-
 		size_type total_done = quantized_bytes_done();
 		if (m_torrent_file->is_valid())
 		{
@@ -7182,6 +7262,7 @@ namespace libtorrent
 
 		ptime now = time_now();
 
+		update_time_counters();
 		int finished_time = m_finished_time;
 		int download_time = int(m_active_time) - finished_time;
 
@@ -7310,6 +7391,7 @@ namespace libtorrent
 		INVARIANT_CHECK;
 
 		if (!m_allow_peers) return;
+		update_time_counters();
 		if (!graceful) set_allow_peers(false);
 		m_announce_to_dht = false;
 		m_announce_to_trackers = false;
@@ -7443,6 +7525,7 @@ namespace libtorrent
 		// don't add duplicates
 		if (std::find(m_web_seeds.begin(), m_web_seeds.end(), ent) != m_web_seeds.end()) return;
 		m_web_seeds.push_back(ent);
+		update_want_tick();
 	}
 
 	void torrent::add_web_seed(std::string const& url, web_seed_entry::type_t type
@@ -7452,6 +7535,7 @@ namespace libtorrent
 		// don't add duplicates
 		if (std::find(m_web_seeds.begin(), m_web_seeds.end(), ent) != m_web_seeds.end()) return;
 		m_web_seeds.push_back(ent);
+		update_want_tick();
 	}
 	
 	void torrent::set_allow_peers(bool b, bool graceful)
@@ -7461,6 +7545,7 @@ namespace libtorrent
 		if (m_allow_peers == b
 			&& m_graceful_pause_mode == graceful) return;
 
+		update_time_counters();
 		m_allow_peers = b;
 		if (!m_ses.is_paused())
 			m_graceful_pause_mode = graceful;
@@ -7496,6 +7581,7 @@ namespace libtorrent
 		// why it's important to set announce_to_trackers to
 		// true first
 		set_allow_peers(true);
+		update_time_counters();
 		if (!m_ses.is_paused()) m_graceful_pause_mode = false;
 
 		// we need to save this new state
@@ -7529,6 +7615,7 @@ namespace libtorrent
 		start_announcing();
 		if (!m_queued_for_checking && should_check_files())
 			queue_torrent_check();
+		update_want_tick();
 	}
 
 	void torrent::update_tracker_timer(ptime now)
@@ -7753,6 +7840,8 @@ namespace libtorrent
 			}
 		}
 
+		update_time_counters();
+
 		// if we're in upload only mode and we're auto-managed
 		// leave upload mode every 10 minutes hoping that the error
 		// condition has been fixed
@@ -7795,17 +7884,6 @@ namespace libtorrent
 			}
 		}
 
-		int seconds_since_last_tick = 1;
-		if (m_ses.m_tick_residual >= 1000) ++seconds_since_last_tick;
-
-		if (is_seed()) m_seeding_time += seconds_since_last_tick;
-		if (is_finished()) m_finished_time += seconds_since_last_tick;
-		if (m_upload_mode) m_upload_mode_time += seconds_since_last_tick;
-		m_last_scrape += seconds_since_last_tick;
-		m_active_time += seconds_since_last_tick;
-		m_last_download += seconds_since_last_tick;
-		m_last_upload += seconds_since_last_tick;
-
 		// ---- TIME CRITICAL PIECES ----
 
 		if (!m_time_critical_pieces.empty())
@@ -7875,6 +7953,79 @@ namespace libtorrent
 			state_updated();
 	}
 
+	bool torrent::want_tick() const
+	{
+		if (m_abort) return false;
+
+		if (!m_connections.empty()) return true;
+
+		// let the transfer rates fade out to 0
+		if (m_stat.low_pass_upload_rate() > 0 || m_stat.low_pass_download_rate() > 0)
+			return true;
+
+		// upload mode is left on the tick
+		if (m_upload_mode) return true;
+
+		if (is_paused()) return false;
+
+		if (!m_time_critical_pieces.empty()) return true;
+
+		// we may want to connect to web seeds
+		if (!is_finished() && !m_web_seeds.empty() && m_files_checked)
+			return true;
+
+		return false;
+	}
+
+	void torrent::update_want_tick()
+	{
+		if (m_tick_index >= 0 || !want_tick()) return;
+
+		std::vector<torrent*>& list = m_ses.m_ticking_torrents;
+		m_tick_index = list.size();
+		list.push_back(this);
+	}
+
+	void torrent::stop_ticking()
+	{
+		if (m_tick_index < 0) return;
+
+		// move the last torrent in the list into our slot
+		std::vector<torrent*>& list = m_ses.m_ticking_torrents;
+		TORRENT_ASSERT(m_tick_index < int(list.size()));
+		TORRENT_ASSERT(list[m_tick_index] == this);
+		torrent* last = list.back();
+		list[m_tick_index] = last;
+		last->m_tick_index = m_tick_index;
+		list.pop_back();
+		m_tick_index = -1;
+	}
+
+	void torrent::update_time_counters() const
+	{
+		ptime now = time_now();
+
+		// the counters don't count while we're paused
+		if (is_paused())
+		{
+			m_last_counter_update = now;
+			return;
+		}
+
+		int delta = total_seconds(now - m_last_counter_update);
+		if (delta <= 0) return;
+		// keep the fraction of a second that hasn't been counted
+		m_last_counter_update += seconds(delta);
+
+		if (is_seed()) m_seeding_time += delta;
+		if (is_finished()) m_finished_time += delta;
+		if (m_upload_mode) m_upload_mode_time += delta;
+		m_last_scrape += delta;
+		m_active_time += delta;
+		m_last_download += delta;
+		m_last_upload += delta;
+	}
+
 	void torrent::recalc_share_mode()
 	{
 		TORRENT_ASSERT(share_mode());
@@ -8014,6 +8165,7 @@ namespace libtorrent
 
 		// now, pick one of the rarest pieces to download
 		int pick = random() % rarest_pieces.size();
+		update_time_counters();
 		bool was_finished = is_finished();
 		m_picker->set_piece_priority(rarest_pieces[pick], 1);
 		update_peer_interest(was_finished);
@@ -8649,6 +8801,8 @@ namespace libtorrent
 
 		if (int(m_state) == s) return;
 
+		update_time_counters();
+
 		if (m_ses.m_alerts.should_post<state_changed_alert>())
 		{
 			m_ses.m_alerts.post_alert(state_changed_alert(get_handle()
@@ -8672,6 +8826,7 @@ namespace libtorrent
 		update_guage();
 
 		state_updated();
+		update_want_tick();
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		for (extension_list_t::iterator i = m_extensions.begin()
@@ -8710,6 +8865,8 @@ namespace libtorrent
 		// is building the status update alert
 		TORRENT_ASSERT(!m_ses.m_posting_torrent_updates);
 
+		++m_status_generation;
+
 		// we're either not subscribing to this torrent, or
 		// it has already been updated this round, no need to
 		// add it to the list twice
@@ -8729,6 +8886,7 @@ namespace libtorrent
 		INVARIANT_CHECK;
 
 		ptime now = time_now();
+		update_time_counters();
 
 		st->handle = get_handle();
 		st->info_hash = info_hash();
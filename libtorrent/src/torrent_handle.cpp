@@ -815,6 +815,18 @@ namespace libtorrent
 		TORRENT_ASYNC_CALL2(read_piece, piece, rdf);
 	}
 
+	void torrent_handle::set_read_cursor(int cursor, int piece) const
+	{
+		INVARIANT_CHECK;
+		TORRENT_ASYNC_CALL2(set_read_cursor, cursor, piece);
+	}
+
+	void torrent_handle::clear_read_cursor(int cursor) const
+	{
+		INVARIANT_CHECK;
+		TORRENT_ASYNC_CALL1(clear_read_cursor, cursor);
+	}
+
 	bool torrent_handle::have_piece(int piece) const
 	{
 		INVARIANT_CHECK;
@@ -50,6 +50,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/debug.hpp"
 #endif
 
+#if TORRENT_USE_MMSG
+#include <sys/socket.h>
+#include <errno.h>
+#include <algorithm>
+#endif
+
 using namespace libtorrent;
 
 udp_socket::udp_socket(asio::io_service& ios
@@ -61,6 +67,12 @@ udp_socket::udp_socket(asio::io_service& ios
 	, m_buf(0)
 #if TORRENT_USE_IPV6
 	, m_ipv6_sock(ios)
+#endif
+#if TORRENT_USE_MMSG
+	, m_batch_buf(0)
+	, m_batch_buf_size(0)
+	, m_send_batch_count(0)
+	, m_batch_sends(false)
 #endif
 	, m_bind_port(0)
 	, m_v4_outstanding(0)
@@ -103,6 +115,9 @@ udp_socket::udp_socket(asio::io_service& ios
 udp_socket::~udp_socket()
 {
 	free(m_buf);
+#if TORRENT_USE_MMSG
+	free(m_batch_buf);
+#endif
 #if TORRENT_USE_IPV6
 	TORRENT_ASSERT_VAL(m_v6_outstanding == 0, m_v6_outstanding);
 #endif
@@ -201,6 +216,43 @@ void udp_socket::send(udp::endpoint const& ep, char const* p, int len
 		return;
 	}
 
+#if TORRENT_USE_MMSG
+	if (flags & dont_fragment)
+	{
+		// the DF bit is a socket option, so this packet has to be
+		// written right away, while the option is set. Anything
+		// queued goes out first to preserve ordering
+		if (m_send_batch_count > 0) flush_send_batch();
+		if (m_send_batch_count > 0)
+		{
+			ec = asio::error::would_block;
+			return;
+		}
+	}
+	// while we're handling a batch of incoming packets, outgoing
+	// packets are queued up and sent in one go once the batch
+	// is drained. If there are packets still waiting for the
+	// socket to become writable, new ones have to queue up
+	// behind them to preserve ordering
+	else if (m_batch_sends || m_send_batch_count > 0)
+	{
+		if (m_batch_sends && m_send_batch_count == udp_batch_size)
+			flush_send_batch();
+
+		if (m_send_batch_count < udp_batch_size)
+			queue_packet(ep, p, len);
+		else
+			ec = asio::error::would_block;
+		return;
+	}
+#endif
+
+#ifdef TORRENT_HAS_DONT_FRAGMENT
+	error_code tmp;
+	if (flags & dont_fragment)
+		set_option(libtorrent::dont_fragment(true), tmp);
+#endif
+
 #if TORRENT_USE_IPV6
 	if (ep.address().is_v6() && m_ipv6_sock.is_open())
 		m_ipv6_sock.send_to(asio::buffer(p, len), ep, 0, ec);
@@ -208,29 +260,38 @@ void udp_socket::send(udp::endpoint const& ep, char const* p, int len
 #endif
 		m_ipv4_sock.send_to(asio::buffer(p, len), ep, 0, ec);
 
+#ifdef TORRENT_HAS_DONT_FRAGMENT
+	if (flags & dont_fragment)
+		set_option(libtorrent::dont_fragment(false), tmp);
+#endif
+
 	if (ec == error::would_block || ec == error::try_again)
 	{
 #if TORRENT_USE_IPV6
 		if (ep.address().is_v6() && m_ipv6_sock.is_open())
-		{
-			if (!m_v6_write_subscribed)
-			{
-				m_ipv6_sock.async_send(asio::null_buffers()
-					, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv6_sock));
-				m_v6_write_subscribed = true;
-			}
-		}
+			wait_writable(&m_ipv6_sock);
 		else
 #endif
-		{
-			if (!m_v4_write_subscribed)
-			{
-				m_ipv4_sock.async_send(asio::null_buffers()
-					, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv4_sock));
-				m_v4_write_subscribed = true;
-			}
-		}
+			wait_writable(&m_ipv4_sock);
+	}
+}
+
+void udp_socket::wait_writable(udp::socket* s)
+{
+#if TORRENT_USE_IPV6
+	if (s == &m_ipv6_sock)
+	{
+		if (m_v6_write_subscribed) return;
+		m_ipv6_sock.async_send(asio::null_buffers()
+			, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv6_sock));
+		m_v6_write_subscribed = true;
+		return;
 	}
+#endif
+	if (m_v4_write_subscribed) return;
+	m_ipv4_sock.async_send(asio::null_buffers()
+		, boost::bind(&udp_socket::on_writable, this, _1, &m_ipv4_sock));
+	m_v4_write_subscribed = true;
 }
 
 void udp_socket::on_writable(error_code const& ec, udp::socket* s)
@@ -242,9 +303,166 @@ void udp_socket::on_writable(error_code const& ec, udp::socket* s)
 #endif
 		m_v4_write_subscribed = false;
 
+#if TORRENT_USE_MMSG
+	// packets that didn't fit in the socket buffer
+	// go out before anything new is sent
+	if (!ec && !m_abort && m_send_batch_count > 0)
+		flush_send_batch();
+	report_send_error();
+#endif
+
 	call_writable_handler();
 }
 
+#if TORRENT_USE_MMSG
+udp::socket* udp_socket::socket_for(udp::endpoint const& ep)
+{
+#if TORRENT_USE_IPV6
+	if (ep.address().is_v6() && m_ipv6_sock.is_open())
+		return &m_ipv6_sock;
+#endif
+	return &m_ipv4_sock;
+}
+
+void udp_socket::queue_packet(udp::endpoint const& ep, char const* p, int len)
+{
+	TORRENT_ASSERT(m_send_batch_count < udp_batch_size);
+	m_send_batch.insert(m_send_batch.end(), p, p + len);
+	m_send_batch_ep[m_send_batch_count] = ep;
+	m_send_batch_len[m_send_batch_count] = len;
+	++m_send_batch_count;
+}
+
+void udp_socket::flush_send_batch()
+{
+	TORRENT_ASSERT(is_single_thread());
+
+	int sent = 0;
+	int sent_bytes = 0;
+	while (sent < m_send_batch_count)
+	{
+		// sendmmsg() only writes to a single socket, so send
+		// the run of packets going to the same socket as the
+		// first one
+		udp::socket* s = socket_for(m_send_batch_ep[sent]);
+		mmsghdr msgs[udp_batch_size];
+		iovec iov[udp_batch_size];
+		char* ptr = m_send_batch.begin() + sent_bytes;
+		int num = 0;
+		for (int i = sent; i < m_send_batch_count
+			&& socket_for(m_send_batch_ep[i]) == s; ++i, ++num)
+		{
+			iov[num].iov_base = ptr;
+			iov[num].iov_len = m_send_batch_len[i];
+			ptr += m_send_batch_len[i];
+			std::memset(&msgs[num], 0, sizeof(mmsghdr));
+			msgs[num].msg_hdr.msg_name = m_send_batch_ep[i].data();
+			msgs[num].msg_hdr.msg_namelen = m_send_batch_ep[i].size();
+			msgs[num].msg_hdr.msg_iov = &iov[num];
+			msgs[num].msg_hdr.msg_iovlen = 1;
+		}
+
+		int ret = sendmmsg(s->native_handle(), msgs, num, MSG_DONTWAIT);
+		if (ret < 0)
+		{
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				// the socket buffer is full. Keep the remaining
+				// packets until the socket becomes writable
+				wait_writable(s);
+				break;
+			}
+			// the first packet failed. Drop it, just like a failed
+			// send_to() drops the packet, and remember the error
+			if (!m_send_error)
+			{
+				m_send_error = error_code(errno, get_system_category());
+				m_send_error_ep = m_send_batch_ep[sent];
+			}
+			ret = 1;
+		}
+
+		for (int i = 0; i < ret; ++i, ++sent)
+			sent_bytes += m_send_batch_len[sent];
+	}
+
+	if (sent == 0) return;
+
+	m_send_batch.erase(m_send_batch.begin(), m_send_batch.begin() + sent_bytes);
+	std::copy(m_send_batch_ep + sent, m_send_batch_ep + m_send_batch_count
+		, m_send_batch_ep);
+	std::copy(m_send_batch_len + sent, m_send_batch_len + m_send_batch_count
+		, m_send_batch_len);
+	m_send_batch_count -= sent;
+}
+
+// flush_send_batch() may be called from within an observer, so
+// send errors are held on to until we're back in one of our own
+// handlers, where the observers can be called safely
+void udp_socket::report_send_error()
+{
+	if (!m_send_error || m_abort) return;
+	error_code e = m_send_error;
+	m_send_error.clear();
+	call_handler(e, m_send_error_ep, 0, 0);
+}
+
+// reads up to udp_batch_size packets with a single system call
+// and dispatches them. Returns true if the socket may have more
+// packets to read
+bool udp_socket::read_batch(udp::socket* s)
+{
+	if (m_batch_buf_size != m_buf_size)
+	{
+		void* tmp = realloc(m_batch_buf, m_buf_size * udp_batch_size);
+		if (tmp == 0)
+		{
+			udp::endpoint ep;
+			call_handler(error::no_memory, ep, 0, 0);
+			close();
+			return false;
+		}
+		m_batch_buf = (char*)tmp;
+		m_batch_buf_size = m_buf_size;
+	}
+
+	int const slot_size = m_batch_buf_size;
+	mmsghdr msgs[udp_batch_size];
+	iovec iov[udp_batch_size];
+	udp::endpoint eps[udp_batch_size];
+	for (int i = 0; i < udp_batch_size; ++i)
+	{
+		iov[i].iov_base = m_batch_buf + i * slot_size;
+		iov[i].iov_len = slot_size;
+		std::memset(&msgs[i], 0, sizeof(mmsghdr));
+		msgs[i].msg_hdr.msg_name = eps[i].data();
+		msgs[i].msg_hdr.msg_namelen = eps[i].capacity();
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int n = recvmmsg(s->native_handle(), msgs, udp_batch_size, MSG_DONTWAIT, 0);
+	if (n < 0)
+	{
+		if (errno == EINTR) return true;
+		if (errno == EAGAIN || errno == EWOULDBLOCK) return false;
+		error_code ec(errno, get_system_category());
+		on_read_impl(s, eps[0], ec, 0, 0);
+		return false;
+	}
+
+	for (int i = 0; i < n; ++i)
+	{
+		eps[i].resize(msgs[i].msg_hdr.msg_namelen);
+		on_read_impl(s, eps[i], error_code(), m_batch_buf + i * slot_size
+			, msgs[i].msg_len);
+		if (m_abort) return false;
+	}
+	return n == udp_batch_size;
+}
+#endif
+
 // called whenever the socket is readable
 void udp_socket::on_read(error_code const& ec, udp::socket* s)
 {
@@ -273,15 +491,27 @@ void udp_socket::on_read(error_code const& ec, udp::socket* s)
 
 	CHECK_MAGIC;
 
+#if TORRENT_USE_MMSG
+	// anything sent in response to the packets in this batch
+	// (including deferred ACKs sent when the socket is drained)
+	// is collected and sent with a single sendmmsg() call
+	m_batch_sends = true;
+	while (read_batch(s));
+	call_drained_handler();
+	m_batch_sends = false;
+	if (!m_abort) flush_send_batch();
+	report_send_error();
+#else
 	for (;;)
 	{
 		error_code ec;
 		udp::endpoint ep;
 		size_t bytes_transferred = s->receive_from(asio::buffer(m_buf, m_buf_size), ep, 0, ec);
 		if (ec == asio::error::would_block || ec == asio::error::try_again) break;
-		on_read_impl(s, ep, ec, bytes_transferred);
+		on_read_impl(s, ep, ec, m_buf, bytes_transferred);
 	}
 	call_drained_handler();
+#endif
 	setup_read(s);
 }
 
@@ -397,7 +627,7 @@ void udp_socket::unsubscribe(udp_socket_observer* o)
 }
 
 void udp_socket::on_read_impl(udp::socket* s, udp::endpoint const& ep
-	, error_code const& e, std::size_t bytes_transferred)
+	, error_code const& e, char const* buf, std::size_t bytes_transferred)
 {
 	TORRENT_ASSERT(m_magic == 0x1337);
 	TORRENT_ASSERT(is_single_thread());
@@ -441,11 +671,11 @@ void udp_socket::on_read_impl(udp::socket* s, udp::endpoint const& ep
 		{
 			// if the source IP doesn't match the proxy's, ignore the packet
 			if (ep == m_proxy_addr)
-				unwrap(e, m_buf, bytes_transferred);
+				unwrap(e, buf, bytes_transferred);
 		}
 		else if (!m_force_proxy) // block incoming packets that aren't coming via the proxy
 		{
-			call_handler(e, ep, m_buf, bytes_transferred);
+			call_handler(e, ep, buf, bytes_transferred);
 		}
 
 	} TORRENT_CATCH (std::exception&) {}
@@ -37,6 +37,11 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket_io.hpp"
 #include "libtorrent/broadcast_socket.hpp" // for is_teredo
 #include "libtorrent/random.hpp"
+#include <boost/bind.hpp>
+
+#if defined TORRENT_ASIO_DEBUGGING
+#include "libtorrent/debug.hpp"
+#endif
 
 // #define TORRENT_DEBUG_MTU 1135
 
@@ -47,6 +52,14 @@ namespace libtorrent
 		, incoming_utp_callback_t cb)
 		: m_sock(s)
 		, m_cb(cb)
+		, m_num_sockets(0)
+		, m_used_slots(0)
+		, m_deferred_acks(0)
+		, m_deferred_acks_tail(0)
+		, m_drained_event(0)
+		, m_drained_event_tail(0)
+		, m_pacing_timer(s.get_io_service())
+		, m_pacing_timer_active(false)
 		, m_last_socket(0)
 		, m_new_connection(-1)
 		, m_sett(sett)
@@ -55,15 +68,168 @@ namespace libtorrent
 		, m_sock_buf_size(0)
 	{}
 
+	namespace
+	{
+		// marks a slot in the socket table whose socket has been removed
+		utp_socket_impl* const removed_socket = reinterpret_cast<utp_socket_impl*>(1);
+
+		bool live_socket(utp_socket_impl const* s)
+		{ return s != 0 && s != removed_socket; }
+
+		boost::uint32_t socket_hash(udp::endpoint const& ep, boost::uint16_t id)
+		{
+			boost::uint32_t h = id;
+#if TORRENT_USE_IPV6
+			if (ep.address().is_v6())
+			{
+				address_v6::bytes_type b = ep.address().to_v6().to_bytes();
+				for (int i = 0; i < int(b.size()); i += 4)
+				{
+					h ^= (boost::uint32_t(b[i]) << 24) | (boost::uint32_t(b[i+1]) << 16)
+						| (boost::uint32_t(b[i+2]) << 8) | b[i+3];
+					h *= 0x01000193;
+				}
+			}
+			else
+#endif
+			{
+				h ^= boost::uint32_t(ep.address().to_v4().to_ulong());
+				h *= 0x01000193;
+			}
+			h ^= boost::uint32_t(ep.port()) << 16;
+
+			// final mix, so that the low bits used for the
+			// table index depend on all of the input
+			h ^= h >> 16;
+			h *= 0x85ebca6b;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35;
+			h ^= h >> 16;
+			return h;
+		}
+
+		// the size classes of the packet pool, in bytes of packet
+		// data. Small packets, such as SYNs and the ones sent at the
+		// MTU floor while probing for the path MTU, go in the first
+		// one and full sized packets in the second
+		int const packet_pool_size[] = { TORRENT_INET_MIN_MTU, TORRENT_ETHERNET_MTU };
+
+		// the max number of free buffers kept per size class
+		int const max_pooled_packets = 512;
+
+		int packet_pool_index(int size)
+		{
+			for (int i = 0; i < int(sizeof(packet_pool_size) / sizeof(packet_pool_size[0])); ++i)
+				if (size <= packet_pool_size[i]) return i;
+			return -1;
+		}
+	}
+
 	utp_socket_manager::~utp_socket_manager()
 	{
-		for (socket_map_t::iterator i = m_utp_sockets.begin()
+		for (std::vector<socket_entry>::iterator i = m_utp_sockets.begin()
 			, end(m_utp_sockets.end()); i != end; ++i)
 		{
-			delete_utp_impl(i->second);
+			if (!live_socket(i->socket)) continue;
+			delete_utp_impl(i->socket);
+		}
+
+		for (int i = 0; i < num_packet_pools; ++i)
+		{
+			for (std::vector<void*>::iterator j = m_packet_pool[i].begin()
+				, end(m_packet_pool[i].end()); j != end; ++j)
+				free(*j);
 		}
 	}
 
+	utp_socket_impl* utp_socket_manager::find_socket(udp::endpoint const& ep
+		, boost::uint16_t id) const
+	{
+		if (m_utp_sockets.empty()) return 0;
+
+		boost::uint32_t const h = socket_hash(ep, id);
+		int const mask = int(m_utp_sockets.size()) - 1;
+		for (int i = h & mask;; i = (i + 1) & mask)
+		{
+			socket_entry const& e = m_utp_sockets[i];
+			if (e.socket == 0) return 0;
+			if (e.hash == h && e.socket != removed_socket
+				&& utp_match(e.socket, ep, id))
+				return e.socket;
+		}
+	}
+
+	void utp_socket_manager::link_socket(utp_socket_impl* s)
+	{
+		// keep the load factor (including tombstones) below 3/4
+		if ((m_used_slots + 1) * 4 > int(m_utp_sockets.size()) * 3)
+			rebuild_socket_table();
+
+		boost::uint32_t const h = socket_hash(utp_remote_endpoint(s), utp_receive_id(s));
+		int const mask = int(m_utp_sockets.size()) - 1;
+		int i = h & mask;
+		for (;; i = (i + 1) & mask)
+		{
+			socket_entry& e = m_utp_sockets[i];
+			TORRENT_ASSERT(e.socket != s);
+			if (e.socket == removed_socket) break;
+			if (e.socket == 0)
+			{
+				++m_used_slots;
+				break;
+			}
+		}
+		m_utp_sockets[i].hash = h;
+		m_utp_sockets[i].socket = s;
+		++m_num_sockets;
+	}
+
+	void utp_socket_manager::unlink_socket(utp_socket_impl* s)
+	{
+		if (m_last_socket == s) m_last_socket = 0;
+		if (m_utp_sockets.empty()) return;
+
+		boost::uint32_t const h = socket_hash(utp_remote_endpoint(s), utp_receive_id(s));
+		int const mask = int(m_utp_sockets.size()) - 1;
+		for (int i = h & mask;; i = (i + 1) & mask)
+		{
+			socket_entry& e = m_utp_sockets[i];
+			if (e.socket == 0)
+			{
+				TORRENT_ASSERT(false);
+				return;
+			}
+			if (e.socket != s) continue;
+			e.socket = removed_socket;
+			--m_num_sockets;
+			return;
+		}
+	}
+
+	// rehashes all sockets into a table sized for the current
+	// number of sockets, dropping all tombstones
+	void utp_socket_manager::rebuild_socket_table()
+	{
+		int size = 64;
+		while (size < (m_num_sockets + 1) * 2) size *= 2;
+
+		std::vector<socket_entry> old;
+		old.swap(m_utp_sockets);
+		socket_entry const empty = { 0, 0 };
+		m_utp_sockets.resize(size, empty);
+
+		int const mask = size - 1;
+		for (std::vector<socket_entry>::iterator j = old.begin()
+			, end(old.end()); j != end; ++j)
+		{
+			if (!live_socket(j->socket)) continue;
+			int i = j->hash & mask;
+			while (m_utp_sockets[i].socket != 0) i = (i + 1) & mask;
+			m_utp_sockets[i] = *j;
+		}
+		m_used_slots = m_num_sockets;
+	}
+
 	void utp_socket_manager::get_status(utp_status& s) const
 	{
 		s.num_idle = 0;
@@ -72,10 +238,11 @@ namespace libtorrent
 		s.num_fin_sent = 0;
 		s.num_close_wait = 0;
 
-		for (socket_map_t::const_iterator i = m_utp_sockets.begin()
+		for (std::vector<socket_entry>::const_iterator i = m_utp_sockets.begin()
 			, end(m_utp_sockets.end()); i != end; ++i)
 		{
-			int state = utp_socket_state(i->second);
+			if (!live_socket(i->socket)) continue;
+			int state = utp_socket_state(i->socket);
 			switch (state)
 			{
 				case 0: ++s.num_idle; break;
@@ -90,18 +257,22 @@ namespace libtorrent
 
 	void utp_socket_manager::tick(ptime now)
 	{
-		for (socket_map_t::iterator i = m_utp_sockets.begin()
-			, end(m_utp_sockets.end()); i != end;)
+		// ticking a socket may link new sockets, which may
+		// rebuild the table, so don't hold on to iterators
+		for (int i = 0; i < int(m_utp_sockets.size()); ++i)
 		{
-			if (should_delete(i->second))
+			utp_socket_impl* s = m_utp_sockets[i].socket;
+			if (!live_socket(s)) continue;
+			if (should_delete(s))
 			{
-				delete_utp_impl(i->second);
-				if (m_last_socket == i->second) m_last_socket = 0;
-				m_utp_sockets.erase(i++);
+				if (m_last_socket == s) m_last_socket = 0;
+				unsubscribe_drained(s);
+				m_utp_sockets[i].socket = removed_socket;
+				--m_num_sockets;
+				delete_utp_impl(s);
 				continue;
 			}
-			tick_utp_impl(i->second, now);
-			++i;
+			tick_utp_impl(s, now);
 		}
 	}
 
@@ -194,16 +365,10 @@ namespace libtorrent
 		if ((flags & dont_fragment) && len > TORRENT_DEBUG_MTU) return;
 #endif
 
-#ifdef TORRENT_HAS_DONT_FRAGMENT
-		error_code tmp;
-		if (flags & utp_socket_manager::dont_fragment)
-			m_sock.set_option(libtorrent::dont_fragment(true), tmp);
-#endif
-		m_sock.send(ep, p, len, ec);
-#ifdef TORRENT_HAS_DONT_FRAGMENT
-		if (flags & utp_socket_manager::dont_fragment)
-			m_sock.set_option(libtorrent::dont_fragment(false), tmp);
-#endif
+		// the udp socket sets the DF bit around the send call, and
+		// doesn't hold back the packet in its send batch
+		m_sock.send(ep, p, len, ec
+			, (flags & utp_socket_manager::dont_fragment) ? udp_socket::dont_fragment : 0);
 	}
 
 	int utp_socket_manager::local_port(error_code& ec) const
@@ -294,14 +459,11 @@ namespace libtorrent
 			return utp_incoming_packet(m_last_socket, p, size, ep, receive_time);
 		}
 
-		std::pair<socket_map_t::iterator, socket_map_t::iterator> r =
-			m_utp_sockets.equal_range(id);
-
-		for (; r.first != r.second; ++r.first)
+		utp_socket_impl* s = find_socket(ep, id);
+		if (s)
 		{
-			if (!utp_match(r.first->second, ep, id)) continue;
-			bool ret = utp_incoming_packet(r.first->second, p, size, ep, receive_time);
-			if (ret) m_last_socket = r.first->second;
+			bool ret = utp_incoming_packet(s, p, size, ep, receive_time);
+			if (ret) m_last_socket = s;
 			return ret;
 		}
 
@@ -315,7 +477,7 @@ namespace libtorrent
 		if (ph->get_type() == ST_SYN)
 		{
 			// possible SYN flood. Just ignore
-			if (m_utp_sockets.size() > m_sett.connections_limit * 2)
+			if (m_num_sockets > m_sett.connections_limit * 2)
 				return false;
 
 //			UTP_LOGV("not found, new connection id:%d\n", m_new_connection);
@@ -346,6 +508,31 @@ namespace libtorrent
 		return false;
 	}
 
+	void* utp_socket_manager::allocate_packet(int size)
+	{
+		int const pool = packet_pool_index(size);
+		if (pool < 0) return malloc(utp_packet_overhead() + size);
+
+		std::vector<void*>& l = m_packet_pool[pool];
+		if (l.empty()) return malloc(utp_packet_overhead() + packet_pool_size[pool]);
+		void* ret = l.back();
+		l.pop_back();
+		return ret;
+	}
+
+	void utp_socket_manager::release_packet(void* p, int size)
+	{
+		if (p == 0) return;
+
+		int const pool = packet_pool_index(size);
+		if (pool < 0 || int(m_packet_pool[pool].size()) >= max_pooled_packets)
+		{
+			free(p);
+			return;
+		}
+		m_packet_pool[pool].push_back(p);
+	}
+
 	void utp_socket_manager::subscribe_writable(utp_socket_impl* s)
 	{
 		TORRENT_ASSERT(std::find(m_stalled_sockets.begin(), m_stalled_sockets.end()
@@ -365,50 +552,107 @@ namespace libtorrent
 		}
 	}
 
+	void utp_socket_manager::subscribe_pacing(utp_socket_impl* s)
+	{
+		TORRENT_ASSERT(std::find(m_paced_sockets.begin(), m_paced_sockets.end()
+			, s) == m_paced_sockets.end());
+		m_paced_sockets.push_back(s);
+
+		if (m_pacing_timer_active) return;
+		m_pacing_timer_active = true;
+		error_code ec;
+		m_pacing_timer.expires_from_now(milliseconds(utp_pacing_interval), ec);
+#if defined TORRENT_ASIO_DEBUGGING
+		add_outstanding_async("utp_socket_manager::on_pacing_timer");
+#endif
+		m_pacing_timer.async_wait(boost::bind(&utp_socket_manager::on_pacing_timer, this, _1));
+	}
+
+	void utp_socket_manager::on_pacing_timer(error_code const& ec)
+	{
+#if defined TORRENT_ASIO_DEBUGGING
+		complete_async("utp_socket_manager::on_pacing_timer");
+#endif
+		m_pacing_timer_active = false;
+
+		// even if the timer was cancelled, the sockets need to be
+		// released from the queue, or they could never be deleted.
+		// sockets that still can't send will subscribe again
+		std::vector<utp_socket_impl*> paced_sockets;
+		m_paced_sockets.swap(paced_sockets);
+		for (std::vector<utp_socket_impl*>::iterator i = paced_sockets.begin()
+			, end(paced_sockets.end()); i != end; ++i)
+		{
+			utp_pacing_tick(*i);
+		}
+	}
+
 	void utp_socket_manager::socket_drained()
 	{
-		// flush all deferred acks
-		
-		std::vector<utp_socket_impl*> deferred_acks;
-		m_deferred_acks.swap(deferred_acks);
-		for (std::vector<utp_socket_impl*>::iterator i = deferred_acks.begin()
-			, end(deferred_acks.end()); i != end; ++i)
+		// flush all deferred acks. The lists are detached first,
+		// since sockets may add themselves again while we're
+		// going through them
+
+		utp_socket_impl* s = m_deferred_acks;
+		m_deferred_acks = 0;
+		m_deferred_acks_tail = 0;
+		while (s)
 		{
-			utp_socket_impl* s = *i;
+			utp_socket_impl* next = utp_next_deferred_ack(s);
+			utp_next_deferred_ack(s) = 0;
 			utp_send_ack(s);
+			s = next;
 		}
 
-		std::vector<utp_socket_impl*> drained_event;
-		m_drained_event.swap(drained_event);
-		for (std::vector<utp_socket_impl*>::iterator i = drained_event.begin()
-			, end(drained_event.end()); i != end; ++i)
+		s = m_drained_event;
+		m_drained_event = 0;
+		m_drained_event_tail = 0;
+		while (s)
 		{
-			utp_socket_impl* s = *i;
+			utp_socket_impl* next = utp_next_drained(s);
+			utp_next_drained(s) = 0;
 			utp_socket_drained(s);
+			s = next;
 		}
 	}
 
 	void utp_socket_manager::defer_ack(utp_socket_impl* s)
 	{
-		TORRENT_ASSERT(std::find(m_deferred_acks.begin(), m_deferred_acks.end(), s)
-			== m_deferred_acks.end());
-		m_deferred_acks.push_back(s);
+		TORRENT_ASSERT(utp_next_deferred_ack(s) == 0);
+		TORRENT_ASSERT(m_deferred_acks_tail != s);
+		if (m_deferred_acks_tail) utp_next_deferred_ack(m_deferred_acks_tail) = s;
+		else m_deferred_acks = s;
+		m_deferred_acks_tail = s;
 	}
 
 	void utp_socket_manager::subscribe_drained(utp_socket_impl* s)
 	{
-		TORRENT_ASSERT(std::find(m_drained_event.begin(), m_drained_event.end(), s)
-			== m_drained_event.end());
-		m_drained_event.push_back(s);
+		TORRENT_ASSERT(utp_next_drained(s) == 0);
+		TORRENT_ASSERT(m_drained_event_tail != s);
+		if (m_drained_event_tail) utp_next_drained(m_drained_event_tail) = s;
+		else m_drained_event = s;
+		m_drained_event_tail = s;
 	}
 
-	void utp_socket_manager::remove_socket(boost::uint16_t id)
+	// a socket that's about to be deleted may still be waiting
+	// for the drained event, if it subscribed outside of a
+	// receive round. Sockets are rarely deleted, and the list
+	// is short, so a linear scan is fine
+	void utp_socket_manager::unsubscribe_drained(utp_socket_impl* s)
 	{
-		socket_map_t::iterator i = m_utp_sockets.find(id);
-		if (i == m_utp_sockets.end()) return;
-		delete_utp_impl(i->second);
-		if (m_last_socket == i->second) m_last_socket = 0;
-		m_utp_sockets.erase(i);
+		if (!utp_subscribed_drained(s)) return;
+
+		utp_socket_impl* prev = 0;
+		for (utp_socket_impl* i = m_drained_event; i; prev = i, i = utp_next_drained(i))
+		{
+			if (i != s) continue;
+			utp_socket_impl* next = utp_next_drained(s);
+			if (prev) utp_next_drained(prev) = next;
+			else m_drained_event = next;
+			if (m_drained_event_tail == s) m_drained_event_tail = prev;
+			utp_next_drained(s) = 0;
+			return;
+		}
 	}
 	
 	void utp_socket_manager::set_sock_buf(int size)
@@ -448,7 +692,7 @@ namespace libtorrent
 			recv_id = send_id - 1;
 		}
 		utp_socket_impl* impl = construct_utp_impl(recv_id, send_id, str, this);
-		m_utp_sockets.insert(std::make_pair(recv_id, impl));
+		link_socket(impl);
 		return impl;
 	}
 }
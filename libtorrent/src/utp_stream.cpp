@@ -113,6 +113,34 @@ enum
 	sack_resend_limit = 3,
 };
 
+// a packet that hasn't been acked is only considered lost once at
+// least dup_ack_limit packets sent after it have been acked (like
+// RFC 6675). Holes closer to last_ack than that may just be reordered,
+// and are left alone for now. Acked packets have been removed from
+// outbuf
+TORRENT_EXTRA_EXPORT int utp_sack_lost_packets(packet_buffer const& outbuf
+	, boost::uint16_t first, boost::uint16_t last_ack)
+{
+	// the number of acked packets after 'first', up to and
+	// including last_ack
+	int sacked = 0;
+	for (int i = (first + 1) & ACK_MASK
+		, end((last_ack + 1) & ACK_MASK); i != end; i = (i + 1) & ACK_MASK)
+	{
+		if (outbuf.at(i) == 0) ++sacked;
+	}
+
+	int lost = 0;
+	int seq_nr = first;
+	while (seq_nr != last_ack && sacked >= dup_ack_limit)
+	{
+		++lost;
+		seq_nr = (seq_nr + 1) & ACK_MASK;
+		if (outbuf.at(seq_nr) == 0) --sacked;
+	}
+	return lost;
+}
+
 // compare if lhs is less than rhs, taking wrapping
 // into account. if lhs is close to UINT_MAX and rhs
 // is close to 0, lhs is assumed to have wrapped and
@@ -217,6 +245,8 @@ struct utp_socket_impl
 	utp_socket_impl(boost::uint16_t recv_id, boost::uint16_t send_id
 		, void* userdata, utp_socket_manager* sm)
 		: m_sm(sm)
+		, m_next_deferred_ack(0)
+		, m_next_drained(0)
 		, m_userdata(userdata)
 		, m_nagle_packet(NULL)
 		, m_read_handler(0)
@@ -226,6 +256,7 @@ struct utp_socket_impl
 		, m_timeout(time_now_hires() + milliseconds(m_sm->connect_timeout()))
 		, m_last_cwnd_hit(time_now())
 		, m_last_history_step(time_now_hires())
+		, m_last_pacing_update(time_now_hires())
 		, m_cwnd(TORRENT_ETHERNET_MTU << 16)
 		, m_buffered_incoming_bytes(0)
 		, m_reply_micro(0)
@@ -237,6 +268,8 @@ struct utp_socket_impl
 		, m_receive_buffer_size(0)
 		, m_read_buffer_size(0)
 		, m_in_buf_size(100 * 1024 * 1024)
+		, m_pacing_credit(0)
+		, m_target_delay(0)
 		, m_in_packets(0)
 		, m_out_packets(0)
 		, m_send_delay(0)
@@ -266,6 +299,7 @@ struct utp_socket_impl
 		, m_deferred_ack(false)
 		, m_subscribe_drained(false)
 		, m_stalled(false)
+		, m_paced(false)
 	{
 		TORRENT_ASSERT(m_userdata);
 		for (int i = 0; i != num_delay_hist; ++i)
@@ -299,6 +333,11 @@ struct utp_socket_impl
 
 	void subscribe_drained();
 	void defer_ack();
+	void set_remote_endpoint(address const& addr, boost::uint16_t port);
+	bool pacing_allows(int bytes);
+	int target_delay() const;
+	packet* allocate_packet(int size);
+	void release_packet(packet* p);
 	void remove_sack_header(packet* p);
 
 	enum packet_flags_t { pkt_ack = 1, pkt_fin = 2 };
@@ -332,6 +371,12 @@ struct utp_socket_impl
 
 	utp_socket_manager* m_sm;
 
+	// the links of the utp socket manager's intrusive lists
+	// of sockets with deferred acks and sockets subscribed
+	// to the drained event
+	utp_socket_impl* m_next_deferred_ack;
+	utp_socket_impl* m_next_drained;
+
 	// userdata pointer passed along
 	// with any callback. This is initialized to 0
 	// then set to point to the utp_stream when
@@ -425,6 +470,9 @@ struct utp_socket_impl
 	// the last time we stepped the timestamp history
 	ptime m_last_history_step;
 
+	// the last time m_pacing_credit was topped up
+	ptime m_last_pacing_update;
+
 	// the max number of bytes in-flight. This is a fixed point
 	// value, to get the true number of bytes, shift right 16 bits
 	// the value is always >= 0, but the calculations performed on
@@ -471,6 +519,15 @@ struct utp_socket_impl
 	// max number of bytes to allocate for receive buffer
 	boost::int32_t m_in_buf_size;
 
+	// the number of bytes of new payload we may send right now
+	// when pacing. It grows at the rate of one cwnd per RTT,
+	// up to one pacing interval's worth (or 2 packets)
+	boost::int32_t m_pacing_credit;
+
+	// the target delay for this socket, in microseconds. 0 means
+	// use the socket manager's (i.e. the session's) target delay
+	boost::int32_t m_target_delay;
+
 	// this holds the 3 last delay measurements,
 	// these are the actual corrected delay measurements.
 	// the lowest of the 3 last ones is used in the congestion
@@ -636,6 +693,11 @@ struct utp_socket_impl
 	// of sockets in the utp_socket_manager to be notified of
 	// the socket being writable again
 	bool m_stalled:1;
+
+	// this is set when the pacing rate kept us from sending
+	// and we're waiting in the utp socket manager's pacing
+	// queue to be given another chance to send
+	bool m_paced:1;
 };
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
@@ -692,11 +754,31 @@ udp::endpoint utp_remote_endpoint(utp_socket_impl* s)
 	return udp::endpoint(s->m_remote_address, s->m_port);
 }
 
+int utp_packet_overhead()
+{
+	return sizeof(packet);
+}
+
 boost::uint16_t utp_receive_id(utp_socket_impl* s)
 {
 	return s->m_recv_id;
 }
 
+utp_socket_impl*& utp_next_deferred_ack(utp_socket_impl* s)
+{
+	return s->m_next_deferred_ack;
+}
+
+utp_socket_impl*& utp_next_drained(utp_socket_impl* s)
+{
+	return s->m_next_drained;
+}
+
+bool utp_subscribed_drained(utp_socket_impl const* s)
+{
+	return s->m_subscribe_drained;
+}
+
 void utp_writable(utp_socket_impl* s)
 {
 	TORRENT_ASSERT(s->m_stalled);
@@ -711,6 +793,13 @@ void utp_send_ack(utp_socket_impl* s)
 	s->send_pkt(utp_socket_impl::pkt_ack);
 }
 
+void utp_pacing_tick(utp_socket_impl* s)
+{
+	TORRENT_ASSERT(s->m_paced);
+	s->m_paced = false;
+	s->writable();
+}
+
 void utp_socket_drained(utp_socket_impl* s)
 {
 	s->m_subscribe_drained = false;
@@ -756,6 +845,12 @@ int utp_stream::recv_delay() const
 	return m_impl ? m_impl->m_recv_delay : 0;
 }
 
+void utp_stream::set_target_delay(int ms)
+{
+	if (m_impl == 0) return;
+	m_impl->m_target_delay = ms * 1000;
+}
+
 utp_stream::utp_stream(asio::io_service& io_service)
 	: m_io_service(io_service)
 	, m_impl(0)
@@ -1007,7 +1102,7 @@ size_t utp_stream::read_some(bool clear_buffers)
 		// Consumed entire packet
 		if (p->header_size == p->size)
 		{
-			free(p);
+			m_impl->release_packet(p);
 			++pop_packets;
 			*i = 0;
 			++i;
@@ -1071,8 +1166,7 @@ void utp_stream::do_connect(tcp::endpoint const& ep, utp_stream::connect_handler
 	m_impl->m_sm->mtu_for_dest(ep.address(), link_mtu, utp_mtu);
 	m_impl->init_mtu(link_mtu, utp_mtu);
 	TORRENT_ASSERT(m_impl->m_connect_handler == 0);
-	m_impl->m_remote_address = ep.address();
-	m_impl->m_port = ep.port();
+	m_impl->set_remote_endpoint(ep.address(), ep.port());
 	m_impl->m_connect_handler = handler;
 
 	error_code ec;
@@ -1098,24 +1192,24 @@ utp_socket_impl::~utp_socket_impl()
 		+ m_inbuf.capacity()) & ACK_MASK);
 		i != end; i = (i + 1) & ACK_MASK)
 	{
-		void* p = m_inbuf.remove(i);
-		free(p);
+		packet* p = (packet*)m_inbuf.remove(i);
+		release_packet(p);
 	}
 	for (boost::uint16_t i = m_outbuf.cursor(), end((m_outbuf.cursor()
 		+ m_outbuf.capacity()) & ACK_MASK);
 		i != end; i = (i + 1) & ACK_MASK)
 	{
-		void* p = m_outbuf.remove(i);
-		free(p);
+		packet* p = (packet*)m_outbuf.remove(i);
+		release_packet(p);
 	}
 
 	for (std::vector<packet*>::iterator i = m_receive_buffer.begin()
 		, end = m_receive_buffer.end(); i != end; ++i)
 	{
-		free(*i);
+		release_packet(*i);
 	}
 
-	free(m_nagle_packet);
+	release_packet(m_nagle_packet);
 	m_nagle_packet = NULL;
 }
 
@@ -1133,9 +1227,10 @@ bool utp_socket_impl::should_delete() const
 	// pointer to this socket, waiting for the UDP socket to
 	// become writable again. We have to wait for that, so that
 	// the pointer is removed from that queue. Otherwise we would
-	// leave a dangling pointer in the socket manager
+	// leave a dangling pointer in the socket manager. The same
+	// goes for m_paced and the socket manager's pacing queue
 	bool ret = (m_state >= UTP_STATE_ERROR_WAIT || m_state == UTP_STATE_NONE)
-		&& !m_attached && !m_stalled;
+		&& !m_attached && !m_stalled && !m_paced;
 
 	if (ret)
 	{
@@ -1232,7 +1327,7 @@ void utp_socket_impl::send_syn()
 	m_ack_nr = 0;
 	m_fast_resend_seq_nr = m_seq_nr;
 
-	packet* p = (packet*)malloc(sizeof(packet) + sizeof(utp_header));
+	packet* p = allocate_packet(sizeof(utp_header));
 	p->size = sizeof(utp_header);
 	p->header_size = sizeof(utp_header);
 	p->num_transmissions = 0;
@@ -1277,7 +1372,7 @@ void utp_socket_impl::send_syn()
 	}
 	else if (ec)
 	{
-		free(p);
+		release_packet(p);
 		m_error = ec;
 		m_state = UTP_STATE_ERROR_WAIT;
 		test_socket_state();
@@ -1441,18 +1536,29 @@ void utp_socket_impl::parse_sack(boost::uint16_t packet_ack, boost::uint8_t cons
 	TORRENT_ASSERT(m_outbuf.at((m_acked_seq_nr + 1) & ACK_MASK) || ((m_seq_nr - m_acked_seq_nr) & ACK_MASK) <= 1);
 
 	// we received more than dup_ack_limit ACKs in this SACK message.
-	// trigger fast re-send
+	// trigger fast re-send of the holes considered lost
 	if (dups >= dup_ack_limit && compare_less_wrap(m_fast_resend_seq_nr, last_ack, ACK_MASK))
 	{
-		experienced_loss(m_fast_resend_seq_nr);
+		int const lost = utp_sack_lost_packets(m_outbuf, m_fast_resend_seq_nr, last_ack);
+
+		bool cut_cwnd = false;
 		int num_resent = 0;
-		for (; m_fast_resend_seq_nr != last_ack; m_fast_resend_seq_nr = (m_fast_resend_seq_nr + 1) & ACK_MASK)
+		for (int i = 0; i < lost; ++i)
 		{
 			packet* p = (packet*)m_outbuf.at(m_fast_resend_seq_nr);
-			if (!p) continue;
-			++num_resent;
-			if (!resend_packet(p, true)) break;
-			m_duplicate_acks = 0;
+			if (p)
+			{
+				if (!cut_cwnd)
+				{
+					experienced_loss(m_fast_resend_seq_nr);
+					cut_cwnd = true;
+				}
+				// if we couldn't resend it, try again with the next ACK
+				if (!resend_packet(p, true)) break;
+				m_duplicate_acks = 0;
+				++num_resent;
+			}
+			m_fast_resend_seq_nr = (m_fast_resend_seq_nr + 1) & ACK_MASK;
 			if (num_resent >= sack_resend_limit) break;
 		}
 	}
@@ -1535,6 +1641,76 @@ void utp_socket_impl::defer_ack()
 	m_sm->defer_ack(this);
 }
 
+// the utp socket manager looks sockets up by remote endpoint
+// and connection ID, so it needs to re-index the socket
+// whenever the endpoint changes
+void utp_socket_impl::set_remote_endpoint(address const& addr, boost::uint16_t port)
+{
+	if (m_remote_address == addr && m_port == port) return;
+	m_sm->unlink_socket(this);
+	m_remote_address = addr;
+	m_port = port;
+	m_sm->link_socket(this);
+}
+
+// packet buffers come from the socket manager's pool. 'allocated'
+// is what the pool uses to find the buffer's size class, so it
+// must not change for the lifetime of the packet
+packet* utp_socket_impl::allocate_packet(int size)
+{
+	packet* p = (packet*)m_sm->allocate_packet(size);
+	p->allocated = size;
+	return p;
+}
+
+void utp_socket_impl::release_packet(packet* p)
+{
+	if (p == NULL) return;
+	m_sm->release_packet(p, p->allocated);
+}
+
+int utp_socket_impl::target_delay() const
+{
+	return m_target_delay > 0 ? m_target_delay : m_sm->target_delay();
+}
+
+// returns true if 'bytes' more may be sent without exceeding the
+// pacing rate of one cwnd per RTT. Without pacing, a whole window
+// worth of packets would go out back-to-back whenever ACKs open it
+// up, building a queue at the bottleneck. If the packet can't be
+// sent, the socket subscribes to the socket manager's pacing timer
+bool utp_socket_impl::pacing_allows(int bytes)
+{
+	// until we have an RTT estimate, there's no rate to pace at
+	int const rtt = m_rtt.mean();
+	if (!m_sm->pacing() || rtt <= 0) return true;
+
+	ptime const now = time_now_hires();
+	boost::int64_t const cwnd = m_cwnd >> 16;
+	boost::int64_t const earned = cwnd
+		* total_microseconds(now - m_last_pacing_update) / (rtt * 1000);
+	// don't move the timestamp forward unless we actually earned
+	// something, to not lose credit to rounding
+	if (earned > 0) m_last_pacing_update = now;
+
+	// allow bursts of what we may send during one pacing interval
+	// (the granularity of the pacing timer), but no less than two
+	// packets
+	boost::int64_t const max_burst = (std::max)(
+		cwnd * utp_pacing_interval / rtt, boost::int64_t(m_mtu * 2));
+	m_pacing_credit = boost::int32_t((std::min)(m_pacing_credit + earned, max_burst));
+
+	if (m_pacing_credit >= bytes) return true;
+
+	if (!m_paced)
+	{
+		UTP_LOGV("%8p: paced credit:%d bytes:%d\n", this, m_pacing_credit, bytes);
+		m_paced = true;
+		m_sm->subscribe_pacing(this);
+	}
+	return false;
+}
+
 void utp_socket_impl::remove_sack_header(packet* p)
 {
 	INVARIANT_CHECK;
@@ -1645,6 +1821,16 @@ bool utp_socket_impl::send_pkt(int flags)
 		}
 	}
 
+	// don't send new payload faster than the pacing rate. ACKs still
+	// go out, just without payload. Once there's room, the socket
+	// manager's pacing timer will call writable()
+	if (payload_size > 0 && (flags & pkt_fin) == 0
+		&& !pacing_allows(header_size + payload_size))
+	{
+		payload_size = 0;
+		if (!force) return false;
+	}
+
 	// if we don't have any data to send, or can't send any data
 	// and we don't have any data to force, don't send a packet
 	if (payload_size == 0 && !force && !m_nagle_packet)
@@ -1679,8 +1865,7 @@ bool utp_socket_impl::send_pkt(int flags)
 		// need to keep the packet around (in the outbuf)
 		if (payload_size) 
 		{
-			p = (packet*)malloc(sizeof(packet) + m_mtu);
-			p->allocated = m_mtu;
+			p = allocate_packet(m_mtu);
 		}
 		else
 		{
@@ -1888,7 +2073,7 @@ bool utp_socket_impl::send_pkt(int flags)
 	else if (ec)
 	{
 		TORRENT_ASSERT(stack_alloced != bool(payload_size));
-		if (payload_size) free(p);
+		if (payload_size) release_packet(p);
 		m_error = ec;
 		m_state = UTP_STATE_ERROR_WAIT;
 		test_socket_state();
@@ -1918,12 +2103,16 @@ bool utp_socket_impl::send_pkt(int flags)
 		{
 			TORRENT_ASSERT(((utp_header*)old->buf)->seq_nr == m_seq_nr);
 			if (!old->need_resend) m_bytes_in_flight -= old->size - old->header_size;
-			free(old);
+			release_packet(old);
 		}
 		TORRENT_ASSERT(h->seq_nr == m_seq_nr);
 		m_seq_nr = (m_seq_nr + 1) & ACK_MASK;
 		TORRENT_ASSERT(payload_size >= 0);
 		m_bytes_in_flight += p->size - p->header_size;
+		// the credit is only topped up while pacing, don't let it
+		// run down (and eventually overflow) when it isn't
+		if (m_sm->pacing() && m_rtt.mean() > 0)
+			m_pacing_credit -= p->size;
 	}
 	else
 	{
@@ -2168,7 +2357,7 @@ void utp_socket_impl::ack_packet(packet* p, ptime const& receive_time
 
 	m_rtt.add_sample(rtt / 1000);
 	if (rtt < min_rtt) min_rtt = rtt;
-	free(p);
+	release_packet(p);
 }
 
 void utp_socket_impl::incoming(boost::uint8_t const* buf, int size, packet* p, ptime now)
@@ -2204,7 +2393,7 @@ void utp_socket_impl::incoming(boost::uint8_t const* buf, int size, packet* p, p
 		if (size == 0)
 		{
 			TORRENT_ASSERT(p == 0 || p->header_size == p->size);
-			free(p);
+			release_packet(p);
 			return;
 		}
 	}
@@ -2214,7 +2403,7 @@ void utp_socket_impl::incoming(boost::uint8_t const* buf, int size, packet* p, p
 	if (!p)
 	{
 		TORRENT_ASSERT(buf);
-		p = (packet*)malloc(sizeof(packet) + size);
+		p = allocate_packet(size);
 		p->size = size;
 		p->header_size = 0;
 		memcpy(p->buf, buf, size);
@@ -2316,7 +2505,7 @@ bool utp_socket_impl::consume_incoming_data(
 		}
 
 		// we don't need to save the packet header, just the payload
-		packet* p = (packet*)malloc(sizeof(packet) + payload_size);
+		packet* p = allocate_packet(payload_size);
 		p->size = payload_size;
 		p->header_size = 0;
 		p->num_transmissions = 0;
@@ -2434,10 +2623,7 @@ bool utp_socket_impl::incoming_packet(boost::uint8_t const* buf, int size
 	}
 
 	if (m_state == UTP_STATE_NONE && ph->get_type() == ST_SYN)
-	{
-		m_remote_address = ep.address();
-		m_port = ep.port();
-	}
+		set_remote_endpoint(ep.address(), ep.port());
 
 	if (m_state != UTP_STATE_NONE && ph->get_type() == ST_SYN)
 	{
@@ -2747,8 +2933,7 @@ bool utp_socket_impl::incoming_packet(boost::uint8_t const* buf, int size
 				// we accept are SYN packets.
 				m_state = UTP_STATE_CONNECTED;
 
-				m_remote_address = ep.address();
-				m_port = ep.port();
+				set_remote_endpoint(ep.address(), ep.port());
 
 				error_code ec;
 				m_local_address = m_sm->local_endpoint(m_remote_address, ec).address();
@@ -2929,12 +3114,12 @@ bool utp_socket_impl::incoming_packet(boost::uint8_t const* buf, int size
 					, sample
 					, float(delay / 1000.f)
 					, float(their_delay / 1000.f)
-					, float(int(m_sm->target_delay() - delay)) / 1000.f
+					, float(int(target_delay() - delay)) / 1000.f
 					, boost::uint32_t(m_cwnd >> 16)
 					, 0
 					, our_delay_base
 					, float(delay + their_delay) / 1000.f
-					, m_sm->target_delay() / 1000
+					, target_delay() / 1000
 					, acked_bytes
 					, m_bytes_in_flight
 					, 0.f // float(scaled_gain)
@@ -3070,7 +3255,7 @@ void utp_socket_impl::do_ledbat(int acked_bytes, int delay, int in_flight, ptime
 	TORRENT_ASSERT(in_flight > 0);
 	TORRENT_ASSERT(acked_bytes > 0);
 
-	int target_delay = m_sm->target_delay();
+	int target_delay = this->target_delay();
 
 	// all of these are fixed points with 16 bits fraction portion
 	boost::int64_t window_factor = (boost::int64_t(acked_bytes) << 16) / in_flight;
@@ -71,6 +71,8 @@ namespace libtorrent
 		, web_seed_entry::headers_t const& extra_headers)
 		: web_connection_base(ses, t, s, remote, url, peerinfo, auth, extra_headers)
 		, m_url(url)
+		, m_piece(ses, 0)
+		, m_piece_size(0)
 		, m_received_body(0)
 		, m_range_pos(0)
 		, m_block_pos(0)
@@ -289,8 +291,8 @@ namespace libtorrent
 	{
 		peer_request const& front_request = m_requests.front();
 
-		if (int(m_piece.size()) < front_request.length) return false;
-		TORRENT_ASSERT(int(m_piece.size() == front_request.length));
+		if (m_piece_size < front_request.length) return false;
+		TORRENT_ASSERT(m_piece_size == front_request.length);
 
 		// each call to incoming_piece() may result in us becoming
 		// a seed. If we become a seed, all seeds we're connected to
@@ -301,7 +303,9 @@ namespace libtorrent
 		TORRENT_ASSERT(t);
 		buffer::const_interval recv_buffer = receive_buffer();
 
-		incoming_piece(front_request, &m_piece[0]);
+		incoming_piece(front_request, m_piece);
+		m_piece.reset();
+		m_piece_size = 0;
 		m_requests.pop_front();
 		if (associated_torrent().expired()) return false;
 		TORRENT_ASSERT(m_block_pos >= front_request.length);
@@ -310,8 +314,26 @@ namespace libtorrent
 		m_body_start = 0;
 		recv_buffer = receive_buffer();
 //		TORRENT_ASSERT(m_received_body <= range_end - range_start);
-		m_piece.clear();
-		TORRENT_ASSERT(m_piece.empty());
+		return true;
+	}
+
+	bool web_peer_connection::append_piece(char const* buf, int size)
+	{
+		if (!m_piece)
+		{
+			TORRENT_ASSERT(m_piece_size == 0);
+			m_piece.reset(m_ses.allocate_disk_buffer("receive buffer"));
+			if (!m_piece)
+			{
+				disconnect(errors::no_memory);
+				return false;
+			}
+		}
+		TORRENT_ASSERT(!m_requests.empty());
+		TORRENT_ASSERT(m_piece_size + size <= m_requests.front().length);
+		if (buf) std::memcpy(m_piece.get() + m_piece_size, buf, size);
+		else std::memset(m_piece.get() + m_piece_size, 0, size);
+		m_piece_size += size;
 		return true;
 	}
 
@@ -732,7 +754,7 @@ namespace libtorrent
 			// 3. the start of a block
 			// in that order, these parts are parsed.
 
-			bool range_overlaps_request = re > fs + int(m_piece.size());
+			bool range_overlaps_request = re > fs + m_piece_size;
 
 			if (!range_overlaps_request)
 			{
@@ -740,7 +762,7 @@ namespace libtorrent
 					, front_request.length - m_block_pos));
 				m_statistics.received_bytes(0, bytes_transferred);
 				// this means the end of the incoming request ends _before_ the
-				// first expected byte (fs + m_piece.size())
+				// first expected byte (fs + m_piece_size)
 				disconnect(errors::invalid_range, 2);
 				return;
 			}
@@ -757,16 +779,14 @@ namespace libtorrent
 				// (if it completed) call incoming_piece() with
 				// m_piece as buffer.
 				
-				int piece_size = int(m_piece.size());
-				int copy_size = (std::min)((std::min)(front_request.length - piece_size
+				int copy_size = (std::min)((std::min)(front_request.length - m_piece_size
 					, recv_buffer.left()), int(range_end - range_start - m_received_body));
 				if (copy_size > m_chunk_pos && m_chunk_pos > 0) copy_size = m_chunk_pos;
 				if (copy_size > 0)
 				{
-					TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
-					m_piece.resize(piece_size + copy_size);
-					std::memcpy(&m_piece[0] + piece_size, recv_buffer.begin, copy_size);
-					TORRENT_ASSERT(int(m_piece.size()) <= front_request.length);
+					TORRENT_ASSERT(m_piece_size == m_received_in_piece);
+					if (!append_piece(recv_buffer.begin, copy_size)) return;
+					TORRENT_ASSERT(m_piece_size <= front_request.length);
 					recv_buffer.begin += copy_size;
 					m_received_body += copy_size;
 					m_body_start += copy_size;
@@ -776,9 +796,9 @@ namespace libtorrent
 						m_chunk_pos -= copy_size;
 					}
 					TORRENT_ASSERT(m_received_body <= range_end - range_start);
-					TORRENT_ASSERT(int(m_piece.size()) <= front_request.length);
+					TORRENT_ASSERT(m_piece_size <= front_request.length);
 					incoming_piece_fragment(copy_size);
-					TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
+					TORRENT_ASSERT(m_piece_size == m_received_in_piece);
 				}
 
 				if (maybe_harvest_block())
@@ -818,20 +838,18 @@ namespace libtorrent
 				if (in_range.start + in_range.length < m_requests.front().start + m_requests.front().length
 					&& (m_received_body + recv_buffer.left() >= range_end - range_start))
 				{
-					int piece_size = int(m_piece.size());
-					int copy_size = (std::min)((std::min)(m_requests.front().length - piece_size
+					int copy_size = (std::min)((std::min)(m_requests.front().length - m_piece_size
 						, recv_buffer.left()), int(range_end - range_start - m_received_body));
 					TORRENT_ASSERT(copy_size >= 0);
 					if (copy_size > 0)
 					{
-						TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
-						m_piece.resize(piece_size + copy_size);
-						std::memcpy(&m_piece[0] + piece_size, recv_buffer.begin, copy_size);
+						TORRENT_ASSERT(m_piece_size == m_received_in_piece);
+						if (!append_piece(recv_buffer.begin, copy_size)) return;
 						recv_buffer.begin += copy_size;
 						m_received_body += copy_size;
 						m_body_start += copy_size;
 						incoming_piece_fragment(copy_size);
-						TORRENT_ASSERT(m_piece.size() == m_received_in_piece);
+						TORRENT_ASSERT(m_piece_size == m_received_in_piece);
 					}
 					TORRENT_ASSERT(m_received_body == range_end - range_start);
 				}
@@ -879,7 +897,7 @@ namespace libtorrent
 					int pad_size = (std::min)(file_size, size_type(front_request.length - m_block_pos));
 
 					// insert zeroes to represent the pad file
-					m_piece.resize(m_piece.size() + pad_size, 0);
+					if (!append_piece(0, pad_size)) return;
 					m_block_pos += pad_size;
 					incoming_piece_fragment(pad_size);
 
@@ -85,9 +85,9 @@ bool print_alerts(libtorrent::session& ses, char const* name
 	TEST_CHECK(!handles.empty() || allow_no_torrents);
 	torrent_handle h;
 	if (!handles.empty()) h = handles[0];
-	std::deque<alert*> alerts;
+	std::vector<alert*> alerts;
 	ses.pop_alerts(&alerts);
-	for (std::deque<alert*>::iterator i = alerts.begin(); i != alerts.end(); ++i)
+	for (std::vector<alert*>::iterator i = alerts.begin(); i != alerts.end(); ++i)
 	{
 		if (predicate && predicate(*i)) ret = true;
 		if (peer_disconnected_alert* p = alert_cast<peer_disconnected_alert>(*i))
@@ -119,7 +119,6 @@ bool print_alerts(libtorrent::session& ses, char const* name
 				|| (allow_disconnects && pea->error.message() == "Connection reset by peer")
 				|| (allow_disconnects && pea->error.message() == "End of file."));
 		}
-		delete *i;
 	}
 	return ret;
 }
@@ -66,9 +66,11 @@ struct peer_connection: bandwidth_socket
 		, m_ignore_limits(ignore_limits)
 		, m_name(name)
 		, m_quota(0)
+		, m_latency_critical(false)
 	{}
 
 	bool is_disconnecting() const { return false; }
+	bool latency_critical(int channel) const { return m_latency_critical; }
 	bool ignore_bandwidth_limits() { return m_ignore_limits; }
 	void assign_bandwidth(int channel, int amount);
 
@@ -85,6 +87,7 @@ struct peer_connection: bandwidth_socket
 	bool m_ignore_limits;
 	std::string m_name;
 	int m_quota;
+	bool m_latency_critical;
 };
 
 void peer_connection::assign_bandwidth(int channel, int amount)
@@ -447,6 +450,43 @@ void test_no_starvation(int limit)
 	TEST_CHECK(close_to(p->m_quota / sample_time, limit / 200 / num_peers, 5));
 }
 
+void test_latency_critical(int limit)
+{
+	std::cerr << "\ntest latency critical " << limit << std::endl;
+	bandwidth_manager manager(0);
+	bandwidth_channel t1;
+	global_bwc.throttle(limit);
+
+	connections_t v1;
+	spawn_connections(v1, manager, t1, 10, "p");
+	connections_t v;
+	std::copy(v1.begin(), v1.end(), std::back_inserter(v));
+
+	// the latency critical peer has the lowest priority, but it's
+	// served before all the others, up to its own rate limit
+	boost::intrusive_ptr<peer_connection> p(
+		new peer_connection(manager, t1, 1, false, "latency-critical"));
+	p->m_latency_critical = true;
+	p->throttle(limit / 4);
+	v.push_back(p);
+	run_test(v, manager);
+
+	float sum = 0.f;
+	for (connections_t::iterator i = v1.begin()
+		, end(v1.end()); i != end; ++i)
+	{
+		sum += (*i)->m_quota;
+	}
+	sum /= sample_time;
+	std::cerr << sum << " target: " << (limit - limit / 4) << std::endl;
+	TEST_CHECK(sum > 0);
+	TEST_CHECK(close_to(sum, limit - limit / 4, 50));
+
+	std::cerr << "latency critical rate: " << p->m_quota / sample_time
+		<< " target: " << (limit / 4) << std::endl;
+	TEST_CHECK(close_to(p->m_quota / sample_time, limit / 4, 50));
+}
+
 int test_main()
 {
 	using namespace libtorrent;
@@ -479,6 +519,7 @@ int test_main()
 	test_peer_priority(40000, false);
 	test_peer_priority(40000, true);
 	test_no_starvation(40000);
+	test_latency_critical(40000);
 
 	return 0;
 }
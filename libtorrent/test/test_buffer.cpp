@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <utility>
 #include <set>
+#include <string>
 
 #include "libtorrent/buffer.hpp"
 #include "libtorrent/chained_buffer.hpp"
@@ -169,7 +170,7 @@ void test_buffer()
 
 std::set<char*> buffer_list;
 
-void free_buffer(char* m)
+void free_buffer(char* m, void*)
 {
 	std::set<char*>::iterator i = buffer_list.find(m);
 	TEST_CHECK(i != buffer_list.end());
@@ -203,7 +204,7 @@ bool compare_chained_buffer(chained_buffer& b, char const* mem, int size)
 {
 	if (size == 0) return true;
 	std::vector<char> flat(size);
-	std::list<libtorrent::asio::const_buffer> const& iovec2 = b.build_iovec(size);
+	chained_buffer::buffer_sequence iovec2 = b.build_iovec(size);
 	int copied = copy_buffers(iovec2, &flat[0]);
 	TEST_CHECK(copied == size);
 	return std::memcmp(&flat[0], mem, size) == 0;
@@ -223,7 +224,7 @@ void test_chained_buffer()
 
 		char* b1 = allocate_buffer(512);
 		std::memcpy(b1, data, 6);
-		b.append_buffer(b1, 512, 6, (void(*)(char*))&free_buffer);
+		b.append_buffer(b1, 512, 6, &free_buffer);
 		TEST_CHECK(buffer_list.size() == 1);
 
 		TEST_CHECK(b.capacity() == 512);
@@ -252,12 +253,12 @@ void test_chained_buffer()
 
 		char* b2 = allocate_buffer(512);
 		std::memcpy(b2, data, 6);
-		b.append_buffer(b2, 512, 6, (void(*)(char*))&free_buffer);
+		b.append_buffer(b2, 512, 6, &free_buffer);
 		TEST_CHECK(buffer_list.size() == 2);
 
 		char* b3 = allocate_buffer(512);
 		std::memcpy(b3, data, 6);
-		b.append_buffer(b3, 512, 6, (void(*)(char*))&free_buffer);
+		b.append_buffer(b3, 512, 6, &free_buffer);
 		TEST_CHECK(buffer_list.size() == 3);
 
 		TEST_CHECK(b.capacity() == 512 * 3);
@@ -292,7 +293,7 @@ void test_chained_buffer()
 		char* b4 = allocate_buffer(20);
 		std::memcpy(b4, data, 6);
 		std::memcpy(b4 + 6, data, 6);
-		b.append_buffer(b4, 20, 12, (void(*)(char*))&free_buffer);
+		b.append_buffer(b4, 20, 12, &free_buffer);
 		TEST_CHECK(b.space_in_last_buffer() == 8);
 
 		ret = b.append(data, 6);
@@ -306,12 +307,40 @@ void test_chained_buffer()
 		
 		char* b5 = allocate_buffer(20);
 		std::memcpy(b4, data, 6);
-		b.append_buffer(b5, 20, 6, (void(*)(char*))&free_buffer);
+		b.append_buffer(b5, 20, 6, &free_buffer);
 
 		b.pop_front(22);
 		TEST_CHECK(b.size() == 5);
 	}
 	TEST_CHECK(buffer_list.empty());
+
+	{
+		// queue and pop buffers so that the ring wraps around
+		// and grows while it wraps
+		chained_buffer b;
+		std::string expected;
+		for (int round = 0; round < 10; ++round)
+		{
+			for (int i = 0; i < 4 + round; ++i)
+			{
+				char* buf = allocate_buffer(1);
+				*buf = 'a' + expected.size() % 26;
+				expected += *buf;
+				b.append_buffer(buf, 1, 1, &free_buffer);
+			}
+			TEST_CHECK(compare_chained_buffer(b, expected.c_str(), b.size()));
+			b.pop_front(3);
+			expected.erase(0, 3);
+		}
+		TEST_CHECK(int(buffer_list.size()) == b.size());
+
+		// no more than max_iovec buffers are returned at a time
+		for (int i = 0; i < chained_buffer::max_iovec + 10; ++i)
+			b.append_buffer(allocate_buffer(1), 1, 1, &free_buffer);
+		chained_buffer::buffer_sequence vec = b.build_iovec(b.size());
+		TEST_CHECK(vec.end() - vec.begin() == chained_buffer::max_iovec);
+	}
+	TEST_CHECK(buffer_list.empty());
 }
 
 int test_main()
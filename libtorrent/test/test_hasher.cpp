@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libtorrent/hasher.hpp"
+#include "libtorrent/hash_pool.hpp"
 #include <boost/lexical_cast.hpp>
 #include "libtorrent/escape_string.hpp" // from_hex
 
@@ -75,6 +76,36 @@ int test_main()
 		TEST_CHECK(result == h.final());
 	}
 
+	// the hash pool must produce the same hashes as hashing
+	// the buffers one at a time
+	std::vector<char> buf(64 * 1024);
+	for (int i = 0; i < int(buf.size()); ++i) buf[i] = char(i * 7);
+
+	hash_job jobs[16];
+	for (int i = 0; i < 16; ++i)
+	{
+		jobs[i].buf = &buf[0] + i * 1000;
+		jobs[i].size = 4096 + i * 100;
+		if (i & 1) jobs[i].small_size = 1000 + i;
+	}
+
+	hash_pool pool;
+	pool.set_num_threads(4);
+	TEST_EQUAL(pool.num_threads(), 4);
+	pool.hash(jobs, 16);
+	// run it twice to make sure the threads pick up new work
+	pool.hash(jobs, 16);
+
+	for (int i = 0; i < 16; ++i)
+	{
+		TEST_CHECK(jobs[i].hash == hasher(jobs[i].buf, jobs[i].size).final());
+		if (jobs[i].small_size > 0)
+			TEST_CHECK(jobs[i].small_hash == hasher(jobs[i].buf, jobs[i].small_size).final());
+	}
+
+	pool.set_num_threads(1);
+	TEST_EQUAL(pool.num_threads(), 1);
+
 	return 0;
 }
 
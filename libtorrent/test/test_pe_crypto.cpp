@@ -36,6 +36,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/pe_crypto.hpp"
 #include "libtorrent/session.hpp"
+#include "libtorrent/escape_string.hpp"
 
 #include "setup_transfer.hpp"
 #include "test.hpp"
@@ -173,6 +174,41 @@ int test_main()
 
 	TEST_CHECK(std::equal(DH1.get_secret(), DH1.get_secret() + 96, DH2.get_secret()));
 
+	// known answers, computed independently. The private exponents
+	// are the bytes 0x01 - 0x14 and 0x21 - 0x34
+	{
+		char secret1[20];
+		char secret2[20];
+		for (int i = 0; i < 20; ++i)
+		{
+			secret1[i] = 0x01 + i;
+			secret2[i] = 0x21 + i;
+		}
+
+		char key1[96];
+		char key2[96];
+		char shared[96];
+		from_hex("96e112dab29e8c5272accb9b17b26887ce54a144a4e3b697c7d159b7a817e556"
+			"b0918db2b4c658e02a87f7e5fb14b18a553e084cbf3dad2d30f16596ccb982d4"
+			"06258c61b30c5c1dae2ddc60bdbd48d79896312aad63238c39e1a633821eb693", 192, key1);
+		from_hex("8f9c9f400fe9b3258f3e48598a95c7805cc90c995cd770283322679d132ebdae"
+			"09b75eeadc01de698ef86945cf38314a95fad08c2ad5641802bd5f658eb3ea0d"
+			"b2712c04aa5efed03deecc5104f75d869d2d197e4336c61f0d71d763bee99416", 192, key2);
+		from_hex("cd8536d5f2c98f01f8f5a648f69f6f2d6a6aafd044666b01fc8beb81f63ddbea"
+			"0a862b2b6306431f7a308b063f795d181ca711b22ab0602a9c4b5d1c53269837"
+			"773ff53a4de47d9aace6b6a1b789ea37077507842742eb7581ea180b16748826", 192, shared);
+
+		dh_key_exchange DH3(secret1);
+		dh_key_exchange DH4(secret2);
+		TEST_CHECK(std::equal(key1, key1 + 96, DH3.get_local_key()));
+		TEST_CHECK(std::equal(key2, key2 + 96, DH4.get_local_key()));
+
+		DH3.compute_secret(key2);
+		DH4.compute_secret(key1);
+		TEST_CHECK(std::equal(shared, shared + 96, DH3.get_secret()));
+		TEST_CHECK(std::equal(shared, shared + 96, DH4.get_secret()));
+	}
+
 	sha1_hash test1_key = hasher("test1_key",8).final();
 	sha1_hash test2_key = hasher("test2_key",8).final();
 
@@ -44,6 +44,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/identify_client.hpp"
 #include "libtorrent/file.hpp"
 #include "libtorrent/packet_buffer.hpp"
+#include "libtorrent/utp_stream.hpp"
 #include "libtorrent/session.hpp"
 #include "libtorrent/bencode.hpp"
 #include "libtorrent/timestamp_history.hpp"
@@ -52,6 +53,10 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/aux_/session_impl.hpp"
 #include "libtorrent/rsa.hpp"
 #include "libtorrent/ip_voter.hpp"
+#include "libtorrent/alert_types.hpp"
+#include "libtorrent/status_diff.hpp"
+#include "libtorrent/udp_socket.hpp"
+#include "libtorrent/connection_queue.hpp"
 #ifndef TORRENT_DISABLE_DHT
 #include "libtorrent/kademlia/node_id.hpp"
 #include "libtorrent/kademlia/routing_table.hpp"
@@ -402,6 +407,55 @@ address rand_v6()
 	return address_v6(bytes);
 }
 
+// an alert defined without TORRENT_DEFINE_ALERT, like one
+// from outside of libtorrent
+// sends packets from within the incoming packet handler, i.e.
+// while the udp_socket is batching its sends
+struct batch_send_observer : udp_socket_observer
+{
+	batch_send_observer(udp_socket& s, udp::endpoint const& ep)
+		: sock(s), target(ep), called(false) {}
+
+	virtual bool incoming_packet(error_code const& ec
+		, udp::endpoint const& ep, char const* buf, int size)
+	{
+		if (ec || called) return false;
+		called = true;
+
+		// this one is held back in the send batch
+		error_code e;
+		sock.send(target, "a", 1, e);
+
+		// DF packets (uTP MTU probes) go out right away
+		sock.send(target, "b", 1, probe_ec, udp_socket::dont_fragment);
+
+		// too large for any MTU. The error has to make it back to
+		// us, rather than being lost in the batch
+		std::vector<char> big(0x10000);
+		sock.send(target, &big[0], big.size(), big_ec, udp_socket::dont_fragment);
+		return true;
+	}
+
+	udp_socket& sock;
+	udp::endpoint target;
+	bool called;
+	error_code probe_ec;
+	error_code big_ec;
+};
+
+struct test_plain_alert : alert
+{
+	enum { alert_type = 10000 };
+	test_plain_alert(int v): value(v) {}
+	virtual int type() const { return alert_type; }
+	virtual char const* what() const { return "test_plain_alert"; }
+	virtual std::string message() const { return "test"; }
+	virtual int category() const { return alert::status_notification; }
+	virtual std::auto_ptr<alert> clone() const
+	{ return std::auto_ptr<alert>(new test_plain_alert(*this)); }
+	int value;
+};
+
 int test_main()
 {
 	using namespace libtorrent;
@@ -633,6 +687,84 @@ int test_main()
 		// TODO: test the case where a sample is lower than the history entry but not lower than the base
 	}
 
+	// test uTP selective ACK loss detection
+	{
+		packet_buffer pb;
+		// packets 10 - 15 are in flight
+		for (int i = 10; i < 16; ++i) pb.insert(i, (void*)(i + 1));
+
+		// 12 and 13 are acked. Two packets after the hole
+		// may just be reordering
+		pb.remove(12);
+		pb.remove(13);
+		TEST_EQUAL(utp_sack_lost_packets(pb, 10, 13), 0);
+
+		// with the third one acked, 10 and 11 are lost
+		pb.remove(14);
+		TEST_EQUAL(utp_sack_lost_packets(pb, 10, 14), 2);
+		// but 11 only has three acked packets after it when
+		// starting from there
+		TEST_EQUAL(utp_sack_lost_packets(pb, 11, 14), 1);
+
+		// a hole in between the acked packets is lost once
+		// three acked packets follow it
+		pb.insert(12, (void*)13);
+		pb.remove(11);
+		TEST_EQUAL(utp_sack_lost_packets(pb, 10, 14), 1);
+		pb.remove(15);
+		TEST_EQUAL(utp_sack_lost_packets(pb, 10, 15), 3);
+	}
+
+	// across the sequence number wrap
+	{
+		packet_buffer pb;
+		for (int i = 0xfffe; i < 0x10003; ++i) pb.insert(i & 0xffff, (void*)1);
+		pb.remove(0);
+		pb.remove(1);
+		pb.remove(2);
+		TEST_EQUAL(utp_sack_lost_packets(pb, 0xfffe, 2), 2);
+	}
+
+	// test that packets sent with the DF bit bypass the udp_socket's
+	// send batch, and that their errors are reported to the sender
+	{
+		io_service ios;
+		connection_queue cq(ios);
+		udp_socket s(ios, cq);
+		error_code ec;
+		s.bind(udp::endpoint(address_v4::loopback(), 0), ec);
+		TEST_CHECK(!ec);
+		udp::endpoint sock_ep(address_v4::loopback(), s.local_endpoint(ec).port());
+
+		udp::socket peer(ios);
+		peer.open(udp::v4(), ec);
+		peer.bind(udp::endpoint(address_v4::loopback(), 0), ec);
+		TEST_CHECK(!ec);
+
+		batch_send_observer o(s, peer.local_endpoint(ec));
+		s.subscribe(&o);
+		peer.send_to(asio::buffer("x", 1), sock_ep, 0, ec);
+		TEST_CHECK(!ec);
+		while (!o.called && !ec) ios.run_one(ec);
+
+		TEST_CHECK(o.called);
+		TEST_CHECK(!o.probe_ec);
+		TEST_CHECK(o.big_ec == asio::error::message_size);
+
+		// the queued packet was flushed before the DF packet was sent
+		char buf[10];
+		udp::endpoint from;
+		int ret = peer.receive_from(asio::buffer(buf, sizeof(buf)), from, 0, ec);
+		TEST_EQUAL(ret, 1);
+		TEST_EQUAL(buf[0], 'a');
+		ret = peer.receive_from(asio::buffer(buf, sizeof(buf)), from, 0, ec);
+		TEST_EQUAL(ret, 1);
+		TEST_EQUAL(buf[0], 'b');
+
+		s.unsubscribe(&o);
+		s.close();
+	}
+
 	// test packet_buffer
 	{
 		packet_buffer pb;
@@ -753,6 +885,154 @@ int test_main()
 		pb.insert(0xffff, (void*)0xffff);
 	}
 
+	// test alert_manager
+	{
+		io_service ios;
+		alert_manager am(ios, 5000, alert::all_categories);
+
+		for (int i = 0; i < 3000; ++i)
+			am.post_alert(external_ip_alert(address_v4(i)));
+
+		std::vector<alert*> alerts;
+		am.get_all(&alerts);
+		TEST_EQUAL(alerts.size(), 3000);
+		for (int i = 0; i < int(alerts.size()); ++i)
+		{
+			external_ip_alert* a = alert_cast<external_ip_alert>(alerts[i]);
+			TEST_CHECK(a && a->external_address == address_v4(i));
+		}
+
+		// the alerts handed out are still valid while new ones are posted
+		am.post_alert(external_ip_alert(address_v4(1337)));
+		TEST_CHECK(alert_cast<external_ip_alert>(alerts[2999])->external_address == address_v4(2999));
+
+		std::auto_ptr<alert> a = am.get();
+		TEST_CHECK(a.get() && alert_cast<external_ip_alert>(a.get())->external_address == address_v4(1337));
+		TEST_CHECK(am.get().get() == 0);
+
+		am.post_alert(external_ip_alert(address_v4(1)));
+		am.post_alert(external_ip_alert(address_v4(2)));
+		std::deque<alert*> owned;
+		am.get_all(&owned);
+		TEST_EQUAL(owned.size(), 2);
+		for (std::deque<alert*>::iterator i = owned.begin(); i != owned.end(); ++i)
+			delete *i;
+
+		am.get_all(&alerts);
+		TEST_CHECK(alerts.empty());
+
+		// alerts are taken one at a time in the order they were posted
+		for (int i = 0; i < 100; ++i)
+			am.post_alert(external_ip_alert(address_v4(i)));
+		for (int i = 0; i < 50; ++i)
+		{
+			a = am.get();
+			TEST_CHECK(a.get() && alert_cast<external_ip_alert>(a.get())->external_address == address_v4(i));
+		}
+		TEST_CHECK(am.pending());
+		am.get_all(&alerts);
+		TEST_EQUAL(alerts.size(), 50);
+		TEST_CHECK(alert_cast<external_ip_alert>(alerts[0])->external_address == address_v4(50));
+		TEST_CHECK(!am.pending());
+
+		// alerts that don't use TORRENT_DEFINE_ALERT are queued on the heap
+		am.post_alert(test_plain_alert(42));
+		a = am.get();
+		TEST_CHECK(a.get() && a->type() == test_plain_alert::alert_type);
+		TEST_EQUAL(static_cast<test_plain_alert*>(a.get())->value, 42);
+		am.post_alert(test_plain_alert(43));
+		am.get_all(&alerts);
+		TEST_EQUAL(alerts.size(), 1);
+		TEST_EQUAL(static_cast<test_plain_alert*>(alerts[0])->value, 43);
+	}
+
+	// test status diff
+	{
+		status_diff_cursor::torrent_entry e;
+		torrent_status st;
+		st.info_hash = to_hash("abababababababababababababababababababab");
+		st.name = "test";
+		st.paused = true;
+		st.download_rate = 1000;
+		st.total_download = 0x100000000LL;
+		st.active_time = 10;
+		bitfield pieces(100, false);
+		pieces.set_bit(3);
+		pieces.set_bit(99);
+		boost::function<bool(int)> have = boost::bind(&bitfield::get_bit, &pieces, _1);
+
+		std::vector<int> completed;
+		std::vector<int> lost;
+		TEST_CHECK(diff_status_pieces(e.pieces, 100, have, completed, lost));
+		TEST_EQUAL(completed.size(), 2);
+		TEST_CHECK(lost.empty());
+
+		std::vector<char> buf;
+		TEST_CHECK(write_status_diff(buf, e, st, torrent_handle::query_name
+			, &completed, &lost));
+
+		std::map<sha1_hash, torrent_status> torrents;
+		TEST_CHECK(apply_status_diff(&buf[0], buf.size(), torrents));
+		TEST_EQUAL(torrents.size(), 1);
+		torrent_status& s = torrents[st.info_hash];
+		TEST_EQUAL(s.name, "test");
+		TEST_EQUAL(s.paused, true);
+		TEST_EQUAL(s.download_rate, 1000);
+		TEST_EQUAL(s.total_download, 0x100000000LL);
+		// the time counters were not asked for
+		TEST_EQUAL(s.active_time, 0);
+		TEST_EQUAL(s.pieces.size(), 100);
+		TEST_EQUAL(s.pieces.count(), 2);
+		TEST_CHECK(s.pieces.get_bit(3) && s.pieces.get_bit(99));
+
+		// nothing changed, nothing is written
+		completed.clear();
+		TEST_CHECK(!diff_status_pieces(e.pieces, 100, have, completed, lost));
+		buf.clear();
+		TEST_CHECK(!write_status_diff(buf, e, st, torrent_handle::query_name));
+		TEST_CHECK(buf.empty());
+
+		// only the changed field and the completed piece are included
+		st.download_rate = 2000;
+		pieces.set_bit(50);
+		TEST_CHECK(diff_status_pieces(e.pieces, 100, have, completed, lost));
+		TEST_EQUAL(completed.size(), 1);
+		TEST_CHECK(write_status_diff(buf, e, st, torrent_handle::query_name
+			, &completed, &lost));
+		// info-hash, flags, field mask, download_rate, number of pieces,
+		// one completed piece and no lost ones
+		TEST_EQUAL(buf.size(), 20 + 1 + 9 + 4 + 4 + 4 + 4 + 4);
+		TEST_CHECK(apply_status_diff(&buf[0], buf.size(), torrents));
+		TEST_EQUAL(s.download_rate, 2000);
+		TEST_EQUAL(s.name, "test");
+		TEST_EQUAL(s.pieces.count(), 3);
+		TEST_CHECK(s.pieces.get_bit(50));
+
+		// a truncated diff is rejected
+		TEST_CHECK(!apply_status_diff(&buf[0], buf.size() - 1, torrents));
+
+		// losing one piece and completing another keeps the count
+		// the same, but both are still reported
+		buf.clear();
+		completed.clear();
+		pieces.clear_bit(3);
+		pieces.set_bit(7);
+		TEST_CHECK(diff_status_pieces(e.pieces, 100, have, completed, lost));
+		TEST_EQUAL(completed.size(), 1);
+		TEST_EQUAL(lost.size(), 1);
+		TEST_CHECK(write_status_diff(buf, e, st, torrent_handle::query_name
+			, &completed, &lost));
+		TEST_CHECK(apply_status_diff(&buf[0], buf.size(), torrents));
+		TEST_EQUAL(s.pieces.count(), 3);
+		TEST_CHECK(!s.pieces.get_bit(3));
+		TEST_CHECK(s.pieces.get_bit(7));
+
+		buf.clear();
+		write_status_removed(buf, st.info_hash);
+		TEST_CHECK(apply_status_diff(&buf[0], buf.size(), torrents));
+		TEST_CHECK(torrents.empty());
+	}
+
 	// test error codes
 	TEST_CHECK(error_code(errors::http_error).message() == "HTTP error");
 	TEST_CHECK(error_code(errors::missing_file_sizes).message() == "missing or invalid 'file sizes' entry");
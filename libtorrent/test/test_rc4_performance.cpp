@@ -0,0 +1,140 @@
+/*
+
+Copyright (c) 2012, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/pe_crypto.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/time.hpp"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <iostream>
+
+#include "test.hpp"
+
+using namespace libtorrent;
+
+#ifndef TORRENT_DISABLE_ENCRYPTION
+
+int test_main()
+{
+	sha1_hash key = hasher("test_key", 8).final();
+
+	// make sure the key stream is still RC4 (with the first
+	// 1024 bytes discarded)
+	{
+		unsigned char const expected[] = { 0x74, 0x68, 0x4a, 0xc3, 0xb6, 0x25, 0x53, 0xed
+			, 0xf9, 0x39, 0xdf, 0x42, 0x18, 0x55, 0xc3, 0x14 };
+		char zeroes[16];
+		std::memset(zeroes, 0, sizeof(zeroes));
+		rc4_handler rc4;
+		rc4.set_outgoing_key(&key[0], 20);
+		rc4.encrypt(zeroes, sizeof(zeroes));
+		TEST_CHECK(std::memcmp(zeroes, expected, sizeof(expected)) == 0);
+	}
+
+	// 16 MiB of payload, cut up the way it's received from a socket,
+	// partly into the receive buffer and partly into a disk buffer
+	const int total_size = 16 * 1024 * 1024;
+	const int chunk_size = 16 * 1024;
+	const int split = 13;
+	std::vector<char> plain(total_size);
+	std::generate(plain.begin(), plain.end(), &std::rand);
+
+	rc4_handler enc;
+	enc.set_outgoing_key(&key[0], 20);
+	std::vector<char> cipher = plain;
+	ptime start(time_now_hires());
+	enc.encrypt(&cipher[0], cipher.size());
+	ptime stop(time_now_hires());
+	std::cout << "encrypt (single buffer): "
+		<< (total_size / 1024.) / (std::max)(total_microseconds(stop - start), size_type(1))
+			* 1000000. / 1024. << " MiB/s" << std::endl;
+
+	// decrypt chunk by chunk, one call per buffer
+	rc4_handler dec1;
+	dec1.set_incoming_key(&key[0], 20);
+	std::vector<char> buf = cipher;
+	start = time_now_hires();
+	for (int i = 0; i < total_size; i += chunk_size)
+	{
+		dec1.decrypt(&buf[i], split);
+		dec1.decrypt(&buf[i + split], chunk_size - split);
+	}
+	stop = time_now_hires();
+	TEST_CHECK(buf == plain);
+	std::cout << "decrypt (one call per buffer): "
+		<< (total_size / 1024.) / (std::max)(total_microseconds(stop - start), size_type(1))
+			* 1000000. / 1024. << " MiB/s" << std::endl;
+
+	// decrypt chunk by chunk, one call per scatter/gather vector
+	rc4_handler dec2;
+	dec2.set_incoming_key(&key[0], 20);
+	buf = cipher;
+	encryption_handler* h = &dec2;
+	start = time_now_hires();
+	for (int i = 0; i < total_size; i += chunk_size)
+	{
+		buffer::interval bufs[2] = {
+			buffer::interval(&buf[i], &buf[i] + split)
+			, buffer::interval(&buf[i] + split, &buf[i] + chunk_size) };
+		h->decrypt_buffers(bufs, 2);
+	}
+	stop = time_now_hires();
+	TEST_CHECK(buf == plain);
+	std::cout << "decrypt (one call per vector): "
+		<< (total_size / 1024.) / (std::max)(total_microseconds(stop - start), size_type(1))
+			* 1000000. / 1024. << " MiB/s" << std::endl;
+
+	// odd sized buffers exercise the tail of the key stream generator
+	rc4_handler dec3;
+	dec3.set_incoming_key(&key[0], 20);
+	buf = cipher;
+	for (int i = 0; i < total_size;)
+	{
+		int len = (std::min)(1 + rand() % 37, total_size - i);
+		dec3.decrypt(&buf[i], len);
+		i += len;
+	}
+	TEST_CHECK(buf == plain);
+
+	return 0;
+}
+
+#else
+
+int test_main()
+{
+	return 0;
+}
+
+#endif
+
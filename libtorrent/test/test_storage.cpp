@@ -673,6 +673,80 @@ void test_remove(std::string const& test_path, bool unbuffered)
 	TEST_CHECK(!exists(combine_path(test_path, "temp_storage")));	
 }
 
+#if TORRENT_USE_MMAP
+void test_mmap_storage(std::string const& test_path)
+{
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+	if (ec) std::cerr << "remove_all '" << combine_path(test_path, "temp_storage")
+		<< "': " << ec.message() << std::endl;
+
+	// make sure reads span multiple files, and that some
+	// of them are not aligned to pages
+	file_storage fs;
+	fs.set_piece_length(512);
+	fs.add_file("temp_storage/test1.tmp", 17);
+	fs.add_file("temp_storage/test2.tmp", 612);
+	fs.add_file("temp_storage/test3.tmp", 0);
+	fs.add_file("temp_storage/test4.tmp", 3253);
+	fs.set_num_pieces((fs.total_size() + 511) / 512);
+
+	session_settings set;
+	file_pool fp;
+	disk_buffer_pool dp(16 * 1024);
+	boost::scoped_ptr<storage_interface> s(
+		mmap_storage_constructor(fs, 0, test_path, fp, std::vector<boost::uint8_t>()));
+	s->m_settings = &set;
+	s->m_disk_pool = &dp;
+
+	char buf[512];
+	char piece[512];
+
+	// write the first two pieces and read them back
+	for (int i = 0; i < 2; ++i)
+	{
+		std::generate(buf, buf + 512, &std::rand);
+		int ret = s->write(buf, i, 0, 512);
+		if (ret != 512) print_error(ret, s);
+		TEST_EQUAL(ret, 512);
+		ret = s->read(piece, i, 0, 512);
+		if (ret != 512) print_error(ret, s);
+		TEST_EQUAL(ret, 512);
+		TEST_CHECK(std::equal(piece, piece + 512, buf));
+
+		// unaligned read within the piece
+		ret = s->read(piece, i, 13, 400);
+		TEST_EQUAL(ret, 400);
+		TEST_CHECK(std::equal(piece, piece + 400, buf + 13));
+	}
+
+	// the last piece has not been written, and is beyond the end
+	// of test4.tmp. This must not be read through the mapping
+	int last = fs.num_pieces() - 1;
+	int ret = s->read(piece, last, 0, fs.piece_size(last));
+	TEST_CHECK(ret < fs.piece_size(last));
+
+	// now write it, which grows the file beyond what was mapped
+	std::generate(buf, buf + 512, &std::rand);
+	ret = s->write(buf, last, 0, fs.piece_size(last));
+	TEST_EQUAL(ret, fs.piece_size(last));
+	ret = s->read(piece, last, 0, fs.piece_size(last));
+	TEST_EQUAL(ret, fs.piece_size(last));
+	TEST_CHECK(std::equal(piece, piece + fs.piece_size(last), buf));
+
+	s->hint_read(0, 0, 512);
+	s->release_files();
+
+	// reading again after the mappings were released
+	ret = s->read(piece, last, 0, fs.piece_size(last));
+	TEST_EQUAL(ret, fs.piece_size(last));
+	TEST_CHECK(std::equal(piece, piece + fs.piece_size(last), buf));
+
+	s->delete_files();
+	TEST_CHECK(!exists(combine_path(test_path, "temp_storage")));
+}
+#endif
+
 namespace
 {
 	void check_files_fill_array(int ret, disk_io_job const& j, bool* array, bool* done)
@@ -1041,6 +1115,843 @@ void test_rename_file_in_fastresume(std::string const& test_path)
 		<< "': " << ec.message() << std::endl;
 }
 
+void test_piece_checkpoint(std::string const& test_path)
+{
+	std::cout << "\n\n=== test piece checkpoint ===" << std::endl;
+	error_code ec;
+	std::string path = combine_path(test_path, combine_path("checkpoints", "test.checkpoint"));
+	remove_all(combine_path(test_path, "checkpoints"), ec);
+
+	sha1_hash info_hash = hasher("checkpoint", 10).final();
+	std::vector<std::pair<size_type, std::time_t> > files;
+	files.push_back(std::make_pair(size_type(100), std::time_t(1000)));
+	files.push_back(std::make_pair(size_type(200), std::time_t(2000)));
+
+	{
+		piece_checkpoint cp;
+		cp.init(path, info_hash, 20, 2);
+		TEST_CHECK(!cp.load());
+		cp.set_have(3);
+		cp.write_snapshot(files, ec);
+		if (ec) std::cerr << "write_snapshot: " << ec.message() << std::endl;
+		TEST_CHECK(!ec);
+		cp.append(7, ec);
+		TEST_CHECK(!ec);
+		cp.append(19, ec);
+		TEST_CHECK(!ec);
+		TEST_EQUAL(cp.log_size(), 2);
+	}
+
+	// the snapshot and the log are both restored
+	{
+		piece_checkpoint cp;
+		cp.init(path, info_hash, 20, 2);
+		TEST_CHECK(cp.load());
+		TEST_EQUAL(cp.log_size(), 2);
+		for (int i = 0; i < 20; ++i)
+			TEST_CHECK(cp.have(i) == (i == 3 || i == 7 || i == 19));
+		TEST_CHECK(cp.files() == files);
+	}
+
+	// a record cut short by a crash is ignored, and the next
+	// one is written over it
+	{
+		file f;
+		f.open(path, file::read_write, ec);
+		size_type size = f.get_size(ec);
+		f.set_size(size - 5, ec);
+	}
+	{
+		piece_checkpoint cp;
+		cp.init(path, info_hash, 20, 2);
+		TEST_CHECK(cp.load());
+		TEST_EQUAL(cp.log_size(), 1);
+		TEST_CHECK(cp.have(7));
+		TEST_CHECK(!cp.have(19));
+		cp.append(11, ec);
+		TEST_CHECK(!ec);
+	}
+	{
+		piece_checkpoint cp;
+		cp.init(path, info_hash, 20, 2);
+		TEST_CHECK(cp.load());
+		TEST_EQUAL(cp.log_size(), 2);
+		TEST_CHECK(cp.have(11));
+	}
+
+	// a checkpoint for another torrent is not used
+	{
+		piece_checkpoint cp;
+		cp.init(path, hasher("other", 5).final(), 20, 2);
+		TEST_CHECK(!cp.load());
+		cp.init(path, info_hash, 21, 2);
+		TEST_CHECK(!cp.load());
+	}
+
+	{
+		piece_checkpoint cp;
+		cp.init(path, info_hash, 20, 2);
+		cp.remove(ec);
+		TEST_CHECK(!ec);
+		TEST_CHECK(!exists(path));
+	}
+	remove_all(combine_path(test_path, "checkpoints"), ec);
+}
+
+void test_checkpoint_removed(std::string const& test_path)
+{
+	std::cout << "\n\n=== test checkpoint removed with torrent ===" << std::endl;
+	error_code ec;
+	std::string path = combine_path(test_path, "tmp3");
+	remove_all(path, ec);
+	create_directory(path, ec);
+	std::string checkpoint_dir = combine_path(path, "checkpoints");
+	create_directory(checkpoint_dir, ec);
+
+	std::ofstream file(combine_path(path, "temporary").c_str());
+	boost::intrusive_ptr<torrent_info> t = ::create_torrent(&file);
+	file.close();
+	std::string checkpoint = combine_path(checkpoint_dir
+		, to_hex(t->info_hash().to_string()) + ".checkpoint");
+
+	{
+		session ses(fingerprint("  ", 0,0,0,0), 0);
+		ses.set_alert_mask(alert::all_categories);
+		session_settings sett = ses.settings();
+		sett.checkpoint_directory = checkpoint_dir;
+		ses.set_settings(sett);
+
+		add_torrent_params p;
+		p.ti = new torrent_info(*t);
+		p.save_path = path;
+		torrent_handle h = ses.add_torrent(p, ec);
+
+		for (int i = 0; i < 10; ++i)
+		{
+			print_alerts(ses, "ses");
+			test_sleep(1000);
+			if (h.status().is_seeding) break;
+		}
+
+		// the checkpoint is written once the files have been checked
+		TEST_CHECK(exists(checkpoint));
+
+		// removing the torrent without deleting its files still removes
+		// the checkpoint. Otherwise adding the same torrent again, with
+		// another save path, would trust it
+		ses.remove_torrent(h);
+
+		ptime end = time_now() + seconds(20);
+		std::auto_ptr<alert> a;
+		while (a.get() == 0 || dynamic_cast<cache_flushed_alert*>(a.get()) == 0)
+		{
+			if (ses.wait_for_alert(end - time_now()) == 0)
+			{
+				std::cerr << "wait_for_alert() expired" << std::endl;
+				break;
+			}
+			a = ses.pop_alert();
+		}
+		TEST_CHECK(!exists(checkpoint));
+		TEST_CHECK(exists(combine_path(path, "temporary")));
+	}
+	remove_all(path, ec);
+}
+
+void test_file_pool(std::string const& test_path)
+{
+	std::cout << "\n\n=== test file pool ===" << std::endl;
+	error_code ec;
+	std::string path = combine_path(test_path, "temp_file_pool");
+	remove_all(path, ec);
+	create_directory(path, ec);
+	create_directory(combine_path(path, "pool"), ec);
+
+	file_storage fs;
+	fs.set_piece_length(16);
+	for (int i = 0; i < 5; ++i)
+	{
+		char name[50];
+		snprintf(name, sizeof(name), "pool/file%d", i);
+		fs.add_file(name, 16);
+	}
+
+	int st;
+	file_pool fp(3);
+	size_type hits, misses, evictions;
+
+	// opening more files than fit evicts the least recently used one
+	for (int i = 0; i < 3; ++i)
+		TEST_CHECK(fp.open_file(&st, path, fs.begin() + i, fs, file::read_write, ec));
+	// touch file0, so that file1 is the oldest
+	TEST_CHECK(fp.open_file(&st, path, fs.begin(), fs, file::read_write, ec));
+	TEST_CHECK(fp.open_file(&st, path, fs.begin() + 3, fs, file::read_write, ec));
+	TEST_EQUAL(fp.num_open_files(), 3);
+
+	fp.get_stats(hits, misses, evictions);
+	TEST_EQUAL(hits, 1);
+	TEST_EQUAL(misses, 4);
+	TEST_EQUAL(evictions, 1);
+
+	// file0 is still open, file1 isn't
+	TEST_CHECK(fp.open_file(&st, path, fs.begin(), fs, file::read_write, ec));
+	TEST_CHECK(fp.open_file(&st, path, fs.begin() + 1, fs, file::read_write, ec));
+	fp.get_stats(hits, misses, evictions);
+	TEST_EQUAL(hits, 2);
+	TEST_EQUAL(misses, 5);
+	TEST_EQUAL(evictions, 2);
+
+	fp.release(&st, 0);
+	TEST_EQUAL(fp.num_open_files(), 2);
+	fp.release(&st);
+	TEST_EQUAL(fp.num_open_files(), 0);
+
+	// a big pool is split into shards
+	fp.resize(2000);
+	int storages[40];
+	for (int i = 0; i < 40; ++i)
+		for (int j = 0; j < 5; ++j)
+			TEST_CHECK(fp.open_file(&storages[i], path, fs.begin() + j, fs, file::read_write, ec));
+	TEST_EQUAL(fp.num_open_files(), 200);
+	fp.release(&storages[7]);
+	TEST_EQUAL(fp.num_open_files(), 195);
+	fp.resize(10);
+	TEST_CHECK(fp.num_open_files() <= 10);
+	fp.release(0);
+	TEST_EQUAL(fp.num_open_files(), 0);
+
+	// the pool size is shared by the shards. A single storage
+	// may keep all of it open
+	file_storage big_fs;
+	big_fs.set_piece_length(16);
+	for (int i = 0; i < 300; ++i)
+	{
+		char name[50];
+		snprintf(name, sizeof(name), "pool/big%d", i);
+		big_fs.add_file(name, 16);
+	}
+	fp.resize(300);
+	fp.get_stats(hits, misses, evictions);
+	size_type evictions_before = evictions;
+	for (int i = 0; i < 300; ++i)
+		TEST_CHECK(fp.open_file(&st, path, big_fs.begin() + i, big_fs, file::read_write, ec));
+	TEST_EQUAL(fp.num_open_files(), 300);
+	fp.get_stats(hits, misses, evictions);
+	TEST_EQUAL(evictions, evictions_before);
+	// one more evicts the least recently used
+	TEST_CHECK(fp.open_file(&storages[0], path, fs.begin(), fs, file::read_write, ec));
+	TEST_EQUAL(fp.num_open_files(), 300);
+	fp.get_stats(hits, misses, evictions);
+	TEST_EQUAL(evictions, evictions_before + 1);
+	fp.release(0);
+
+	TEST_CHECK(file_pool::default_size() > 0);
+
+	remove_all(path, ec);
+}
+
+int num_full_pieces(std::vector<cached_piece_info> const& pieces, int piece)
+{
+	for (std::vector<cached_piece_info>::const_iterator i = pieces.begin()
+		, end(pieces.end()); i != end; ++i)
+	{
+		if (i->piece != piece || i->kind != cached_piece_info::read_cache) continue;
+		return std::count(i->blocks.begin(), i->blocks.end(), true) == int(i->blocks.size());
+	}
+	return 0;
+}
+
+void test_read_cursor(std::string const& test_path)
+{
+	std::cout << "\n\n=== test read cursor ===" << std::endl;
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_cursor"), ec);
+	create_directory(combine_path(test_path, "temp_cursor"), ec);
+
+	file_storage fs;
+	fs.add_file("temp_cursor/stream.tmp", piece_size * 6);
+	libtorrent::create_torrent t(fs, piece_size, -1, 0);
+	for (int i = 0; i < 6; ++i) t.set_hash(i, hasher(piece0, piece_size).final());
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), t.generate());
+	boost::intrusive_ptr<torrent_info> info = new torrent_info(&buf[0], buf.size(), ec);
+
+	std::ofstream f(combine_path(test_path, combine_path("temp_cursor", "stream.tmp")).c_str()
+		, std::ios::trunc | std::ios::binary);
+	for (int i = 0; i < 6; ++i) f.write(piece0, piece_size);
+	f.close();
+
+	{
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	disk_io_thread io(ios, boost::function<void()>(), fp);
+
+	// the cache fits 4 pieces, of which the cursor may pin 2
+	disk_io_job j;
+	session_settings* set = new session_settings;
+	set->cache_size = 4 * piece_size / block_size;
+	j.buffer = (char*)set;
+	j.action = disk_io_job::update_settings;
+	io.add_job(j);
+
+	boost::shared_ptr<int> dummy(new int);
+	boost::intrusive_ptr<piece_manager> pm = new piece_manager(dummy, info
+		, test_path, fp, io, default_storage_constructor, storage_mode_sparse
+		, std::vector<boost::uint8_t>());
+
+	bool done = false;
+	lazy_entry frd;
+	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
+	ios.reset();
+	run_until(ios, done);
+	done = false;
+	pm->async_check_files(boost::bind(&on_check_files, _1, _2, &done));
+	run_until(ios, done);
+
+	pm->async_set_read_cursor(0, 1, 3);
+
+	std::vector<cached_piece_info> pieces;
+	for (int i = 0; i < 50; ++i)
+	{
+		io.get_cache_info(info->info_hash(), pieces);
+		if (num_full_pieces(pieces, 1) + num_full_pieces(pieces, 2) == 2) break;
+		test_sleep(100);
+	}
+	TEST_EQUAL(num_full_pieces(pieces, 0), 0);
+	TEST_EQUAL(num_full_pieces(pieces, 1), 1);
+	TEST_EQUAL(num_full_pieces(pieces, 2), 1);
+	TEST_EQUAL(num_full_pieces(pieces, 3), 0);
+
+	// let the pieces expire, and fill the rest of the cache. The
+	// pieces ahead of the cursor must not be evicted
+	test_sleep(1100);
+	for (int i = 3; i < 6; ++i)
+	{
+		peer_request r;
+		r.piece = i;
+		r.start = 0;
+		r.length = block_size;
+		done = false;
+		pm->async_read(r, boost::bind(&on_read, _1, _2, &done));
+		run_until(ios, done);
+	}
+	io.get_cache_info(info->info_hash(), pieces);
+	TEST_EQUAL(num_full_pieces(pieces, 1), 1);
+	TEST_EQUAL(num_full_pieces(pieces, 2), 1);
+
+	io.abort();
+	io.join();
+	}
+	remove_all(combine_path(test_path, "temp_cursor"), ec);
+}
+
+void on_block_written(int ret, disk_io_job const& j, int* blocks)
+{
+	TEST_EQUAL(ret, j.buffer_size);
+	++*blocks;
+}
+
+void on_released(int ret, disk_io_job const& j, bool* done)
+{
+	*done = true;
+}
+
+void on_hash_checked(int ret, disk_io_job const& j, int* failed)
+{
+	if (ret != 0) ++*failed;
+}
+
+void test_write_extent(std::string const& test_path)
+{
+	std::cout << "\n\n=== test write extent ===" << std::endl;
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_extent"), ec);
+	create_directory(combine_path(test_path, "temp_extent"), ec);
+
+	const int num_pieces = 4;
+	const int blocks_per_piece = piece_size / block_size;
+	std::vector<char> data(piece_size * num_pieces);
+	for (std::vector<char>::iterator i = data.begin(); i != data.end(); ++i)
+		*i = rand();
+
+	file_storage fs;
+	fs.add_file("temp_extent/extent.tmp", piece_size * num_pieces);
+	libtorrent::create_torrent t(fs, piece_size, -1, 0);
+	for (int i = 0; i < num_pieces; ++i)
+		t.set_hash(i, hasher(&data[i * piece_size], piece_size).final());
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), t.generate());
+	boost::intrusive_ptr<torrent_info> info = new torrent_info(&buf[0], buf.size(), ec);
+
+	{
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	disk_io_thread io(ios, boost::function<void()>(), fp);
+
+	// the cache fits all the pieces, and no piece is flushed on its own
+	disk_io_job j;
+	session_settings* set = new session_settings;
+	set->cache_size = 2 * num_pieces * blocks_per_piece;
+	set->write_cache_line_size = 2 * num_pieces * blocks_per_piece;
+	set->disk_cache_algorithm = session_settings::lru;
+	j.buffer = (char*)set;
+	j.action = disk_io_job::update_settings;
+	io.add_job(j);
+
+	boost::shared_ptr<int> dummy(new int);
+	boost::intrusive_ptr<piece_manager> pm = new piece_manager(dummy, info
+		, test_path, fp, io, default_storage_constructor, storage_mode_sparse
+		, std::vector<boost::uint8_t>());
+
+	bool done = false;
+	lazy_entry frd;
+	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
+	ios.reset();
+	run_until(ios, done);
+
+	// write the pieces out of order. When they're flushed, the whole
+	// torrent is contiguous and goes to disk in a single write
+	int const order[] = { 2, 0, 3, 1 };
+	int blocks_written = 0;
+	for (int i = 0; i < num_pieces; ++i)
+	{
+		for (int b = 0; b < blocks_per_piece; ++b)
+		{
+			peer_request r;
+			r.piece = order[i];
+			r.start = b * block_size;
+			r.length = block_size;
+			char* block = io.allocate_buffer("test write");
+			std::memcpy(block, &data[r.piece * piece_size + r.start], block_size);
+			disk_buffer_holder h(io, block);
+			pm->async_write(r, h, boost::bind(&on_block_written, _1, _2, &blocks_written));
+		}
+	}
+	done = false;
+	pm->async_release_files(boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	while (blocks_written < num_pieces * blocks_per_piece) { ios.reset(); ios.run_one(ec); }
+
+	cache_status st = io.status();
+	TEST_EQUAL(st.blocks_written, num_pieces * blocks_per_piece);
+	TEST_EQUAL(st.writes, 1);
+
+	// the partial hashes were updated for every piece in the write, so
+	// checking them doesn't read anything back
+	int failed = 0;
+	for (int i = 0; i < num_pieces; ++i)
+		pm->async_hash(i, boost::bind(&on_hash_checked, _1, _2, &failed));
+	done = false;
+	pm->async_release_files(boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	TEST_EQUAL(failed, 0);
+	TEST_EQUAL(io.status().total_read_back, 0);
+
+	io.abort();
+	io.join();
+	}
+
+	std::vector<char> file_data(piece_size * num_pieces);
+	std::ifstream f(combine_path(test_path, combine_path("temp_extent", "extent.tmp")).c_str()
+		, std::ios::binary);
+	f.read(&file_data[0], file_data.size());
+	TEST_CHECK(f.gcount() == int(file_data.size()));
+	TEST_CHECK(file_data == data);
+	remove_all(combine_path(test_path, "temp_extent"), ec);
+}
+
+void on_piece_read(int ret, disk_io_job const& j, char* dst, bool* done)
+{
+	TEST_EQUAL(ret, j.buffer_size);
+	if (ret > 0) std::memcpy(dst, j.buffer, ret);
+	*done = true;
+}
+
+void test_part_file(std::string const& test_path)
+{
+	std::cout << "\n\n=== test part file ===" << std::endl;
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_part"), ec);
+	remove(combine_path(test_path, ".temp_part.parts"), ec);
+
+	const int num_pieces = 4;
+	const int blocks_per_piece = piece_size / block_size;
+	std::vector<char> data(piece_size * num_pieces);
+	for (std::vector<char>::iterator i = data.begin(); i != data.end(); ++i)
+		*i = rand();
+
+	// piece 1 is half in a.tmp and half in b.tmp
+	file_storage fs;
+	fs.add_file("temp_part/a.tmp", piece_size + piece_size / 2);
+	fs.add_file("temp_part/b.tmp", 2 * piece_size + piece_size / 2);
+	libtorrent::create_torrent t(fs, piece_size, -1, 0);
+	for (int i = 0; i < num_pieces; ++i)
+		t.set_hash(i, hasher(&data[i * piece_size], piece_size).final());
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), t.generate());
+	boost::intrusive_ptr<torrent_info> info = new torrent_info(&buf[0], buf.size(), ec);
+
+	std::string part_path = combine_path(test_path, ".temp_part.parts");
+	std::string a_path = combine_path(test_path, combine_path("temp_part", "a.tmp"));
+	std::string b_path = combine_path(test_path, combine_path("temp_part", "b.tmp"));
+
+	{
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	disk_io_thread io(ios, boost::function<void()>(), fp);
+
+	std::vector<boost::uint8_t> prio(2, 1);
+	prio[0] = 0;
+	boost::shared_ptr<int> dummy(new int);
+	boost::intrusive_ptr<piece_manager> pm = new piece_manager(dummy, info
+		, test_path, fp, io, default_storage_constructor, storage_mode_sparse
+		, prio);
+
+	bool done = false;
+	lazy_entry frd;
+	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
+	ios.reset();
+	run_until(ios, done);
+
+	int blocks_written = 0;
+	for (int b = 0; b < blocks_per_piece; ++b)
+	{
+		peer_request r;
+		r.piece = 1;
+		r.start = b * block_size;
+		r.length = block_size;
+		char* block = io.allocate_buffer("test write");
+		std::memcpy(block, &data[r.piece * piece_size + r.start], block_size);
+		disk_buffer_holder h(io, block);
+		pm->async_write(r, h, boost::bind(&on_block_written, _1, _2, &blocks_written));
+	}
+	done = false;
+	pm->async_release_files(boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	while (blocks_written < blocks_per_piece) { ios.reset(); ios.run_one(ec); }
+
+	// the unwanted file isn't created, its half of the piece
+	// went to the part file
+	TEST_CHECK(!exists(a_path));
+	TEST_CHECK(exists(b_path));
+	TEST_CHECK(exists(part_path));
+
+	// and it's read back from there
+	std::vector<char> block(block_size);
+	peer_request r;
+	r.piece = 1;
+	r.start = piece_size / 2 - block_size;
+	r.length = block_size;
+	done = false;
+	pm->async_read(r, boost::bind(&on_piece_read, _1, _2, &block[0], &done));
+	run_until(ios, done);
+	TEST_CHECK(std::memcmp(&block[0], &data[piece_size + r.start], block_size) == 0);
+
+	// once the file is wanted, the part file is emptied into it
+	prio[0] = 1;
+	done = false;
+	pm->async_set_file_priority(prio, boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	done = false;
+	pm->async_release_files(boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	TEST_CHECK(exists(a_path));
+	TEST_CHECK(!exists(part_path));
+
+	io.abort();
+	io.join();
+	}
+
+	std::vector<char> file_data(piece_size / 2);
+	std::ifstream f(a_path.c_str(), std::ios::binary);
+	f.seekg(piece_size);
+	f.read(&file_data[0], file_data.size());
+	TEST_CHECK(f.gcount() == int(file_data.size()));
+	TEST_CHECK(std::memcmp(&file_data[0], &data[piece_size], file_data.size()) == 0);
+	remove_all(combine_path(test_path, "temp_part"), ec);
+}
+
+void test_direct_read(std::string const& test_path)
+{
+	std::cout << "\n\n=== test direct read ===" << std::endl;
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_direct"), ec);
+	create_directory(combine_path(test_path, "temp_direct"), ec);
+
+	file_storage fs;
+	fs.add_file("temp_direct/direct.tmp", piece_size * 2);
+	libtorrent::create_torrent t(fs, piece_size, -1, 0);
+	for (int i = 0; i < 2; ++i) t.set_hash(i, hasher(piece0, piece_size).final());
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), t.generate());
+	boost::intrusive_ptr<torrent_info> info = new torrent_info(&buf[0], buf.size(), ec);
+
+	std::ofstream f(combine_path(test_path, combine_path("temp_direct", "direct.tmp")).c_str()
+		, std::ios::trunc | std::ios::binary);
+	for (int i = 0; i < 2; ++i) f.write(piece0, piece_size);
+	f.close();
+
+	{
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	disk_io_thread io(ios, boost::function<void()>(), fp);
+
+	// the cache line is a quarter of a piece, but with the OS cache
+	// disabled whole pieces are read
+	disk_io_job j;
+	session_settings* set = new session_settings;
+	set->cache_size = 4 * piece_size / block_size;
+	set->read_cache_line_size = piece_size / block_size / 4;
+	set->disk_io_read_mode = session_settings::disable_os_cache;
+	set->disk_io_write_mode = session_settings::disable_os_cache;
+	set->coalesce_reads = true;
+	j.buffer = (char*)set;
+	j.action = disk_io_job::update_settings;
+	io.add_job(j);
+
+	boost::shared_ptr<int> dummy(new int);
+	boost::intrusive_ptr<piece_manager> pm = new piece_manager(dummy, info
+		, test_path, fp, io, default_storage_constructor, storage_mode_sparse
+		, std::vector<boost::uint8_t>());
+
+	bool done = false;
+	lazy_entry frd;
+	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
+	ios.reset();
+	run_until(ios, done);
+
+	// a request in the middle of the piece reads all of it
+	std::vector<char> block(block_size);
+	peer_request r;
+	r.piece = 1;
+	r.start = piece_size / 2;
+	r.length = block_size;
+	done = false;
+	pm->async_read(r, boost::bind(&on_piece_read, _1, _2, &block[0], &done));
+	run_until(ios, done);
+	TEST_CHECK(std::memcmp(&block[0], piece0 + r.start, block_size) == 0);
+
+	std::vector<cached_piece_info> pieces;
+	io.get_cache_info(info->info_hash(), pieces);
+	TEST_EQUAL(num_full_pieces(pieces, 1), 1);
+
+	// and the blocks before it are served from the cache
+	r.start = 0;
+	done = false;
+	pm->async_read(r, boost::bind(&on_piece_read, _1, _2, &block[0], &done));
+	run_until(ios, done);
+	TEST_CHECK(std::memcmp(&block[0], piece0, block_size) == 0);
+	cache_status st = io.status();
+	TEST_EQUAL(st.reads, 1);
+	TEST_EQUAL(st.blocks_read_hit, 1);
+
+	io.abort();
+	io.join();
+	}
+	remove_all(combine_path(test_path, "temp_direct"), ec);
+}
+
+void write_blocks(piece_manager* pm, disk_io_thread& io, io_service& ios
+	, std::vector<char> const& data, int piece, int first, int last)
+{
+	int blocks_written = 0;
+	for (int b = first; b < last; ++b)
+	{
+		peer_request r;
+		r.piece = piece;
+		r.start = b * block_size;
+		r.length = block_size;
+		char* block = io.allocate_buffer("test write");
+		std::memcpy(block, &data[r.piece * piece_size + r.start], block_size);
+		disk_buffer_holder h(io, block);
+		pm->async_write(r, h, boost::bind(&on_block_written, _1, _2, &blocks_written));
+	}
+	bool done = false;
+	pm->async_release_files(boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	error_code ec;
+	while (blocks_written < last - first) { ios.reset(); ios.run_one(ec); }
+}
+
+// a file that's made unwanted half way through a piece. The part of
+// the piece that was written to the file before must not be lost
+void test_part_file_unwanted(std::string const& test_path)
+{
+	std::cout << "\n\n=== test part file, unwanted mid piece ===" << std::endl;
+	error_code ec;
+	remove_all(combine_path(test_path, "temp_part2"), ec);
+	remove(combine_path(test_path, ".temp_part2.parts"), ec);
+
+	const int num_pieces = 4;
+	const int blocks_per_piece = piece_size / block_size;
+	std::vector<char> data(piece_size * num_pieces);
+	for (std::vector<char>::iterator i = data.begin(); i != data.end(); ++i)
+		*i = rand();
+
+	// piece 1 is half in a.tmp and half in b.tmp
+	file_storage fs;
+	fs.add_file("temp_part2/a.tmp", piece_size + piece_size / 2);
+	fs.add_file("temp_part2/b.tmp", 2 * piece_size + piece_size / 2);
+	libtorrent::create_torrent t(fs, piece_size, -1, 0);
+	for (int i = 0; i < num_pieces; ++i)
+		t.set_hash(i, hasher(&data[i * piece_size], piece_size).final());
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), t.generate());
+	boost::intrusive_ptr<torrent_info> info = new torrent_info(&buf[0], buf.size(), ec);
+
+	std::string part_path = combine_path(test_path, ".temp_part2.parts");
+	std::string a_path = combine_path(test_path, combine_path("temp_part2", "a.tmp"));
+
+	{
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	disk_io_thread io(ios, boost::function<void()>(), fp);
+
+	std::vector<boost::uint8_t> prio(2, 1);
+	boost::shared_ptr<int> dummy(new int);
+	boost::intrusive_ptr<piece_manager> pm = new piece_manager(dummy, info
+		, test_path, fp, io, default_storage_constructor, storage_mode_sparse
+		, prio);
+
+	bool done = false;
+	lazy_entry frd;
+	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
+	ios.reset();
+	run_until(ios, done);
+
+	// the first block of piece 1 goes to a.tmp while it's wanted
+	write_blocks(pm.get(), io, ios, data, 1, 0, 1);
+	TEST_CHECK(exists(a_path));
+	TEST_CHECK(!exists(part_path));
+
+	// the rest of a.tmp's half of the piece goes to the part file
+	prio[0] = 0;
+	done = false;
+	pm->async_set_file_priority(prio, boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	write_blocks(pm.get(), io, ios, data, 1, 1, blocks_per_piece);
+	TEST_CHECK(exists(part_path));
+
+	// when a.tmp is wanted again, the whole slice is exported
+	// from the part file, including the first block
+	prio[0] = 1;
+	done = false;
+	pm->async_set_file_priority(prio, boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	done = false;
+	pm->async_release_files(boost::bind(&on_released, _1, _2, &done));
+	run_until(ios, done);
+	TEST_CHECK(!exists(part_path));
+
+	io.abort();
+	io.join();
+	}
+
+	std::vector<char> file_data(piece_size / 2);
+	std::ifstream f(a_path.c_str(), std::ios::binary);
+	f.seekg(piece_size);
+	f.read(&file_data[0], file_data.size());
+	TEST_CHECK(f.gcount() == int(file_data.size()));
+	TEST_CHECK(std::memcmp(&file_data[0], &data[piece_size], file_data.size()) == 0);
+	remove_all(combine_path(test_path, "temp_part2"), ec);
+}
+
+void test_recheck_dirty_files(std::string const& test_path)
+{
+	std::cout << "\n\n=== test recheck dirty files only ===" << std::endl;
+	error_code ec;
+	const int piece_size = 16 * 1024;
+	std::string path = combine_path(test_path, "temp_dirty");
+	remove_all(path, ec);
+	create_directory(path, ec);
+	if (ec) std::cerr << "create_directory: " << ec.message() << std::endl;
+
+	file_storage fs;
+	fs.add_file("temp_dirty/test1.tmp", piece_size);
+	fs.add_file("temp_dirty/test2.tmp", piece_size * 2);
+	fs.add_file("temp_dirty/test3.tmp", piece_size);
+
+	std::vector<char> data(piece_size * 4);
+	std::generate(data.begin(), data.end(), std::rand);
+
+	libtorrent::create_torrent t(fs, piece_size, -1, 0);
+	for (int i = 0; i < 4; ++i)
+		t.set_hash(i, hasher(&data[i * piece_size], piece_size).final());
+	std::vector<char> buf;
+	bencode(std::back_inserter(buf), t.generate());
+	boost::intrusive_ptr<torrent_info> info = new torrent_info(&buf[0], buf.size(), ec);
+
+	// test1.tmp and test3.tmp don't match their piece hashes. Only
+	// test3.tmp looks modified since the resume data was saved
+	data[0] ^= 0xff;
+	data[3 * piece_size] ^= 0xff;
+
+	char const* names[] = { "test1.tmp", "test2.tmp", "test3.tmp" };
+	int const offsets[] = { 0, piece_size, piece_size * 3, piece_size * 4 };
+	entry rd;
+	entry::list_type& file_sizes = rd["file sizes"].list();
+	for (int i = 0; i < 3; ++i)
+	{
+		std::string file_path = combine_path(path, names[i]);
+		std::ofstream f(file_path.c_str(), std::ios::trunc | std::ios::binary);
+		f.write(&data[offsets[i]], offsets[i + 1] - offsets[i]);
+		f.close();
+
+		file_status st;
+		stat_file(file_path, &st, ec);
+		entry::list_type l;
+		l.push_back(entry(offsets[i + 1] - offsets[i]));
+		l.push_back(entry(i == 2 ? st.mtime - 1000 : st.mtime));
+		file_sizes.push_back(l);
+	}
+	rd["pieces"] = std::string(4, '\x01');
+	rd["blocks per piece"] = 1;
+
+	std::vector<char> resume_buf;
+	bencode(std::back_inserter(resume_buf), rd);
+	lazy_entry frd;
+	lazy_bdecode(&resume_buf[0], &resume_buf[0] + resume_buf.size(), frd, ec);
+	TEST_CHECK(!ec);
+
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	disk_io_thread io(ios, boost::function<void()>(), fp);
+
+	session_settings set;
+	set.recheck_dirty_files_only = true;
+	set.hashing_threads = 2;
+	disk_io_job j;
+	j.buffer = (char*)new session_settings(set);
+	j.action = disk_io_job::update_settings;
+	io.add_job(j);
+
+	boost::shared_ptr<int> dummy(new int);
+	boost::intrusive_ptr<piece_manager> pm = new piece_manager(dummy, info
+		, test_path, fp, io, default_storage_constructor, storage_mode_sparse
+		, std::vector<boost::uint8_t>());
+
+	bool done = false;
+	pm->async_check_fastresume(&frd, boost::bind(&on_check_resume_data, _1, _2, &done));
+	ios.reset();
+	run_until(ios, done);
+
+	bool pieces[4] = {false, false, false, false};
+	done = false;
+	pm->async_check_files(boost::bind(&check_files_fill_array, _1, _2, pieces, &done));
+	run_until(ios, done);
+
+	// the pieces of the unchanged files are taken from the resume
+	// data, even the corrupt one. Only test3.tmp's piece is hashed
+	TEST_EQUAL(pieces[0], true);
+	TEST_EQUAL(pieces[1], true);
+	TEST_EQUAL(pieces[2], true);
+	TEST_EQUAL(pieces[3], false);
+	io.abort();
+	io.join();
+
+	remove_all(path, ec);
+}
+
 int test_main()
 {
 
@@ -1072,8 +1983,20 @@ int test_main()
 
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_fastresume, _1));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_rename_file_in_fastresume, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_piece_checkpoint, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_checkpoint_removed, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_recheck_dirty_files, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_file_pool, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_read_cursor, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_write_extent, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_part_file, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_part_file_unwanted, _1));
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_direct_read, _1));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&run_test, _1, true));
 	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&run_test, _1, false));
+#if TORRENT_USE_MMAP
+	std::for_each(test_paths.begin(), test_paths.end(), boost::bind(&test_mmap_storage, _1));
+#endif
 
 	file_storage fs;
 	fs.set_piece_length(512);
@@ -41,6 +41,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "test.hpp"
 #include "setup_transfer.hpp"
 #include <iostream>
+#include <memory> // for auto_ptr
 
 void test_swarm(bool super_seeding = false, bool strict = false, bool seed_mode = false, bool time_critical = false)
 {
@@ -205,6 +206,75 @@ void test_swarm(bool super_seeding = false, bool strict = false, bool seed_mode
 	remove_all("tmp3_swarm", ec);
 }
 
+// the seed writes to its peer from the network thread pool. The
+// downloader goes away in the middle of the transfer, so the seed's
+// pool writes complete (or fail) after the peer is disconnected
+void test_pool_write_disconnect()
+{
+	using namespace libtorrent;
+
+	// in case the previous run was terminated
+	error_code ec;
+	remove_all("tmp1_pool", ec);
+	remove_all("tmp2_pool", ec);
+
+	session ses1(fingerprint("LT", 0, 1, 0, 0), std::make_pair(48000, 49000), "0.0.0.0", 0);
+	std::auto_ptr<session> ses2(new session(fingerprint("LT", 0, 1, 0, 0)
+		, std::make_pair(49000, 50000), "0.0.0.0", 0));
+
+	session_settings settings;
+	settings.network_threads = 2;
+	ses1.set_settings(settings);
+
+	// keep the transfer going long enough for the downloader
+	// to disappear while the seed is still sending
+	settings = session_settings();
+	settings.download_rate_limit = 500000;
+	ses2->set_settings(settings);
+
+	torrent_handle tor1;
+	torrent_handle tor2;
+
+	boost::tie(tor1, tor2, boost::tuples::ignore) = setup_transfer(&ses1, ses2.get(), 0
+		, true, false, true, "_pool", 256 * 1024);
+
+	for (int i = 0; i < 100; ++i)
+	{
+		print_alerts(ses1, "ses1");
+		print_alerts(*ses2, "ses2");
+
+		torrent_status st2 = tor2.status();
+		if (st2.progress > 0.1f) break;
+		test_sleep(100);
+	}
+
+	torrent_status st2 = tor2.status();
+	TEST_CHECK(st2.progress > 0.1f);
+	TEST_CHECK(st2.progress < 1.f);
+	TEST_EQUAL(ses1.settings().network_threads, 2);
+
+	// closes the downloader's end of the connection
+	ses2.reset();
+
+	for (int i = 0; i < 100; ++i)
+	{
+		print_alerts(ses1, "ses1", true);
+		if (tor1.status().num_peers == 0) break;
+		test_sleep(100);
+	}
+
+	TEST_EQUAL(tor1.status().num_peers, 0);
+	TEST_CHECK(tor1.status().is_seeding);
+
+	// the pool threads are joined with an empty queue
+	settings = ses1.settings();
+	settings.network_threads = 0;
+	ses1.set_settings(settings);
+
+	remove_all("tmp1_pool", ec);
+	remove_all("tmp2_pool", ec);
+}
+
 int test_main()
 {
 	using namespace libtorrent;
@@ -223,6 +293,8 @@ int test_main()
 	// with strict super seeding
 	test_swarm(true, true);
 
+	test_pool_write_disconnect();
+
 	return 0;
 }
 
@@ -109,6 +109,7 @@ int main(int argc, char* argv[])
 		settings.allow_multiple_connections_per_ip = true;
 		settings.local_service_announce_interval = 15;
 		settings.min_announce_interval = 20;
+		settings.checkpoint_directory = combine_path(".", ".resume");
 		session_obj->set_settings(settings);
 
 		lazy_entry resume_data;
@@ -177,15 +178,14 @@ int main(int argc, char* argv[])
 			alert const* a = s.wait_for_alert(seconds(10));
 			if (a == 0) continue;
 
-			std::deque<alert*> alerts;
+			// the alerts are owned by the session and stay valid
+			// until the next call to pop_alerts()
+			std::vector<alert*> alerts;
 			s.pop_alerts(&alerts);
 			std::string now = time_now_string();
-			for (std::deque<alert*>::iterator i = alerts.begin()
+			for (std::vector<alert*>::iterator i = alerts.begin()
 				, end(alerts.end()); i != end; ++i)
 			{
-				// make sure to delete each alert
-				std::auto_ptr<alert> a(*i);
-
 				torrent_paused_alert const* tp = alert_cast<torrent_paused_alert>(*i);
 				if (tp)
 				{